@@ -266,6 +266,18 @@ void fz_flush_warnings(fz_context *ctx);
 	when we already hold any lock i, where 0 <= i <= n. In order
 	to verify this, we have some debugging code, that can be
 	enabled by defining FITZ_DEBUG_LOCKING.
+
+	FZ_LOCK_FREETYPE_FACE is the first of FZ_FREETYPE_FACE_LOCKS
+	consecutive locks used to protect individual font faces when
+	per-face font locking is enabled (see
+	fz_set_font_face_locking). They are numbered above
+	FZ_LOCK_FREETYPE, so a thread holding a face lock may go on to
+	take FZ_LOCK_FREETYPE, and anything wanting every face takes
+	the face locks before FZ_LOCK_FREETYPE.
+
+	FZ_LOCK_JPX is held while OpenJPEG decodes an image. It is
+	numbered last since the decoder's allocations may scavenge the
+	store, and so drop fonts and glyphs.
 */
 
 typedef struct
@@ -275,10 +287,16 @@ typedef struct
 	void (*unlock)(void *user, int lock);
 } fz_locks_context;
 
+#ifndef FZ_FREETYPE_FACE_LOCKS
+#define FZ_FREETYPE_FACE_LOCKS 8
+#endif
+
 enum {
 	FZ_LOCK_ALLOC = 0,
 	FZ_LOCK_FREETYPE,
-	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_FREETYPE_FACE,
+	FZ_LOCK_GLYPHCACHE = FZ_LOCK_FREETYPE_FACE + FZ_FREETYPE_FACE_LOCKS,
+	FZ_LOCK_JPX,
 	FZ_LOCK_MAX
 };
 
@@ -518,6 +536,38 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/**
+	Set the size of the tile grid used when caching subareas of
+	images.
+
+	By default each decoded subarea of an image is cached as a
+	separate pixmap, so panning around a zoomed in image decodes it
+	afresh whenever the visible area changes. With a non-zero
+	tile_size, subareas of images that can be partially decoded are
+	instead cached as a grid of tiles for each subsampling level.
+	Requests are assembled from the cached tiles, and only the
+	missing tiles are decoded.
+
+	tile_size: The size of the tiles (in subsampled pixels), rounded
+	up to a multiple of 8. 0 (the default) to disable tiling.
+*/
+void fz_tune_image_tiling(fz_context *ctx, int tile_size);
+
+/**
+	Set the number of threads used to decode JPEG 2000 images.
+
+	OpenJPEG can decode the code-blocks of an image in parallel.
+	While it does so, its allocations go straight to the C
+	library's malloc and free, rather than through the context's
+	allocator, since its worker threads cannot safely use a
+	context that they do not own.
+
+	threads: The number of threads to use. 0 or 1 (the default)
+	decodes on the calling thread only. Has no effect if OpenJPEG
+	was built without thread support.
+*/
+void fz_tune_jpx_threads(fz_context *ctx, int threads);
+
 /**
 	Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
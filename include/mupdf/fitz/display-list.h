@@ -139,4 +139,11 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	Return the number of bytes used to hold the commands of a
+	display list. Objects it references, such as images, fonts and
+	text, are not included.
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list);
+
 #endif
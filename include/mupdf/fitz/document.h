@@ -36,6 +36,7 @@
 
 typedef struct fz_document_handler fz_document_handler;
 typedef struct fz_page fz_page;
+typedef struct fz_chapter_layout fz_chapter_layout;
 typedef intptr_t fz_bookmark;
 
 typedef enum
@@ -193,6 +194,12 @@ typedef int (fz_document_count_chapters_fn)(fz_context *ctx, fz_document *doc);
 */
 typedef int (fz_document_count_pages_fn)(fz_context *ctx, fz_document *doc, int chapter);
 
+/**
+	Type for a function to start laying out a chapter of a
+	document. See fz_begin_chapter_layout for more information.
+*/
+typedef fz_chapter_layout *(fz_document_begin_chapter_layout_fn)(fz_context *ctx, fz_document *doc, int chapter);
+
 /**
 	Type for a function to load a given
 	page from a document. See fz_load_page for more information.
@@ -780,6 +787,41 @@ int fz_count_chapters(fz_context *ctx, fz_document *doc);
 */
 int fz_count_chapter_pages(fz_context *ctx, fz_document *doc, int chapter);
 
+/**
+	Laying out the chapters of a reflowable document in parallel.
+
+	Counting the pages of a reflowable document means laying out
+	every chapter, which fz_count_chapter_pages does one at a time.
+	These functions split that work into a part that needs the
+	document and a part that does not, so that the latter can run
+	on several threads at once.
+
+	fz_begin_chapter_layout parses a chapter. It returns NULL if the
+	number of pages in the chapter is already known for the current
+	layout, or if the document does not need laying out. Like all
+	other calls on the document, it must not run at the same time as
+	other calls on the same document.
+
+	fz_run_chapter_layout lays out the chapter. It does not access the
+	document, so any number of jobs may run at the same time, on
+	different threads with their own cloned contexts, and alongside
+	other calls on the document (e.g. rendering pages of chapters
+	that are already laid out).
+
+	fz_end_chapter_layout records the number of pages in the chapter
+	with the document, so that later calls to fz_count_chapter_pages
+	and fz_load_chapter_page for it need not lay it out again, and
+	frees the job. It returns the number of pages, or -1 if the job
+	was never run, or the document was laid out with different
+	parameters in the meantime. It must be serialized with other calls
+	on the document, like fz_begin_chapter_layout.
+
+	A job must always be ended, even if running it failed.
+*/
+fz_chapter_layout *fz_begin_chapter_layout(fz_context *ctx, fz_document *doc, int chapter);
+void fz_run_chapter_layout(fz_context *ctx, fz_chapter_layout *job);
+int fz_end_chapter_layout(fz_context *ctx, fz_chapter_layout *job);
+
 /**
 	Load a page.
 
@@ -1042,6 +1084,24 @@ struct fz_page
 	fz_page **prev, *next;
 };
 
+/**
+	Structure definition is public so other classes can
+	derive from it. Callers should not access the members
+	directly.
+
+	run lays out the chapter, and must not touch the document.
+	end records the result with the document and frees anything
+	held by the derived structure (but not the structure itself);
+	it returns the number of pages, or -1 if it was not run.
+*/
+struct fz_chapter_layout
+{
+	fz_document *doc;
+	int chapter;
+	void (*run)(fz_context *ctx, fz_chapter_layout *job);
+	int (*end)(fz_context *ctx, fz_chapter_layout *job);
+};
+
 /**
 	Structure definition is public so other classes can
 	derive from it. Callers should not access the members
@@ -1064,6 +1124,7 @@ struct fz_document
 	fz_document_format_link_uri_fn *format_link_uri;
 	fz_document_count_chapters_fn *count_chapters;
 	fz_document_count_pages_fn *count_pages;
+	fz_document_begin_chapter_layout_fn *begin_chapter_layout;
 	fz_document_load_page_fn *load_page;
 	fz_document_page_label_fn *page_label;
 	fz_document_lookup_metadata_fn *lookup_metadata;
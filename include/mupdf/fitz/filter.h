@@ -118,6 +118,26 @@ fz_stream *fz_open_rld(fz_context *ctx, fz_stream *chain);
 */
 fz_stream *fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int l2factor, fz_stream *jpegtables);
 
+/**
+	dctd filter with control over the scale and region decoded.
+
+	color_transform, invert_cmyk and jpegtables are as for
+	fz_open_dctd.
+
+	scale: Decode at scale/8 of full size, for any scale from 1
+	(one eighth) to 8 (full size). fz_open_dctd with an l2factor
+	is equivalent to a scale of 8>>l2factor.
+
+	region: If non-NULL, only decode the given area of the image
+	(in full size image coordinates). The stream then returns just
+	the scanlines and columns covering the area, scaled as above;
+	decoding stops after the last scanline required, and (where
+	the underlying libjpeg supports it) blocks to the left and
+	right of the area and scanlines above it are skipped without
+	being decoded.
+*/
+fz_stream *fz_open_dctd_region(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int scale, const fz_irect *region, fz_stream *jpegtables);
+
 /**
 	faxd filter performs FAX decoding of data read from
 	the chained filter.
@@ -154,6 +174,24 @@ fz_stream *fz_open_faxd(fz_context *ctx, fz_stream *chain,
 */
 fz_stream *fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits);
 
+/**
+	Inflate a complete block of flate encoded data in a single pass,
+	returning a new buffer.
+
+	This is an alternative to reading the whole of an fz_open_flated
+	stream when all the compressed data is already in memory; the
+	data is decoded straight into the returned buffer rather than
+	trickling through the stream's small internal buffer.
+
+	window_bits: As for fz_open_flated.
+
+	initial: The expected size of the decoded data, used to pre-size
+	the returned buffer (0 for a guess).
+
+	truncated, worst_case: As for fz_read_best.
+*/
+fz_buffer *fz_new_inflated_buffer(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, size_t initial, int *truncated, size_t worst_case);
+
 /**
 	libarchived filter performs generic compressed decoding of data
 	in any format understood by libarchive from the chained filter.
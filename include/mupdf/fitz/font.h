@@ -602,6 +602,25 @@ void fz_run_t3_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, str
 */
 float fz_advance_glyph(fz_context *ctx, fz_font *font, int glyph, int wmode);
 
+/**
+	Fill in the cached horizontal advances and bounding boxes for
+	every glyph in a font in one go.
+
+	The metrics are read straight from the hmtx, loca and glyf
+	tables of the font file rather than by loading each glyph
+	through FreeType. Glyphs (or whole fonts) that cannot be
+	handled this way, such as bounding boxes of CFF outlines or
+	synthesized bold/italic faces, are left to be measured on
+	first use as before.
+
+	This only does work the first time it is called for a font. It
+	is called automatically when a font is first used for html
+	layout, or for structured text extraction with accurate
+	bounding boxes. Walking every glyph is costly for large fonts,
+	so only call this when most glyphs will be measured.
+*/
+void fz_preload_font_metrics(fz_context *ctx, fz_font *font);
+
 /**
 	Find the glyph id for a given unicode
 	character within a font.
@@ -752,6 +771,7 @@ struct fz_font
 	fz_font_flags_t flags;
 
 	void *ft_face; /* has an FT_Face if used */
+	void *ft_lib; /* private FreeType library if using per-face locking */
 	fz_shaper_data_t shaper_data;
 
 	fz_matrix t3matrix;
@@ -782,6 +802,7 @@ struct fz_font
 
 	/* cached glyph metrics */
 	float **advance_cache;
+	int metrics_preloaded;
 
 	/* cached encoding lookup */
 	uint16_t *encoding_cache[256];
@@ -798,11 +819,43 @@ void fz_ft_lock(fz_context *ctx);
 
 void fz_ft_unlock(fz_context *ctx);
 
+/* Internal functions. Lock the FreeType face of a single font
+ * for use by this thread. For fonts loaded without per-face
+ * locking this is the same as fz_ft_lock/fz_ft_unlock. While
+ * holding a face lock FZ_LOCK_FREETYPE may be taken, but never
+ * fz_ft_lock, which needs every face lock. */
+void fz_ft_lock_face(fz_context *ctx, fz_font *font);
+
+void fz_ft_unlock_face(fz_context *ctx, fz_font *font);
+
 /* Internal function. Must be called with FT_ALLOC_LOCK
  * held. Returns 1 if this thread (context!) already holds
- * the freeetype lock. */
+ * the freeetype lock, or any font face lock. */
 int fz_ft_lock_held(fz_context *ctx);
 
+/**
+	Enable or disable per-face locking of FreeType for fonts
+	loaded from now on.
+
+	By default a single lock (FZ_LOCK_FREETYPE) serialises every
+	call into FreeType, so threads rendering text queue up behind
+	each other. With per-face locking, each font gets its own
+	FreeType library instance, and glyph loading, rendering,
+	measuring and encoding only take one of a small set of face
+	locks chosen for that font. Threads working with different
+	fonts can then use FreeType at the same time. This costs a
+	few kilobytes per loaded font.
+
+	Fonts keep the locking they were loaded with. Must be called
+	before the context is used from more than one thread.
+*/
+void fz_set_font_face_locking(fz_context *ctx, int enable);
+
+/**
+	Returns 1 if fonts loaded from now on use per-face locking.
+*/
+int fz_font_face_locking(fz_context *ctx);
+
 /* Internal function: Extract a ttf from the ttc that underlies
  * a given fz_font. Caller takes ownership of the returned
  * buffer.
@@ -74,6 +74,26 @@ void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 */
 void fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out);
 
+/**
+	A snapshot of the glyph cache's usage.
+
+	size: Bytes currently held.
+
+	glyphs: Number of glyphs currently held.
+
+	hits, misses: Outcome of every cache lookup for a rendered glyph
+	since the cache was created.
+*/
+typedef struct
+{
+	size_t size;
+	int glyphs;
+	size_t hits;
+	size_t misses;
+} fz_glyph_cache_stats;
+
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Perform subpixel quantisation and adjustment on a glyph matrix.
 
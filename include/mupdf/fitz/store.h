@@ -410,6 +410,30 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 */
 void fz_debug_store(fz_context *ctx, fz_output *out);
 
+/**
+	A snapshot of the store's usage, for benchmarking and
+	diagnostics.
+
+	size: Bytes currently held.
+
+	max: The limit on size (FZ_STORE_UNLIMITED for none).
+
+	items: Number of items currently held.
+
+	hits, misses: Outcome of every fz_find_item lookup since the
+	store was created.
+*/
+typedef struct
+{
+	size_t size;
+	size_t max;
+	int items;
+	size_t hits;
+	size_t misses;
+} fz_store_stats;
+
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
 /**
 	Increment the defer reap count.
 
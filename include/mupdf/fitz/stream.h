@@ -113,6 +113,62 @@ fz_stream *fz_open_memory(fz_context *ctx, const unsigned char *data, size_t len
 */
 fz_stream *fz_open_buffer(fz_context *ctx, fz_buffer *buf);
 
+/**
+	Callback used by a range stream to get bytes from its source.
+
+	Fill buf with the len bytes starting at offset, and return len.
+	The range never extends past the end of the source.
+
+	A fetcher that can block (a local file, a synchronous HTTP
+	range request) simply does so. One that cannot should start the
+	transfer and return 0; the read then fails with
+	FZ_ERROR_TRYLATER, and the same range (or a part of it) will be
+	asked for again when the caller retries. Errors should be
+	thrown.
+*/
+typedef size_t (fz_range_fetch_fn)(fz_context *ctx, void *opaque, unsigned char *buf, int64_t offset, size_t len);
+
+/**
+	Callback used to release the fetcher's state when a range stream
+	is dropped. May not throw exceptions.
+*/
+typedef void (fz_range_drop_fn)(fz_context *ctx, void *opaque);
+
+/**
+	Open a seekable stream over a source of known length that is
+	read on demand, a block at a time, through a fetch callback.
+
+	Fetched blocks are kept in an LRU cache, so that the back and
+	forth seeking of document parsers does not refetch data.
+
+	length: Total number of bytes in the source.
+
+	block_size: Size of a fetch/cache unit; 0 for the default (64K).
+
+	max_blocks: Number of blocks to cache; 0 for the default (256).
+
+	progressive: Flag the stream as progressive, so that linearized
+	PDF files are read front to back, with pages becoming available
+	as their data arrives. Use this with non-blocking fetchers. A
+	blocking fetcher is better off without it: random access via the
+	xref then touches far fewer bytes than reading the whole file.
+
+	fetch, drop, opaque: The fetcher. drop (if not NULL) is called
+	with opaque when the stream is dropped, or if opening it fails.
+*/
+fz_stream *fz_open_range_stream(fz_context *ctx, int64_t length, size_t block_size, int max_blocks, int progressive, fz_range_fetch_fn *fetch, fz_range_drop_fn *drop, void *opaque);
+
+/**
+	Ask a range stream to bring the given byte range into its cache,
+	with as few calls to the fetcher as possible. Ranges larger than
+	the cache are truncated.
+
+	Returns 0 if a non-blocking fetcher has yet to supply the data,
+	otherwise 1. Calling this on any other kind of stream does
+	nothing and returns 1.
+*/
+int fz_prefetch_range_stream(fz_context *ctx, fz_stream *stm, int64_t offset, int64_t len);
+
 /**
 	Attach a filter to a stream that will store any
 	characters read from the stream into the supplied buffer.
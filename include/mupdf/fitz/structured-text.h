@@ -94,6 +94,7 @@ typedef struct fz_stext_line fz_stext_line;
 typedef struct fz_stext_block fz_stext_block;
 typedef struct fz_stext_struct fz_stext_struct;
 typedef struct fz_stext_grid_positions fz_stext_grid_positions;
+typedef struct fz_stext_line_index fz_stext_line_index;
 
 /**
 	FZ_STEXT_PRESERVE_LIGATURES: If this option is activated
@@ -318,6 +319,10 @@ typedef struct
 	 * not be used by anything outside of the stext device. */
 	fz_stext_block *last_block;
 	fz_stext_struct *last_struct;
+
+	/* Spatial index over the lines of the page, built on first use
+	 * by the selection functions and freed with the page. */
+	fz_stext_line_index *line_index;
 } fz_stext_page;
 
 enum
@@ -551,6 +556,102 @@ typedef int (fz_search_callback_fn)(fz_context *ctx, void *opaque, int num_quads
 */
 int fz_search_stext_page_cb(fz_context *ctx, fz_stext_page *text, const char *needle, fz_search_callback_fn *cb, void *opaque);
 
+/**
+	Callback function for use in searching for several needles.
+
+	As fz_search_callback_fn, but also given the index of the
+	needle that was found.
+*/
+typedef int (fz_search_multi_callback_fn)(fz_context *ctx, void *opaque, int needle, int num_quads, fz_quad *hit_bbox);
+
+/**
+	Search for occurrences of each of 'count' needles in text page,
+	in a single pass over the text.
+
+	The hits for each needle are the same as fz_search_stext_page_cb
+	would find for it, and are passed in order for each needle, but
+	the hits for different needles are interleaved.
+
+	Returns the total number of hits.
+*/
+int fz_search_stext_page_multi_cb(fz_context *ctx, fz_stext_page *text, int count, const char **needles, fz_search_multi_callback_fn *cb, void *opaque);
+
+/**
+	A search index holds the text of a set of pages, with the
+	positions of every character, and an index of the character
+	trigrams that occur on each page. Once built, repeated
+	searches of a whole document only look at the pages that can
+	contain the needle, and never need to reload or extract them.
+
+	Pages are identified by number, and can be added, replaced
+	and removed individually.
+*/
+typedef struct fz_search_index fz_search_index;
+
+/**
+	Create a new, empty, search index.
+*/
+fz_search_index *fz_new_search_index(fz_context *ctx);
+
+/**
+	Free a search index.
+*/
+void fz_drop_search_index(fz_context *ctx, fz_search_index *index);
+
+/**
+	Add the text of a page to the index, replacing anything
+	previously indexed for that page number. Pass NULL for the
+	page to remove the page from the index.
+*/
+void fz_update_search_index(fz_context *ctx, fz_search_index *index, int number, fz_stext_page *page);
+
+/**
+	Returns 1 if the page has been added to the index.
+*/
+int fz_search_index_has_page(fz_context *ctx, fz_search_index *index, int number);
+
+/**
+	Callback function for use in searching an index.
+
+	As fz_search_callback_fn, but also given the number of the page
+	the hit is on.
+*/
+typedef int (fz_search_index_callback_fn)(fz_context *ctx, void *opaque, int number, int num_quads, fz_quad *hit_bbox);
+
+/**
+	Search for occurrences of 'needle' in the indexed pages.
+
+	Matches exactly as fz_search_stext_page_cb does, calling the
+	callback once for each hit, in page order.
+
+	Returns the number of hits.
+*/
+int fz_search_index_cb(fz_context *ctx, fz_search_index *index, const char *needle, fz_search_index_callback_fn *cb, void *opaque);
+
+/**
+	Write a search index to an output, so that it can be loaded
+	again without extracting the text of the pages.
+*/
+void fz_save_search_index(fz_context *ctx, fz_search_index *index, fz_output *out);
+
+/**
+	Load a search index written by fz_save_search_index.
+*/
+fz_search_index *fz_load_search_index(fz_context *ctx, fz_stream *stm);
+
+
+/**
+	The selection and rectangle copying functions below look up
+	lines through a spatial index that is built the first time one
+	of them is called on a page. Building it is not thread safe, so
+	a page shared between threads should have it built (for example
+	by a selection call) before it is shared.
+
+	The index is discarded by the functions that restructure a page.
+	Code that changes the blocks, lines or characters of a page
+	itself must call fz_invalidate_stext_line_index afterwards.
+*/
+void fz_invalidate_stext_line_index(fz_context *ctx, fz_stext_page *page);
 
 /**
 	Return a list of quads to highlight lines inside the selection
@@ -585,13 +686,32 @@ char *fz_copy_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_poi
 */
 char *fz_copy_rectangle(fz_context *ctx, fz_stext_page *page, fz_rect area, int crlf);
 
+/**
+	Time taken, in milliseconds, by each of the analysis phases that
+	an stext device can run on the page as it is closed.
+*/
+typedef struct
+{
+	float segment;
+	float table_hunt;
+	float paragraph_break;
+} fz_stext_timings;
+
 /**
 	Options for creating structured text.
+
+	timings: If not NULL, the time taken by each of the analysis
+	phases selected by flags (FZ_STEXT_SEGMENT, FZ_STEXT_TABLE_HUNT
+	and FZ_STEXT_PARAGRAPH_BREAK) is added to the totals here when
+	the device is closed. The totals are not reset, so one block can
+	gather timings over a whole document, but it must not be shared
+	between devices that are closed on different threads.
 */
 typedef struct
 {
 	int flags;
 	float scale;
+	fz_stext_timings *timings;
 } fz_stext_options;
 
 /**
@@ -642,6 +762,28 @@ void fz_table_hunt(fz_context *ctx, fz_stext_page *page);
 */
 fz_device *fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options *options);
 
+/**
+	Create a device that writes the text on a page to an output as
+	plain UTF-8, one line at a time, with a blank line after each
+	paragraph.
+
+	Lines and paragraphs are found in the same way as the stext
+	device finds them, and the output is the same as printing the
+	text page with fz_print_stext_page_as_text, but without
+	building the page: memory use is bounded by the longest line.
+
+	Since the device never sees the whole page, the options to
+	segment the page, hunt for tables, or break paragraphs, and to
+	collect images, vectors, styles and structure, are ignored.
+
+	out: The output to write the text to.
+
+	mediabox: The page bounds, for the clip option.
+
+	options: Options to configure the device.
+*/
+fz_device *fz_new_text_output_device(fz_context *ctx, fz_output *out, fz_rect mediabox, const fz_stext_options *options);
+
 /**
 	Create a device to OCR the text on the page.
 
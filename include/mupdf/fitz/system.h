@@ -212,6 +212,10 @@ int64_t fz_stat_ctime(const char *path);
 int64_t fz_stat_mtime(const char *path);
 int fz_mkdir(char *path);
 
+/* A wall clock in milliseconds, for timing. Unlike clock(), this
+ * doesn't add up the time taken by every thread. */
+double fz_ms_clock(void);
+
 
 /* inline is standard in C++. For some compilers we can enable it within
  * C too. Some compilers think they know better than we do about when
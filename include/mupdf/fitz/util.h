@@ -113,6 +113,12 @@ int fz_search_page_number_cb(fz_context *ctx, fz_document *doc, int number, cons
 int fz_search_chapter_page_number_cb(fz_context *ctx, fz_document *doc, int chapter, int page, const char *needle, fz_search_callback_fn *cb, void *opaque);
 int fz_search_display_list_cb(fz_context *ctx, fz_display_list *list, const char *needle, fz_search_callback_fn *cb, void *opaque);
 
+/**
+	Create a search index covering every page of a document.
+	See fz_search_index_cb.
+*/
+fz_search_index *fz_new_search_index_from_document(fz_context *ctx, fz_document *doc, const fz_stext_options *options);
+
 /**
 	Parse an SVG document into a display-list.
 */
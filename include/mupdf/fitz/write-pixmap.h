@@ -239,6 +239,16 @@ void fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, fz_pixmap *pix, in
 */
 void fz_save_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pixmap, const char *filename, int quality);
 
+/**
+	Create a new JPEG band writer (greyscale, RGB or CMYK, no
+	alpha).
+
+	Unlike fz_write_pixmap_as_jpeg, this writes a baseline rather
+	than a progressive JPEG, so that the whole image never needs to
+	be held in memory at once.
+*/
+fz_band_writer *fz_new_jpeg_band_writer(fz_context *ctx, fz_output *out, int quality, int invert_cmyk);
+
 /**
 	Write a (Greyscale or RGB) pixmap as a png.
 */
@@ -28,6 +28,7 @@
 #include "mupdf/fitz/output.h"
 #include "mupdf/fitz/document.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/structured-text.h"
 
 typedef struct fz_document_writer fz_document_writer;
 
@@ -137,6 +138,26 @@ fz_document_writer *fz_new_svg_writer_with_output(fz_context *ctx, fz_output *ou
 fz_document_writer *fz_new_text_writer(fz_context *ctx, const char *format, const char *path, const char *options);
 fz_document_writer *fz_new_text_writer_with_output(fz_context *ctx, const char *format, fz_output *out, const char *options);
 
+/**
+	Text writers can be given pages whose text has already been
+	extracted, so that several pages can be extracted at once (for
+	instance on other threads) and still be written in page order.
+
+	fz_text_writer_options returns the options the writer extracts
+	text with, or NULL if wri is not a text writer or is a plain
+	text writer that streams its text as it is found without
+	building a page. Pages for such writers must be written with
+	fz_begin_page/fz_end_page to give the same output.
+
+	fz_write_stext_page writes page as the next page of the output,
+	in place of a fz_begin_page/fz_end_page pair. The page should be
+	made with the page mediabox and filled by a stext device using
+	the options above. It is scaled in place if the writer has a
+	resolution other than the default, but is not dropped.
+*/
+const fz_stext_options *fz_text_writer_options(fz_context *ctx, fz_document_writer *wri);
+void fz_write_stext_page(fz_context *ctx, fz_document_writer *wri, fz_stext_page *page);
+
 fz_document_writer *fz_new_odt_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_odt_writer_with_output(fz_context *ctx, fz_output *out, const char *options);
 fz_document_writer *fz_new_docx_writer(fz_context *ctx, const char *path, const char *options);
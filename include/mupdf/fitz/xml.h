@@ -75,6 +75,44 @@ fz_xml *fz_try_parse_xml_archive_entry(fz_context *ctx, fz_archive *dir, const c
 */
 fz_xml *fz_parse_xml_from_html5(fz_context *ctx, fz_buffer *buf);
 
+/**
+	Callbacks for event based parsing of XML.
+
+	open_tag is called at the start of every element, with the tag
+	name (stripped of any namespace prefix) and a NULL terminated
+	array of attribute name and value pairs, in document order.
+
+	close_tag is called at the end of every element, including empty
+	elements and any that are still open at the end of the data.
+
+	text is called for character data (with entities resolved) and
+	CDATA sections inside the root element. With preserve_white unset,
+	runs of character data that are all whitespace are skipped.
+
+	The strings passed are only valid during the call. Any callback
+	may be NULL. Return non-zero from a callback to stop parsing.
+*/
+typedef struct
+{
+	int (*open_tag)(fz_context *ctx, void *arg, const char *tag, char **atts);
+	int (*close_tag)(fz_context *ctx, void *arg, const char *tag);
+	int (*text)(fz_context *ctx, void *arg, const char *text, size_t len);
+} fz_xml_sax_handler;
+
+/**
+	Parse XML from a stream, calling the handler functions as
+	elements and text are encountered, without building a tree.
+
+	Memory use is bounded by the largest single tag or run of
+	text and the nesting depth, rather than the size of the
+	document. (Input in encodings other than UTF-8 and ASCII
+	is read in full and converted first.)
+
+	Throws on syntax errors, having made calls for all the data
+	before the error.
+*/
+void fz_parse_xml_sax(fz_context *ctx, fz_stream *stm, int preserve_white, const fz_xml_sax_handler *handler, void *arg);
+
 /**
 	Add a reference to the XML.
 */
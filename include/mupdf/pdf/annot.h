@@ -869,6 +869,49 @@ int pdf_update_annot(fz_context *ctx, pdf_annot *annot);
 */
 int pdf_update_page(fz_context *ctx, pdf_page *page);
 
+/*
+	Incremental rendering of annotation changes.
+
+	A page renderer rasterises the page contents once and keeps them
+	aside, together with a display list for each annotation and widget.
+	After an edit, pdf_update_page_renderer re-records only those
+	annotations whose appearance changed (or that were added, removed or
+	hidden for editing) and repaints just the affected areas of the
+	page pixmap: cached contents first, then every annotation touching
+	that area, in page order.
+
+	The renderer holds a reference to the page. It assumes the page
+	contents themselves do not change; after e.g. applying redactions,
+	drop it and create a new one. Likewise for a new ctm.
+*/
+typedef struct pdf_page_renderer pdf_page_renderer;
+
+/*
+	Create a renderer for the page at the given transform, and render
+	the full page (contents, annotations and widgets) into its pixmap.
+*/
+pdf_page_renderer *pdf_new_page_renderer(fz_context *ctx, pdf_page *page, fz_matrix ctm, fz_colorspace *cs, int alpha);
+
+void pdf_drop_page_renderer(fz_context *ctx, pdf_page_renderer *ren);
+
+/*
+	Return a borrowed reference to the rendered page. Its contents are
+	updated in place by pdf_update_page_renderer.
+*/
+fz_pixmap *pdf_page_renderer_pixmap(fz_context *ctx, pdf_page_renderer *ren);
+
+/*
+	Update annotation appearances as pdf_update_page does, and repaint
+	whatever changed.
+
+	damage: Filled in with up to max_damage device space rectangles
+	that were repainted. If there are more, the remainder are merged
+	into the last one.
+
+	Returns the number of rectangles written; 0 if nothing changed.
+*/
+int pdf_update_page_renderer(fz_context *ctx, pdf_page_renderer *ren, fz_irect *damage, int max_damage);
+
 /*
 	Update internal state appropriate for editing this field. When editing
 	is true, updating the text of the text widget will not have any
@@ -36,6 +36,7 @@ typedef struct pdf_ocg_descriptor pdf_ocg_descriptor;
 typedef struct pdf_page pdf_page;
 typedef struct pdf_annot pdf_annot;
 typedef struct pdf_js pdf_js;
+typedef struct pdf_profile pdf_profile;
 typedef struct pdf_document pdf_document;
 
 enum
@@ -504,6 +505,9 @@ struct pdf_document
 	int recalculate;
 	int redacted;
 	int resynth_required;
+	int cache_forms;
+	int form_cache_generation; /* bumped by edits, to expire form recordings */
+	pdf_profile *profile;
 
 	pdf_doc_event_cb *event_cb;
 	pdf_free_doc_event_data_cb *free_event_data_cb;
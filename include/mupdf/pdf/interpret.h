@@ -161,6 +161,11 @@ struct pdf_processor
 	void (*op_Do_image)(fz_context *ctx, pdf_processor *proc, const char *name, fz_image *image);
 	void (*op_Do_form)(fz_context *ctx, pdf_processor *proc, const char *name, pdf_obj *form);
 
+	/* Optional. Return non-zero if an image painted with the current
+	 * graphics state could not be seen, so the interpreter can skip
+	 * loading it and calling op_Do_image at all. */
+	int (*cull_image)(fz_context *ctx, pdf_processor *proc);
+
 	/* marked content */
 	void (*op_MP)(fz_context *ctx, pdf_processor *proc, const char *tag);
 	void (*op_DP)(fz_context *ctx, pdf_processor *proc, const char *tag, pdf_obj *raw, pdf_obj *cooked);
@@ -185,6 +190,10 @@ struct pdf_processor
 	const char *usage;
 	int hidden;
 
+	/* resources already resolved by name; lives until the processor
+	 * is closed, so nested forms sharing a resource dict reuse it */
+	fz_hash_table *resource_cache;
+
 	pdf_processor_requirements requirements;
 };
 
@@ -217,6 +226,19 @@ void pdf_count_q_balance(fz_context *ctx, pdf_document *doc, pdf_obj *res, pdf_o
 
 pdf_processor *pdf_new_run_processor(fz_context *ctx, pdf_document *doc, fz_device *dev, fz_matrix ctm, int struct_parent, const char *usage, pdf_gstate *gstate, fz_default_colorspaces *default_cs, fz_cookie *cookie, pdf_gstate *fill_gstate, pdf_gstate *stroke_gstate);
 
+/*
+	Restrict a run processor to a region of the device.
+
+	Paths, text, images, shadings and Form XObjects whose device space
+	bounds fall entirely outside scissor are dropped without being sent
+	to the device. Forms outside the region are not interpreted at all,
+	and images outside it are never loaded. Clips are still passed on
+	so the device's clip stack stays balanced.
+
+	Pass fz_infinite_rect (the default) to run everything.
+*/
+void pdf_run_processor_set_scissor(fz_context *ctx, pdf_processor *proc, fz_rect scissor);
+
 /*
 	Create a buffer processor.
 
@@ -493,4 +515,48 @@ void pdf_tos_translate(pdf_text_object_state *tos, float tx, float ty);
 void pdf_tos_set_matrix(pdf_text_object_state *tos, float a, float b, float c, float d, float e, float f);
 void pdf_tos_newline(pdf_text_object_state *tos, float leading);
 
+/*
+	Interpretation profiling.
+
+	A profile accumulates wall clock time and call counts for every
+	content stream operator run for a document, and for the resources
+	those operators pull in: Form XObjects (including the time taken
+	by their contents), images and shadings (time to load, and time to
+	draw, which for images includes decoding them), and fonts (time to
+	load).
+
+	Operator times are reported both inclusive and exclusive of any
+	operators nested inside them, so 'Do' on a form is not counted
+	twice.
+
+	A profile is not thread safe; only attach it to a document that
+	is run from one thread at a time.
+*/
+pdf_profile *pdf_new_profile(fz_context *ctx);
+void pdf_drop_profile(fz_context *ctx, pdf_profile *prof);
+
+/*
+	Start (or with NULL, stop) accounting everything the document
+	interprets to prof. This covers pages, annotations and Type 3
+	glyphs alike. The document does not take a reference, so detach
+	the profile before dropping it.
+*/
+void pdf_set_profile(fz_context *ctx, pdf_document *doc, pdf_profile *prof);
+
+/*
+	Write the profile as a JSON object on a single line, without a
+	trailing newline, with the most expensive entries first in each
+	list:
+
+	{"total_ms":..., "operators":[{"op":"Do","count":...,"ms":...,"self_ms":...}, ...],
+	"forms":[...], "images":[...], "fonts":[...], "shadings":[...]}
+
+	Resources are listed with their object number (0 for direct
+	objects), the name they were first used by, a count, and
+	"load_ms" and/or "ms" as applicable. Direct objects are told
+	apart by that name alone. Keywords longer than any operator
+	are counted together as "?".
+*/
+void pdf_write_profile_json(fz_context *ctx, fz_output *out, pdf_profile *prof);
+
 #endif
@@ -226,6 +226,39 @@ void pdf_run_page_contents_with_usage(fz_context *ctx, pdf_page *page, fz_device
 void pdf_run_page_annots_with_usage(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_cookie *cookie);
 void pdf_run_page_widgets_with_usage(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_cookie *cookie);
 
+/*
+	Interpret only the part of the page contents that can be seen
+	inside a region, for example when redrawing a single tile.
+
+	scissor: The region of interest, in device space (i.e. after
+	ctm has been applied).
+
+	Paths, text, images and shadings lying entirely outside the
+	scissor are skipped, as are Form XObjects whose transformed BBox
+	misses it; such forms are not interpreted and such images are
+	never loaded. Anything that touches the scissor is drawn in full,
+	so the device should still clip to the region if it needs to.
+*/
+void pdf_run_page_contents_with_scissor(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
+
+/*
+	Enable or disable display list caching of Form XObjects.
+
+	When enabled, a form that is not a transparency group and is drawn
+	with a plain inherited graphics state (no soft mask, pattern or
+	shading fill) is recorded into a display list the first time it is
+	run, and replayed with the current transform after that. This is a
+	large win for pages that stamp the same form many times.
+
+	The recordings are held in the store, charged at the size of their
+	display lists. Any edit to the document, including to the images,
+	forms and fonts that a form uses, makes all of its recordings stale.
+	Documents with optional content are never cached. Disabled by
+	default.
+*/
+void pdf_set_form_caching(fz_context *ctx, pdf_document *doc, int enable);
+int pdf_form_caching(fz_context *ctx, pdf_document *doc);
+
 void pdf_filter_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page, pdf_filter_options *options);
 void pdf_filter_annot_contents(fz_context *ctx, pdf_document *doc, pdf_annot *annot, pdf_filter_options *options);
 
@@ -126,6 +126,16 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_image_tiling(fz_context *ctx, int tile_size)
+{
+	ctx->tuning->image_tile_size = tile_size > 0 ? (fz_mini(tile_size, 4096) + 7) & ~7 : 0;
+}
+
+void fz_tune_jpx_threads(fz_context *ctx, int threads)
+{
+	ctx->tuning->jpx_threads = fz_maxi(threads, 0);
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
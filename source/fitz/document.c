@@ -769,6 +769,43 @@ fz_count_chapter_pages(fz_context *ctx, fz_document *doc, int chapter)
 	return 0;
 }
 
+fz_chapter_layout *
+fz_begin_chapter_layout(fz_context *ctx, fz_document *doc, int chapter)
+{
+	fz_ensure_layout(ctx, doc);
+	if (doc && doc->begin_chapter_layout)
+		return doc->begin_chapter_layout(ctx, doc, chapter);
+	return NULL;
+}
+
+void
+fz_run_chapter_layout(fz_context *ctx, fz_chapter_layout *job)
+{
+	if (job)
+		job->run(ctx, job);
+}
+
+int
+fz_end_chapter_layout(fz_context *ctx, fz_chapter_layout *job)
+{
+	int n;
+
+	if (!job)
+		return -1;
+
+	fz_try(ctx)
+		n = job->end(ctx, job);
+	fz_always(ctx)
+	{
+		fz_drop_document(ctx, job->doc);
+		fz_free(ctx, job);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return n;
+}
+
 int
 fz_count_pages(fz_context *ctx, fz_document *doc)
 {
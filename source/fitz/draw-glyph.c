@@ -58,6 +58,8 @@ struct fz_glyph_cache
 {
 	int refs;
 	size_t total;
+	size_t hits;
+	size_t misses;
 #ifndef NDEBUG
 	int num_evictions;
 	ptrdiff_t evicted;
@@ -331,11 +333,13 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		{
 			move_to_front(cache, entry);
 			val = fz_keep_glyph(ctx, entry->val);
+			cache->hits++;
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -486,3 +490,22 @@ fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
 #endif
 }
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_entry *entry;
+
+	memset(stats, 0, sizeof *stats);
+	if (!cache)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	stats->size = cache->total;
+	for (entry = cache->lru_head; entry; entry = entry->lru_next)
+		stats->glyphs++;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
@@ -40,7 +40,12 @@ typedef struct
 	int invert_cmyk; /* has inverted CMYK polarity */
 	int init;
 	int stride;
-	int l2factor;
+	int scale;
+	int has_region;
+	fz_irect region;
+	int skip; /* bytes to drop from the start of each decoded scanline */
+	int span; /* bytes to return from each decoded scanline */
+	JDIMENSION y_end; /* output scanline at which to stop */
 	unsigned char *scanline;
 	unsigned char *rp, *wp;
 	struct jpeg_decompress_struct cinfo;
@@ -196,6 +201,68 @@ static void invert_cmyk(unsigned char *p, int n)
 		p[i] = 255 - p[i];
 }
 
+/*
+ * Set up decoding of a region of the image; called after
+ * jpeg_start_decompress. The region is given in full size image
+ * coordinates, so first map it onto the (scaled) output.
+ */
+static void
+start_region(fz_context *ctx, fz_dctd *state)
+{
+	j_decompress_ptr cinfo = &state->cinfo;
+	JDIMENSION x0, x1, y0, y1;
+	int n = cinfo->output_components;
+
+	x0 = (JDIMENSION)(((int64_t)fz_maxi(state->region.x0, 0) * state->scale) / 8);
+	y0 = (JDIMENSION)(((int64_t)fz_maxi(state->region.y0, 0) * state->scale) / 8);
+	x1 = (JDIMENSION)(((int64_t)fz_maxi(state->region.x1, 0) * state->scale + 7) / 8);
+	y1 = (JDIMENSION)(((int64_t)fz_maxi(state->region.y1, 0) * state->scale + 7) / 8);
+	if (x1 > cinfo->output_width)
+		x1 = cinfo->output_width;
+	if (y1 > cinfo->output_height)
+		y1 = cinfo->output_height;
+	if (x0 > x1)
+		x0 = x1;
+	if (y0 > y1)
+		y0 = y1;
+
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+	/* libjpeg-turbo can skip whole iMCU columns and rows for us. It
+	 * rounds the cropped area out to an iMCU boundary, leaving us to
+	 * trim off the rest. Chroma upsampling replicates samples at the
+	 * edges of the cropped area, so crop a little wider than we need
+	 * to keep the edge pixels identical to a full decode. */
+	if (x1 > x0 && (x0 > 0 || x1 < cinfo->output_width))
+	{
+		JDIMENSION xoff = x0 > 0 ? x0 - 1 : 0;
+		JDIMENSION w = fz_mini(x1 + 16, cinfo->output_width) - xoff;
+		jpeg_crop_scanline(cinfo, &xoff, &w);
+		x0 -= xoff;
+		x1 -= xoff;
+	}
+	if (y0 > 0)
+		jpeg_skip_scanlines(cinfo, y0);
+#else
+	/* Other libjpegs have no means to skip data, so we decode and
+	 * drop the scanlines above the region. */
+	if (y0 > 0)
+	{
+		unsigned char *scanline = fz_malloc(ctx, cinfo->output_width * (size_t)n);
+		fz_try(ctx)
+			while (cinfo->output_scanline < y0)
+				jpeg_read_scanlines(cinfo, &scanline, 1);
+		fz_always(ctx)
+			fz_free(ctx, scanline);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+#endif
+
+	state->skip = x0 * n;
+	state->span = (x1 - x0) * n;
+	state->y_end = y1;
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 {
@@ -261,12 +328,18 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 					cinfo->jpeg_color_space = JCS_CMYK;
 			}
 
-			cinfo->scale_num = 8/(1<<state->l2factor);
+			cinfo->scale_num = state->scale;
 			cinfo->scale_denom = 8;
 
 			jpeg_start_decompress(cinfo);
 
+			state->y_end = cinfo->output_height;
+			if (state->has_region)
+				start_region(ctx, state);
+
 			state->stride = cinfo->output_width * cinfo->output_components;
+			if (!state->has_region)
+				state->span = state->stride;
 			state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
 			state->rp = state->scanline;
 			state->wp = state->scanline;
@@ -277,10 +350,10 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 
 		while (p < ep)
 		{
-			if (cinfo->output_scanline == cinfo->output_height)
+			if (cinfo->output_scanline >= state->y_end)
 				break;
 
-			if (p + state->stride <= ep)
+			if (state->span == state->stride && p + state->stride <= ep)
 			{
 				jpeg_read_scanlines(cinfo, &p, 1);
 				if (state->invert_cmyk && cinfo->num_components == 4)
@@ -292,8 +365,8 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 				jpeg_read_scanlines(cinfo, &state->scanline, 1);
 				if (state->invert_cmyk && cinfo->num_components == 4)
 					invert_cmyk(state->scanline, state->stride);
-				state->rp = state->scanline;
-				state->wp = state->scanline + state->stride;
+				state->rp = state->scanline + state->skip;
+				state->wp = state->rp + state->span;
 			}
 
 			while (state->rp < state->wp && p < ep)
@@ -351,6 +424,12 @@ close_dctd(fz_context *ctx, void *state_)
 
 fz_stream *
 fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int l2factor, fz_stream *jpegtables)
+{
+	return fz_open_dctd_region(ctx, chain, color_transform, invert_cmyk, 8>>l2factor, NULL, jpegtables);
+}
+
+fz_stream *
+fz_open_dctd_region(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int scale, const fz_irect *region, fz_stream *jpegtables)
 {
 	fz_dctd *state = fz_malloc_struct(ctx, fz_dctd);
 	j_decompress_ptr cinfo = &state->cinfo;
@@ -368,7 +447,12 @@ fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int invert_
 	state->color_transform = color_transform;
 	state->invert_cmyk = invert_cmyk;
 	state->init = 0;
-	state->l2factor = l2factor;
+	state->scale = fz_clampi(scale, 1, 8);
+	if (region)
+	{
+		state->has_region = 1;
+		state->region = *region;
+	}
 	state->chain = fz_keep_stream(ctx, chain);
 	state->jpegtables = fz_keep_stream(ctx, jpegtables);
 	state->curr_stm = state->chain;
@@ -24,7 +24,14 @@
 
 #include <zlib.h>
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
 #include <string.h>
+#include <limits.h>
+
+#define MIN_BOMB (100 << 20)
 
 typedef struct
 {
@@ -143,3 +150,166 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 
 	return fz_new_stream(ctx, state, next_flated, close_flated);
 }
+
+#ifdef HAVE_LIBDEFLATE
+/* libdeflate only decodes complete, well formed data, but does so much
+ * faster than zlib. Returns NULL (leaving zlib to cope) for anything it
+ * cannot handle. */
+static fz_buffer *
+inflate_libdeflate(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, size_t initial, size_t worst_case)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res = LIBDEFLATE_BAD_DATA;
+	fz_buffer *buf = NULL;
+	size_t out = 0;
+
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		return NULL;
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		buf = fz_new_buffer(ctx, initial + 1);
+		while (1)
+		{
+			if (window_bits > 15)
+				res = libdeflate_gzip_decompress(d, data, len, buf->data, buf->cap - 1, &out);
+			else if (window_bits < 0)
+				res = libdeflate_deflate_decompress(d, data, len, buf->data, buf->cap - 1, &out);
+			else
+				res = libdeflate_zlib_decompress(d, data, len, buf->data, buf->cap - 1, &out);
+			if (res != LIBDEFLATE_INSUFFICIENT_SPACE || buf->cap > worst_case)
+				break;
+			fz_resize_buffer(ctx, buf, buf->cap * 2);
+		}
+	}
+	fz_always(ctx)
+		libdeflate_free_decompressor(d);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	if (res != LIBDEFLATE_SUCCESS)
+	{
+		fz_drop_buffer(ctx, buf);
+		return NULL;
+	}
+
+	buf->len = out;
+	return buf;
+}
+#endif
+
+fz_buffer *
+fz_new_inflated_buffer(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, size_t initial, int *truncated, size_t worst_case)
+{
+	fz_buffer *buf = NULL;
+	z_stream z;
+	int code;
+
+	if (truncated)
+		*truncated = 0;
+
+	if (initial == 0)
+		initial = len * 3;
+	if (worst_case == 0)
+		worst_case = initial * 200;
+	if (worst_case < MIN_BOMB)
+		worst_case = MIN_BOMB;
+	if (initial < 1024)
+		initial = 1024;
+
+#ifdef HAVE_LIBDEFLATE
+	buf = inflate_libdeflate(ctx, data, len, window_bits, initial, worst_case);
+	if (buf)
+		return buf;
+#endif
+
+	memset(&z, 0, sizeof z);
+	z.zalloc = fz_zlib_alloc;
+	z.zfree = fz_zlib_free;
+	z.opaque = ctx;
+
+	code = inflateInit2(&z, window_bits);
+	if (code != Z_OK)
+		fz_throw(ctx, FZ_ERROR_LIBRARY, "zlib error: inflateInit2 failed");
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		buf = fz_new_buffer(ctx, initial + 1);
+
+		z.next_in = (Bytef *)data;
+
+		while (1)
+		{
+			size_t in_chunk, out_chunk;
+
+			if (buf->len == buf->cap)
+				fz_grow_buffer(ctx, buf);
+
+			if (buf->len > worst_case)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "compression bomb detected");
+
+			/* zlib counts in uInt, so feed huge blocks in pieces. */
+			in_chunk = len < UINT_MAX ? len : UINT_MAX;
+			out_chunk = buf->cap - buf->len;
+			if (out_chunk > UINT_MAX)
+				out_chunk = UINT_MAX;
+
+			z.avail_in = (uInt)in_chunk;
+			z.next_out = buf->data + buf->len;
+			z.avail_out = (uInt)out_chunk;
+
+			code = inflate(&z, Z_SYNC_FLUSH);
+
+			len -= in_chunk - z.avail_in;
+			buf->len += out_chunk - z.avail_out;
+
+			if (code == Z_STREAM_END)
+			{
+				break;
+			}
+			else if (code == Z_BUF_ERROR || (code == Z_OK && len == 0 && z.avail_out > 0))
+			{
+				fz_warn(ctx, "premature end of data in flate filter");
+				break;
+			}
+			else if (code == Z_DATA_ERROR && len == 0)
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else if (code == Z_DATA_ERROR && !strcmp(z.msg, "incorrect data check"))
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else if (code != Z_OK)
+			{
+				fz_throw(ctx, FZ_ERROR_LIBRARY, "zlib error: %s", z.msg);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		inflateEnd(&z);
+	}
+	fz_catch(ctx)
+	{
+		if (fz_caught(ctx) == FZ_ERROR_SYSTEM || !truncated || !buf)
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_rethrow(ctx);
+		}
+		*truncated = 1;
+		fz_report_error(ctx);
+	}
+
+	return buf;
+}
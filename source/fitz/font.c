@@ -88,6 +88,8 @@ int ft_name_index(void *face, const char *name)
 }
 
 static void fz_drop_freetype(fz_context *ctx);
+typedef struct fz_ft_face_lib fz_ft_face_lib;
+static void drop_ft_face_lib(fz_context *ctx, fz_ft_face_lib *fl, FT_Face face, const char *name);
 
 static fz_font *
 fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_count)
@@ -209,7 +211,12 @@ fz_drop_font(fz_context *ctx, fz_font *font)
 	fz_free(ctx, font->t3widths);
 	fz_free(ctx, font->t3flags);
 
-	if (font->ft_face)
+	if (font->ft_lib)
+	{
+		drop_ft_face_lib(ctx, font->ft_lib, font->ft_face, font->name);
+		fz_drop_freetype(ctx);
+	}
+	else if (font->ft_face)
 	{
 		fz_ft_lock(ctx);
 		fterr = FT_Done_Face((FT_Face)font->ft_face);
@@ -292,6 +299,13 @@ struct fz_font_context
 	FT_Library ftlib;
 	struct FT_MemoryRec_ ftmemory;
 	int ftlib_refs;
+
+	/* Per-face locking */
+	int face_locking; /* new fonts get their own library */
+	int face_locks_used; /* fz_ft_lock must take the face locks too */
+	unsigned int next_face_lock;
+	fz_context *face_lock_owner[FZ_FREETYPE_FACE_LOCKS];
+
 	fz_load_system_font_fn *load_font;
 	fz_load_system_cjk_font_fn *load_cjk_font;
 	fz_load_system_fallback_font_fn *load_fallback_font;
@@ -315,21 +329,28 @@ struct ft_error
 	char *str;
 };
 
-static void *ft_alloc(FT_Memory memory, long size)
+/*
+	A FreeType library private to one font, used with per-face
+	locking. Its memory callbacks allocate with the context that
+	holds the face lock, or failing that the one holding the
+	global lock (which also holds every face lock).
+*/
+struct fz_ft_face_lib
 {
-	fz_context *ctx = (fz_context *) memory->user;
-	return Memento_label(fz_malloc_no_throw(ctx, size), "ft_alloc");
-}
+	struct FT_MemoryRec_ memory;
+	FT_Library library;
+	fz_font_context *fct;
+	fz_context *owner;
+	int lock;
+};
 
-static void ft_free(FT_Memory memory, void *block)
+static void *ft_alloc_imp(fz_context *ctx, long size)
 {
-	fz_context *ctx = (fz_context *) memory->user;
-	fz_free(ctx, block);
+	return Memento_label(fz_malloc_no_throw(ctx, size), "ft_alloc");
 }
 
-static void *ft_realloc(FT_Memory memory, long cur_size, long new_size, void *block)
+static void *ft_realloc_imp(fz_context *ctx, long new_size, void *block)
 {
-	fz_context *ctx = (fz_context *) memory->user;
 	void *newblock = NULL;
 	if (new_size == 0)
 	{
@@ -337,13 +358,60 @@ static void *ft_realloc(FT_Memory memory, long cur_size, long new_size, void *bl
 		return newblock;
 	}
 	if (block == NULL)
-		return ft_alloc(memory, new_size);
+		return ft_alloc_imp(ctx, new_size);
 	return fz_realloc_no_throw(ctx, block, new_size);
 }
 
+static void *ft_alloc(FT_Memory memory, long size)
+{
+	fz_context *ctx = (fz_context *) memory->user;
+	return ft_alloc_imp(ctx, size);
+}
+
+static void ft_free(FT_Memory memory, void *block)
+{
+	fz_context *ctx = (fz_context *) memory->user;
+	fz_free(ctx, block);
+}
+
+static void *ft_realloc(FT_Memory memory, long cur_size, long new_size, void *block)
+{
+	fz_context *ctx = (fz_context *) memory->user;
+	return ft_realloc_imp(ctx, new_size, block);
+}
+
+static fz_context *ft_face_memory_ctx(FT_Memory memory)
+{
+	fz_ft_face_lib *fl = (fz_ft_face_lib *) memory->user;
+	return fl->owner ? fl->owner : (fz_context *) fl->fct->ftmemory.user;
+}
+
+static void *ft_face_alloc(FT_Memory memory, long size)
+{
+	return ft_alloc_imp(ft_face_memory_ctx(memory), size);
+}
+
+static void ft_face_free(FT_Memory memory, void *block)
+{
+	fz_free(ft_face_memory_ctx(memory), block);
+}
+
+static void *ft_face_realloc(FT_Memory memory, long cur_size, long new_size, void *block)
+{
+	return ft_realloc_imp(ft_face_memory_ctx(memory), new_size, block);
+}
+
 void
 fz_ft_lock(fz_context *ctx)
 {
+	int i;
+
+	/* Exclude every thread working on a single face too. Locks may
+	 * only be taken in descending order, and the face locks are
+	 * numbered above FZ_LOCK_FREETYPE, so take them first. */
+	if (ctx->font->face_locks_used)
+		for (i = FZ_FREETYPE_FACE_LOCKS - 1; i >= 0; i--)
+			fz_lock(ctx, FZ_LOCK_FREETYPE_FACE + i);
 	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	assert(ctx->font->ftmemory.user == NULL);
@@ -354,18 +422,139 @@ fz_ft_lock(fz_context *ctx)
 void
 fz_ft_unlock(fz_context *ctx)
 {
+	int i;
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	ctx->font->ftmemory.user = NULL;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	if (ctx->font->face_locks_used)
+		for (i = 0; i < FZ_FREETYPE_FACE_LOCKS; i++)
+			fz_unlock(ctx, FZ_LOCK_FREETYPE_FACE + i);
+}
+
+void
+fz_ft_lock_face(fz_context *ctx, fz_font *font)
+{
+	fz_ft_face_lib *fl = font->ft_lib;
+
+	if (!fl)
+	{
+		fz_ft_lock(ctx);
+		return;
+	}
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE_FACE + fl->lock);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	assert(ctx->font->face_lock_owner[fl->lock] == NULL);
+	ctx->font->face_lock_owner[fl->lock] = ctx;
+	fl->owner = ctx;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_ft_unlock_face(fz_context *ctx, fz_font *font)
+{
+	fz_ft_face_lib *fl = font->ft_lib;
+
+	if (!fl)
+	{
+		fz_ft_unlock(ctx);
+		return;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	fl->owner = NULL;
+	ctx->font->face_lock_owner[fl->lock] = NULL;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_unlock(ctx, FZ_LOCK_FREETYPE_FACE + fl->lock);
 }
 
 int
 fz_ft_lock_held(fz_context *ctx)
 {
+	int i;
+
 	/* If this thread has locked the freetype lock already, then
 	 * the stored context will be this one. */
-	return (ctx->font->ftmemory.user == ctx);
+	if (ctx->font->ftmemory.user == ctx)
+		return 1;
+	for (i = 0; i < FZ_FREETYPE_FACE_LOCKS; i++)
+		if (ctx->font->face_lock_owner[i] == ctx)
+			return 1;
+	return 0;
+}
+
+void
+fz_set_font_face_locking(fz_context *ctx, int enable)
+{
+	ctx->font->face_locking = !!enable;
+	if (enable)
+		ctx->font->face_locks_used = 1;
+}
+
+int
+fz_font_face_locking(fz_context *ctx)
+{
+	return ctx->font->face_locking;
+}
+
+static fz_ft_face_lib *
+new_ft_face_lib(fz_context *ctx)
+{
+	fz_font_context *fct = ctx->font;
+	fz_ft_face_lib *fl;
+	int fterr;
+
+	fl = fz_malloc_struct(ctx, fz_ft_face_lib);
+	fl->fct = fct;
+	fl->memory.user = fl;
+	fl->memory.alloc = ft_face_alloc;
+	fl->memory.free = ft_face_free;
+	fl->memory.realloc = ft_face_realloc;
+
+	/* Nobody else can see this library yet, so no lock is needed. */
+	fl->owner = ctx;
+	fterr = FT_New_Library(&fl->memory, &fl->library);
+	if (fterr)
+	{
+		fz_free(ctx, fl);
+		fz_throw(ctx, FZ_ERROR_LIBRARY, "cannot init freetype: %s", ft_error_string(fterr));
+	}
+	FT_Add_Default_Modules(fl->library);
+	fl->owner = NULL;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	fl->lock = fct->next_face_lock++ % FZ_FREETYPE_FACE_LOCKS;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return fl;
+}
+
+/* Only called once nobody else can reach the face or library. */
+static void
+drop_ft_face_lib(fz_context *ctx, fz_ft_face_lib *fl, FT_Face face, const char *name)
+{
+	int fterr;
+
+	fl->owner = ctx;
+	if (face)
+	{
+		fterr = FT_Done_Face(face);
+		if (fterr)
+			fz_warn(ctx, "FT_Done_Face(%s): %s", name, ft_error_string(fterr));
+	}
+	fterr = FT_Done_Library(fl->library);
+	if (fterr)
+		fz_warn(ctx, "FT_Done_Library(): %s", ft_error_string(fterr));
+	fz_free(ctx, fl);
+}
+
+static FT_Library
+font_ft_library(fz_context *ctx, fz_font *font)
+{
+	fz_ft_face_lib *fl = font->ft_lib;
+	return fl ? fl->library : ctx->font->ftlib;
 }
 
 void fz_new_font_context(fz_context *ctx)
@@ -489,8 +678,42 @@ fz_font *fz_load_system_fallback_font(fz_context *ctx, int script, int language,
 	return font;
 }
 
+/*
+	The builtin and fallback font caches in the font context are shared
+	by every context cloned from the same one, so several threads may
+	look for the same font at once. Fonts are loaded without any lock
+	held, since loading takes the FreeType locks, and are then published
+	under FZ_LOCK_ALLOC. A thread that loses the race drops its own copy
+	and uses the one that got there first.
+*/
+static fz_font *get_cached_font(fz_context *ctx, fz_font **slot)
+{
+	fz_font *font;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	font = *slot;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return font;
+}
+
+static fz_font *set_cached_font(fz_context *ctx, fz_font **slot, fz_font *font)
+{
+	fz_font *old;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	old = *slot;
+	if (!old)
+		*slot = font;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (old)
+	{
+		fz_drop_font(ctx, font);
+		return old;
+	}
+	return font;
+}
+
 fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int serif, int bold, int italic)
 {
+	fz_font *font;
 	fz_font **fontp;
 	const unsigned char *data;
 	int ordering = FZ_ADOBE_JAPAN;
@@ -525,20 +748,23 @@ fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int se
 	else
 		fontp = &ctx->font->fallback[index].sans;
 
-	if (!*fontp)
+	font = get_cached_font(ctx, fontp);
+	if (font)
+		return font;
+
+	font = fz_load_system_fallback_font(ctx, script, language, serif, bold, italic);
+	if (!font)
 	{
-		*fontp = fz_load_system_fallback_font(ctx, script, language, serif, bold, italic);
-		if (!*fontp)
+		data = fz_lookup_noto_font(ctx, script, language, &size, &subfont);
+		if (data)
 		{
-			data = fz_lookup_noto_font(ctx, script, language, &size, &subfont);
-			if (data)
-			{
-				*fontp = fz_new_font_from_memory(ctx, NULL, data, size, subfont, 0);
-				/* Noto fonts can be embedded. */
-				fz_set_font_embedding(ctx, *fontp, 1);
-			}
+			font = fz_new_font_from_memory(ctx, NULL, data, size, subfont, 0);
+			/* Noto fonts can be embedded. */
+			fz_set_font_embedding(ctx, font, 1);
 		}
 	}
+	if (!font)
+		return NULL;
 
 	switch (script)
 	{
@@ -547,91 +773,97 @@ fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int se
 	case UCDN_SCRIPT_KATAKANA: script = UCDN_SCRIPT_HAN; ordering = FZ_ADOBE_JAPAN; break;
 	case UCDN_SCRIPT_BOPOMOFO: script = UCDN_SCRIPT_HAN; ordering = FZ_ADOBE_CNS; break;
 	}
-	if (*fontp && (script == UCDN_SCRIPT_HAN))
+	if (script == UCDN_SCRIPT_HAN)
 	{
-		(*fontp)->flags.cjk = 1;
-		(*fontp)->flags.cjk_lang = ordering;
+		font->flags.cjk = 1;
+		font->flags.cjk_lang = ordering;
 	}
 
-	return *fontp;
+	return set_cached_font(ctx, fontp, font);
 }
 
 static fz_font *fz_load_fallback_math_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->math)
+	fz_font *font = get_cached_font(ctx, &ctx->font->math);
+	if (!font)
 	{
 		data = fz_lookup_noto_math_font(ctx, &size);
 		if (data)
-			ctx->font->math = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->math, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->math;
+	return font;
 }
 
 static fz_font *fz_load_fallback_music_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->music)
+	fz_font *font = get_cached_font(ctx, &ctx->font->music);
+	if (!font)
 	{
 		data = fz_lookup_noto_music_font(ctx, &size);
 		if (data)
-			ctx->font->music = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->music, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->music;
+	return font;
 }
 
 static fz_font *fz_load_fallback_symbol1_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->symbol1)
+	fz_font *font = get_cached_font(ctx, &ctx->font->symbol1);
+	if (!font)
 	{
 		data = fz_lookup_noto_symbol1_font(ctx, &size);
 		if (data)
-			ctx->font->symbol1 = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->symbol1, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->symbol1;
+	return font;
 }
 
 static fz_font *fz_load_fallback_symbol2_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->symbol2)
+	fz_font *font = get_cached_font(ctx, &ctx->font->symbol2);
+	if (!font)
 	{
 		data = fz_lookup_noto_symbol2_font(ctx, &size);
 		if (data)
-			ctx->font->symbol2 = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->symbol2, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->symbol2;
+	return font;
 }
 
 static fz_font *fz_load_fallback_emoji_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->emoji)
+	fz_font *font = get_cached_font(ctx, &ctx->font->emoji);
+	if (!font)
 	{
 		data = fz_lookup_noto_emoji_font(ctx, &size);
 		if (data)
-			ctx->font->emoji = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->emoji, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->emoji;
+	return font;
 }
 
 static fz_font *fz_load_fallback_boxes_font(fz_context *ctx)
 {
 	const unsigned char *data;
 	int size;
-	if (!ctx->font->boxes)
+	fz_font *font = get_cached_font(ctx, &ctx->font->boxes);
+	if (!font)
 	{
 		data = fz_lookup_noto_boxes_font(ctx, &size);
 		if (data)
-			ctx->font->boxes = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			font = set_cached_font(ctx, &ctx->font->boxes, fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
-	return ctx->font->boxes;
+	return font;
 }
 
 static const struct ft_error ft_errors[] =
@@ -716,16 +948,40 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 	FT_ULong tag, size, i, n;
 	FT_UShort flags;
 	char namebuf[sizeof(font->name)];
+	fz_ft_face_lib *fl = NULL;
 
 	fz_keep_freetype(ctx);
 
-	fz_ft_lock(ctx);
-	fterr = FT_New_Memory_Face(ctx->font->ftlib, buffer->data, (FT_Long)buffer->len, index, &face);
-	fz_ft_unlock(ctx);
-	if (fterr)
+	if (ctx->font->face_locking)
 	{
-		fz_drop_freetype(ctx);
-		fz_throw(ctx, FZ_ERROR_LIBRARY, "FT_New_Memory_Face(%s): %s", name, ft_error_string(fterr));
+		fz_try(ctx)
+			fl = new_ft_face_lib(ctx);
+		fz_catch(ctx)
+		{
+			fz_drop_freetype(ctx);
+			fz_rethrow(ctx);
+		}
+
+		fl->owner = ctx;
+		fterr = FT_New_Memory_Face(fl->library, buffer->data, (FT_Long)buffer->len, index, &face);
+		fl->owner = NULL;
+		if (fterr)
+		{
+			drop_ft_face_lib(ctx, fl, NULL, name);
+			fz_drop_freetype(ctx);
+			fz_throw(ctx, FZ_ERROR_LIBRARY, "FT_New_Memory_Face(%s): %s", name, ft_error_string(fterr));
+		}
+	}
+	else
+	{
+		fz_ft_lock(ctx);
+		fterr = FT_New_Memory_Face(ctx->font->ftlib, buffer->data, (FT_Long)buffer->len, index, &face);
+		fz_ft_unlock(ctx);
+		if (fterr)
+		{
+			fz_drop_freetype(ctx);
+			fz_throw(ctx, FZ_ERROR_LIBRARY, "FT_New_Memory_Face(%s): %s", name, ft_error_string(fterr));
+		}
 	}
 
 	if (!name)
@@ -755,16 +1011,22 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 		font = fz_new_font(ctx, name, use_glyph_bbox, face->num_glyphs);
 	fz_catch(ctx)
 	{
-		fz_ft_lock(ctx);
-		fterr = FT_Done_Face(face);
-		fz_ft_unlock(ctx);
-		if (fterr)
-			fz_warn(ctx, "FT_Done_Face(%s): %s", name, ft_error_string(fterr));
+		if (fl)
+			drop_ft_face_lib(ctx, fl, face, name);
+		else
+		{
+			fz_ft_lock(ctx);
+			fterr = FT_Done_Face(face);
+			fz_ft_unlock(ctx);
+			if (fterr)
+				fz_warn(ctx, "FT_Done_Face(%s): %s", name, ft_error_string(fterr));
+		}
 		fz_drop_freetype(ctx);
 		fz_rethrow(ctx);
 	}
 
 	font->ft_face = face;
+	font->ft_lib = fl;
 	fz_set_font_bbox(ctx, font,
 		(float) face->bbox.xMin / face->units_per_EM,
 		(float) face->bbox.yMin / face->units_per_EM,
@@ -792,7 +1054,7 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 
 	if (FT_IS_SFNT(face))
 	{
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 		os2 = FT_Get_Sfnt_Table(face, FT_SFNT_OS2);
 		if (os2)
 			font->flags.is_serif = !(os2->sFamilyClass & 2048); /* Class 8 is sans-serif */
@@ -812,7 +1074,7 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 			if (tag == TTAG_GDEF || tag == TTAG_GPOS || tag == TTAG_GSUB)
 				font->flags.has_opentype = 1;
 		}
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 
 	if (name)
@@ -904,21 +1166,24 @@ fz_new_base14_font(fz_context *ctx, const char *name)
 {
 	const unsigned char *data;
 	int size;
+	fz_font *font;
 	int x = find_base14_index(name);
 	if (x >= 0)
 	{
-		if (ctx->font->base14[x])
-			return fz_keep_font(ctx, ctx->font->base14[x]);
+		font = get_cached_font(ctx, &ctx->font->base14[x]);
+		if (font)
+			return fz_keep_font(ctx, font);
 		data = fz_lookup_base14_font(ctx, name, &size);
 		if (data)
 		{
-			ctx->font->base14[x] = fz_new_font_from_memory(ctx, name, data, size, 0, 1);
-			ctx->font->base14[x]->flags.is_serif = (name[0] == 'T'); /* Times-Roman */
+			font = fz_new_font_from_memory(ctx, name, data, size, 0, 1);
+			font->flags.is_serif = (name[0] == 'T'); /* Times-Roman */
 			/* Ideally we should not embed base14 fonts by default, but we have to
 			 * allow it for now until we have written code in pdf-device to output
 			 * base14s in a 'special' manner. */
-			fz_set_font_embedding(ctx, ctx->font->base14[x], 1);
-			return fz_keep_font(ctx, ctx->font->base14[x]);
+			fz_set_font_embedding(ctx, font, 1);
+			font = set_cached_font(ctx, &ctx->font->base14[x], font);
+			return fz_keep_font(ctx, font);
 		}
 	}
 	fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot find builtin font with name '%s'", name);
@@ -932,8 +1197,9 @@ fz_new_cjk_font(fz_context *ctx, int ordering)
 	fz_font *font;
 	if (ordering >= 0 && ordering < (int)nelem(ctx->font->cjk))
 	{
-		if (ctx->font->cjk[ordering])
-			return fz_keep_font(ctx, ctx->font->cjk[ordering]);
+		font = get_cached_font(ctx, &ctx->font->cjk[ordering]);
+		if (font)
+			return fz_keep_font(ctx, font);
 		data = fz_lookup_cjk_font(ctx, ordering, &size, &index);
 		if (data)
 			font = fz_new_font_from_memory(ctx, NULL, data, size, index, 0);
@@ -944,8 +1210,8 @@ fz_new_cjk_font(fz_context *ctx, int ordering)
 		{
 			font->flags.cjk = 1;
 			font->flags.cjk_lang = ordering;
-			ctx->font->cjk[ordering] = font;
-			return fz_keep_font(ctx, ctx->font->cjk[ordering]);
+			font = set_cached_font(ctx, &ctx->font->cjk[ordering], font);
+			return fz_keep_font(ctx, font);
 		}
 	}
 	fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot find builtin CJK font");
@@ -979,9 +1245,9 @@ fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm
 		float subw;
 		float realw;
 
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 		fterr = FT_Get_Advance(font->ft_face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		if (fterr && fterr != FT_Err_Invalid_Argument)
 			fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
 
@@ -1019,7 +1285,7 @@ pixmap_from_ft_bitmap(fz_context *ctx, int left, int top, FT_Bitmap *bitmap)
 		return fz_new_pixmap_from_8bpp_data(ctx, left, top - bitmap->rows, bitmap->width, bitmap->rows, bitmap->buffer + (bitmap->rows-1)*bitmap->pitch, -bitmap->pitch);
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Takes the font's face lock, and returns with it held */
 static FT_GlyphSlot
 do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa)
 {
@@ -1035,7 +1301,7 @@ do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 
 	if (aa == 0)
 	{
@@ -1120,7 +1386,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 
 	if (slot == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		return NULL;
 	}
 
@@ -1130,7 +1396,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 	fz_catch(ctx)
 	{
@@ -1149,7 +1415,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 
 	if (slot == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		return NULL;
 	}
 
@@ -1159,7 +1425,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 	fz_catch(ctx)
 	{
@@ -1169,7 +1435,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	return glyph;
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Takes the font's face lock, and returns with it held */
 static FT_Glyph
 do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, fz_matrix ctm, const fz_stroke_state *state, int aa)
 {
@@ -1196,7 +1462,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	v.x = trm.e * 64;
 	v.y = trm.f * 64;
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 	{
@@ -1213,7 +1479,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 		return NULL;
 	}
 
-	fterr = FT_Stroker_New(ctx->font->ftlib, &stroker);
+	fterr = FT_Stroker_New(font_ft_library(ctx, font), &stroker);
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Stroker_New(): %s", ft_error_string(fterr));
@@ -1272,7 +1538,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 
 	if (bitmap == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		return NULL;
 	}
 
@@ -1283,7 +1549,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	fz_always(ctx)
 	{
 		FT_Done_Glyph(glyph);
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 	fz_catch(ctx)
 	{
@@ -1347,7 +1613,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	v.x = trm.e * 65536;
 	v.y = trm.f * 65536;
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	/* Set the char size to scale=face->units_per_EM to effectively give
 	 * us unscaled results. This avoids quantisation. We then apply the
 	 * scale ourselves below. */
@@ -1360,7 +1626,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_NO_HINTING): %s", font->name, gid, ft_error_string(fterr));
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		bounds->x0 = bounds->x1 = trm.e;
 		bounds->y0 = bounds->y1 = trm.f;
 		return bounds;
@@ -1373,7 +1639,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	}
 
 	FT_Outline_Get_CBox(&face->glyph->outline, &cbox);
-	fz_ft_unlock(ctx);
+	fz_ft_unlock_face(ctx, font);
 	bounds->x0 = cbox.xMin * recip;
 	bounds->y0 = cbox.yMin * recip;
 	bounds->x1 = cbox.xMax * recip;
@@ -1469,7 +1735,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 
 	fterr = FT_Set_Char_Size(face, scale, scale, 72, 72);
 	if (fterr)
@@ -1484,7 +1750,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_IGNORE_TRANSFORM | FT_LOAD_NO_HINTING): %s", font->name, gid, ft_error_string(fterr));
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		return NULL;
 	}
 
@@ -1506,7 +1772,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 	fz_catch(ctx)
 	{
@@ -1845,10 +2111,10 @@ fz_advance_ft_glyph_aux(fz_context *ctx, fz_font *font, int gid, int wmode, int
 	if (wmode)
 		mask |= FT_LOAD_VERTICAL_LAYOUT;
 	if (!locked)
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 	fterr = FT_Get_Advance(font->ft_face, gid, mask, &adv);
 	if (!locked)
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	if (fterr && fterr != FT_Err_Invalid_Argument)
 	{
 		fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
@@ -1885,9 +2151,9 @@ fz_get_glyph_name(fz_context *ctx, fz_font *font, int glyph, char *buf, int size
 		if (FT_HAS_GLYPH_NAMES(face))
 		{
 			int fterr;
-			fz_ft_lock(ctx);
+			fz_ft_lock_face(ctx, font);
 			fterr = FT_Get_Glyph_Name(face, glyph, buf, size);
-			fz_ft_unlock(ctx);
+			fz_ft_unlock_face(ctx, font);
 			if (fterr)
 				fz_warn(ctx, "FT_Get_Glyph_Name(%s,%d): %s", font->name, glyph, ft_error_string(fterr));
 		}
@@ -1911,7 +2177,7 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 		{
 			float f;
 			int block = gid>>8;
-			fz_ft_lock(ctx);
+			fz_ft_lock_face(ctx, font);
 			if (!font->advance_cache)
 			{
 				int n = (font->glyph_count+255)/256;
@@ -1919,7 +2185,7 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 					font->advance_cache = Memento_label(fz_malloc_array(ctx, n, float *), "font_advance_cache");
 				fz_catch(ctx)
 				{
-					fz_ft_unlock(ctx);
+					fz_ft_unlock_face(ctx, font);
 					fz_rethrow(ctx);
 				}
 				memset(font->advance_cache, 0, n * sizeof(float *));
@@ -1931,7 +2197,7 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 					font->advance_cache[block] = Memento_label(fz_malloc_array(ctx, 256, float), "font_advance_cache");
 				fz_catch(ctx)
 				{
-					fz_ft_unlock(ctx);
+					fz_ft_unlock_face(ctx, font);
 					fz_rethrow(ctx);
 				}
 				n = (block<<8)+256;
@@ -1942,7 +2208,7 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 					font->advance_cache[block][i] = fz_advance_ft_glyph_aux(ctx, font, (block<<8)+i, 0, 1);
 			}
 			f = font->advance_cache[block][gid & 255];
-			fz_ft_unlock(ctx);
+			fz_ft_unlock_face(ctx, font);
 			return f;
 		}
 
@@ -1963,20 +2229,32 @@ fz_encode_character(fz_context *ctx, fz_font *font, int ucs)
 		{
 			int pg = ucs >> 8;
 			int ix = ucs & 0xFF;
-			if (!font->encoding_cache[pg])
+			uint16_t *cache = font->encoding_cache[pg];
+			if (!cache)
 			{
+				/* Fonts may be shared between threads, so fill in
+				 * the page before anyone else can see it, and only
+				 * publish it (under the face lock) if nobody else
+				 * has done so in the meantime. */
+				uint16_t *page = fz_malloc_array(ctx, 256, uint16_t);
 				int i;
-				font->encoding_cache[pg] = fz_malloc_array(ctx, 256, uint16_t);
-				fz_ft_lock(ctx);
-				for (i = 0; i < 256; ++i)
-					font->encoding_cache[pg][i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
-				fz_ft_unlock(ctx);
+				fz_ft_lock_face(ctx, font);
+				cache = font->encoding_cache[pg];
+				if (!cache)
+				{
+					for (i = 0; i < 256; ++i)
+						page[i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+					cache = font->encoding_cache[pg] = page;
+					page = NULL;
+				}
+				fz_ft_unlock_face(ctx, font);
+				fz_free(ctx, page);
 			}
-			return font->encoding_cache[pg][ix];
+			return cache[ix];
 		}
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 		idx = FT_Get_Char_Index(font->ft_face, ucs);
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		return idx;
 	}
 	return ucs;
@@ -1997,17 +2275,17 @@ fz_encode_character_sc(fz_context *ctx, fz_font *font, int unicode)
 			name = fz_glyph_name_from_unicode_sc(unicode);
 			if (name)
 			{
-				fz_ft_lock(ctx);
+				fz_ft_lock_face(ctx, font);
 				glyph = FT_Get_Name_Index(font->ft_face, (char*)name);
-				fz_ft_unlock(ctx);
+				fz_ft_unlock_face(ctx, font);
 				if (glyph > 0)
 					return glyph;
 			}
 
 			sprintf(buf, "uni%04X.sc", unicode);
-			fz_ft_lock(ctx);
+			fz_ft_lock_face(ctx, font);
 			glyph = FT_Get_Name_Index(font->ft_face, buf);
-			fz_ft_unlock(ctx);
+			fz_ft_unlock_face(ctx, font);
 			if (glyph > 0)
 				return glyph;
 		}
@@ -2021,11 +2299,11 @@ fz_encode_character_by_glyph_name(fz_context *ctx, fz_font *font, const char *gl
 	int glyph = 0;
 	if (font->ft_face)
 	{
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 		glyph = ft_name_index(font->ft_face, glyphname);
 		if (glyph == 0)
 			glyph = ft_char_index(font->ft_face, fz_unicode_from_glyph_name(glyphname));
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 	}
 	// TODO: type3 fonts (not needed for now)
 	return glyph;
@@ -2364,6 +2642,367 @@ fz_extract_ttf_from_ttc(fz_context *ctx, fz_font *font)
 	return buf;
 }
 
+static uint32_t get32_be(const unsigned char *p)
+{
+	return ((uint32_t)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static int get16_be(const unsigned char *p)
+{
+	return (p[0]<<8) | p[1];
+}
+
+static int get16s_be(const unsigned char *p)
+{
+	return (int16_t)((p[0]<<8) | p[1]);
+}
+
+/* Find a table in the sfnt (or ttc subfont) held in the font buffer. */
+static const unsigned char *
+find_sfnt_table(fz_font *font, uint32_t tag, uint32_t *lenp)
+{
+	const unsigned char *data;
+	size_t len;
+	uint32_t dir = 0;
+	uint32_t version, ofs, size;
+	int i, n;
+
+	if (!font->buffer)
+		return NULL;
+	data = font->buffer->data;
+	len = font->buffer->len;
+	if (len < 12)
+		return NULL;
+
+	if (get32_be(data) == CHR('t','t','c','f'))
+	{
+		if (font->subfont < 0 || (uint32_t)font->subfont >= get32_be(data + 8))
+			return NULL;
+		if (12 + 4 * (size_t)font->subfont + 4 > len)
+			return NULL;
+		dir = get32_be(data + 12 + 4 * font->subfont);
+		if (dir > len - 12)
+			return NULL;
+	}
+
+	version = get32_be(data + dir);
+	if (version != 0x10000 && version != CHR('t','r','u','e') && version != CHR('O','T','T','O'))
+		return NULL;
+
+	n = get16_be(data + dir + 4);
+	if (dir + 12 + (size_t)n * 16 > len)
+		return NULL;
+	for (i = 0; i < n; i++)
+	{
+		const unsigned char *rec = data + dir + 12 + i * 16;
+		if (get32_be(rec) == tag)
+		{
+			ofs = get32_be(rec + 8);
+			size = get32_be(rec + 12);
+			if (ofs > len || size > len - ofs)
+				return NULL;
+			*lenp = size;
+			return data + ofs;
+		}
+	}
+	return NULL;
+}
+
+/* Called with the face lock held. */
+static void
+preload_advances(fz_context *ctx, fz_font *font)
+{
+	FT_Face face = font->ft_face;
+	const unsigned char *hhea = NULL, *hmtx = NULL;
+	uint32_t hhea_len, hmtx_len;
+	int stretch = font->flags.ft_stretch && font->width_table;
+	int nhm = 0;
+	int b, i, n, gid;
+	float *block;
+
+	/* Substitute fonts take their widths from the PDF, as in
+	 * fz_advance_ft_glyph_aux. Everything else uses hmtx, which is
+	 * what FreeType reads for unscaled advances. */
+	if (!stretch)
+	{
+		hhea = find_sfnt_table(font, CHR('h','h','e','a'), &hhea_len);
+		hmtx = find_sfnt_table(font, CHR('h','m','t','x'), &hmtx_len);
+		if (!hhea || !hmtx || hhea_len < 36 || face->units_per_EM == 0)
+			return;
+		nhm = get16_be(hhea + 34);
+		if (nhm == 0 || (uint32_t)nhm * 4 > hmtx_len)
+			return;
+	}
+
+	n = (font->glyph_count + 255) / 256;
+	if (!font->advance_cache)
+	{
+		font->advance_cache = Memento_label(fz_malloc_array(ctx, n, float *), "font_advance_cache");
+		memset(font->advance_cache, 0, n * sizeof(float *));
+	}
+
+	for (b = 0; b < n; b++)
+	{
+		if (font->advance_cache[b])
+			continue;
+		block = Memento_label(fz_malloc_array(ctx, 256, float), "font_advance_cache");
+		for (i = 0; i < 256; i++)
+		{
+			gid = (b<<8) + i;
+			if (gid >= font->glyph_count)
+				break;
+			if (stretch)
+			{
+				if (gid < font->width_count)
+					block[i] = font->width_table[gid] / 1000.0f;
+				else
+					block[i] = font->width_default / 1000.0f;
+			}
+			else
+			{
+				/* Glyphs past numberOfHMetrics share the last advance. */
+				block[i] = (float) get16_be(hmtx + 4 * fz_mini(gid, nhm - 1)) / face->units_per_EM;
+			}
+		}
+		font->advance_cache[b] = block;
+	}
+}
+
+/*
+	Bound the points of a simple glyf outline, which is what
+	FreeType's control box is when the glyph is loaded unscaled
+	(apart from the left side bearing shift, done by the caller).
+	Returns 0 for composite or damaged glyphs, or 1 with the
+	(possibly empty) bounds.
+*/
+static int
+bound_glyf_points(const unsigned char *p, uint32_t len, int *x0, int *y0, int *x1, int *y1)
+{
+	const unsigned char *end = p + len;
+	const unsigned char *flags, *xs, *ys;
+	int contours, points, i, k, f, rep;
+	int x, y;
+
+	contours = get16s_be(p);
+	if (contours < 0)
+		return 0;
+	if (contours == 0)
+	{
+		*x0 = *y0 = *x1 = *y1 = 0;
+		return 1;
+	}
+	if ((size_t)(end - p) < 10 + (size_t)contours * 2 + 2)
+		return 0;
+	points = get16_be(p + 10 + (contours - 1) * 2) + 1;
+	p += 10 + contours * 2;
+	p += 2 + get16_be(p);
+	if (p > end)
+		return 0;
+
+	/* Find the extent of the flags to locate the coordinate arrays. */
+	flags = p;
+	k = 0;
+	xs = NULL;
+	i = 0;
+	while (i < points)
+	{
+		if (p >= end)
+			return 0;
+		f = *p++;
+		rep = 1;
+		if (f & 8)
+		{
+			if (p >= end)
+				return 0;
+			rep += *p++;
+		}
+		if (f & 2)
+			k += rep;
+		else if (!(f & 16))
+			k += 2 * rep;
+		i += rep;
+	}
+	xs = p;
+	ys = xs + k;
+	if (ys > end)
+		return 0;
+
+	x = y = 0;
+	*x0 = *y0 = INT_MAX;
+	*x1 = *y1 = INT_MIN;
+	p = flags;
+	i = 0;
+	while (i < points)
+	{
+		f = *p++;
+		rep = 1;
+		if (f & 8)
+			rep += *p++;
+		while (rep-- > 0 && i < points)
+		{
+			if (f & 2)
+			{
+				if (xs >= end)
+					return 0;
+				x += (f & 16) ? *xs : -*xs;
+				xs++;
+			}
+			else if (!(f & 16))
+			{
+				if (xs + 2 > end)
+					return 0;
+				x += get16s_be(xs);
+				xs += 2;
+			}
+			if (f & 4)
+			{
+				if (ys >= end)
+					return 0;
+				y += (f & 32) ? *ys : -*ys;
+				ys++;
+			}
+			else if (!(f & 32))
+			{
+				if (ys + 2 > end)
+					return 0;
+				y += get16s_be(ys);
+				ys += 2;
+			}
+			if (x < *x0) *x0 = x;
+			if (y < *y0) *y0 = y;
+			if (x > *x1) *x1 = x;
+			if (y > *y1) *y1 = y;
+			i++;
+		}
+	}
+	return 1;
+}
+
+/* Called with the face lock held. */
+static void
+preload_bboxes(fz_context *ctx, fz_font *font)
+{
+	FT_Face face = font->ft_face;
+	const unsigned char *head, *loca, *glyf, *hhea, *hmtx;
+	uint32_t head_len, loca_len, glyf_len, hhea_len, hmtx_len;
+	uint32_t start, end;
+	int long_loca, gid, nhm, lsb;
+	int x0, y0, x1, y1;
+	float recip;
+	fz_rect *r;
+
+	/* fz_bound_ft_glyph distorts the outline for these, so leave
+	 * them to it. */
+	if (!font->use_glyph_bbox || font->flags.fake_bold || font->flags.fake_italic)
+		return;
+	if (font->flags.ft_stretch && font->width_table)
+		return;
+
+	head = find_sfnt_table(font, CHR('h','e','a','d'), &head_len);
+	loca = find_sfnt_table(font, CHR('l','o','c','a'), &loca_len);
+	glyf = find_sfnt_table(font, CHR('g','l','y','f'), &glyf_len);
+	hhea = find_sfnt_table(font, CHR('h','h','e','a'), &hhea_len);
+	hmtx = find_sfnt_table(font, CHR('h','m','t','x'), &hmtx_len);
+	if (!head || !loca || !glyf || head_len < 54 || face->units_per_EM == 0)
+		return;
+	if (!hhea || !hmtx || hhea_len < 36)
+		return;
+	nhm = get16_be(hhea + 34);
+	if (nhm == 0 || (size_t)nhm * 4 + (size_t)fz_maxi(font->glyph_count - nhm, 0) * 2 > hmtx_len)
+		return;
+
+	long_loca = get16s_be(head + 50) != 0;
+	if ((size_t)(font->glyph_count + 1) * (long_loca ? 4 : 2) > loca_len)
+		return;
+
+	recip = 1.0f / face->units_per_EM;
+	for (gid = 0; gid < font->glyph_count; gid++)
+	{
+		r = get_gid_bbox(ctx, font, gid);
+		if (!fz_is_empty_rect(*r) && !fz_is_infinite_rect(*r))
+			continue;
+
+		if (long_loca)
+		{
+			start = get32_be(loca + 4 * gid);
+			end = get32_be(loca + 4 * gid + 4);
+		}
+		else
+		{
+			start = get16_be(loca + 2 * gid) * 2;
+			end = get16_be(loca + 2 * gid + 2) * 2;
+		}
+
+		if (start == end)
+		{
+			/* No outline. Store the same tiny rectangle that
+			 * fz_bound_glyph would. */
+			r->x0 = 0;
+			r->y0 = 0;
+			r->x1 = 0.0000001f;
+			r->y1 = 0.0000001f;
+			continue;
+		}
+
+		/* Leave composites and anything odd to be loaded
+		 * properly later. The bbox in the glyph header is not
+		 * trustworthy enough to use instead. */
+		if (end < start || end > glyf_len || end - start < 10)
+			continue;
+		if (!bound_glyf_points(glyf + start, end - start, &x0, &y0, &x1, &y1))
+			continue;
+
+		/* FreeType moves the outline so that its header xMin sits
+		 * at the left side bearing from hmtx. */
+		if (gid < nhm)
+			lsb = get16s_be(hmtx + 4 * gid + 2);
+		else
+			lsb = get16s_be(hmtx + 4 * nhm + 2 * (gid - nhm));
+		lsb -= get16s_be(glyf + start + 2);
+		x0 += lsb;
+		x1 += lsb;
+
+		r->x0 = x0 * recip;
+		r->y0 = y0 * recip;
+		r->x1 = x1 * recip;
+		r->y1 = y1 * recip;
+		if (fz_is_empty_rect(*r))
+		{
+			r->x0 = 0;
+			r->y0 = 0;
+			r->x1 = 0.0000001f;
+			r->y1 = 0.0000001f;
+		}
+	}
+}
+
+void
+fz_preload_font_metrics(fz_context *ctx, fz_font *font)
+{
+	FT_Face face;
+
+	if (!font || !font->ft_face || font->metrics_preloaded)
+		return;
+
+	face = font->ft_face;
+	fz_ft_lock_face(ctx, font);
+	fz_try(ctx)
+	{
+		if (!font->metrics_preloaded)
+		{
+			font->metrics_preloaded = 1;
+			if (FT_IS_SFNT(face) || font->flags.ft_stretch)
+				preload_advances(ctx, font);
+			if (FT_IS_SFNT(face))
+				preload_bboxes(ctx, font);
+		}
+	}
+	fz_always(ctx)
+		fz_ft_unlock_face(ctx, font);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 void fz_enumerate_font_cmap(fz_context *ctx, fz_font *font, fz_cmap_callback *cb, void *opaque)
 {
 	unsigned long ucs;
@@ -2372,12 +3011,12 @@ void fz_enumerate_font_cmap(fz_context *ctx, fz_font *font, fz_cmap_callback *cb
 	if (font == NULL || font->ft_face == NULL)
 		return;
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	for (ucs = FT_Get_First_Char(font->ft_face, &gid); gid > 0; ucs = FT_Get_Next_Char(font->ft_face, ucs, &gid))
 	{
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, font);
 		cb(ctx, opaque, ucs, gid);
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, font);
 	}
-	fz_ft_unlock(ctx);
+	fz_ft_unlock_face(ctx, font);
 }
@@ -373,32 +373,14 @@ static void fz_adjust_image_subarea(fz_context *ctx, fz_image *image, fz_irect *
 		subarea->y1 = image->h;
 }
 
-static void fz_compute_image_key(fz_context *ctx, fz_image *image, fz_matrix *ctm,
-	fz_image_key *key, const fz_irect *subarea, int l2factor, int *w, int *h, int *dw, int *dh)
+static void fz_compute_image_extent(fz_image *image, const fz_matrix *ctm, const fz_irect *rect,
+	int *w, int *h, int *dw, int *dh)
 {
-	key->refs = 1;
-	key->image = image;
-	key->l2factor = l2factor;
-
-	if (subarea == NULL)
-	{
-		key->rect.x0 = 0;
-		key->rect.y0 = 0;
-		key->rect.x1 = image->w;
-		key->rect.y1 = image->h;
-	}
-	else
-	{
-		key->rect = *subarea;
-		ctx->tuning->image_decode(ctx->tuning->image_decode_arg, image->w, image->h, key->l2factor, &key->rect);
-		fz_adjust_image_subarea(ctx, image, &key->rect, key->l2factor);
-	}
-
-	/* Based on that subarea, recalculate the extents */
+	/* Based on the subarea, recalculate the extents */
 	if (ctm)
 	{
-		float frac_w = (float) (key->rect.x1 - key->rect.x0) / image->w;
-		float frac_h = (float) (key->rect.y1 - key->rect.y0) / image->h;
+		float frac_w = (float) (rect->x1 - rect->x0) / image->w;
+		float frac_h = (float) (rect->y1 - rect->y0) / image->h;
 		float a = ctm->a * frac_w;
 		float b = ctm->b * frac_w;
 		float c = ctm->c * frac_h;
@@ -421,6 +403,30 @@ static void fz_compute_image_key(fz_context *ctx, fz_image *image, fz_matrix *ct
 		*w = image->w;
 	if (*h > image->h)
 		*h = image->h;
+}
+
+static void fz_compute_image_key(fz_context *ctx, fz_image *image, fz_matrix *ctm,
+	fz_image_key *key, const fz_irect *subarea, int l2factor, int *w, int *h, int *dw, int *dh)
+{
+	key->refs = 1;
+	key->image = image;
+	key->l2factor = l2factor;
+
+	if (subarea == NULL)
+	{
+		key->rect.x0 = 0;
+		key->rect.y0 = 0;
+		key->rect.x1 = image->w;
+		key->rect.y1 = image->h;
+	}
+	else
+	{
+		key->rect = *subarea;
+		ctx->tuning->image_decode(ctx->tuning->image_decode_arg, image->w, image->h, key->l2factor, &key->rect);
+		fz_adjust_image_subarea(ctx, image, &key->rect, key->l2factor);
+	}
+
+	fz_compute_image_extent(image, ctm, &key->rect, w, h, dw, dh);
 
 	if (*w == 0 || *h == 0)
 		key->l2factor = 0;
@@ -598,9 +604,10 @@ subsample_stream(fz_context *ctx, fz_stream *src, int w, int h, int n, int l2ext
 /* l2factor is the amount of subsampling that the decoder is going to be
  * doing for us already. (So for JPEG 0,1,2,3 corresponding to 1, 2, 4,
  * 8. For other formats, probably 0.). l2extra is the additional amount
- * of subsampling we should perform here. */
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+ * of subsampling we should perform here. cropped is set if the decoder
+ * has already cropped its output to the subarea. */
+static fz_pixmap *
+decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra, int cropped)
 {
 	fz_image *image = &cimg->super;
 	fz_pixmap *tile = NULL;
@@ -652,7 +659,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 		if (image->use_colorkey)
 			alpha = 1;
 
-		if (subarea)
+		if (subarea && !cropped)
 			read_stream = sstream = subarea_stream(ctx, stm, image, subarea, l2factor);
 		if (image->bpc != 8 || image->use_colorkey)
 			read_stream = unpstream = fz_unpack_stream(ctx, read_stream, image->bpc, w, h, image->n, indexed, image->use_colorkey, 0);
@@ -728,6 +735,12 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+{
+	return decomp_image_from_stream(ctx, stm, cimg, subarea, indexed, l2factor, l2extra, 0);
+}
+
 void
 fz_drop_image_base(fz_context *ctx, fz_image *image)
 {
@@ -761,6 +774,78 @@ drop_pixmap_image(fz_context *ctx, fz_image *image_)
 	fz_drop_pixmap(ctx, image->tile);
 }
 
+/* JPEG images can decode just the blocks covering a subarea, rather
+ * than decoding whole scanlines for us to crop afterwards. The subarea
+ * is adjusted exactly as decomp_image_from_stream will adjust it, so
+ * that the decoder returns precisely the data that would have been left
+ * after cropping. */
+static fz_stream *
+open_jpeg_subarea_stream(fz_context *ctx, fz_compressed_image *image, fz_irect *subarea, int *l2factor)
+{
+	fz_compression_params *params = &image->buffer->params;
+	fz_irect region = *subarea;
+	fz_stream *tail, *head;
+	int native_l2factor = 0;
+
+	if (l2factor)
+	{
+		native_l2factor = fz_mini(*l2factor, 3);
+		*l2factor -= native_l2factor;
+	}
+
+	fz_adjust_image_subarea(ctx, &image->super, &region, native_l2factor);
+
+	tail = fz_open_buffer(ctx, image->buffer->buffer);
+	fz_try(ctx)
+		head = fz_open_dctd_region(ctx, tail, params->u.jpeg.color_transform, params->u.jpeg.invert_cmyk, 8>>native_l2factor, &region, NULL);
+	fz_always(ctx)
+		fz_drop_stream(ctx, tail);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return head;
+}
+
+/* Flate compressed images that are to be decoded in full can be inflated
+ * in a single pass from memory, rather than trickling through the
+ * streaming filter. Subareas still stream, so that we never hold more
+ * than one copy of a huge image just to crop a small part out of it. */
+static fz_stream *
+open_compressed_image_stream(fz_context *ctx, fz_compressed_image *image, fz_irect *subarea, int *l2factor, int *cropped)
+{
+	fz_compression_params *params = &image->buffer->params;
+	fz_buffer *raw = image->buffer->buffer;
+	fz_buffer *buf;
+	fz_stream *stm;
+	size_t expected;
+	int truncated;
+	int partial = subarea && (subarea->x0 != 0 || subarea->y0 != 0 || subarea->x1 != image->super.w || subarea->y1 != image->super.h);
+
+	*cropped = 0;
+
+	if (params->type == FZ_IMAGE_JPEG && partial)
+	{
+		*cropped = 1;
+		return open_jpeg_subarea_stream(ctx, image, subarea, l2factor);
+	}
+
+	if (params->type != FZ_IMAGE_FLATE || params->u.flate.predictor > 1 || partial)
+		return fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
+
+	expected = image->super.h * (((size_t)image->super.w * image->super.n * image->super.bpc + 7) / 8);
+	/* Damaged data is returned truncated (and then padded), as it would
+	 * be when read through the streaming filter. */
+	buf = fz_new_inflated_buffer(ctx, raw->data, raw->len, 15, expected, &truncated, 0);
+	fz_try(ctx)
+		stm = fz_open_buffer(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return stm;
+}
+
 static fz_pixmap *
 compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
 {
@@ -770,6 +855,7 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 	int indexed;
 	fz_pixmap *tile;
 	int can_sub = 0;
+	int cropped;
 	int local_l2factor;
 
 	/* If we are using matte, then the decode code requires both image and tile sizes
@@ -804,7 +890,8 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace);
+		tile = fz_load_jpx_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace, subarea, l2factor);
+		can_sub = 1;
 		break;
 	case FZ_IMAGE_PSD:
 		tile = fz_load_psd(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
@@ -830,14 +917,14 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 
 	default:
 		native_l2factor = l2factor ? *l2factor : 0;
-		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
+		stm = open_compressed_image_stream(ctx, image, subarea, l2factor, &cropped);
 		fz_try(ctx)
 		{
 			if (l2factor)
 				native_l2factor -= *l2factor;
 			indexed = fz_colorspace_is_indexed(ctx, image->super.colorspace);
 			can_sub = 1;
-			tile = fz_decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, l2factor);
+			tile = decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, l2factor, cropped);
 		}
 		fz_always(ctx)
 			fz_drop_stream(ctx, stm);
@@ -932,18 +1019,235 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	return NULL;
 }
 
+static fz_pixmap *
+fz_store_image_tile(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *rect, fz_pixmap *tile)
+{
+	fz_image_key *keyp = NULL;
+
+	fz_var(keyp);
+
+	fz_try(ctx)
+	{
+		fz_pixmap *existing_tile;
+
+		/* Now we try to cache the pixmap. Any failure here will just result
+		 * in us not caching. */
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image_store_key(ctx, image);
+		keyp->l2factor = l2factor;
+		keyp->rect = *rect;
+
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		if (existing_tile)
+		{
+			/* We already have a tile. This must have been produced by a
+			 * racing thread. We'll throw away ours and use that one. */
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+	}
+
+	return tile;
+}
+
+/* Can subareas of this image be decoded without decoding the whole
+ * thing? Only then is it worth caching the image as a grid of tiles. */
+static int
+fz_image_can_decode_tiles(fz_context *ctx, fz_image *image)
+{
+	fz_compressed_image *cimg = (fz_compressed_image *)image;
+	int bpp = image->n * image->bpc;
+
+	if (image->get_pixmap != compressed_image_get_pixmap || cimg->buffer == NULL)
+		return 0;
+	if (image->use_colorkey && image->mask)
+		return 0;
+	if ((bpp & 7) != 0 && bpp != 1 && bpp != 2 && bpp != 4)
+		return 0;
+
+	switch (cimg->buffer->params.type)
+	{
+	case FZ_IMAGE_RAW:
+	case FZ_IMAGE_FAX:
+	case FZ_IMAGE_FLATE:
+	case FZ_IMAGE_LZW:
+	case FZ_IMAGE_RLD:
+	case FZ_IMAGE_JPEG:
+	case FZ_IMAGE_JBIG2:
+	case FZ_IMAGE_JPX:
+		return 1;
+	default:
+		/* Everything else is decoded in its entirety. */
+		return 0;
+	}
+}
+
+static void
+copy_pixmap_rect(fz_pixmap *dst, int dx, int dy, const fz_pixmap *src, int sx, int sy, int w, int h)
+{
+	unsigned char *d = dst->samples + dy * (size_t)dst->stride + dx * (size_t)dst->n;
+	const unsigned char *s = src->samples + sy * (size_t)src->stride + sx * (size_t)src->n;
+	size_t len = w * (size_t)src->n;
+
+	while (h-- > 0)
+	{
+		memcpy(d, s, len);
+		d += dst->stride;
+		s += src->stride;
+	}
+}
+
+/* Fetch the tile-aligned area covering key->rect from the grid of tiles
+ * cached for this image at this l2factor, decoding and caching whichever
+ * tiles are missing. */
+static fz_pixmap *
+fz_get_tiled_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_image_key *key, fz_matrix *ctm, int *dw, int *dh)
+{
+	int l2factor = key->l2factor;
+	int f = 1 << l2factor;
+	int t = ctx->tuning->image_tile_size << l2factor;
+	int tx0 = key->rect.x0 / t;
+	int ty0 = key->rect.y0 / t;
+	int cols = (key->rect.x1 + t - 1) / t - tx0;
+	int rows = (key->rect.y1 + t - 1) / t - ty0;
+	fz_irect area, missing = fz_empty_irect;
+	fz_pixmap **tiles;
+	fz_pixmap *decoded = NULL;
+	fz_pixmap *pix = NULL;
+	int i, x, y, w, h;
+
+	area.x0 = tx0 * t;
+	area.y0 = ty0 * t;
+	area.x1 = fz_mini((tx0 + cols) * t, image->w);
+	area.y1 = fz_mini((ty0 + rows) * t, image->h);
+
+	tiles = fz_calloc(ctx, (size_t)cols * rows, sizeof(*tiles));
+
+	fz_var(decoded);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		fz_image_key tkey;
+
+		/* See which tiles we already have. */
+		tkey.refs = 1;
+		tkey.image = image;
+		tkey.l2factor = l2factor;
+		for (i = 0, y = 0; y < rows; y++)
+		{
+			for (x = 0; x < cols; x++, i++)
+			{
+				tkey.rect.x0 = area.x0 + x * t;
+				tkey.rect.y0 = area.y0 + y * t;
+				tkey.rect.x1 = fz_mini(tkey.rect.x0 + t, image->w);
+				tkey.rect.y1 = fz_mini(tkey.rect.y0 + t, image->h);
+				tiles[i] = fz_find_item(ctx, fz_drop_pixmap_imp, &tkey, &fz_image_store_type);
+				if (!tiles[i])
+				{
+					if (fz_is_empty_irect(missing))
+						missing = tkey.rect;
+					missing.x0 = fz_mini(missing.x0, tkey.rect.x0);
+					missing.y0 = fz_mini(missing.y0, tkey.rect.y0);
+					missing.x1 = fz_maxi(missing.x1, tkey.rect.x1);
+					missing.y1 = fz_maxi(missing.y1, tkey.rect.y1);
+				}
+			}
+		}
+
+		/* Decode the bounding box of the missing tiles in one go, and
+		 * cut it up into tiles. */
+		if (!fz_is_empty_irect(missing))
+		{
+			fz_irect r = missing;
+			int l2factor_remaining = l2factor;
+
+			decoded = image->get_pixmap(ctx, image, &r, (r.x1 - r.x0) >> l2factor, (r.y1 - r.y0) >> l2factor, &l2factor_remaining);
+			if (l2factor_remaining)
+				fz_subsample_pixmap(ctx, decoded, l2factor_remaining);
+
+			/* The decoder may have given us more than we asked for, but
+			 * it must at least cover what we asked for. */
+			if (r.x0 > missing.x0 || r.y0 > missing.y0 || r.x1 < missing.x1 || r.y1 < missing.y1 || (r.x0 | r.y0) & (f - 1))
+				fz_throw(ctx, FZ_ERROR_ARGUMENT, "unexpected image subarea decoded");
+
+			for (i = 0, y = 0; y < rows; y++)
+			{
+				for (x = 0; x < cols; x++, i++)
+				{
+					fz_irect tr;
+					fz_pixmap *tile;
+
+					if (tiles[i])
+						continue;
+
+					tr.x0 = area.x0 + x * t;
+					tr.y0 = area.y0 + y * t;
+					tr.x1 = fz_mini(tr.x0 + t, image->w);
+					tr.y1 = fz_mini(tr.y0 + t, image->h);
+					w = (tr.x1 - tr.x0 + f - 1) >> l2factor;
+					h = (tr.y1 - tr.y0 + f - 1) >> l2factor;
+
+					tile = fz_new_pixmap(ctx, decoded->colorspace, w, h, decoded->seps, decoded->alpha);
+					tile->flags = decoded->flags;
+					tile->xres = decoded->xres;
+					tile->yres = decoded->yres;
+					copy_pixmap_rect(tile, 0, 0, decoded, (tr.x0 - r.x0) >> l2factor, (tr.y0 - r.y0) >> l2factor, w, h);
+					tiles[i] = fz_store_image_tile(ctx, image, l2factor, &tr, tile);
+				}
+			}
+		}
+
+		/* Assemble the tiles. */
+		w = (area.x1 - area.x0 + f - 1) >> l2factor;
+		h = (area.y1 - area.y0 + f - 1) >> l2factor;
+		pix = fz_new_pixmap(ctx, tiles[0]->colorspace, w, h, tiles[0]->seps, tiles[0]->alpha);
+		pix->flags = tiles[0]->flags;
+		pix->xres = tiles[0]->xres;
+		pix->yres = tiles[0]->yres;
+		for (i = 0, y = 0; y < rows; y++)
+			for (x = 0; x < cols; x++, i++)
+				copy_pixmap_rect(pix, (x * t) >> l2factor, (y * t) >> l2factor, tiles[i], 0, 0, tiles[i]->w, tiles[i]->h);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, decoded);
+		for (i = 0; i < cols * rows; i++)
+			fz_drop_pixmap(ctx, tiles[i]);
+		fz_free(ctx, tiles);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+
+	fz_compute_image_extent(image, ctm, &area, &w, &h, dw, dh);
+	update_ctm_for_subarea(ctm, &area, image->w, image->h);
+
+	return pix;
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
 	fz_pixmap *tile;
 	int l2factor, l2factor_remaining;
 	fz_image_key key;
-	fz_image_key *keyp = NULL;
 	int w;
 	int h;
 
-	fz_var(keyp);
-
 	if (!image)
 		return NULL;
 
@@ -1017,6 +1321,12 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	if (subarea)
 		fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
 
+	/* If tiling is enabled, assemble partial areas from a grid of cached tiles. */
+	if (subarea && ctx->tuning->image_tile_size > 0 &&
+		(key.rect.x0 > 0 || key.rect.y0 > 0 || key.rect.x1 < image->w || key.rect.y1 < image->h) &&
+		fz_image_can_decode_tiles(ctx, image))
+		return fz_get_tiled_pixmap_from_image(ctx, image, &key, ctm, dw, dh);
+
 	/* We'll have to decode the image; request the correct amount of downscaling. */
 	l2factor_remaining = l2factor;
 	tile = image->get_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
@@ -1037,39 +1347,7 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		}
 	}
 
-	fz_try(ctx)
-	{
-		fz_pixmap *existing_tile;
-
-		/* Now we try to cache the pixmap. Any failure here will just result
-		 * in us not caching. */
-		keyp = fz_malloc_struct(ctx, fz_image_key);
-		keyp->refs = 1;
-		keyp->image = fz_keep_image_store_key(ctx, image);
-		keyp->l2factor = l2factor;
-		keyp->rect = key.rect;
-
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
-		if (existing_tile)
-		{
-			/* We already have a tile. This must have been produced by a
-			 * racing thread. We'll throw away ours and use that one. */
-			fz_drop_pixmap(ctx, tile);
-			tile = existing_tile;
-		}
-	}
-	fz_always(ctx)
-	{
-		fz_drop_image_key(ctx, keyp);
-	}
-	fz_catch(ctx)
-	{
-		/* Do nothing */
-		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
-		fz_report_error(ctx);
-	}
-
-	return tile;
+	return fz_store_image_tile(ctx, image, l2factor, &key.rect, tile);
 }
 
 fz_pixmap *
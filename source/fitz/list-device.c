@@ -233,6 +233,14 @@ cmd_needs_alignment(fz_display_command cmd)
 		cmd == FZ_CMD_DEFAULT_COLORSPACES);
 }
 
+/* The ctm is compared bit for bit, so that a negative zero is recorded
+ * and replayed as it was given. */
+static int
+float_differs(float a, float b)
+{
+	return memcmp(&a, &b, sizeof a) != 0;
+}
+
 static unsigned char *
 fz_append_display_node(
 	fz_context *ctx,
@@ -518,17 +526,17 @@ fz_append_display_node(
 			node.alpha = ALPHA_PRESENT;
 		}
 	}
-	if (ctm && (ctm->a != writer->ctm.a || ctm->b != writer->ctm.b || ctm->c != writer->ctm.c || ctm->d != writer->ctm.d || ctm->e != writer->ctm.e || ctm->f != writer->ctm.f))
+	if (ctm && memcmp(ctm, &writer->ctm, sizeof *ctm))
 	{
 		int ctm_flags;
 
 		ctm_off = size;
 		ctm_flags = CTM_UNCHANGED;
-		if (ctm->a != writer->ctm.a || ctm->d != writer->ctm.d)
+		if (float_differs(ctm->a, writer->ctm.a) || float_differs(ctm->d, writer->ctm.d))
 			ctm_flags = CTM_CHANGE_AD, size += SIZE_IN_NODES(2*sizeof(float));
-		if (ctm->b != writer->ctm.b || ctm->c != writer->ctm.c)
+		if (float_differs(ctm->b, writer->ctm.b) || float_differs(ctm->c, writer->ctm.c))
 			ctm_flags |= CTM_CHANGE_BC, size += SIZE_IN_NODES(2*sizeof(float));
-		if (ctm->e != writer->ctm.e || ctm->f != writer->ctm.f)
+		if (float_differs(ctm->e, writer->ctm.e) || float_differs(ctm->f, writer->ctm.f))
 			ctm_flags |= CTM_CHANGE_EF, size += SIZE_IN_NODES(2*sizeof(float));
 		node.ctm = ctm_flags;
 	}
@@ -1699,6 +1707,13 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list)
+{
+	if (!list)
+		return 0;
+	return sizeof(*list) + list->max * sizeof(fz_display_node);
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
@@ -1724,6 +1739,11 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 	fz_matrix trans_ctm;
 	int tile_skip_depth = 0;
 
+	/* Replaying at the identity must hand the device exactly what was
+	 * recorded, so that it makes no difference to the output whether a
+	 * page was run directly or through a list. */
+	int top_is_identity = fz_is_identity(top_ctm);
+
 	if (cookie)
 	{
 		cookie->progress_max = list->len;
@@ -1886,7 +1906,7 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 				continue;
 		}
 
-		trans_rect = fz_transform_rect(rect, top_ctm);
+		trans_rect = top_is_identity ? rect : fz_transform_rect(rect, top_ctm);
 
 		/* cull objects to draw using a quick visibility test */
 
@@ -1958,7 +1978,7 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 		}
 
 visible:
-		trans_ctm = fz_concat(ctm, top_ctm);
+		trans_ctm = top_is_identity ? ctm : fz_concat(ctm, top_ctm);
 
 		fz_try(ctx)
 		{
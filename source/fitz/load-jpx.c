@@ -22,9 +22,12 @@
 
 #include "mupdf/fitz.h"
 
+#include "context-imp.h"
+#include "image-imp.h"
 #include "pixmap-imp.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if FZ_ENABLE_JPX
@@ -89,6 +92,19 @@ typedef struct
  * calls to openjpeg. Any attempt to call through
  * without setting these will be detected.
  *
+ * This uses a lock of its own rather than the FreeType
+ * one, so that decoding a large image does not hold up
+ * text rendering.
+ *
+ * When a decode uses OpenJPEG's worker threads, those
+ * threads allocate too, and must not call fz_malloc on
+ * a context that they do not own (which might scavenge
+ * the store, or throw). For the duration of such a decode
+ * all of OpenJPEG's allocations go straight to the C
+ * library instead, which is safe from any thread. Every
+ * block is freed again before we unlock, so the two kinds
+ * never mix.
+ *
  * It is therefore vital that any fz_lock/fz_unlock
  * handlers are shared between all the fz_contexts in
  * use at a time.
@@ -100,6 +116,7 @@ typedef struct
  */
 
 static fz_context *opj_secret = NULL;
+static int opj_threaded = 0;
 
 static void set_opj_context(fz_context *ctx)
 {
@@ -113,16 +130,18 @@ static fz_context *get_opj_context(void)
 
 void opj_lock(fz_context *ctx)
 {
-	fz_ft_lock(ctx);
+	fz_lock(ctx, FZ_LOCK_JPX);
 
 	set_opj_context(ctx);
+	opj_threaded = 0;
 }
 
 void opj_unlock(fz_context *ctx)
 {
 	set_opj_context(NULL);
+	opj_threaded = 0;
 
-	fz_ft_unlock(ctx);
+	fz_unlock(ctx, FZ_LOCK_JPX);
 }
 
 void *opj_malloc(size_t size)
@@ -131,6 +150,9 @@ void *opj_malloc(size_t size)
 
 	assert(ctx != NULL);
 
+	if (opj_threaded)
+		return malloc(size);
+
 	return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
 }
 
@@ -140,6 +162,9 @@ void *opj_calloc(size_t n, size_t size)
 
 	assert(ctx != NULL);
 
+	if (opj_threaded)
+		return calloc(n, size);
+
 	return fz_calloc_no_throw(ctx, n, size);
 }
 
@@ -149,6 +174,9 @@ void *opj_realloc(void *ptr, size_t size)
 
 	assert(ctx != NULL);
 
+	if (opj_threaded)
+		return realloc(ptr, size);
+
 	return fz_realloc_no_throw(ctx, ptr, size);
 }
 
@@ -158,6 +186,12 @@ void opj_free(void *ptr)
 
 	assert(ctx != NULL);
 
+	if (opj_threaded)
+	{
+		free(ptr);
+		return;
+	}
+
 	fz_free(ctx, ptr);
 }
 
@@ -293,6 +327,12 @@ safe_mla32(fz_context *ctx, int32_t a, int32_t b, int32_t c)
 	return res32;
 }
 
+static inline int32_t
+ceildivpow2(int32_t a, int b)
+{
+	return (int32_t)(((int64_t)a + (1 << b) - 1) >> b);
+}
+
 static inline void
 template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT32 *src, int32_t ox, int32_t oy, OPJ_UINT32 cdx, OPJ_UINT32 cdy, OPJ_UINT32 cw, OPJ_UINT32 ch, OPJ_UINT32 sgnd, OPJ_UINT32 prec, int comps)
 {
@@ -370,7 +410,7 @@ template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT3
 }
 
 static void
-copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
+copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx, int reduce)
 {
 	unsigned char *dst;
 	int stride, comps;
@@ -389,8 +429,8 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		int32_t oy = safe_mul32(ctx, ceildivpow2(comp->y0, comp->factor), cdy) - ceildivpow2(jpx->y0, reduce);
+		int32_t ox = safe_mul32(ctx, ceildivpow2(comp->x0, comp->factor), cdx) - ceildivpow2(jpx->x0, reduce);
 		unsigned char *dst0 = dst + oy * stride;
 		int prec = comp->prec;
 		int sgnd = comp->sgnd;
@@ -416,8 +456,65 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* Arrange for only the tiles and resolution levels needed for the
+ * subarea and l2factor to be decoded. Returns the number of resolution
+ * levels discarded. */
+static int
+jpx_setup_partial_decode(fz_context *ctx, opj_codec_t *codec, opj_image_t *jpx, fz_irect *subarea, int *l2factor)
+{
+	opj_codestream_info_v2_t *info;
+	int w = jpx->x1 - jpx->x0;
+	int h = jpx->y1 - jpx->y0;
+	int reduce = l2factor ? *l2factor : 0;
+	fz_irect area;
+	OPJ_UINT32 i;
+
+	/* We can discard no more resolution levels than every component
+	 * has, and the reduced image must stay aligned to the canvas. */
+	if (reduce > 0)
+	{
+		info = opj_get_cstr_info(codec);
+		if (info && info->m_default_tile_info.tccp_info)
+		{
+			for (i = 0; i < info->nbcomps; i++)
+				reduce = fz_mini(reduce, (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1);
+		}
+		else
+			reduce = 0;
+		opj_destroy_cstr_info(&info);
+		while (reduce > 0 && ((jpx->x0 | jpx->y0) & ((1 << reduce) - 1)))
+			reduce--;
+		if (reduce > 0 && !opj_set_decoded_resolution_factor(codec, reduce))
+			reduce = 0;
+	}
+
+	if (subarea)
+	{
+		int f = 1 << reduce;
+
+		area.x0 = fz_clampi(subarea->x0 & ~(f - 1), 0, w);
+		area.y0 = fz_clampi(subarea->y0 & ~(f - 1), 0, h);
+		area.x1 = fz_clampi((subarea->x1 + f - 1) & ~(f - 1), 0, w);
+		area.y1 = fz_clampi((subarea->y1 + f - 1) & ~(f - 1), 0, h);
+		if (fz_is_empty_irect(area) || (area.x0 == 0 && area.y0 == 0 && area.x1 == w && area.y1 == h) ||
+			!opj_set_decode_area(codec, jpx, jpx->x0 + area.x0, jpx->y0 + area.y0, jpx->x0 + area.x1, jpx->y0 + area.y1))
+		{
+			area.x0 = 0;
+			area.y0 = 0;
+			area.x1 = w;
+			area.y1 = h;
+		}
+		*subarea = area;
+	}
+
+	if (l2factor)
+		*l2factor -= reduce;
+
+	return reduce;
+}
+
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor, int onlymeta)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -427,6 +524,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	OPJ_CODEC_FORMAT format;
 	int a, n, k;
 	int w, h;
+	int reduce = 0;
+	int threads = ctx->tuning->jpx_threads;
 	stream_block sb;
 	OPJ_UINT32 i;
 
@@ -441,6 +540,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	else
 		format = OPJ_CODEC_JP2;
 
+	/* Nothing has been allocated by OpenJPEG yet, so this is
+	 * the place to choose how it allocates. */
+	opj_threaded = threads > 1 && opj_has_thread_support();
+
 	opj_set_default_decoder_parameters(&params);
 	if (fz_colorspace_is_indexed(ctx, defcs))
 		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
@@ -455,6 +558,9 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_LIBRARY, "j2k decode failed");
 	}
 
+	if (opj_threaded)
+		opj_codec_set_threads(codec, threads);
+
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
 	sb.pos = 0;
@@ -474,6 +580,11 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_LIBRARY, "Failed to read JPX header");
 	}
 
+	state->width = jpx->x1 - jpx->x0;
+	state->height = jpx->y1 - jpx->y0;
+	if (!onlymeta)
+		reduce = jpx_setup_partial_decode(ctx, codec, jpx, subarea, l2factor);
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -508,12 +619,12 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	w = state->width = jpx->x1 - jpx->x0;
-	h = state->height = jpx->y1 - jpx->y0;
+	w = ceildivpow2(jpx->x1, reduce) - ceildivpow2(jpx->x0, reduce);
+	h = ceildivpow2(jpx->y1, reduce) - ceildivpow2(jpx->y0, reduce);
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
-	if (w < 0 || h < 0)
+	if (w < 0 || h < 0 || state->width < 0 || state->height < 0)
 	{
 		opj_image_destroy(jpx);
 		fz_throw(ctx, FZ_ERROR_LIMIT, "Unbelievable size for jpx");
@@ -584,7 +695,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		a = !!a; /* ignore any superfluous alpha channels */
 		img = fz_new_pixmap(ctx, state->cs, w, h, NULL, a);
 		fz_clear_pixmap_with_value(ctx, img, 0);
-		copy_jpx_to_pixmap(ctx, img, jpx);
+		copy_jpx_to_pixmap(ctx, img, jpx, reduce);
 
 		if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 3 && a == 0)
 			jpx_ycc_to_rgb(ctx, img, 1, 1);
@@ -606,7 +717,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 }
 
 fz_pixmap *
-fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
 {
 	fz_jpxd state = { 0 };
 	fz_pixmap *pix = NULL;
@@ -614,7 +725,7 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, subarea, l2factor, 0);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -624,6 +735,12 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return pix;
 }
 
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+{
+	return fz_load_jpx_subarea(ctx, data, size, defcs, NULL, NULL);
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -632,7 +749,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, NULL, NULL, 1);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -648,6 +765,12 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 
 #else /* FZ_ENABLE_JPX */
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "JPX support disabled");
+}
+
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
 {
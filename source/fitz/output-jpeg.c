@@ -134,6 +134,37 @@ static void term_destination(j_compress_ptr cinfo)
 	fz_write_data(ctx, out, dest->buffer, datacount);
 }
 
+static void
+setup_compress(fz_context *ctx, struct jpeg_compress_struct *cinfo, int w, int h, int n, int xres, int yres, int quality)
+{
+	cinfo->image_width = w;
+	cinfo->image_height = h;
+	cinfo->input_components = n;
+	switch (n) {
+	case 1:
+		cinfo->in_color_space = JCS_GRAYSCALE;
+		break;
+	case 3:
+		cinfo->in_color_space = JCS_RGB;
+		break;
+	case 4:
+		cinfo->in_color_space = JCS_CMYK;
+		break;
+	}
+
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, quality, FALSE);
+
+	/* Write image resolution */
+	cinfo->density_unit = 1; /* dots/inch */
+	cinfo->X_density = xres;
+	cinfo->Y_density = yres;
+
+	/* Disable chroma subsampling */
+	cinfo->comp_info[0].h_samp_factor = 1;
+	cinfo->comp_info[0].v_samp_factor = 1;
+}
+
 void
 fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, fz_pixmap *pix, int quality, int invert_cmyk)
 {
@@ -178,32 +209,7 @@ fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, fz_pixmap *pix, int qua
 		dest.pub.term_destination = term_destination;
 		dest.out = out;
 
-		cinfo.image_width = pix->w;
-		cinfo.image_height = pix->h;
-		cinfo.input_components = n;
-		switch (n) {
-		case 1:
-			cinfo.in_color_space = JCS_GRAYSCALE;
-			break;
-		case 3:
-			cinfo.in_color_space = JCS_RGB;
-			break;
-		case 4:
-			cinfo.in_color_space = JCS_CMYK;
-			break;
-		}
-
-		jpeg_set_defaults(&cinfo);
-		jpeg_set_quality(&cinfo, quality, FALSE);
-
-		/* Write image resolution */
-		cinfo.density_unit = 1; /* dots/inch */
-		cinfo.X_density = pix->xres;
-		cinfo.Y_density = pix->yres;
-
-		/* Disable chroma subsampling */
-		cinfo.comp_info[0].h_samp_factor = 1;
-		cinfo.comp_info[0].v_samp_factor = 1;
+		setup_compress(ctx, &cinfo, pix->w, pix->h, n, pix->xres, pix->yres, quality);
 
 		/* Progressive JPEGs are smaller */
 		jpeg_simple_progression(&cinfo);
@@ -256,6 +262,131 @@ fz_save_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pixmap, const char *filename,
 	}
 }
 
+typedef struct
+{
+	fz_band_writer super;
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr err;
+	my_destination_mgr dest;
+	int created;
+	int quality;
+	int invert_cmyk;
+	unsigned char *row;
+} jpeg_band_writer;
+
+static void
+jpeg_write_header(fz_context *ctx, fz_band_writer *writer_, fz_colorspace *cs)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+	int n = writer->super.n;
+	int alpha = writer->super.alpha;
+
+	if (writer->super.s != 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "JPEGs cannot contain spot colors");
+	if (cs && !fz_colorspace_is_gray(ctx, cs) && !fz_colorspace_is_rgb(ctx, cs) && !fz_colorspace_is_cmyk(ctx, cs))
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "pixmap must be Grayscale, RGB, or CMYK to save as JPEG");
+
+	/* Treat alpha only as greyscale */
+	if (n == 1 && alpha)
+		alpha = 0;
+	n -= alpha;
+
+	if (alpha > 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "pixmap may not have alpha to save as JPEG");
+	if (n != 1 && n != 3 && n != 4)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "pixmap must be Grayscale, RGB, or CMYK to save as JPEG");
+
+	if (!writer->created)
+	{
+		writer->cinfo.mem = NULL;
+		writer->cinfo.global_state = 0;
+		writer->cinfo.err = jpeg_std_error(&writer->err);
+		writer->err.error_exit = error_exit;
+		writer->cinfo.client_data = NULL;
+		fz_jpg_mem_init((j_common_ptr)&writer->cinfo, ctx);
+		writer->created = 1;
+		jpeg_create_compress(&writer->cinfo);
+
+		writer->cinfo.dest = (void*) &writer->dest;
+		writer->dest.pub.init_destination = init_destination;
+		writer->dest.pub.empty_output_buffer = empty_output_buffer;
+		writer->dest.pub.term_destination = term_destination;
+		writer->dest.out = writer->super.out;
+	}
+
+	fz_free(ctx, writer->row);
+	writer->row = NULL;
+	if (n == 4 && writer->invert_cmyk)
+		writer->row = fz_malloc(ctx, (size_t)writer->super.w * n);
+
+	/* We write a baseline JPEG rather than a progressive one, as
+	 * otherwise libjpeg would hold the whole image in memory. */
+	setup_compress(ctx, &writer->cinfo, writer->super.w, writer->super.h, n, writer->super.xres, writer->super.yres, writer->quality);
+	jpeg_start_compress(&writer->cinfo, TRUE);
+}
+
+static void
+jpeg_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+	int w = writer->super.w;
+	int n = writer->cinfo.input_components;
+	JSAMPROW row_pointer[1];
+	int x, y;
+
+	for (y = 0; y < band_height; y++)
+	{
+		if (writer->row)
+		{
+			unsigned char *d = writer->row;
+			const unsigned char *s = sp;
+			for (x = w * n; x > 0; x--)
+				*d++ = 255 - *s++;
+			row_pointer[0] = writer->row;
+		}
+		else
+			row_pointer[0] = (JSAMPROW)sp;
+		(void) jpeg_write_scanlines(&writer->cinfo, row_pointer, 1);
+		sp += stride;
+	}
+}
+
+static void
+jpeg_write_trailer(fz_context *ctx, fz_band_writer *writer_)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+
+	jpeg_finish_compress(&writer->cinfo);
+}
+
+static void
+jpeg_drop_band_writer(fz_context *ctx, fz_band_writer *writer_)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+
+	if (writer->created)
+	{
+		jpeg_destroy_compress(&writer->cinfo);
+		fz_jpg_mem_term((j_common_ptr)&writer->cinfo);
+	}
+	fz_free(ctx, writer->row);
+}
+
+fz_band_writer *fz_new_jpeg_band_writer(fz_context *ctx, fz_output *out, int quality, int invert_cmyk)
+{
+	jpeg_band_writer *writer = fz_new_band_writer(ctx, jpeg_band_writer, out);
+
+	writer->super.header = jpeg_write_header;
+	writer->super.band = jpeg_write_band;
+	writer->super.trailer = jpeg_write_trailer;
+	writer->super.drop = jpeg_drop_band_writer;
+
+	writer->quality = quality;
+	writer->invert_cmyk = invert_cmyk;
+
+	return &writer->super;
+}
+
 static fz_buffer *
 jpeg_from_pixmap(fz_context *ctx, fz_pixmap *pix, fz_color_params color_params, int quality, int invert_cmyk, int drop)
 {
@@ -135,36 +135,20 @@ boxer_create(fz_context *ctx, fz_rect *mediabox)
 	return boxer;
 }
 
-static void
-push_if_intersect_suitable(rectlist_t *dst, const fz_rect *a, const fz_rect *b)
-{
-	fz_rect c;
-
-	/* Intersect a and b. */
-	c = fz_intersect_rect(*a, *b);
-	/* If no intersection, nothing to push. */
-	if (!fz_is_valid_rect(c))
-		return;
-
-	rectlist_append(dst, &c);
-}
-
-static void
-boxlist_feed_intersect(rectlist_t *dst, const rectlist_t *src, const fz_rect *box)
+/* Does box cut into r? Touching doesn't count. */
+static int
+box_splits_rect(const fz_rect *box, const fz_rect *r)
 {
-	int i;
-
-	for (i = 0; i < src->len; i++)
-		push_if_intersect_suitable(dst, &src->list[i], box);
+	return r->x1 > box->x0 && r->x0 < box->x1 && r->y1 > box->y0 && r->y0 < box->y1;
 }
 
 /* Mark a given box as being occupied (typically by a glyph) */
 static void boxer_feed(fz_context *ctx, boxer_t *boxer, fz_rect *bbox)
 {
-	fz_rect box;
-	/* When we feed a box into a the boxer, we can never make
-	* the list more than 4 times as long. */
-	rectlist_t *newlist = rectlist_create(ctx, boxer->list->len * 4);
+	rectlist_t *list = boxer->list;
+	rectlist_t *newlist;
+	fz_rect region[4];
+	int i, j, split;
 
 #ifdef DEBUG_WRITE_AS_PS
 	printf("0 0 1 setrgbcolor\n");
@@ -176,33 +160,73 @@ static void boxer_feed(fz_context *ctx, boxer_t *boxer, fz_rect *bbox)
 	);
 #endif
 
+	/* Every free rectangle is cut against the four regions around
+	 * the box, and the pieces that are left make up the new list.
+	 *
+	 * A rectangle that the box doesn't overlap lies wholly within
+	 * one of those regions, and so survives as it is. The list never
+	 * holds two rectangles one of which encloses the other, so none
+	 * of the pieces cut from elsewhere can displace it, and its own
+	 * pieces are all enclosed by it. Only the handful of rectangles
+	 * that the box actually overlaps need to be cut up and merged
+	 * back in, which saves scanning the whole list for every piece
+	 * of every rectangle on the page. */
+	split = 0;
+	for (i = 0; i < list->len; i++)
+		if (box_splits_rect(bbox, &list->list[i]))
+			split++;
+	if (split == 0)
+		return;
+
+	/* Each rectangle we split can leave at most 4 pieces. */
+	newlist = rectlist_create(ctx, list->len + split * 3);
+
+	/* The untouched rectangles go first, so that rectlist_append
+	 * can't disturb them as it merges in the pieces. */
+	newlist->len = 0;
+	for (i = 0; i < list->len; i++)
+		if (!box_splits_rect(bbox, &list->list[i]))
+			newlist->list[newlist->len++] = list->list[i];
+
 	/* Left (0,0) (x0,H) */
-	box.x0 = boxer->mediabox.x0;
-	box.y0 = boxer->mediabox.y0;
-	box.x1 = bbox->x0;
-	box.y1 = boxer->mediabox.y1;
-	boxlist_feed_intersect(newlist, boxer->list, &box);
+	region[0].x0 = boxer->mediabox.x0;
+	region[0].y0 = boxer->mediabox.y0;
+	region[0].x1 = bbox->x0;
+	region[0].y1 = boxer->mediabox.y1;
 
 	/* Right (x1,0) (W,H) */
-	box.x0 = bbox->x1;
-	box.y0 = boxer->mediabox.y0;
-	box.x1 = boxer->mediabox.x1;
-	box.y1 = boxer->mediabox.y1;
-	boxlist_feed_intersect(newlist, boxer->list, &box);
+	region[1].x0 = bbox->x1;
+	region[1].y0 = boxer->mediabox.y0;
+	region[1].x1 = boxer->mediabox.x1;
+	region[1].y1 = boxer->mediabox.y1;
 
 	/* Bottom (0,0) (W,y0) */
-	box.x0 = boxer->mediabox.x0;
-	box.y0 = boxer->mediabox.y0;
-	box.x1 = boxer->mediabox.x1;
-	box.y1 = bbox->y0;
-	boxlist_feed_intersect(newlist, boxer->list, &box);
+	region[2].x0 = boxer->mediabox.x0;
+	region[2].y0 = boxer->mediabox.y0;
+	region[2].x1 = boxer->mediabox.x1;
+	region[2].y1 = bbox->y0;
 
 	/* Top (0,y1) (W,H) */
-	box.x0 = boxer->mediabox.x0;
-	box.y0 = bbox->y1;
-	box.x1 = boxer->mediabox.x1;
-	box.y1 = boxer->mediabox.y1;
-	boxlist_feed_intersect(newlist, boxer->list, &box);
+	region[3].x0 = boxer->mediabox.x0;
+	region[3].y0 = bbox->y1;
+	region[3].x1 = boxer->mediabox.x1;
+	region[3].y1 = boxer->mediabox.y1;
+
+	for (j = 0; j < 4; j++)
+	{
+		for (i = 0; i < list->len; i++)
+		{
+			fz_rect c;
+
+			if (!box_splits_rect(bbox, &list->list[i]))
+				continue;
+
+			/* If no intersection, nothing to push. */
+			c = fz_intersect_rect(list->list[i], region[j]);
+			if (fz_is_valid_rect(c))
+				rectlist_append(newlist, &c);
+		}
+	}
 
 	fz_free(ctx, boxer->list);
 	boxer->list = newlist;
@@ -858,6 +882,8 @@ int fz_segment_stext_page(fz_context *ctx, fz_stext_page *page)
 	fz_stext_block *block;
 	int ret = 0;
 
+	fz_invalidate_stext_line_index(ctx, page);
+
 	/* If we have structure already, give up. We can't hope to beat
 	 * proper structure! */
 	for (block = page->first_block; block != NULL; block = block->next)
@@ -123,6 +123,7 @@ typedef struct
 	int color;
 	int last_was_fake_bold;
 	const fz_text *lasttext;
+	fz_matrix lastctm;
 	fz_stext_options opts;
 
 	metatext_t *metatext;
@@ -157,11 +158,11 @@ const char *fz_stext_options_usage =
 	"\ttable-hunt: hunt for tables within a (segmented) page\n"
 	"\n";
 
-/* Find the current actualtext, if any. Will abort if dev == NULL. */
+/* Find the current actualtext in a metatext stack, if any. */
 static metatext_t *
-find_actualtext(fz_stext_device *dev)
+find_actualtext(metatext_t *top)
 {
-	metatext_t *mt = dev->metatext;
+	metatext_t *mt = top;
 
 	while (mt && mt->type != FZ_METATEXT_ACTUALTEXT)
 		mt = mt->prev;
@@ -169,12 +170,12 @@ find_actualtext(fz_stext_device *dev)
 	return mt;
 }
 
-/* Find the bounds of the given metatext. Will abort if mt or
- * dev are NULL. */
+/* Find the bounds of the given metatext in the stack. Will abort
+ * if mt is NULL. */
 static fz_rect *
-metatext_bounds(metatext_t *mt, fz_stext_device *dev)
+metatext_bounds(metatext_t *mt, metatext_t *top)
 {
-	metatext_t *mt2 = dev->metatext;
+	metatext_t *mt2 = top;
 
 	while (mt2 != mt)
 	{
@@ -186,16 +187,16 @@ metatext_bounds(metatext_t *mt, fz_stext_device *dev)
 }
 
 /* Find the bounds of the current actualtext, or NULL if there
- * isn't one. Will abort if dev is NULL. */
+ * isn't one. */
 static fz_rect *
-actualtext_bounds(fz_stext_device *dev)
+actualtext_bounds(metatext_t *top)
 {
-	metatext_t *mt = find_actualtext(dev);
+	metatext_t *mt = find_actualtext(top);
 
 	if (mt == NULL)
 		return NULL;
 
-	return metatext_bounds(mt, dev);
+	return metatext_bounds(mt, top);
 }
 
 fz_stext_page *
@@ -210,6 +211,7 @@ fz_new_stext_page(fz_context *ctx, fz_rect mediabox)
 		page->mediabox = mediabox;
 		page->first_block = NULL;
 		page->last_block = NULL;
+		page->line_index = NULL;
 	}
 	fz_catch(ctx)
 	{
@@ -251,6 +253,7 @@ fz_drop_stext_page(fz_context *ctx, fz_stext_page *page)
 {
 	if (page)
 	{
+		fz_invalidate_stext_line_index(ctx, page);
 		drop_run(ctx, page->first_block);
 		fz_drop_pool(ctx, page->pool);
 	}
@@ -567,6 +570,140 @@ check_for_fake_bold(fz_context *ctx, fz_stext_block *block, fz_font *font, int c
 	return 0;
 }
 
+/*
+	Decide whether a character starting at p carries on the current line,
+	given where the pen was left after the previous character. If it
+	does, *add_space is set when the gap is wide enough to be a missing
+	space, and *bidi may be set to 3 to mark the line as being in visual
+	order. If not, *new_para is set when the jump is large enough to start
+	a new paragraph (or the line is indented at the start of a text object).
+*/
+static int
+continues_line(fz_point ndir, float size, float adv, int wmode, fz_point p, fz_point pen, fz_point lag_pen,
+	int lastchar, int lastbidi, int indented, int *bidi, int *add_space, int *new_para)
+{
+	fz_point delta;
+	float spacing, base_offset;
+
+	/* Calculate how far we've moved since the last character. */
+	delta.x = p.x - pen.x;
+	delta.y = p.y - pen.y;
+
+	/* The transform has not changed, so we know we're in the same
+	 * direction. Calculate 2 distances; how far off the previous
+	 * baseline we are, together with how far along the baseline
+	 * we are from the expected position. */
+	spacing = (ndir.x * delta.x + ndir.y * delta.y) / size;
+	base_offset = (-ndir.y * delta.x + ndir.x * delta.y) / size;
+
+	/* Only a small amount off the baseline - we'll take this */
+	if (fabsf(base_offset) < BASE_MAX_DIST)
+	{
+		/* If mixed LTR and RTL content */
+		if ((*bidi & 1) != (lastbidi & 1))
+		{
+			/* Ignore jumps within line when switching between LTR and RTL text. */
+			return 1;
+		}
+
+		/* RTL */
+		else if (*bidi & 1)
+		{
+			fz_point logical_delta = fz_make_point(p.x - lag_pen.x, p.y - lag_pen.y);
+			float logical_spacing = (ndir.x * logical_delta.x + ndir.y * logical_delta.y) / size + adv;
+
+			/* If the pen is where we would have been if we
+			 * had advanced backwards from the previous
+			 * character by this character's advance, we
+			 * are probably seeing characters emitted in
+			 * logical order.
+			 */
+			if (fabsf(logical_spacing) < SPACE_DIST)
+			{
+				return 1;
+			}
+
+			/* However, if the pen has advanced to where we would expect it
+			 * in an LTR context, we're seeing them emitted in visual order
+			 * and should flag them for reordering!
+			 */
+			else if (fabsf(spacing) < SPACE_DIST)
+			{
+				*bidi = 3; /* mark line as visual */
+				return 1;
+			}
+
+			/* And any other small jump could be a missing space. */
+			else if (logical_spacing < 0 && logical_spacing > -SPACE_MAX_DIST)
+			{
+				if (wmode == 0 && may_add_space(lastchar))
+					*add_space = 1;
+				return 1;
+			}
+			else if (spacing < 0 && spacing > -SPACE_MAX_DIST)
+			{
+				/* Motion is in line, but negative. We've probably got overlapping
+				 * chars here. Live with it. */
+				return 1;
+			}
+			else if (spacing > 0 && spacing < SPACE_MAX_DIST)
+			{
+				*bidi = 3; /* mark line as visual */
+				if (wmode == 0 && may_add_space(lastchar))
+					*add_space = 1;
+				return 1;
+			}
+
+			else
+			{
+				/* Motion is large and unexpected (probably a new table column). */
+				return 0;
+			}
+		}
+
+		/* LTR or neutral character */
+		else
+		{
+			if (fabsf(spacing) < SPACE_DIST)
+			{
+				/* Motion is in line and small enough to ignore. */
+				return 1;
+			}
+			else if (spacing < 0 && spacing > -SPACE_MAX_DIST)
+			{
+				/* Motion is in line, but negative. We've probably got overlapping
+				 * chars here. Live with it. */
+				return 1;
+			}
+			else if (spacing > 0 && spacing < SPACE_MAX_DIST)
+			{
+				/* Motion is forward in line and large enough to warrant us adding a space. */
+				if (wmode == 0 && may_add_space(lastchar))
+					*add_space = 1;
+				return 1;
+			}
+			else
+			{
+				/* Motion is large and unexpected (probably a new table column). */
+				return 0;
+			}
+		}
+	}
+
+	/* Enough for a new line, but not enough for a new paragraph */
+	else if (fabsf(base_offset) <= PARAGRAPH_DIST)
+	{
+		/* Check indent to spot text-indent style paragraphs */
+		if (indented)
+			*new_para = 1;
+		return 0;
+	}
+
+	/* Way off the baseline - open a new paragraph */
+	*new_para = 1;
+	return 0;
+}
+
 static void
 fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int c, int glyph, fz_matrix trm, float adv, int wmode, int bidi, int force_new_line, int flags)
 {
@@ -580,8 +717,6 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 	fz_point dir, ndir, p, q;
 	float size;
 	fz_point delta;
-	float spacing = 0;
-	float base_offset = 0;
 
 	/* Preserve RTL-ness only (and ignore level) so we can use bit 2 as "visual" tag for reordering pass. */
 	bidi = bidi & 1;
@@ -680,127 +815,9 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 		if (delta.x < FLT_EPSILON && delta.y < FLT_EPSILON && c == dev->lastchar)
 			return;
 
-		/* Calculate how far we've moved since the last character. */
-		delta.x = p.x - dev->pen.x;
-		delta.y = p.y - dev->pen.y;
-
-		/* The transform has not changed, so we know we're in the same
-		 * direction. Calculate 2 distances; how far off the previous
-		 * baseline we are, together with how far along the baseline
-		 * we are from the expected position. */
-		spacing = (ndir.x * delta.x + ndir.y * delta.y) / size;
-		base_offset = (-ndir.y * delta.x + ndir.x * delta.y) / size;
-
-		/* Only a small amount off the baseline - we'll take this */
-		if (fabsf(base_offset) < BASE_MAX_DIST)
-		{
-			/* If mixed LTR and RTL content */
-			if ((bidi & 1) != (dev->lastbidi & 1))
-			{
-				/* Ignore jumps within line when switching between LTR and RTL text. */
-				new_line = 0;
-			}
-
-			/* RTL */
-			else if (bidi & 1)
-			{
-				fz_point logical_delta = fz_make_point(p.x - dev->lag_pen.x, p.y - dev->lag_pen.y);
-				float logical_spacing = (ndir.x * logical_delta.x + ndir.y * logical_delta.y) / size + adv;
-
-				/* If the pen is where we would have been if we
-				 * had advanced backwards from the previous
-				 * character by this character's advance, we
-				 * are probably seeing characters emitted in
-				 * logical order.
-				 */
-				if (fabsf(logical_spacing) < SPACE_DIST)
-				{
-					new_line = 0;
-				}
-
-				/* However, if the pen has advanced to where we would expect it
-				 * in an LTR context, we're seeing them emitted in visual order
-				 * and should flag them for reordering!
-				 */
-				else if (fabsf(spacing) < SPACE_DIST)
-				{
-					bidi = 3; /* mark line as visual */
-					new_line = 0;
-				}
-
-				/* And any other small jump could be a missing space. */
-				else if (logical_spacing < 0 && logical_spacing > -SPACE_MAX_DIST)
-				{
-					if (wmode == 0 && may_add_space(dev->lastchar))
-						add_space = 1;
-					new_line = 0;
-				}
-				else if (spacing < 0 && spacing > -SPACE_MAX_DIST)
-				{
-					/* Motion is in line, but negative. We've probably got overlapping
-					 * chars here. Live with it. */
-					new_line = 0;
-				}
-				else if (spacing > 0 && spacing < SPACE_MAX_DIST)
-				{
-					bidi = 3; /* mark line as visual */
-					if (wmode == 0 && may_add_space(dev->lastchar))
-						add_space = 1;
-					new_line = 0;
-				}
-
-				else
-				{
-					/* Motion is large and unexpected (probably a new table column). */
-					new_line = 1;
-				}
-			}
-
-			/* LTR or neutral character */
-			else
-			{
-				if (fabsf(spacing) < SPACE_DIST)
-				{
-					/* Motion is in line and small enough to ignore. */
-					new_line = 0;
-				}
-				else if (spacing < 0 && spacing > -SPACE_MAX_DIST)
-				{
-					/* Motion is in line, but negative. We've probably got overlapping
-					 * chars here. Live with it. */
-					new_line = 0;
-				}
-				else if (spacing > 0 && spacing < SPACE_MAX_DIST)
-				{
-					/* Motion is forward in line and large enough to warrant us adding a space. */
-					if (wmode == 0 && may_add_space(dev->lastchar))
-						add_space = 1;
-					new_line = 0;
-				}
-				else
-				{
-					/* Motion is large and unexpected (probably a new table column). */
-					new_line = 1;
-				}
-			}
-		}
-
-		/* Enough for a new line, but not enough for a new paragraph */
-		else if (fabsf(base_offset) <= PARAGRAPH_DIST)
-		{
-			/* Check indent to spot text-indent style paragraphs */
-			if (wmode == 0 && cur_line && dev->new_obj)
-				if ((p.x - dev->start.x) > 0.5f)
-					new_para = 1;
-			new_line = 1;
-		}
-
-		/* Way off the baseline - open a new paragraph */
-		else
-		{
-			new_para = 1;
-			new_line = 1;
-		}
+		new_line = !continues_line(ndir, size, adv, wmode, p, dev->pen, dev->lag_pen, dev->lastchar, dev->lastbidi,
+			wmode == 0 && dev->new_obj && (p.x - dev->start.x) > 0.5f,
+			&bidi, &add_space, &new_para);
 	}
 
 	/* Start a new block (but only at the beginning of a text object) */
@@ -839,58 +856,40 @@ move_pen_and_exit:
 	dev->trm = trm;
 }
 
-static void
-fz_add_stext_char(fz_context *ctx,
-	fz_stext_device *dev,
-	fz_font *font,
-	int c,
-	int glyph,
-	fz_matrix trm,
-	float adv,
-	int wmode,
-	int bidi,
-	int force_new_line,
-	int flags)
+/*
+	Expand ligatures and normalise whitespace as the flags ask.
+	Writes up to 3 characters to out, and returns how many.
+*/
+static int
+expand_stext_char(int c, int flags, int *out)
 {
-	/* ignore when one unicode character maps to multiple glyphs */
-	if (c == -1)
-		return;
-
-	if (!(dev->flags & FZ_STEXT_PRESERVE_LIGATURES))
+	if (!(flags & FZ_STEXT_PRESERVE_LIGATURES))
 	{
 		switch (c)
 		{
 		case 0xFB00: /* ff */
-			fz_add_stext_char_imp(ctx, dev, font, 'f', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'f', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 'f'; out[1] = 'f';
+			return 2;
 		case 0xFB01: /* fi */
-			fz_add_stext_char_imp(ctx, dev, font, 'f', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'i', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 'f'; out[1] = 'i';
+			return 2;
 		case 0xFB02: /* fl */
-			fz_add_stext_char_imp(ctx, dev, font, 'f', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'l', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 'f'; out[1] = 'l';
+			return 2;
 		case 0xFB03: /* ffi */
-			fz_add_stext_char_imp(ctx, dev, font, 'f', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'f', -1, trm, 0, wmode, bidi, 0, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'i', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 'f'; out[1] = 'f'; out[2] = 'i';
+			return 3;
 		case 0xFB04: /* ffl */
-			fz_add_stext_char_imp(ctx, dev, font, 'f', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'f', -1, trm, 0, wmode, bidi, 0, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 'l', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 'f'; out[1] = 'f'; out[2] = 'l';
+			return 3;
 		case 0xFB05: /* long st */
 		case 0xFB06: /* st */
-			fz_add_stext_char_imp(ctx, dev, font, 's', glyph, trm, adv, wmode, bidi, force_new_line, flags);
-			fz_add_stext_char_imp(ctx, dev, font, 't', -1, trm, 0, wmode, bidi, 0, flags);
-			return;
+			out[0] = 's'; out[1] = 't';
+			return 2;
 		}
 	}
 
-	if (!(dev->flags & FZ_STEXT_PRESERVE_WHITESPACE))
+	if (!(flags & FZ_STEXT_PRESERVE_WHITESPACE))
 	{
 		switch (c)
 		{
@@ -917,7 +916,35 @@ fz_add_stext_char(fz_context *ctx,
 		}
 	}
 
-	fz_add_stext_char_imp(ctx, dev, font, c, glyph, trm, adv, wmode, bidi, force_new_line, flags);
+	out[0] = c;
+	return 1;
+}
+
+static void
+fz_add_stext_char(fz_context *ctx,
+	fz_stext_device *dev,
+	fz_font *font,
+	int c,
+	int glyph,
+	fz_matrix trm,
+	float adv,
+	int wmode,
+	int bidi,
+	int force_new_line,
+	int flags)
+{
+	int out[3];
+	int i, n;
+
+	/* ignore when one unicode character maps to multiple glyphs */
+	if (c == -1)
+		return;
+
+	/* The first character takes the glyph; any more are added to its cluster. */
+	n = expand_stext_char(c, dev->flags, out);
+	fz_add_stext_char_imp(ctx, dev, font, out[0], glyph, trm, adv, wmode, bidi, force_new_line, flags);
+	for (i = 1; i < n; ++i)
+		fz_add_stext_char_imp(ctx, dev, font, out[i], -1, trm, 0, wmode, bidi, 0, flags);
 }
 
 static void
@@ -941,6 +968,9 @@ do_extract(fz_context *ctx, fz_stext_device *dev, fz_text_span *span, fz_matrix
 		{
 			fz_drop_font(ctx, dev->last.font);
 			dev->last.font = fz_keep_font(ctx, font);
+			/* Only accurate bboxes look at the glyph metrics. */
+			if (dev->flags & FZ_STEXT_ACCURATE_BBOXES)
+				fz_preload_font_metrics(ctx, font);
 		}
 		dev->last.valid = 1;
 		dev->last.flags = flags;
@@ -1119,6 +1149,9 @@ do_extract_within_actualtext(fz_context *ctx, fz_stext_device *dev, fz_text_span
 		{
 			fz_drop_font(ctx, dev->last.font);
 			dev->last.font = fz_keep_font(ctx, font);
+			/* Only accurate bboxes look at the glyph metrics. */
+			if (dev->flags & FZ_STEXT_ACCURATE_BBOXES)
+				fz_preload_font_metrics(ctx, font);
 		}
 		dev->last.valid = 1;
 
@@ -1184,7 +1217,7 @@ fz_stext_extract(fz_context *ctx, fz_stext_device *dev, fz_text_span *span, fz_m
 
 	/* Are we in an actualtext? */
 	if (!(tdev->opts.flags & FZ_STEXT_IGNORE_ACTUALTEXT))
-		mt = find_actualtext(dev);
+		mt = find_actualtext(dev->metatext);
 
 	if (mt)
 		do_extract_within_actualtext(ctx, dev, span, ctm, mt, flags);
@@ -1203,13 +1236,26 @@ static int hexrgba_from_color(fz_context *ctx, fz_colorspace *colorspace, const
 		(fz_clampi(rgb[2] * 255 + 0.5f, 0, 255));
 }
 
+/*
+	A text object sent again at the same place is the second half of a
+	fill/stroke pair. Display lists can replay the same object elsewhere
+	though, so the transform has to match too.
+*/
+static int
+is_repeated_text(fz_stext_device *tdev, const fz_text *text, fz_matrix ctm)
+{
+	if (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES)
+		return 0;
+	return text == tdev->lasttext && !memcmp(&ctm, &tdev->lastctm, sizeof ctm);
+}
+
 static void
 fz_stext_fill_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm,
 	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_text_span *span;
-	if (text == tdev->lasttext && (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES) == 0)
+	if (is_repeated_text(tdev, text, ctm))
 		return;
 	tdev->color = hexrgba_from_color(ctx, colorspace, color, alpha);
 	tdev->new_obj = 1;
@@ -1217,6 +1263,7 @@ fz_stext_fill_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matr
 		fz_stext_extract(ctx, tdev, span, ctm, FZ_STEXT_FILLED);
 	fz_drop_text(ctx, tdev->lasttext);
 	tdev->lasttext = fz_keep_text(ctx, text);
+	tdev->lastctm = ctm;
 }
 
 static void
@@ -1225,7 +1272,7 @@ fz_stext_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_text_span *span;
-	if (text == tdev->lasttext && (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES) == 0)
+	if (is_repeated_text(tdev, text, ctm))
 		return;
 	tdev->color = hexrgba_from_color(ctx, colorspace, color, alpha);
 	tdev->new_obj = 1;
@@ -1233,6 +1280,7 @@ fz_stext_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const
 		fz_stext_extract(ctx, tdev, span, ctm, FZ_STEXT_STROKED);
 	fz_drop_text(ctx, tdev->lasttext);
 	tdev->lasttext = fz_keep_text(ctx, text);
+	tdev->lastctm = ctm;
 }
 
 static void
@@ -1240,7 +1288,7 @@ fz_stext_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matr
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_text_span *span;
-	if (text == tdev->lasttext && (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES) == 0)
+	if (is_repeated_text(tdev, text, ctm))
 		return;
 	tdev->color = 0;
 	tdev->new_obj = 1;
@@ -1248,6 +1296,7 @@ fz_stext_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matr
 		fz_stext_extract(ctx, tdev, span, ctm, FZ_STEXT_FILLED | FZ_STEXT_CLIPPED);
 	fz_drop_text(ctx, tdev->lasttext);
 	tdev->lasttext = fz_keep_text(ctx, text);
+	tdev->lastctm = ctm;
 }
 
 static void
@@ -1255,7 +1304,7 @@ fz_stext_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text,
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_text_span *span;
-	if (text == tdev->lasttext && (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES) == 0)
+	if (is_repeated_text(tdev, text, ctm))
 		return;
 	tdev->color = 0;
 	tdev->new_obj = 1;
@@ -1263,6 +1312,7 @@ fz_stext_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text,
 		fz_stext_extract(ctx, tdev, span, ctm, FZ_STEXT_STROKED | FZ_STEXT_CLIPPED);
 	fz_drop_text(ctx, tdev->lasttext);
 	tdev->lasttext = fz_keep_text(ctx, text);
+	tdev->lastctm = ctm;
 }
 
 static void
@@ -1270,7 +1320,7 @@ fz_stext_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_ma
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_text_span *span;
-	if (text == tdev->lasttext && (tdev->opts.flags & FZ_STEXT_COLLECT_STYLES) == 0)
+	if (is_repeated_text(tdev, text, ctm))
 		return;
 	tdev->color = 0;
 	tdev->new_obj = 1;
@@ -1278,6 +1328,7 @@ fz_stext_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_ma
 		fz_stext_extract(ctx, tdev, span, ctm, 0);
 	fz_drop_text(ctx, tdev->lasttext);
 	tdev->lasttext = fz_keep_text(ctx, text);
+	tdev->lastctm = ctm;
 }
 
 static void
@@ -1294,19 +1345,19 @@ fz_stext_begin_metatext(fz_context *ctx, fz_device *dev, fz_metatext meta, const
 }
 
 static void
-pop_metatext(fz_context *ctx, fz_stext_device *dev)
+pop_metatext(fz_context *ctx, metatext_t **top)
 {
 	metatext_t *prev;
 	fz_rect bounds;
 
-	if (!dev->metatext)
+	if (!*top)
 		return;
 
-	prev = dev->metatext->prev;
-	bounds = dev->metatext->bounds;
-	fz_free(ctx, dev->metatext->text);
-	fz_free(ctx, dev->metatext);
-	dev->metatext = prev;
+	prev = (*top)->prev;
+	bounds = (*top)->bounds;
+	fz_free(ctx, (*top)->text);
+	fz_free(ctx, *top);
+	*top = prev;
 	if (prev)
 		prev->bounds = fz_union_rect(prev->bounds, bounds);
 }
@@ -1324,7 +1375,7 @@ fz_stext_end_metatext(fz_context *ctx, fz_device *dev)
 	{
 		/* We only deal with ActualText here. Just pop anything else off,
 		 * and we're done. */
-		pop_metatext(ctx, tdev);
+		pop_metatext(ctx, &tdev->metatext);
 		return;
 	}
 
@@ -1332,7 +1383,7 @@ fz_stext_end_metatext(fz_context *ctx, fz_device *dev)
 	if (tdev->last.valid)
 	{
 		flush_actualtext(ctx, tdev, tdev->metatext->text, 0);
-		pop_metatext(ctx, tdev);
+		pop_metatext(ctx, &tdev->metatext);
 		return;
 	}
 
@@ -1360,7 +1411,7 @@ fz_stext_end_metatext(fz_context *ctx, fz_device *dev)
 			tdev->last.font = myfont;
 		}
 		flush_actualtext(ctx, tdev, tdev->metatext->text, 0);
-		pop_metatext(ctx, tdev);
+		pop_metatext(ctx, &tdev->metatext);
 	}
 	fz_always(ctx)
 	{
@@ -1381,7 +1432,7 @@ static void
 fz_stext_fill_image(fz_context *ctx, fz_device *dev, fz_image *img, fz_matrix ctm, float alpha, fz_color_params color_params)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
-	fz_rect *bounds = actualtext_bounds(tdev);
+	fz_rect *bounds = actualtext_bounds(tdev->metatext);
 
 	/* If there is an actualtext in force, update its bounds. */
 	if (bounds)
@@ -1448,7 +1499,7 @@ static void
 fz_stext_fill_shade(fz_context *ctx, fz_device *dev, fz_shade *shade, fz_matrix ctm, float alpha, fz_color_params color_params)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
-	fz_rect *bounds = actualtext_bounds(tdev);
+	fz_rect *bounds = actualtext_bounds(tdev->metatext);
 	fz_matrix local_ctm;
 	fz_rect scissor;
 	fz_image *image;
@@ -1516,19 +1567,36 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_stext_page *page = tdev->page;
 
+	fz_invalidate_stext_line_index(ctx, page);
+
 	fixup_bboxes_and_bidi(ctx, page->first_block);
 
 	/* TODO: smart sorting of blocks and lines in reading order */
 	/* TODO: unicode NFC normalization */
 
 	if (tdev->opts.flags & FZ_STEXT_SEGMENT)
+	{
+		double t = fz_ms_clock();
 		fz_segment_stext_page(ctx, page);
+		if (tdev->opts.timings)
+			tdev->opts.timings->segment += fz_ms_clock() - t;
+	}
 
 	if (tdev->opts.flags & FZ_STEXT_TABLE_HUNT)
+	{
+		double t = fz_ms_clock();
 		fz_table_hunt(ctx, page);
+		if (tdev->opts.timings)
+			tdev->opts.timings->table_hunt += fz_ms_clock() - t;
+	}
 
 	if (tdev->opts.flags & FZ_STEXT_PARAGRAPH_BREAK)
+	{
+		double t = fz_ms_clock();
 		fz_paragraph_break(ctx, page);
+		if (tdev->opts.timings)
+			tdev->opts.timings->paragraph_break += fz_ms_clock() - t;
+	}
 }
 
 static void
@@ -1538,7 +1606,7 @@ fz_stext_drop_device(fz_context *ctx, fz_device *dev)
 	fz_drop_text(ctx, tdev->lasttext);
 	fz_drop_font(ctx, tdev->last.font);
 	while (tdev->metatext)
-		pop_metatext(ctx, tdev);
+		pop_metatext(ctx, &tdev->metatext);
 }
 
 fz_stext_options *
@@ -1966,7 +2034,7 @@ fz_stext_fill_path(fz_context *ctx, fz_device *dev, const fz_path *path, int eve
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_stext_page *page = tdev->page;
 	fz_rect path_bounds = fz_bound_path(ctx, path, NULL, ctm);
-	fz_rect *bounds = actualtext_bounds(tdev);
+	fz_rect *bounds = actualtext_bounds(tdev->metatext);
 
 	/* If we're in an actualttext, then update the bounds to include this content. */
 	if (bounds != NULL)
@@ -1985,7 +2053,7 @@ fz_stext_stroke_path(fz_context *ctx, fz_device *dev, const fz_path *path, const
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_stext_page *page = tdev->page;
 	fz_rect path_bounds = fz_bound_path(ctx, path, ss, ctm);
-	fz_rect *bounds = actualtext_bounds((fz_stext_device *)dev);
+	fz_rect *bounds = actualtext_bounds(((fz_stext_device *)dev)->metatext);
 
 	/* If we're in an actualttext, then update the bounds to include this content. */
 	if (bounds != NULL)
@@ -2223,3 +2291,565 @@ fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options
 
 	return (fz_device*)dev;
 }
+
+/* Text output device: the same line joining as the stext device, but
+ * writing each line of plain text out as soon as it is complete instead
+ * of building a page of blocks, lines and characters. */
+
+typedef struct
+{
+	fz_device super;
+	fz_output *out;
+	fz_rect mediabox;
+	int flags;
+
+	/* The line being collected. */
+	int *line;
+	unsigned char *line_bidi;
+	int len, cap;
+	int have_line;
+	int in_para;
+	fz_point line_dir;
+	int line_wmode;
+
+	fz_point pen, lag_pen, start;
+	int lastchar;
+	int lastbidi;
+	int new_obj;
+	const fz_text *lasttext;
+	fz_matrix lastctm;
+
+	/* As for the stext device, for flushing the actualtext. */
+	metatext_t *metatext;
+	struct
+	{
+		int valid;
+		int clipped;
+		fz_matrix trm;
+		int wmode;
+		int bidi_level;
+	} last;
+} fz_text_output_device;
+
+static void
+text_output_append(fz_context *ctx, fz_text_output_device *dev, int c, int bidi)
+{
+	if (dev->len == dev->cap)
+	{
+		int cap = dev->cap ? dev->cap * 2 : 256;
+		dev->line = fz_realloc_array(ctx, dev->line, cap, int);
+		dev->line_bidi = fz_realloc_array(ctx, dev->line_bidi, cap, unsigned char);
+		dev->cap = cap;
+	}
+	dev->line[dev->len] = c;
+	dev->line_bidi[dev->len] = bidi;
+	dev->len++;
+}
+
+/* As reverse_bidi_line, reverse each run of RTL characters in a line
+ * that has been seen in visual order. */
+static void
+text_output_reorder(fz_text_output_device *dev)
+{
+	int i, j, a, b, t;
+
+	for (i = 0; i < dev->len; ++i)
+		if (dev->line_bidi[i] == 3)
+			break;
+	if (i == dev->len)
+		return;
+
+	for (i = 0; i < dev->len; i = j)
+	{
+		for (j = i; j < dev->len && dev->line_bidi[j]; ++j)
+			;
+		for (a = i, b = j - 1; a < b; ++a, --b)
+		{
+			t = dev->line[a];
+			dev->line[a] = dev->line[b];
+			dev->line[b] = t;
+		}
+		if (j == i)
+			++j;
+	}
+}
+
+static void
+text_output_end_line(fz_context *ctx, fz_text_output_device *dev)
+{
+	int i;
+
+	if (!dev->have_line)
+		return;
+
+	text_output_reorder(dev);
+	for (i = 0; i < dev->len; ++i)
+		fz_write_rune(ctx, dev->out, dev->line[i]);
+	fz_write_byte(ctx, dev->out, '\n');
+	dev->len = 0;
+	dev->have_line = 0;
+}
+
+static void
+text_output_end_para(fz_context *ctx, fz_text_output_device *dev)
+{
+	text_output_end_line(ctx, dev);
+	if (dev->in_para)
+		fz_write_byte(ctx, dev->out, '\n');
+	dev->in_para = 0;
+}
+
+/* This follows fz_add_stext_char_imp, without the style collection. */
+static void
+text_output_char_imp(fz_context *ctx, fz_text_output_device *dev, int c, int glyph, fz_matrix trm, float adv, int wmode, int bidi, int force_new_line)
+{
+	int new_para = 0;
+	int new_line = 1;
+	int add_space = 0;
+	fz_point dir, ndir, p, q;
+	float size;
+
+	bidi = bidi & 1;
+
+	if (wmode == 0)
+		dir = fz_make_point(1, 0);
+	else
+		dir = fz_make_point(0, -1);
+	dir = fz_transform_vector(dir, trm);
+	ndir = fz_normalize_vector(dir);
+
+	size = fz_matrix_expansion(trm);
+
+	if (wmode == 0)
+	{
+		p = fz_make_point(trm.e, trm.f);
+		q = fz_make_point(trm.e + adv * dir.x, trm.f + adv * dir.y);
+	}
+	else
+	{
+		p = fz_make_point(trm.e - adv * dir.x, trm.f - adv * dir.y);
+		q = fz_make_point(trm.e, trm.f);
+	}
+
+	if (dev->have_line && glyph < 0)
+	{
+		/* Don't advance pen or break lines for no-glyph characters in a cluster */
+		text_output_append(ctx, dev, c, bidi);
+		dev->lastbidi = bidi;
+		dev->lastchar = c;
+		return;
+	}
+
+	if (!dev->have_line || dev->line_wmode != wmode || vec_dot(&ndir, &dev->line_dir) < 0.999f)
+	{
+		new_para = 1;
+		new_line = 1;
+	}
+	else
+	{
+		/* Detect fake bold where text is printed twice in the same place. */
+		if (fabsf(q.x - dev->pen.x) < FLT_EPSILON && fabsf(q.y - dev->pen.y) < FLT_EPSILON && c == dev->lastchar)
+			return;
+
+		new_line = !continues_line(ndir, size, adv, wmode, p, dev->pen, dev->lag_pen, dev->lastchar, dev->lastbidi,
+			wmode == 0 && dev->new_obj && (p.x - dev->start.x) > 0.5f,
+			&bidi, &add_space, &new_para);
+	}
+
+	if (new_para)
+		text_output_end_para(ctx, dev);
+	else if (new_line && (dev->flags & FZ_STEXT_DEHYPHENATE) && is_hyphen(dev->lastchar))
+	{
+		/* As remove_last_char, only if the hyphen is not all there is. */
+		if (dev->len > 1)
+			dev->len--;
+		new_line = 0;
+	}
+
+	if (new_line || !dev->have_line || force_new_line)
+	{
+		text_output_end_line(ctx, dev);
+		dev->have_line = 1;
+		dev->in_para = 1;
+		dev->line_dir = ndir;
+		dev->line_wmode = wmode;
+		dev->start = p;
+	}
+
+	if (add_space && !(dev->flags & FZ_STEXT_INHIBIT_SPACES))
+		text_output_append(ctx, dev, ' ', bidi);
+	text_output_append(ctx, dev, c, bidi);
+
+	dev->lastchar = c;
+	dev->lastbidi = bidi;
+	dev->lag_pen = p;
+	dev->pen = q;
+	dev->new_obj = 0;
+}
+
+static void
+text_output_char(fz_context *ctx, fz_text_output_device *dev, int c, int glyph, fz_matrix trm, float adv, int wmode, int bidi, int force_new_line)
+{
+	int out[3];
+	int i, n;
+
+	if (c == -1)
+		return;
+
+	n = expand_stext_char(c, dev->flags, out);
+	text_output_char_imp(ctx, dev, out[0], glyph, trm, adv, wmode, bidi, force_new_line);
+	for (i = 1; i < n; ++i)
+		text_output_char_imp(ctx, dev, out[i], -1, trm, 0, wmode, bidi, 0);
+}
+
+/* This follows do_extract. */
+static void
+text_output_extract(fz_context *ctx, fz_text_output_device *dev, fz_text_span *span, fz_matrix ctm, int start, int end)
+{
+	fz_matrix tm = span->trm;
+	fz_rect scissor = fz_infinite_rect;
+	int i, c;
+
+	if (dev->flags & FZ_STEXT_CLIP)
+		scissor = fz_intersect_rect(fz_device_current_scissor(ctx, &dev->super), dev->mediabox);
+
+	for (i = start; i < end; i++)
+	{
+		fz_text_item *item = &span->items[i];
+
+		tm.e = item->x;
+		tm.f = item->y;
+		dev->last.trm = fz_concat(tm, ctm);
+		dev->last.wmode = span->wmode;
+		dev->last.bidi_level = span->bidi_level;
+		dev->last.valid = 1;
+
+		if (dev->flags & FZ_STEXT_CLIP)
+		{
+			if (fz_glyph_entirely_outside_box(ctx, &ctm, span, item, &scissor))
+			{
+				dev->last.clipped = 1;
+				continue;
+			}
+		}
+		dev->last.clipped = 0;
+
+		c = item->ucs;
+		if (c == FZ_REPLACEMENT_CHARACTER)
+		{
+			if (dev->flags & FZ_STEXT_USE_CID_FOR_UNKNOWN_UNICODE)
+				c = item->cid;
+			else if (dev->flags & FZ_STEXT_USE_GID_FOR_UNKNOWN_UNICODE)
+				c = item->gid;
+		}
+
+		text_output_char(ctx, dev, c, item->gid,
+			dev->last.trm,
+			item->gid >= 0 ? item->adv : 0,
+			span->wmode,
+			span->bidi_level,
+			(i == 0) && (dev->flags & FZ_STEXT_PRESERVE_SPANS));
+	}
+}
+
+/* This follows flush_actualtext. */
+static void
+text_output_flush_actualtext(fz_context *ctx, fz_text_output_device *dev, const char *actualtext, int i)
+{
+	int rune;
+
+	while (*actualtext)
+	{
+		actualtext += fz_chartorune(&rune, actualtext);
+
+		if (dev->flags & FZ_STEXT_CLIP)
+			if (dev->last.clipped)
+				continue;
+
+		text_output_char(ctx, dev, rune, -1,
+			dev->last.trm,
+			0,
+			dev->last.wmode,
+			dev->last.bidi_level,
+			(i == 0) && (dev->flags & FZ_STEXT_PRESERVE_SPANS));
+		i++;
+	}
+}
+
+/* This follows do_extract_within_actualtext: send any prefix and
+ * postfix of the span that matches the actualtext as it is, and the
+ * rest of the actualtext in place of the glyphs in the middle. */
+static void
+text_output_extract_within_actualtext(fz_context *ctx, fz_text_output_device *dev, fz_text_span *span, fz_matrix ctm, metatext_t *mt)
+{
+	fz_matrix tm = span->trm;
+	fz_rect scissor = fz_infinite_rect;
+	char *actualtext = mt->text;
+	size_t z = fz_utflen(actualtext);
+	int start, end, i, rune;
+
+	if (z == 0)
+		return;
+
+	/* Spot a matching prefix and send it. */
+	for (start = 0; start < span->len; start++)
+	{
+		int len = fz_chartorune(&rune, actualtext);
+		if (span->items[start].gid != rune || rune == 0)
+			break;
+		actualtext += len; z--;
+	}
+	if (start != 0)
+		text_output_extract(ctx, dev, span, ctm, 0, start);
+
+	if (start == span->len)
+	{
+		memmove(mt->text, actualtext, strlen(actualtext) + 1);
+		return;
+	}
+
+	/* Spot a matching postfix, to send at the end. */
+	for (end = span->len; end > start; end--)
+	{
+		rune = rune_index(actualtext, z-1);
+		if (span->items[end-1].gid != rune)
+			break;
+		z--;
+	}
+
+	if (dev->flags & FZ_STEXT_CLIP)
+		scissor = fz_intersect_rect(fz_device_current_scissor(ctx, &dev->super), dev->mediabox);
+
+	for (i = start; i < end; i++)
+	{
+		fz_text_item *item = &span->items[i];
+
+		rune = -1;
+		if ((size_t)i < z)
+			actualtext += fz_chartorune(&rune, actualtext);
+
+		tm.e = item->x;
+		tm.f = item->y;
+		dev->last.trm = fz_concat(tm, ctm);
+		dev->last.wmode = span->wmode;
+		dev->last.bidi_level = span->bidi_level;
+		dev->last.valid = 1;
+
+		if (dev->flags & FZ_STEXT_CLIP)
+		{
+			if (fz_glyph_entirely_outside_box(ctx, &ctm, span, item, &scissor))
+			{
+				dev->last.clipped = 1;
+				continue;
+			}
+		}
+		dev->last.clipped = 0;
+
+		text_output_char(ctx, dev, rune, item->gid,
+			dev->last.trm,
+			item->gid >= 0 ? item->adv : 0,
+			span->wmode,
+			span->bidi_level,
+			(i == 0) && (dev->flags & FZ_STEXT_PRESERVE_SPANS));
+	}
+
+	/* Without a postfix, more text objects may yet match the rest. */
+	if (end == span->len)
+	{
+		memmove(mt->text, actualtext, strlen(actualtext) + 1);
+		return;
+	}
+
+	text_output_flush_actualtext(ctx, dev, actualtext, i);
+	text_output_extract(ctx, dev, span, ctm, end, span->len);
+	mt->text[0] = 0;
+}
+
+static void
+text_output_span(fz_context *ctx, fz_text_output_device *dev, fz_text_span *span, fz_matrix ctm)
+{
+	metatext_t *mt = NULL;
+
+	if (!(dev->flags & FZ_STEXT_IGNORE_ACTUALTEXT))
+		mt = find_actualtext(dev->metatext);
+
+	if (mt && mt->text)
+		text_output_extract_within_actualtext(ctx, dev, span, ctm, mt);
+	else
+		text_output_extract(ctx, dev, span, ctm, 0, span->len);
+}
+
+static void
+text_output_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	fz_text_span *span;
+
+	if (text == dev->lasttext && !memcmp(&ctm, &dev->lastctm, sizeof ctm))
+		return;
+	dev->new_obj = 1;
+	for (span = text->head; span; span = span->next)
+		if (span->len > 0)
+			text_output_span(ctx, dev, span, ctm);
+	fz_drop_text(ctx, dev->lasttext);
+	dev->lasttext = fz_keep_text(ctx, text);
+	dev->lastctm = ctm;
+}
+
+static void
+text_output_fill_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	text_output_text(ctx, dev, text, ctm);
+}
+
+static void
+text_output_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	text_output_text(ctx, dev, text, ctm);
+}
+
+static void
+text_output_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm, fz_rect scissor)
+{
+	text_output_text(ctx, dev, text, ctm);
+}
+
+static void
+text_output_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	text_output_text(ctx, dev, text, ctm);
+}
+
+static void
+text_output_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm)
+{
+	text_output_text(ctx, dev, text, ctm);
+}
+
+static void
+text_output_begin_metatext(fz_context *ctx, fz_device *dev_, fz_metatext meta, const char *text)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	metatext_t *mt = fz_malloc_struct(ctx, metatext_t);
+
+	mt->prev = dev->metatext;
+	dev->metatext = mt;
+	mt->type = meta;
+	mt->text = text ? fz_strdup(ctx, text) : NULL;
+	mt->bounds = fz_empty_rect;
+}
+
+/* This follows fz_stext_end_metatext. */
+static void
+text_output_end_metatext(fz_context *ctx, fz_device *dev_)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	metatext_t *mt = dev->metatext;
+
+	if (!mt)
+		return;
+
+	if (mt->type == FZ_METATEXT_ACTUALTEXT && mt->text)
+	{
+		if (!dev->last.valid)
+		{
+			/* Put the text where the content it covers was. */
+			if (!fz_is_empty_rect(mt->bounds))
+				dev->last.trm = fz_make_matrix(
+					mt->bounds.x1 - mt->bounds.x0, 0,
+					0, mt->bounds.y1 - mt->bounds.y0,
+					mt->bounds.x0, mt->bounds.y0);
+			else
+				fz_warn(ctx, "Actualtext with no position. Text may be lost or mispositioned.");
+		}
+		fz_try(ctx)
+			text_output_flush_actualtext(ctx, dev, mt->text, 0);
+		fz_always(ctx)
+			pop_metatext(ctx, &dev->metatext);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	else
+		pop_metatext(ctx, &dev->metatext);
+}
+
+/* Images and shadings only matter for placing actualtext. */
+
+static void
+text_output_fill_image(fz_context *ctx, fz_device *dev_, fz_image *img, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	fz_rect *bounds = actualtext_bounds(dev->metatext);
+	if (bounds)
+	{
+		static const fz_rect unit = { 0, 0, 1, 1 };
+		*bounds = fz_union_rect(*bounds, fz_transform_rect(unit, ctm));
+	}
+}
+
+static void
+text_output_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *img, fz_matrix ctm,
+	fz_colorspace *cspace, const float *color, float alpha, fz_color_params color_params)
+{
+	text_output_fill_image(ctx, dev, img, ctm, alpha, color_params);
+}
+
+static void
+text_output_fill_shade(fz_context *ctx, fz_device *dev_, fz_shade *shade, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	fz_rect *bounds = actualtext_bounds(dev->metatext);
+	if (bounds)
+		*bounds = fz_union_rect(*bounds, fz_bound_shade(ctx, shade, ctm));
+}
+
+static void
+text_output_close_device(fz_context *ctx, fz_device *dev_)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	text_output_end_para(ctx, dev);
+}
+
+static void
+text_output_drop_device(fz_context *ctx, fz_device *dev_)
+{
+	fz_text_output_device *dev = (fz_text_output_device*)dev_;
+	fz_drop_text(ctx, dev->lasttext);
+	while (dev->metatext)
+		pop_metatext(ctx, &dev->metatext);
+	fz_free(ctx, dev->line);
+	fz_free(ctx, dev->line_bidi);
+}
+
+fz_device *
+fz_new_text_output_device(fz_context *ctx, fz_output *out, fz_rect mediabox, const fz_stext_options *opts)
+{
+	fz_text_output_device *dev = fz_new_derived_device(ctx, fz_text_output_device);
+
+	dev->super.close_device = text_output_close_device;
+	dev->super.drop_device = text_output_drop_device;
+
+	dev->super.fill_text = text_output_fill_text;
+	dev->super.stroke_text = text_output_stroke_text;
+	dev->super.clip_text = text_output_clip_text;
+	dev->super.clip_stroke_text = text_output_clip_stroke_text;
+	dev->super.ignore_text = text_output_ignore_text;
+	dev->super.begin_metatext = text_output_begin_metatext;
+	dev->super.end_metatext = text_output_end_metatext;
+
+	dev->super.fill_shade = text_output_fill_shade;
+	dev->super.fill_image = text_output_fill_image;
+	dev->super.fill_image_mask = text_output_fill_image_mask;
+
+	dev->super.hints |= FZ_DONT_DECODE_IMAGES;
+
+	dev->out = out;
+	dev->mediabox = mediabox;
+	if (opts)
+		dev->flags = opts->flags;
+	dev->lastchar = ' ';
+
+	return (fz_device*)dev;
+}
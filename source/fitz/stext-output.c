@@ -905,6 +905,11 @@ typedef struct
 	fz_output *out;
 } fz_text_writer;
 
+/* Options that make the plain text depend on more than the order the
+ * text is drawn in. */
+#define TEXT_NEEDS_PAGE (FZ_STEXT_SEGMENT | FZ_STEXT_TABLE_HUNT | FZ_STEXT_PARAGRAPH_BREAK | \
+	FZ_STEXT_COLLECT_STRUCTURE | FZ_STEXT_COLLECT_STYLES | FZ_STEXT_COLLECT_VECTORS | FZ_STEXT_PRESERVE_IMAGES)
+
 static fz_device *
 text_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 {
@@ -919,42 +924,64 @@ text_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 
 	wri->number++;
 
+	/* Plain text that needs nothing from the whole page can be
+	 * written out as it is found. */
+	if (wri->format == FZ_FORMAT_TEXT && (wri->opts.flags & TEXT_NEEDS_PAGE) == 0)
+		return fz_new_text_output_device(ctx, wri->out, mediabox, &wri->opts);
+
 	wri->page = fz_new_stext_page(ctx, fz_transform_rect(mediabox, fz_scale(s, s)));
 	return fz_new_stext_device(ctx, wri->page, &wri->opts);
 }
 
+static void
+text_print_page(fz_context *ctx, fz_text_writer *wri, fz_stext_page *page)
+{
+	switch (wri->format)
+	{
+	default:
+	case FZ_FORMAT_TEXT:
+		fz_print_stext_page_as_text(ctx, wri->out, page);
+		break;
+	case FZ_FORMAT_HTML:
+		fz_print_stext_page_as_html(ctx, wri->out, page, wri->number);
+		break;
+	case FZ_FORMAT_XHTML:
+		fz_print_stext_page_as_xhtml(ctx, wri->out, page, wri->number);
+		break;
+	case FZ_FORMAT_STEXT_XML:
+		fz_print_stext_page_as_xml(ctx, wri->out, page, wri->number);
+		break;
+	case FZ_FORMAT_STEXT_JSON:
+		if (wri->number > 1)
+			fz_write_string(ctx, wri->out, ",");
+		fz_print_stext_page_as_json(ctx, wri->out, page, 1);
+		break;
+	}
+}
+
 static void
 text_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 {
 	fz_text_writer *wri = (fz_text_writer*)wri_;
 	float s = wri->opts.scale;
 
+	if (!wri->page)
+	{
+		fz_try(ctx)
+			fz_close_device(ctx, dev);
+		fz_always(ctx)
+			fz_drop_device(ctx, dev);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return;
+	}
+
 	fz_scale_stext_page(ctx, wri->page, s);
 
 	fz_try(ctx)
 	{
 		fz_close_device(ctx, dev);
-		switch (wri->format)
-		{
-		default:
-		case FZ_FORMAT_TEXT:
-			fz_print_stext_page_as_text(ctx, wri->out, wri->page);
-			break;
-		case FZ_FORMAT_HTML:
-			fz_print_stext_page_as_html(ctx, wri->out, wri->page, wri->number);
-			break;
-		case FZ_FORMAT_XHTML:
-			fz_print_stext_page_as_xhtml(ctx, wri->out, wri->page, wri->number);
-			break;
-		case FZ_FORMAT_STEXT_XML:
-			fz_print_stext_page_as_xml(ctx, wri->out, wri->page, wri->number);
-			break;
-		case FZ_FORMAT_STEXT_JSON:
-			if (wri->number > 1)
-				fz_write_string(ctx, wri->out, ",");
-			fz_print_stext_page_as_json(ctx, wri->out, wri->page, 1);
-			break;
-		}
+		text_print_page(ctx, wri, wri->page);
 	}
 	fz_always(ctx)
 	{
@@ -1054,6 +1081,43 @@ fz_new_text_writer_with_output(fz_context *ctx, const char *format, fz_output *o
 	return (fz_document_writer*)wri;
 }
 
+const fz_stext_options *
+fz_text_writer_options(fz_context *ctx, fz_document_writer *wri)
+{
+	fz_text_writer *twri = (fz_text_writer*)wri;
+
+	if (wri == NULL || wri->begin_page != text_begin_page)
+		return NULL;
+	/* Streamed plain text never builds a page, so such pages must go
+	 * through fz_begin_page. */
+	if (twri->format == FZ_FORMAT_TEXT && (twri->opts.flags & TEXT_NEEDS_PAGE) == 0)
+		return NULL;
+	return &twri->opts;
+}
+
+void
+fz_write_stext_page(fz_context *ctx, fz_document_writer *wri_, fz_stext_page *page)
+{
+	fz_text_writer *wri = (fz_text_writer*)wri_;
+	float s;
+
+	if (wri_ == NULL || wri_->begin_page != text_begin_page)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "not a text writer");
+	if (wri_->dev)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "called write stext page while writing a page");
+
+	s = wri->opts.scale;
+	wri->number++;
+
+	if (s != 1)
+	{
+		page->mediabox = fz_transform_rect(page->mediabox, fz_scale(s, s));
+		fz_scale_stext_page(ctx, page, s);
+	}
+
+	text_print_page(ctx, wri, page);
+}
+
 fz_document_writer *
 fz_new_text_writer(fz_context *ctx, const char *format, const char *path, const char *options)
 {
@@ -1227,5 +1227,6 @@ do_para_break(fz_context *ctx, fz_stext_page *page, fz_stext_block **pfirst, fz_
 void
 fz_paragraph_break(fz_context *ctx, fz_stext_page *page)
 {
+	fz_invalidate_stext_line_index(ctx, page);
 	do_para_break(ctx, page, &page->first_block, &page->last_block, NULL);
 }
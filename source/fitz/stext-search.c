@@ -126,89 +126,382 @@ static int find_closest_in_line(fz_stext_line *line, int idx, fz_point q)
 	return closest_idx;
 }
 
-static int find_closest_in_page(fz_stext_page *page, fz_point q)
+/* Spatial index of the lines of a page */
+
+typedef struct
 {
-	fz_stext_block *block;
 	fz_stext_line *line;
-	fz_stext_line *closest_line = NULL;
-	int closest_idx = 0;
-	float closest_vdist = 1e30f;
-	float closest_hdist = 1e30f;
-	int idx = 0;
+	int idx; /* index of the first char of the line in the page */
+	float hsize;
+	fz_point p1, p2; /* ends of the mid-line */
+	fz_rect bbox; /* union of the char quads */
+} index_line;
 
-	for (block = page->first_block; block; block = block->next)
+typedef struct
+{
+	float y;
+	int i;
+} index_row;
+
+struct fz_stext_line_index
+{
+	int len;
+	int chars;
+	index_line *lines;
+
+	/* Lines running left to right, sorted by the height of their
+	 * mid-line, so that lines near a point can be found by bisection.
+	 * Lines in any other direction are always checked. */
+	int nrows;
+	index_row *rows;
+	float max_hsize;
+	int nother;
+	int *other;
+
+	/* Uniform grid of line bboxes, for rectangle queries. Cell (x,y)
+	 * holds the lines cell_lines[cell[y*w+x]] to cell_lines[cell[y*w+x+1]]. */
+	fz_rect bounds;
+	int w, h;
+	float cw, ch;
+	int *cell;
+	int *cell_lines;
+};
+
+static void
+drop_line_index(fz_context *ctx, fz_stext_line_index *index)
+{
+	if (index)
 	{
-		if (block->type != FZ_STEXT_BLOCK_TEXT)
+		fz_free(ctx, index->lines);
+		fz_free(ctx, index->rows);
+		fz_free(ctx, index->other);
+		fz_free(ctx, index->cell);
+		fz_free(ctx, index->cell_lines);
+		fz_free(ctx, index);
+	}
+}
+
+void
+fz_invalidate_stext_line_index(fz_context *ctx, fz_stext_page *page)
+{
+	if (page)
+	{
+		drop_line_index(ctx, page->line_index);
+		page->line_index = NULL;
+	}
+}
+
+static int
+cmp_index_row(const void *a_, const void *b_)
+{
+	const index_row *a = a_;
+	const index_row *b = b_;
+	if (a->y < b->y) return -1;
+	if (a->y > b->y) return 1;
+	return a->i - b->i;
+}
+
+/* Map a coordinate to a cell, rounding out so that a range of cells
+ * never misses an overlap even with degenerate bounds. */
+static int
+cell_lo(float f, int n)
+{
+	if (!(f > 0))
+		return 0;
+	if (f >= n)
+		return n - 1;
+	return (int)f;
+}
+
+static int
+cell_hi(float f, int n)
+{
+	if (!(f < n))
+		return n - 1;
+	if (f < 0)
+		return 0;
+	return (int)f;
+}
+
+static void
+cell_range(fz_stext_line_index *index, fz_rect r, int *x0, int *y0, int *x1, int *y1)
+{
+	*x0 = cell_lo((r.x0 - index->bounds.x0) / index->cw, index->w);
+	*y0 = cell_lo((r.y0 - index->bounds.y0) / index->ch, index->h);
+	*x1 = cell_hi((r.x1 - index->bounds.x0) / index->cw, index->w);
+	*y1 = cell_hi((r.y1 - index->bounds.y0) / index->ch, index->h);
+}
+
+static void
+build_line_grid(fz_context *ctx, fz_stext_line_index *index)
+{
+	int i, x, y, x0, y0, x1, y1, n;
+
+	index->bounds = fz_empty_rect;
+	for (i = 0; i < index->len; ++i)
+		index->bounds = fz_union_rect(index->bounds, index->lines[i].bbox);
+	if (fz_is_empty_rect(index->bounds))
+		return;
+
+	n = (int)sqrtf(index->len);
+	index->w = index->h = fz_clampi(n, 1, 64);
+	index->cw = (index->bounds.x1 - index->bounds.x0) / index->w;
+	index->ch = (index->bounds.y1 - index->bounds.y0) / index->h;
+
+	/* Count the lines in each cell, turn the counts into offsets, and
+	 * then fill the cells in line order. */
+	index->cell = fz_calloc(ctx, index->w * index->h + 1, sizeof *index->cell);
+	n = 0;
+	for (i = 0; i < index->len; ++i)
+	{
+		if (fz_is_empty_rect(index->lines[i].bbox))
 			continue;
-		for (line = block->u.t.first_line; line; line = line->next)
-		{
-			float hsize = largest_size_in_line(line) / 2;
-			fz_point hdir = line->dir;
-			fz_point vdir = fz_make_point(-line->dir.y, line->dir.x);
-
-			// Compute mid-line from quads!
-			fz_point p1 = fz_make_point(
-				(line->first_char->quad.ll.x + line->first_char->quad.ul.x) / 2,
-				(line->first_char->quad.ll.y + line->first_char->quad.ul.y) / 2
-			);
-			fz_point p2 = fz_make_point(
-				(line->last_char->quad.lr.x + line->last_char->quad.ur.x) / 2,
-				(line->last_char->quad.lr.y + line->last_char->quad.ur.y) / 2
-			);
-
-			// Signed distance perpendicular mid-line (positive is below)
-			float vdist = linedist(p1, vdir, q);
-
-			// Signed distance tangent to mid-line from end points (positive is to end)
-			float hdist1 = linedist(p1, hdir, q);
-			float hdist2 = linedist(p2, hdir, q);
-
-			// Within the line itself!
-			if (vdist >= -hsize && vdist <= hsize && (hdist1 > 0) != (hdist2 > 0))
-			{
-				closest_vdist = 0;
-				closest_hdist = 0;
-				closest_line = line;
-				closest_idx = idx;
-			}
-			else
-			{
-				// Vertical distance from mid-line.
-				float avdist = fz_abs(vdist);
+		cell_range(index, index->lines[i].bbox, &x0, &y0, &x1, &y1);
+		for (y = y0; y <= y1; ++y)
+			for (x = x0; x <= x1; ++x)
+				index->cell[y * index->w + x + 1]++;
+		n += (x1 - x0 + 1) * (y1 - y0 + 1);
+	}
+	for (i = 0; i < index->w * index->h; ++i)
+		index->cell[i + 1] += index->cell[i];
+
+	index->cell_lines = fz_malloc_array(ctx, n, int);
+	for (i = 0; i < index->len; ++i)
+	{
+		if (fz_is_empty_rect(index->lines[i].bbox))
+			continue;
+		cell_range(index, index->lines[i].bbox, &x0, &y0, &x1, &y1);
+		for (y = y0; y <= y1; ++y)
+			for (x = x0; x <= x1; ++x)
+				index->cell_lines[index->cell[y * index->w + x]++] = i;
+	}
+
+	/* Filling advanced each offset to the start of the next cell. */
+	for (i = index->w * index->h; i > 0; --i)
+		index->cell[i] = index->cell[i - 1];
+	index->cell[0] = 0;
+}
+
+static fz_stext_line_index *
+build_line_index(fz_context *ctx, fz_stext_page *page)
+{
+	fz_stext_line_index *index = fz_malloc_struct(ctx, fz_stext_line_index);
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int n, idx;
+
+	fz_try(ctx)
+	{
+		n = 0;
+		for (block = page->first_block; block; block = block->next)
+			if (block->type == FZ_STEXT_BLOCK_TEXT)
+				for (line = block->u.t.first_line; line; line = line->next)
+					++n;
 
-				// Horizontal distance from closest end-point
-				float ahdist = fz_min(fz_abs(hdist1), fz_abs(hdist2));
+		index->lines = fz_malloc_array(ctx, n, index_line);
+		index->rows = fz_malloc_array(ctx, n, index_row);
+		index->other = fz_malloc_array(ctx, n, int);
 
-				if (avdist < hsize)
+		idx = 0;
+		for (block = page->first_block; block; block = block->next)
+		{
+			if (block->type != FZ_STEXT_BLOCK_TEXT)
+				continue;
+			for (line = block->u.t.first_line; line; line = line->next)
+			{
+				index_line *il = &index->lines[index->len];
+
+				il->line = line;
+				il->idx = idx;
+				il->hsize = largest_size_in_line(line) / 2;
+				il->p1 = fz_make_point(
+					(line->first_char->quad.ll.x + line->first_char->quad.ul.x) / 2,
+					(line->first_char->quad.ll.y + line->first_char->quad.ul.y) / 2
+				);
+				il->p2 = fz_make_point(
+					(line->last_char->quad.lr.x + line->last_char->quad.ur.x) / 2,
+					(line->last_char->quad.lr.y + line->last_char->quad.ur.y) / 2
+				);
+				il->bbox = fz_empty_rect;
+				for (ch = line->first_char; ch; ch = ch->next)
 				{
-					// Within extended line
-					if (ahdist <= closest_hdist)
-					{
-						closest_vdist = 0;
-						closest_hdist = ahdist;
-						closest_line = line;
-						closest_idx = idx;
-					}
+					il->bbox = fz_union_rect(il->bbox, fz_rect_from_quad(ch->quad));
+					++idx;
 				}
-				else
+
+				/* Only plain left to right lines with sane numbers
+				 * can be found by bisection. */
+				if (line->dir.x == 1 && line->dir.y == 0 && il->p1.y == il->p1.y && il->hsize == il->hsize)
 				{
-					// Outside line
-					// TODO: closest column?
-					if (avdist <= closest_vdist)
-					{
-						closest_vdist = avdist;
-						closest_line = line;
-						closest_idx = idx;
-					}
+					index->rows[index->nrows].y = il->p1.y;
+					index->rows[index->nrows].i = index->len;
+					index->nrows++;
+					if (il->hsize > index->max_hsize)
+						index->max_hsize = il->hsize;
 				}
+				else
+					index->other[index->nother++] = index->len;
+
+				index->len++;
 			}
+		}
+		index->chars = idx;
+
+		qsort(index->rows, index->nrows, sizeof *index->rows, cmp_index_row);
+
+		build_line_grid(ctx, index);
+	}
+	fz_catch(ctx)
+	{
+		drop_line_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
+static fz_stext_line_index *
+line_index(fz_context *ctx, fz_stext_page *page)
+{
+	if (!page->line_index)
+		page->line_index = build_line_index(ctx, page);
+	return page->line_index;
+}
+
+/* Find the line holding char idx (or the last line if idx is past the end). */
+static int
+find_line_of_char(fz_stext_line_index *index, int idx)
+{
+	int lo = 0, hi = index->len - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (index->lines[mid].idx <= idx)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/*
+	Looking for the line closest to a point used to be a single pass over
+	the lines, keeping the best so far. Lines the point is within, or
+	level with, beat lines above or below it; among those the closest
+	wins, and later lines win ties. Points level with no line pick the
+	line nearest above or below. The tally below gives the same answer
+	from the lines in any order, so most of them can be skipped.
+*/
+typedef struct
+{
+	float level; /* best horizontal distance among level lines */
+	int level_line;
+	int first_level;
+	int zero_line; /* last zero height line running through the point */
+	float apart; /* best vertical distance among other lines */
+	int apart_line;
+} closest_tally;
+
+static void
+tally_line(fz_stext_line_index *index, closest_tally *t, int i, fz_point q)
+{
+	index_line *il = &index->lines[i];
+	fz_stext_line *line = il->line;
+	fz_point hdir = line->dir;
+	fz_point vdir = fz_make_point(-line->dir.y, line->dir.x);
+
+	// Signed distance perpendicular mid-line (positive is below)
+	float vdist = linedist(il->p1, vdir, q);
+
+	// Signed distance tangent to mid-line from end points (positive is to end)
+	float hdist1 = linedist(il->p1, hdir, q);
+	float hdist2 = linedist(il->p2, hdir, q);
+
+	float avdist = fz_abs(vdist);
+	float d;
+
+	// Within the line itself!
+	if (vdist >= -il->hsize && vdist <= il->hsize && (hdist1 > 0) != (hdist2 > 0))
+		d = 0;
+	// Within extended line
+	else if (avdist < il->hsize)
+		d = fz_min(fz_abs(hdist1), fz_abs(hdist2));
+	// Outside line
+	else
+	{
+		if (!(avdist <= 1e30f))
+			return;
+		if (avdist == 0 && i > t->zero_line)
+			t->zero_line = i;
+		if (avdist < t->apart || (avdist == t->apart && i > t->apart_line))
+		{
+			t->apart = avdist;
+			t->apart_line = i;
+		}
+		return;
+	}
+
+	if (!(d <= 1e30f))
+		return;
+	if (i < t->first_level)
+		t->first_level = i;
+	if (d < t->level || (d == t->level && i > t->level_line))
+	{
+		t->level = d;
+		t->level_line = i;
+	}
+}
+
+static int
+find_closest_in_page(fz_context *ctx, fz_stext_page *page, fz_point q)
+{
+	fz_stext_line_index *index = line_index(ctx, page);
+	closest_tally t = { 1e30f, -1, INT_MAX, -1, 1e30f, -1 };
+	int i, lo, hi, mid, k;
 
-			idx += line_length(line);
+	for (i = 0; i < index->nother; ++i)
+		tally_line(index, &t, index->other[i], q);
+
+	if (q.y == q.y)
+	{
+		/* The vertical distance of q.y from a row only falls as the rows
+		 * go down the page, so the rows level with q.y are a range,
+		 * and the nearest rows outside it are the ones either side. */
+		lo = 0, hi = index->nrows;
+		while (lo < hi)
+		{
+			mid = (lo + hi) / 2;
+			if (q.y - index->rows[mid].y > index->max_hsize)
+				lo = mid + 1;
+			else
+				hi = mid;
 		}
+		for (i = lo; i < index->nrows && !(q.y - index->rows[i].y < -index->max_hsize); ++i)
+			tally_line(index, &t, index->rows[i].i, q);
+		hi = i;
+		for (k = lo - 1; k >= 0 && q.y - index->rows[k].y == q.y - index->rows[lo - 1].y; --k)
+			tally_line(index, &t, index->rows[k].i, q);
+		for (k = hi; k < index->nrows && q.y - index->rows[k].y == q.y - index->rows[hi].y; ++k)
+			tally_line(index, &t, index->rows[k].i, q);
+	}
+	else
+	{
+		for (i = 0; i < index->nrows; ++i)
+			tally_line(index, &t, index->rows[i].i, q);
+	}
+
+	if (t.level_line >= 0)
+	{
+		i = t.level_line;
+		if (t.zero_line > t.first_level && t.zero_line > i)
+			i = t.zero_line;
 	}
+	else
+		i = t.apart_line;
 
-	if (closest_line)
-		return find_closest_in_line(closest_line, closest_idx, q);
+	if (i >= 0)
+		return find_closest_in_line(index->lines[i].line, index->lines[i].idx, q);
 
 	return 0;
 }
@@ -223,14 +516,14 @@ struct callbacks
 static void
 fz_enumerate_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_point b, struct callbacks *cb)
 {
-	fz_stext_block *block;
+	fz_stext_line_index *index;
 	fz_stext_line *line;
 	fz_stext_char *ch;
-	int idx, start, end;
+	int i, idx, start, end;
 	int inside;
 
-	start = find_closest_in_page(page, a);
-	end = find_closest_in_page(page, b);
+	start = find_closest_in_page(ctx, page, a);
+	end = find_closest_in_page(ctx, page, b);
 
 	if (start > end)
 		idx = start, start = end, end = idx;
@@ -238,42 +531,41 @@ fz_enumerate_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_poin
 	if (start == end)
 		return;
 
+	index = page->line_index;
+	i = find_line_of_char(index, start);
+
 	inside = 0;
-	idx = 0;
-	for (block = page->first_block; block; block = block->next)
+	idx = index->lines[i].idx;
+	for (; i < index->len; ++i)
 	{
-		if (block->type != FZ_STEXT_BLOCK_TEXT)
-			continue;
-		for (line = block->u.t.first_line; line; line = line->next)
+		line = index->lines[i].line;
+		for (ch = line->first_char; ch; ch = ch->next)
 		{
-			for (ch = line->first_char; ch; ch = ch->next)
-			{
-				if (!inside)
-					if (idx == start)
-						inside = 1;
-				if (inside)
-					cb->on_char(ctx, cb->arg, line, ch);
-				if (++idx == end)
-					return;
-			}
+			if (!inside)
+				if (idx == start)
+					inside = 1;
 			if (inside)
-				cb->on_line(ctx, cb->arg, line);
+				cb->on_char(ctx, cb->arg, line, ch);
+			if (++idx == end)
+				return;
 		}
+		if (inside)
+			cb->on_line(ctx, cb->arg, line);
 	}
 }
 
 fz_quad
 fz_snap_selection(fz_context *ctx, fz_stext_page *page, fz_point *a, fz_point *b, int mode)
 {
-	fz_stext_block *block;
+	fz_stext_line_index *index;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 	fz_quad handles;
-	int idx, start, end;
+	int i, idx, start, end;
 	int pc;
 
-	start = find_closest_in_page(page, *a);
-	end = find_closest_in_page(page, *b);
+	start = find_closest_in_page(ctx, page, *a);
+	end = find_closest_in_page(ctx, page, *b);
 
 	if (start > end)
 		idx = start, start = end, end = idx;
@@ -281,48 +573,51 @@ fz_snap_selection(fz_context *ctx, fz_stext_page *page, fz_point *a, fz_point *b
 	handles.ll = handles.ul = *a;
 	handles.lr = handles.ur = *b;
 
-	idx = 0;
-	for (block = page->first_block; block; block = block->next)
+	/* Every mode snaps the start to the start of a line at the latest,
+	 * so nothing before the line holding the start can matter. */
+	index = page->line_index;
+	if (index->len == 0)
+		return handles;
+	i = find_line_of_char(index, start);
+
+	idx = index->lines[i].idx;
+	for (; i < index->len; ++i)
 	{
-		if (block->type != FZ_STEXT_BLOCK_TEXT)
-			continue;
-		for (line = block->u.t.first_line; line; line = line->next)
+		line = index->lines[i].line;
+		pc = '\n';
+		for (ch = line->first_char; ch; ch = ch->next)
 		{
-			pc = '\n';
-			for (ch = line->first_char; ch; ch = ch->next)
+			if (idx <= start)
 			{
-				if (idx <= start)
+				if (mode == FZ_SELECT_CHARS
+					|| (mode == FZ_SELECT_WORDS && (pc == ' ' || pc == '\n'))
+					|| (mode == FZ_SELECT_LINES && (pc == '\n')))
 				{
-					if (mode == FZ_SELECT_CHARS
-						|| (mode == FZ_SELECT_WORDS && (pc == ' ' || pc == '\n'))
-						|| (mode == FZ_SELECT_LINES && (pc == '\n')))
-					{
-						handles.ll = ch->quad.ll;
-						handles.ul = ch->quad.ul;
-						*a = ch->origin;
-					}
+					handles.ll = ch->quad.ll;
+					handles.ul = ch->quad.ul;
+					*a = ch->origin;
 				}
-				if (idx >= end)
+			}
+			if (idx >= end)
+			{
+				if (mode == FZ_SELECT_CHARS
+					|| (mode == FZ_SELECT_WORDS && (ch->c == ' ')))
 				{
-					if (mode == FZ_SELECT_CHARS
-						|| (mode == FZ_SELECT_WORDS && (ch->c == ' ')))
-					{
-						handles.lr = ch->quad.ll;
-						handles.ur = ch->quad.ul;
-						*b = ch->origin;
-						return handles;
-					}
-					if (!ch->next)
-					{
-						handles.lr = ch->quad.lr;
-						handles.ur = ch->quad.ur;
-						*b = ch->quad.lr;
-						return handles;
-					}
+					handles.lr = ch->quad.ll;
+					handles.ur = ch->quad.ul;
+					*b = ch->origin;
+					return handles;
+				}
+				if (!ch->next)
+				{
+					handles.lr = ch->quad.lr;
+					handles.ur = ch->quad.ur;
+					*b = ch->quad.lr;
+					return handles;
 				}
-				pc = ch->c;
-				++idx;
 			}
+			pc = ch->c;
+			++idx;
 		}
 	}
 
@@ -465,47 +760,92 @@ fz_copy_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_point b,
 	return (char*)s;
 }
 
+static int
+cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Collect the lines whose cells overlap area, in page order. */
+static int *
+lines_in_rect(fz_context *ctx, fz_stext_line_index *index, fz_rect area, int *np)
+{
+	int *list;
+	int x0, y0, x1, y1, x, y, k, n, m;
+
+	*np = 0;
+	if (index->w == 0 || fz_is_empty_rect(fz_intersect_rect(area, index->bounds)))
+		return NULL;
+
+	cell_range(index, area, &x0, &y0, &x1, &y1);
+	n = 0;
+	for (y = y0; y <= y1; ++y)
+		n += index->cell[y * index->w + x1 + 1] - index->cell[y * index->w + x0];
+	if (n == 0)
+		return NULL;
+
+	list = fz_malloc_array(ctx, n, int);
+	n = 0;
+	for (y = y0; y <= y1; ++y)
+		for (x = x0; x <= x1; ++x)
+			for (k = index->cell[y * index->w + x]; k < index->cell[y * index->w + x + 1]; ++k)
+				list[n++] = index->cell_lines[k];
+
+	qsort(list, n, sizeof *list, cmp_int);
+	for (m = 0, k = 0; k < n; ++k)
+		if (m == 0 || list[m - 1] != list[k])
+			list[m++] = list[k];
+
+	*np = m;
+	return list;
+}
+
 char *
 fz_copy_rectangle(fz_context *ctx, fz_stext_page *page, fz_rect area, int crlf)
 {
-	fz_stext_block *block;
+	fz_stext_line_index *index;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 	fz_buffer *buffer;
 	unsigned char *s;
+	int *lines = NULL;
+	int i, n;
 
 	int need_new_line = 0;
 
+	index = line_index(ctx, page);
+
+	fz_var(lines);
+
 	buffer = fz_new_buffer(ctx, 1024);
 	fz_try(ctx)
 	{
-		for (block = page->first_block; block; block = block->next)
+		lines = lines_in_rect(ctx, index, area, &n);
+		for (i = 0; i < n; ++i)
 		{
-			if (block->type != FZ_STEXT_BLOCK_TEXT)
-				continue;
-			for (line = block->u.t.first_line; line; line = line->next)
+			int line_had_text = 0;
+			line = index->lines[lines[i]].line;
+			for (ch = line->first_char; ch; ch = ch->next)
 			{
-				int line_had_text = 0;
-				for (ch = line->first_char; ch; ch = ch->next)
+				fz_rect r = fz_rect_from_quad(ch->quad);
+				if (!fz_is_empty_rect(fz_intersect_rect(r, area)))
 				{
-					fz_rect r = fz_rect_from_quad(ch->quad);
-					if (!fz_is_empty_rect(fz_intersect_rect(r, area)))
+					line_had_text = 1;
+					if (need_new_line)
 					{
-						line_had_text = 1;
-						if (need_new_line)
-						{
-							fz_append_string(ctx, buffer, crlf ? "\r\n" : "\n");
-							need_new_line = 0;
-						}
-						fz_append_rune(ctx, buffer, ch->c < 32 ? FZ_REPLACEMENT_CHARACTER : ch->c);
+						fz_append_string(ctx, buffer, crlf ? "\r\n" : "\n");
+						need_new_line = 0;
 					}
+					fz_append_rune(ctx, buffer, ch->c < 32 ? FZ_REPLACEMENT_CHARACTER : ch->c);
 				}
-				if (line_had_text)
-					need_new_line = 1;
 			}
+			if (line_had_text)
+				need_new_line = 1;
 		}
 		fz_terminate_buffer(ctx, buffer);
 	}
+	fz_always(ctx)
+		fz_free(ctx, lines);
 	fz_catch(ctx)
 	{
 		fz_drop_buffer(ctx, buffer);
@@ -541,44 +881,6 @@ static inline int chartocanon(int *c, const char *s)
 	return n;
 }
 
-static const char *match_string(const char *h, const char *n)
-{
-	int hc, nc;
-	const char *e = h;
-	h += chartocanon(&hc, h);
-	n += chartocanon(&nc, n);
-	while (hc == nc)
-	{
-		e = h;
-		if (hc == ' ')
-			do
-				h += chartocanon(&hc, h);
-			while (hc == ' ');
-		else
-			h += chartocanon(&hc, h);
-		if (nc == ' ')
-			do
-				n += chartocanon(&nc, n);
-			while (nc == ' ');
-		else
-			n += chartocanon(&nc, n);
-	}
-	return nc == 0 ? e : NULL;
-}
-
-static const char *find_string(const char *s, const char *needle, const char **endp)
-{
-	const char *end;
-	while (*s)
-	{
-		end = match_string(s, needle);
-		if (end)
-			return *endp = end, s;
-		++s;
-	}
-	return *endp = NULL, NULL;
-}
-
 struct search_data
 {
 	/* Number of hits so far.*/
@@ -593,23 +895,23 @@ struct search_data
 	void *opaque;
 };
 
-static int hit_char(fz_context *ctx, struct search_data *hits, fz_stext_line *line, fz_stext_char *ch, int is_at_start)
+static int hit_char(fz_context *ctx, struct search_data *hits, fz_point dir, fz_quad quad, float size, int is_at_start)
 {
-	float vfuzz = ch->size * hits->vfuzz;
-	float hfuzz = ch->size * hits->hfuzz;
+	float vfuzz = size * hits->vfuzz;
+	float hfuzz = size * hits->hfuzz;
 
 	/* Can we continue an existing quad? */
 	if (hits->quad_fill > 0 && !is_at_start)
 	{
 		fz_quad *end = &hits->quads[hits->quad_fill-1];
-		if (hdist(&line->dir, &end->lr, &ch->quad.ll) < hfuzz
-			&& vdist(&line->dir, &end->lr, &ch->quad.ll) < vfuzz
-			&& hdist(&line->dir, &end->ur, &ch->quad.ul) < hfuzz
-			&& vdist(&line->dir, &end->ur, &ch->quad.ul) < vfuzz)
+		if (hdist(&dir, &end->lr, &quad.ll) < hfuzz
+			&& vdist(&dir, &end->lr, &quad.ll) < vfuzz
+			&& hdist(&dir, &end->ur, &quad.ul) < hfuzz
+			&& vdist(&dir, &end->ur, &quad.ul) < vfuzz)
 		{
 			/* Yes */
-			end->ur = ch->quad.ur;
-			end->lr = ch->quad.lr;
+			end->ur = quad.ur;
+			end->lr = quad.lr;
 			return 0;
 		}
 	}
@@ -637,106 +939,448 @@ static int hit_char(fz_context *ctx, struct search_data *hits, fz_stext_line *li
 		}
 		hits->max_quads = newmax;
 	}
-	hits->quads[hits->quad_fill++] = ch->quad;
+	hits->quads[hits->quad_fill++] = quad;
 	hits->count_quads++;
 
 	return 0;
 }
 
-int
-fz_search_stext_page_cb(fz_context *ctx, fz_stext_page *page, const char *needle, fz_search_callback_fn *cb, void *opaque)
+static void init_search_data(struct search_data *hits, fz_search_callback_fn *cb, void *opaque)
+{
+	hits->count_quads = 0;
+	hits->count_hits = 0;
+	hits->quad_fill = 0;
+	hits->max_quads = nelem(hits->locals);
+	hits->quads = hits->locals;
+	hits->hfuzz = 0.2f; /* merge kerns but not large gaps */
+	hits->vfuzz = 0.1f;
+	hits->cb = cb;
+	hits->opaque = opaque;
+}
+
+static void drop_search_data(fz_context *ctx, struct search_data *hits)
+{
+	if (hits->quads != hits->locals)
+		fz_free(ctx, hits->quads);
+	hits->quads = hits->locals;
+}
+
+/* Send the quads we have queued. */
+static int flush_hits(fz_context *ctx, struct search_data *hits)
+{
+	if (hits->quad_fill == 0)
+		return 0;
+	hits->count_hits++;
+	if (hits->cb && hits->cb(ctx, hits->opaque, hits->quad_fill, hits->quads))
+		return 1;
+	hits->quad_fill = 0;
+	return 0;
+}
+
+/* A character of a page as kept in a search index (see below). */
+typedef struct
+{
+	int offset;
+	float size;
+	fz_point dir;
+	fz_quad quad;
+} index_char;
+
+/*
+	The text of a page as the search sees it: canonicalised, with the
+	line and block breaks of fz_new_buffer_from_stext_page as whitespace,
+	and each run of whitespace collapsed into a single element.
+
+	For each element we keep the first character at or after it, and
+	whether it starts with that character (rather than a line or block
+	break). From these we can work out which characters each match
+	covers, exactly as the byte offsets into the buffer would.
+*/
+typedef struct
+{
+	int len;
+	int *text;
+	int *start;
+	unsigned char *real;
+	int nchars;
+	fz_stext_char **chars;
+	fz_stext_line **lines;
+	index_char *ichars;
+	int *elem;
+} search_text;
+
+static void
+linearize_page(fz_context *ctx, fz_stext_page *page, search_text *st)
 {
-	struct search_data hits;
 	fz_stext_block *block;
 	fz_stext_line *line;
 	fz_stext_char *ch;
-	fz_buffer *buffer;
-	const char *haystack, *begin, *end;
-	int c, inside;
+	int max_len = 0, max_chars = 0;
+	int n = 0, k = 0;
+	int c;
 
-	if (strlen(needle) == 0)
-		return 0;
+	for (block = page->first_block; block; block = block->next)
+	{
+		if (block->type != FZ_STEXT_BLOCK_TEXT)
+			continue;
+		for (line = block->u.t.first_line; line; line = line->next)
+		{
+			for (ch = line->first_char; ch; ch = ch->next)
+				++max_chars;
+			++max_len;
+		}
+		++max_len;
+	}
+	max_len += max_chars;
 
-	hits.count_quads = 0;
-	hits.count_hits = 0;
-	hits.quad_fill = 0;
-	hits.max_quads = nelem(hits.locals);
-	hits.quads = hits.locals;
-	hits.hfuzz = 0.2f; /* merge kerns but not large gaps */
-	hits.vfuzz = 0.1f;
-	hits.cb = cb;
-	hits.opaque = opaque;
+	st->text = fz_malloc_array(ctx, max_len, int);
+	st->start = fz_malloc_array(ctx, max_len, int);
+	st->real = fz_malloc(ctx, max_len);
+	st->chars = fz_malloc_array(ctx, max_chars, fz_stext_char *);
+	st->lines = fz_malloc_array(ctx, max_chars, fz_stext_line *);
+	st->elem = fz_malloc_array(ctx, max_chars, int);
 
-	buffer = fz_new_buffer_from_stext_page(ctx, page);
-	fz_try(ctx)
+	for (block = page->first_block; block; block = block->next)
 	{
-		haystack = fz_string_from_buffer(ctx, buffer);
-		begin = find_string(haystack, needle, &end);
-		if (!begin)
-			goto no_more_matches;
-
-		inside = 0;
-		for (block = page->first_block; block; block = block->next)
+		if (block->type != FZ_STEXT_BLOCK_TEXT)
+			continue;
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-			if (block->type != FZ_STEXT_BLOCK_TEXT)
-				continue;
-			for (line = block->u.t.first_line; line; line = line->next)
+			for (ch = line->first_char; ch; ch = ch->next)
 			{
-				for (ch = line->first_char; ch; ch = ch->next)
+				/* A zero character ends the buffer text. */
+				if (ch->c == 0)
+					goto done;
+				c = (unsigned int)ch->c > 0x10FFFF ? FZ_REPLACEMENT_CHARACTER : ch->c;
+				c = canon(c);
+				if (c == ' ' && n > 0 && st->text[n-1] == ' ')
+					st->elem[k] = n - 1;
+				else
 				{
-try_new_match:
-					if (!inside)
-					{
-						if (haystack >= begin)
-							inside = 1;
-					}
-					if (inside)
-					{
-						if (haystack < end)
-						{
-							if (hit_char(ctx, &hits, line, ch, haystack == begin))
-								goto no_more_matches;
-						}
-						else
-						{
-							inside = 0;
-							begin = find_string(haystack, needle, &end);
-							if (!begin)
-								goto no_more_matches;
-							else
-								goto try_new_match;
-						}
-					}
-					haystack += fz_chartorune(&c, haystack);
+					st->text[n] = c;
+					st->start[n] = k;
+					st->real[n] = 1;
+					st->elem[k] = n++;
 				}
-				assert(*haystack == '\n');
-				++haystack;
+				st->chars[k] = ch;
+				st->lines[k] = line;
+				++k;
+			}
+			if (n == 0 || st->text[n-1] != ' ')
+			{
+				st->text[n] = ' ';
+				st->start[n] = k;
+				st->real[n++] = 0;
 			}
-			assert(*haystack == '\n');
-			++haystack;
 		}
-no_more_matches:
-		/* Send the quads we have queued. */
-		if (hits.quad_fill)
+		if (n == 0 || st->text[n-1] != ' ')
 		{
-			hits.count_hits++;
-			if (hits.cb)
-				(void)hits.cb(ctx, hits.opaque, hits.quad_fill, hits.quads);
+			st->text[n] = ' ';
+			st->start[n] = k;
+			st->real[n++] = 0;
 		}
 	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, buffer);
-		if (hits.quads != hits.locals)
-			fz_free(ctx, hits.quads);
-	}
-	fz_catch(ctx)
-		fz_rethrow(ctx);
-
-	return hits.count_hits;
+done:
+	st->len = n;
+	st->nchars = k;
 }
 
-typedef struct
+static void
+drop_search_text(fz_context *ctx, search_text *st)
+{
+	fz_free(ctx, st->text);
+	fz_free(ctx, st->start);
+	fz_free(ctx, st->real);
+	fz_free(ctx, st->chars);
+	fz_free(ctx, st->lines);
+	fz_free(ctx, st->elem);
+}
+
+/*
+	A needle compiled for Boyer-Moore-Horspool searching of a
+	search_text, along with the state of its search through one.
+
+	The search resumes at the first character after the previous
+	match. If that is not at the start of its element (it is part
+	of a run of whitespace) the match there starts at that character.
+*/
+typedef struct
+{
+	int len;
+	int *text;
+	int shift[256];
+	int next;
+	int from;
+	int from_char;
+	int done;
+	struct search_data hits;
+} search_needle;
+
+/* Start the search again from the beginning of a (new) text. */
+static void
+rewind_needle(search_needle *sn)
+{
+	sn->from = 0;
+	sn->from_char = -1;
+	sn->done = 0;
+}
+
+static void
+compile_needle(fz_context *ctx, search_needle *sn, const char *needle)
+{
+	int c, i;
+
+	sn->text = fz_malloc_array(ctx, strlen(needle), int);
+	sn->len = 0;
+	while (*needle)
+	{
+		needle += chartocanon(&c, needle);
+		if (c == ' ' && sn->len > 0 && sn->text[sn->len-1] == ' ')
+			continue;
+		sn->text[sn->len++] = c;
+	}
+
+	for (i = 0; i < 256; ++i)
+		sn->shift[i] = sn->len;
+	for (i = 0; i < sn->len - 1; ++i)
+		sn->shift[sn->text[i] & 255] = sn->len - 1 - i;
+
+	rewind_needle(sn);
+}
+
+static int
+match_needle(search_text *st, search_needle *sn, int i)
+{
+	int j;
+	if (i + sn->len > st->len)
+		return 0;
+	for (j = 0; j < sn->len; ++j)
+		if (st->text[i + j] != sn->text[j])
+			return 0;
+	return 1;
+}
+
+static int
+find_needle(search_text *st, search_needle *sn)
+{
+	const int *h = st->text;
+	const int *n = sn->text;
+	int m = sn->len;
+	int i = sn->from;
+	int j;
+
+	while (i + m <= st->len)
+	{
+		j = m - 1;
+		while (j >= 0 && h[i + j] == n[j])
+			--j;
+		if (j < 0)
+			return i;
+		i += sn->shift[h[i + m - 1] & 255];
+	}
+	return -1;
+}
+
+/* Report the characters covered by a match at element i, and move the
+ * needle on to the character after them. Returns 1 to abort. */
+static int
+hit_needle(fz_context *ctx, search_text *st, search_needle *sn, int i)
+{
+	int e = i + sn->len - 1;
+	int first = st->start[i];
+	int real = st->real[i];
+	int stop, k;
+
+	if (i == sn->from && sn->from_char >= 0 && !(real && first == sn->from_char))
+	{
+		first = sn->from_char;
+		real = 1;
+	}
+
+	if (e == i)
+		stop = real ? first + 1 : first;
+	else
+		stop = st->real[e] ? st->start[e] + 1 : st->start[e];
+
+	for (k = first; k < stop; ++k)
+	{
+		if (st->ichars)
+		{
+			index_char *ch = &st->ichars[k];
+			if (hit_char(ctx, &sn->hits, ch->dir, ch->quad, ch->size, real && k == first))
+				return 1;
+		}
+		else
+		{
+			fz_stext_char *ch = st->chars[k];
+			if (hit_char(ctx, &sn->hits, st->lines[k]->dir, ch->quad, ch->size, real && k == first))
+				return 1;
+		}
+	}
+
+	if (stop >= st->nchars)
+		sn->done = 1;
+	else
+	{
+		sn->from = st->elem[stop];
+		sn->from_char = stop;
+	}
+
+	return 0;
+}
+
+/* Report every match of the needle in the text. Returns 1 to abort. */
+static int
+search_needle_in_text(fz_context *ctx, search_text *st, search_needle *sn)
+{
+	int i;
+
+	while (!sn->done)
+	{
+		i = find_needle(st, sn);
+		if (i < 0)
+			break;
+		if (hit_needle(ctx, st, sn, i))
+			return 1;
+	}
+	return flush_hits(ctx, &sn->hits);
+}
+
+static void
+drop_needle(fz_context *ctx, search_needle *sn)
+{
+	fz_free(ctx, sn->text);
+	drop_search_data(ctx, &sn->hits);
+}
+
+int
+fz_search_stext_page_cb(fz_context *ctx, fz_stext_page *page, const char *needle, fz_search_callback_fn *cb, void *opaque)
+{
+	search_text st = { 0 };
+	search_needle sn = { 0 };
+
+	if (strlen(needle) == 0)
+		return 0;
+
+	init_search_data(&sn.hits, cb, opaque);
+
+	fz_try(ctx)
+	{
+		linearize_page(ctx, page, &st);
+		compile_needle(ctx, &sn, needle);
+		(void)search_needle_in_text(ctx, &st, &sn);
+	}
+	fz_always(ctx)
+	{
+		drop_search_text(ctx, &st);
+		drop_needle(ctx, &sn);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return sn.hits.count_hits;
+}
+
+struct multi_search_data
+{
+	fz_search_multi_callback_fn *cb;
+	void *opaque;
+	int needle;
+};
+
+static int
+multi_hit_cb(fz_context *ctx, void *opaque, int num_quads, fz_quad *quads)
+{
+	struct multi_search_data *data = opaque;
+	if (data->cb)
+		return data->cb(ctx, data->opaque, data->needle, num_quads, quads);
+	return 0;
+}
+
+/*
+	Search for all the needles in one pass over the page text. Each
+	element is checked against only the needles starting with the same
+	character (or one that hashes alike), and each needle keeps its own
+	place so that its hits are the same as searching for it alone.
+*/
+int
+fz_search_stext_page_multi_cb(fz_context *ctx, fz_stext_page *page, int count, const char **needles, fz_search_multi_callback_fn *cb, void *opaque)
+{
+	search_text st = { 0 };
+	search_needle *sn = NULL;
+	struct multi_search_data *data = NULL;
+	int bucket[256];
+	int i, k, total = 0;
+
+	fz_var(sn);
+	fz_var(data);
+
+	if (count <= 0)
+		return 0;
+
+	fz_try(ctx)
+	{
+		sn = fz_malloc_array(ctx, count, search_needle);
+		memset(sn, 0, count * sizeof *sn);
+		data = fz_malloc_array(ctx, count, struct multi_search_data);
+
+		for (i = 0; i < 256; ++i)
+			bucket[i] = -1;
+		for (k = count - 1; k >= 0; --k)
+		{
+			data[k].cb = cb;
+			data[k].opaque = opaque;
+			data[k].needle = k;
+			init_search_data(&sn[k].hits, multi_hit_cb, &data[k]);
+			if (strlen(needles[k]) == 0)
+			{
+				sn[k].done = 1;
+				continue;
+			}
+			compile_needle(ctx, &sn[k], needles[k]);
+			sn[k].next = bucket[sn[k].text[0] & 255];
+			bucket[sn[k].text[0] & 255] = k;
+		}
+
+		linearize_page(ctx, page, &st);
+
+		for (i = 0; i < st.len; ++i)
+		{
+			for (k = bucket[st.text[i] & 255]; k >= 0; k = sn[k].next)
+			{
+				/* A match may leave the needle at this same element,
+				 * starting part way through a run of whitespace. */
+				while (!sn[k].done && sn[k].from <= i && match_needle(&st, &sn[k], i))
+				{
+					if (hit_needle(ctx, &st, &sn[k], i))
+						goto stop;
+				}
+			}
+		}
+
+		for (k = 0; k < count; ++k)
+			if (flush_hits(ctx, &sn[k].hits))
+				break;
+stop:
+		for (k = 0; k < count; ++k)
+			total += sn[k].hits.count_hits;
+	}
+	fz_always(ctx)
+	{
+		drop_search_text(ctx, &st);
+		if (sn)
+			for (k = 0; k < count; ++k)
+				drop_needle(ctx, &sn[k]);
+		fz_free(ctx, sn);
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return total;
+}
+
+typedef struct
 {
 	int *hit_mark;
 	fz_quad *quads;
@@ -780,3 +1424,628 @@ fz_search_stext_page(fz_context *ctx, fz_stext_page *page, const char *needle, i
 	(void)fz_search_stext_page_cb(ctx, page, needle, oldsearch_cb, &data);
 	return data.fill; /* Return the number of quads we have read */
 }
+
+/* Search index */
+
+/*
+	For each page we keep the same text as fz_new_buffer_from_stext_page
+	gives, so that searching it matches exactly as searching the page
+	would, along with the position in that text and the geometry of
+	each character.
+
+	Pages are found by looking up the trigrams of the compiled needle
+	in a hash table that lists the pages each trigram appears on, and
+	then searched with the same matcher as fz_search_stext_page_cb.
+*/
+
+typedef struct
+{
+	int indexed;
+	int len;
+	char *text;
+	int nchars;
+	index_char *chars;
+} index_page;
+
+typedef struct
+{
+	uint64_t key;
+	int len, cap;
+	int *pages;
+} index_gram;
+
+struct fz_search_index
+{
+	int page_count;
+	index_page *pages;
+	int gram_count, gram_cap;
+	index_gram *grams;
+};
+
+#define SEARCH_INDEX_MAGIC "MUSRCHX1"
+
+fz_search_index *
+fz_new_search_index(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_search_index);
+}
+
+static void
+drop_index_page(fz_context *ctx, index_page *page)
+{
+	fz_free(ctx, page->text);
+	fz_free(ctx, page->chars);
+	memset(page, 0, sizeof *page);
+}
+
+void
+fz_drop_search_index(fz_context *ctx, fz_search_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+	for (i = 0; i < index->page_count; ++i)
+		drop_index_page(ctx, &index->pages[i]);
+	for (i = 0; i < index->gram_cap; ++i)
+		fz_free(ctx, index->grams[i].pages);
+	fz_free(ctx, index->pages);
+	fz_free(ctx, index->grams);
+	fz_free(ctx, index);
+}
+
+static inline uint64_t
+gram_key(int a, int b, int c)
+{
+	return ((uint64_t)(a & 0x1fffff) << 42) | ((uint64_t)(b & 0x1fffff) << 21) | (uint64_t)(c & 0x1fffff);
+}
+
+static inline unsigned int
+gram_hash(uint64_t key)
+{
+	key *= 0x9e3779b97f4a7c15ull;
+	return (unsigned int)(key >> 32);
+}
+
+static index_gram *
+lookup_gram(fz_search_index *index, uint64_t key)
+{
+	unsigned int mask, pos;
+
+	if (index->gram_cap == 0)
+		return NULL;
+	mask = index->gram_cap - 1;
+	pos = gram_hash(key) & mask;
+	while (index->grams[pos].key != 0)
+	{
+		if (index->grams[pos].key == key)
+			return &index->grams[pos];
+		pos = (pos + 1) & mask;
+	}
+	return NULL;
+}
+
+static index_gram *
+insert_gram(fz_context *ctx, fz_search_index *index, uint64_t key)
+{
+	unsigned int mask, pos;
+	index_gram *gram;
+	int i;
+
+	gram = lookup_gram(index, key);
+	if (gram)
+		return gram;
+
+	/* Keep the table at most half full. */
+	if ((index->gram_count + 1) * 2 > index->gram_cap)
+	{
+		int old_cap = index->gram_cap;
+		index_gram *old = index->grams;
+		int new_cap = old_cap ? old_cap * 2 : 1024;
+
+		index->grams = fz_malloc_array(ctx, new_cap, index_gram);
+		memset(index->grams, 0, new_cap * sizeof *index->grams);
+		index->gram_cap = new_cap;
+		mask = new_cap - 1;
+		for (i = 0; i < old_cap; ++i)
+		{
+			if (old[i].key == 0)
+				continue;
+			pos = gram_hash(old[i].key) & mask;
+			while (index->grams[pos].key != 0)
+				pos = (pos + 1) & mask;
+			index->grams[pos] = old[i];
+		}
+		fz_free(ctx, old);
+	}
+
+	mask = index->gram_cap - 1;
+	pos = gram_hash(key) & mask;
+	while (index->grams[pos].key != 0)
+		pos = (pos + 1) & mask;
+	index->grams[pos].key = key;
+	index->gram_count++;
+	return &index->grams[pos];
+}
+
+/* Find where a page number is, or would go, in a sorted list of pages. */
+static int
+find_gram_page(index_gram *gram, int number)
+{
+	int l = 0, r = gram->len;
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (gram->pages[m] < number)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l;
+}
+
+static int
+gram_has_page(index_gram *gram, int number)
+{
+	int i = find_gram_page(gram, number);
+	return i < gram->len && gram->pages[i] == number;
+}
+
+static void
+add_gram_page(fz_context *ctx, fz_search_index *index, uint64_t key, int number)
+{
+	index_gram *gram = insert_gram(ctx, index, key);
+	int i = find_gram_page(gram, number);
+
+	if (i < gram->len && gram->pages[i] == number)
+		return;
+	if (gram->len == gram->cap)
+	{
+		int new_cap = gram->cap ? gram->cap * 2 : 4;
+		gram->pages = fz_realloc_array(ctx, gram->pages, new_cap, int);
+		gram->cap = new_cap;
+	}
+	memmove(gram->pages + i + 1, gram->pages + i, (gram->len - i) * sizeof(int));
+	gram->pages[i] = number;
+	gram->len++;
+}
+
+static void
+remove_gram_page(fz_context *ctx, fz_search_index *index, uint64_t key, int number)
+{
+	index_gram *gram = lookup_gram(index, key);
+	int i;
+
+	if (!gram)
+		return;
+	i = find_gram_page(gram, number);
+	if (i < gram->len && gram->pages[i] == number)
+	{
+		memmove(gram->pages + i, gram->pages + i + 1, (gram->len - i - 1) * sizeof(int));
+		gram->len--;
+	}
+}
+
+/* Call fn for each trigram of the canonicalised text, with runs of
+ * whitespace collapsed into one space. */
+static void
+for_each_gram(fz_context *ctx, fz_search_index *index, const char *s, int number,
+	void (*fn)(fz_context *ctx, fz_search_index *index, uint64_t key, int number))
+{
+	int a = 0, b = 0, c, n = 0;
+
+	while (*s)
+	{
+		s += chartocanon(&c, s);
+		if (c == ' ' && b == ' ' && n > 0)
+			continue;
+		if (++n >= 3)
+			fn(ctx, index, gram_key(a, b, c), number);
+		a = b;
+		b = c;
+	}
+}
+
+static void
+ensure_index_page(fz_context *ctx, fz_search_index *index, int number)
+{
+	int n;
+
+	if (number < index->page_count)
+		return;
+	n = fz_maxi(number + 1, index->page_count * 2);
+	index->pages = fz_realloc_array(ctx, index->pages, n, index_page);
+	memset(index->pages + index->page_count, 0, (n - index->page_count) * sizeof(index_page));
+	index->page_count = n;
+}
+
+void
+fz_update_search_index(fz_context *ctx, fz_search_index *index, int number, fz_stext_page *page)
+{
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	fz_buffer *buf = NULL;
+	index_page *ip;
+	index_char *chars = NULL;
+	int nchars, i;
+	unsigned char *data;
+	size_t len;
+
+	fz_var(buf);
+	fz_var(chars);
+
+	if (number < 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "invalid page number");
+
+	/* Forget anything we had for this page. */
+	if (number < index->page_count && index->pages[number].indexed)
+	{
+		ip = &index->pages[number];
+		for_each_gram(ctx, index, ip->text, number, remove_gram_page);
+		drop_index_page(ctx, ip);
+	}
+
+	if (!page)
+		return;
+
+	nchars = 0;
+	for (block = page->first_block; block; block = block->next)
+		if (block->type == FZ_STEXT_BLOCK_TEXT)
+			for (line = block->u.t.first_line; line; line = line->next)
+				for (ch = line->first_char; ch; ch = ch->next)
+					++nchars;
+
+	fz_try(ctx)
+	{
+		ensure_index_page(ctx, index, number);
+
+		chars = fz_malloc_array(ctx, nchars, index_char);
+		buf = fz_new_buffer(ctx, nchars + 256);
+
+		/* This must match fz_new_buffer_from_stext_page. */
+		i = 0;
+		for (block = page->first_block; block; block = block->next)
+		{
+			if (block->type != FZ_STEXT_BLOCK_TEXT)
+				continue;
+			for (line = block->u.t.first_line; line; line = line->next)
+			{
+				for (ch = line->first_char; ch; ch = ch->next)
+				{
+					chars[i].offset = (int)buf->len;
+					chars[i].size = ch->size;
+					chars[i].dir = line->dir;
+					chars[i].quad = ch->quad;
+					++i;
+					fz_append_rune(ctx, buf, ch->c);
+				}
+				fz_append_byte(ctx, buf, '\n');
+			}
+			fz_append_byte(ctx, buf, '\n');
+		}
+		fz_terminate_buffer(ctx, buf);
+
+		ip = &index->pages[number];
+		len = fz_buffer_extract(ctx, buf, &data);
+		ip->text = (char *)data;
+		ip->len = (int)len;
+		ip->chars = chars;
+		ip->nchars = nchars;
+		ip->indexed = 1;
+		chars = NULL;
+
+		for_each_gram(ctx, index, ip->text, number, add_gram_page);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, chars);
+		/* Leave the page out rather than half indexed. */
+		if (number < index->page_count && index->pages[number].indexed)
+		{
+			ip = &index->pages[number];
+			for_each_gram(ctx, index, ip->text, number, remove_gram_page);
+			drop_index_page(ctx, ip);
+		}
+		fz_rethrow(ctx);
+	}
+}
+
+int
+fz_search_index_has_page(fz_context *ctx, fz_search_index *index, int number)
+{
+	return number >= 0 && number < index->page_count && index->pages[number].indexed;
+}
+
+struct index_search_data
+{
+	fz_search_index_callback_fn *cb;
+	void *opaque;
+	int number;
+};
+
+static int
+index_hit_cb(fz_context *ctx, void *opaque, int num_quads, fz_quad *quads)
+{
+	struct index_search_data *data = opaque;
+	if (data->cb)
+		return data->cb(ctx, data->opaque, data->number, num_quads, quads);
+	return 0;
+}
+
+/* The same as linearize_page, but from the stored text and characters. */
+static void
+linearize_index_page(fz_context *ctx, index_page *ip, search_text *st)
+{
+	const char *text = ip->text;
+	int p = 0, n = 0, k = 0;
+	int c, is_char;
+
+	st->text = fz_malloc_array(ctx, ip->len, int);
+	st->start = fz_malloc_array(ctx, ip->len, int);
+	st->real = fz_malloc(ctx, ip->len);
+	st->elem = fz_malloc_array(ctx, ip->nchars, int);
+	st->ichars = ip->chars;
+
+	while (p < ip->len)
+	{
+		is_char = k < ip->nchars && ip->chars[k].offset == p;
+		p += chartocanon(&c, text + p);
+		if (is_char)
+		{
+			/* A zero character ends the buffer text. */
+			if (c == 0)
+				break;
+			if (c == ' ' && n > 0 && st->text[n-1] == ' ')
+				st->elem[k] = n - 1;
+			else
+			{
+				st->text[n] = c;
+				st->start[n] = k;
+				st->real[n] = 1;
+				st->elem[k] = n++;
+			}
+			++k;
+		}
+		else if (n == 0 || st->text[n-1] != ' ')
+		{
+			st->text[n] = ' ';
+			st->start[n] = k;
+			st->real[n++] = 0;
+		}
+	}
+	st->len = n;
+	st->nchars = k;
+}
+
+static int
+search_index_page(fz_context *ctx, search_needle *sn, index_page *ip)
+{
+	search_text st = { 0 };
+	int stop = 0;
+
+	fz_try(ctx)
+	{
+		linearize_index_page(ctx, ip, &st);
+		rewind_needle(sn);
+		stop = search_needle_in_text(ctx, &st, sn);
+	}
+	fz_always(ctx)
+		drop_search_text(ctx, &st);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return stop;
+}
+
+static int
+compare_gram_len(const void *a_, const void *b_)
+{
+	const index_gram *a = *(const index_gram **)a_;
+	const index_gram *b = *(const index_gram **)b_;
+	return a->len - b->len;
+}
+
+int
+fz_search_index_cb(fz_context *ctx, fz_search_index *index, const char *needle, fz_search_index_callback_fn *cb, void *opaque)
+{
+	search_needle sn = { 0 };
+	struct index_search_data data;
+	index_gram **grams = NULL;
+	int ngrams;
+	int i, j, number;
+
+	if (strlen(needle) == 0)
+		return 0;
+
+	init_search_data(&sn.hits, index_hit_cb, &data);
+
+	data.cb = cb;
+	data.opaque = opaque;
+
+	fz_var(grams);
+
+	fz_try(ctx)
+	{
+		compile_needle(ctx, &sn, needle);
+
+		/* Look up the trigrams of the needle, stopping if any is missing. */
+		grams = fz_malloc_array(ctx, fz_maxi(sn.len - 2, 1), index_gram *);
+		ngrams = 0;
+		for (i = 2; i < sn.len; ++i)
+		{
+			index_gram *gram = lookup_gram(index, gram_key(sn.text[i-2], sn.text[i-1], sn.text[i]));
+			if (!gram || gram->len == 0)
+				break;
+			grams[ngrams++] = gram;
+		}
+
+		if (i >= sn.len)
+		{
+			if (ngrams > 0)
+			{
+				/* Walk the shortest list, checking the others. */
+				qsort(grams, ngrams, sizeof *grams, compare_gram_len);
+				for (i = 0; i < grams[0]->len; ++i)
+				{
+					number = grams[0]->pages[i];
+					for (j = 1; j < ngrams; ++j)
+						if (!gram_has_page(grams[j], number))
+							break;
+					if (j < ngrams)
+						continue;
+					data.number = number;
+					if (search_index_page(ctx, &sn, &index->pages[number]))
+						break;
+				}
+			}
+			else
+			{
+				/* Too short to use the trigrams; look at every page. */
+				for (number = 0; number < index->page_count; ++number)
+				{
+					if (!index->pages[number].indexed)
+						continue;
+					data.number = number;
+					if (search_index_page(ctx, &sn, &index->pages[number]))
+						break;
+				}
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, grams);
+		drop_needle(ctx, &sn);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return sn.hits.count_hits;
+}
+
+static void
+write_quad(fz_context *ctx, fz_output *out, fz_quad q)
+{
+	fz_write_float_le(ctx, out, q.ul.x);
+	fz_write_float_le(ctx, out, q.ul.y);
+	fz_write_float_le(ctx, out, q.ur.x);
+	fz_write_float_le(ctx, out, q.ur.y);
+	fz_write_float_le(ctx, out, q.ll.x);
+	fz_write_float_le(ctx, out, q.ll.y);
+	fz_write_float_le(ctx, out, q.lr.x);
+	fz_write_float_le(ctx, out, q.lr.y);
+}
+
+static fz_quad
+read_quad(fz_context *ctx, fz_stream *stm)
+{
+	fz_quad q;
+	q.ul.x = fz_read_float_le(ctx, stm);
+	q.ul.y = fz_read_float_le(ctx, stm);
+	q.ur.x = fz_read_float_le(ctx, stm);
+	q.ur.y = fz_read_float_le(ctx, stm);
+	q.ll.x = fz_read_float_le(ctx, stm);
+	q.ll.y = fz_read_float_le(ctx, stm);
+	q.lr.x = fz_read_float_le(ctx, stm);
+	q.lr.y = fz_read_float_le(ctx, stm);
+	return q;
+}
+
+/*
+	The saved index holds only the pages; the trigram table is
+	rebuilt from their text when loading, which takes about as
+	long as reading it would.
+*/
+void
+fz_save_search_index(fz_context *ctx, fz_search_index *index, fz_output *out)
+{
+	index_page *ip;
+	int i, k;
+
+	fz_write_data(ctx, out, SEARCH_INDEX_MAGIC, 8);
+	fz_write_int32_le(ctx, out, index->page_count);
+	for (i = 0; i < index->page_count; ++i)
+	{
+		ip = &index->pages[i];
+		fz_write_int32_le(ctx, out, ip->indexed);
+		if (!ip->indexed)
+			continue;
+		fz_write_int32_le(ctx, out, ip->len);
+		fz_write_data(ctx, out, ip->text, ip->len);
+		fz_write_int32_le(ctx, out, ip->nchars);
+		for (k = 0; k < ip->nchars; ++k)
+		{
+			fz_write_int32_le(ctx, out, ip->chars[k].offset);
+			fz_write_float_le(ctx, out, ip->chars[k].size);
+			fz_write_float_le(ctx, out, ip->chars[k].dir.x);
+			fz_write_float_le(ctx, out, ip->chars[k].dir.y);
+			write_quad(ctx, out, ip->chars[k].quad);
+		}
+	}
+}
+
+fz_search_index *
+fz_load_search_index(fz_context *ctx, fz_stream *stm)
+{
+	fz_search_index *index;
+	index_page *ip;
+	char magic[8];
+	int i, k, n, prev;
+
+	if (fz_read(ctx, stm, (unsigned char *)magic, 8) != 8 || memcmp(magic, SEARCH_INDEX_MAGIC, 8))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "not a search index");
+
+	index = fz_new_search_index(ctx);
+	fz_try(ctx)
+	{
+		n = fz_read_int32_le(ctx, stm);
+		if (n < 0)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt search index");
+		if (n > 0)
+			ensure_index_page(ctx, index, n - 1);
+		for (i = 0; i < n; ++i)
+		{
+			ip = &index->pages[i];
+			if (!fz_read_int32_le(ctx, stm))
+				continue;
+
+			ip->len = fz_read_int32_le(ctx, stm);
+			if (ip->len < 0)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt search index");
+			ip->text = fz_malloc(ctx, (size_t)ip->len + 1);
+			if (fz_read(ctx, stm, (unsigned char *)ip->text, ip->len) != (size_t)ip->len)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "truncated search index");
+			ip->text[ip->len] = 0;
+
+			ip->nchars = fz_read_int32_le(ctx, stm);
+			if (ip->nchars < 0 || ip->nchars > ip->len)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt search index");
+			ip->chars = fz_malloc_array(ctx, ip->nchars, index_char);
+			prev = -1;
+			for (k = 0; k < ip->nchars; ++k)
+			{
+				ip->chars[k].offset = fz_read_int32_le(ctx, stm);
+				if (ip->chars[k].offset <= prev || ip->chars[k].offset >= ip->len)
+					fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt search index");
+				prev = ip->chars[k].offset;
+				ip->chars[k].size = fz_read_float_le(ctx, stm);
+				ip->chars[k].dir.x = fz_read_float_le(ctx, stm);
+				ip->chars[k].dir.y = fz_read_float_le(ctx, stm);
+				ip->chars[k].quad = read_quad(ctx, stm);
+			}
+			ip->indexed = 1;
+
+			for_each_gram(ctx, index, ip->text, i, add_gram_page);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_search_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
@@ -557,34 +557,26 @@ add_struct_block_before(fz_context *ctx, fz_stext_block *before, fz_stext_page *
 	return newstruct;
 }
 
+typedef struct
+{
+	int left;
+	float pos;
+	int freq;
+	int seq;
+} div_entry;
+
 typedef struct
 {
 	int len;
 	int max;
-	struct {
-		int left;
-		float pos;
-		int freq;
-	} *list;
+	div_entry *list;
 } div_list;
 
+/* Edges are gathered unsorted, and put into order by div_list_sort
+ * once they have all been seen. */
 static void
 div_list_push(fz_context *ctx, div_list *div, int left, float pos)
 {
-	int i;
-
-	/* FIXME: Could be bsearch. */
-	for (i = 0; i < div->len; i++)
-	{
-		if (div->list[i].pos > pos)
-			break;
-		else if (div->list[i].pos == pos && div->list[i].left == left)
-		{
-			div->list[i].freq++;
-			return;
-		}
-	}
-
 	if (div->len == div->max)
 	{
 		int newmax = div->max * 2;
@@ -594,12 +586,55 @@ div_list_push(fz_context *ctx, div_list *div, int left, float pos)
 		div->max = newmax;
 	}
 
-	if (i < div->len)
-		memmove(&div->list[i+1], &div->list[i], sizeof(div->list[0]) * (div->len - i));
+	div->list[div->len].left = left;
+	div->list[div->len].pos = pos;
+	div->list[div->len].freq = 1;
+	div->list[div->len].seq = div->len;
 	div->len++;
-	div->list[i].left = left;
-	div->list[i].pos = pos;
-	div->list[i].freq = 1;
+}
+
+static int
+cmp_div_entry(const void *a_, const void *b_)
+{
+	const div_entry *a = a_;
+	const div_entry *b = b_;
+
+	if (a->pos < b->pos)
+		return -1;
+	if (a->pos > b->pos)
+		return 1;
+	return a->seq - b->seq;
+}
+
+/* Sort the edges by position, and merge those of the same kind at the
+ * same position into one with a higher frequency. Edges at the same
+ * position are kept in the order in which they were first seen. */
+static void
+div_list_sort(div_list *div)
+{
+	int i, j, k, start;
+
+	qsort(div->list, div->len, sizeof(div->list[0]), cmp_div_entry);
+
+	j = 0;
+	for (i = 0; i < div->len; i++)
+	{
+		/* Look back over the edges we have kept at this position. */
+		start = j;
+		while (start > 0 && div->list[start-1].pos == div->list[i].pos)
+			start--;
+		for (k = start; k < j; k++)
+		{
+			if (div->list[k].left == div->list[i].left)
+			{
+				div->list[k].freq += div->list[i].freq;
+				break;
+			}
+		}
+		if (k == j)
+			div->list[j++] = div->list[i];
+	}
+	div->len = j;
 }
 
 static fz_stext_grid_positions *
@@ -950,11 +985,21 @@ find_grid_pos_with_reinforcement(fz_context *ctx, fz_stext_grid_positions *pos,
 static int
 find_cell(fz_stext_grid_positions *pos, float x)
 {
-	int i;
+	int lo = 0;
+	int hi = pos->len;
 
-	for (i = 0; i < pos->len; i++)
-		if (x < pos->list[i].pos)
-			return i-1;
+	/* The positions are in increasing order, so look for the first
+	 * one beyond x. */
+	while (lo < hi)
+	{
+		int mid = (lo + hi) >> 1;
+		if (x < pos->list[mid].pos)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (lo < pos->len)
+		return lo-1;
 	if (x == pos->list[pos->len-1].pos)
 		return pos->len-1;
 
@@ -1559,19 +1604,19 @@ merge_column(grid_walker_data *gd, int x)
 		cell_t *s = &gd->cells->cell[x + y * gd->cells->w];
 
 		if (x > 0)
-			memcpy(d-x, s-x, x * sizeof(*d));
+			memmove(d-x, s-x, x * sizeof(*d));
 		d->full = s[0].full || s[1].full;
 		d->h_crossed = s[0].h_crossed || s[1].h_crossed;
 		d->h_line = s[0].h_line; /* == s[1].h_line */
 		d->v_crossed = s[0].v_crossed;
 		d->v_line = s[0].v_line;
 		if (x < gd->cells->w - 2)
-			memcpy(d+1, s+2, (gd->cells->w - 2 - x) * sizeof(*d));
+			memmove(d+1, s+2, (gd->cells->w - 2 - x) * sizeof(*d));
 	}
 	gd->cells->w--;
 
 	if (x < gd->xpos->len - 2)
-		memcpy(&gd->xpos->list[x+1], &gd->xpos->list[x+2], (gd->xpos->len - 2 - x) * sizeof(gd->xpos->list[0]));
+		memmove(&gd->xpos->list[x+1], &gd->xpos->list[x+2], (gd->xpos->len - 2 - x) * sizeof(gd->xpos->list[0]));
 	gd->xpos->len--;
 }
 
@@ -1632,11 +1677,11 @@ merge_row(grid_walker_data *gd, int y)
 		d++;
 	}
 	if (y < gd->cells->h - 2)
-		memcpy(d, d+w, (gd->cells->h - 2 - y) * w * sizeof(*d));
+		memmove(d, d+w, (gd->cells->h - 2 - y) * w * sizeof(*d));
 	gd->cells->h--;
 
 	if (y < gd->ypos->len - 2)
-		memcpy(&gd->ypos->list[y+1], &gd->ypos->list[y+2], (gd->ypos->len - 2 - y) * sizeof(gd->ypos->list[0]));
+		memmove(&gd->ypos->list[y+1], &gd->ypos->list[y+2], (gd->ypos->len - 2 - y) * sizeof(gd->ypos->list[0]));
 	gd->ypos->len--;
 }
 
@@ -1790,6 +1835,9 @@ do_table_hunt(fz_context *ctx, fz_stext_page *page, fz_stext_struct *parent)
 		 * but really needs us to fixup the content. */
 		walk_blocks(ctx, &xs, &ys, *first_block, 0);
 
+		div_list_sort(&xs);
+		div_list_sort(&ys);
+
 		sanitize_positions(ctx, &xs);
 		sanitize_positions(ctx, &ys);
 
@@ -1860,5 +1908,6 @@ fz_table_hunt(fz_context *ctx, fz_stext_page *page)
 	if (page == NULL)
 		return;
 
+	fz_invalidate_stext_line_index(ctx, page);
 	do_table_hunt(ctx, page, NULL);
 }
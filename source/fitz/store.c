@@ -56,6 +56,10 @@ struct fz_store
 	size_t max;
 	size_t size;
 
+	/* Lookup statistics, see fz_get_store_stats. */
+	size_t hits;
+	size_t misses;
+
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
@@ -621,9 +625,11 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
+		store->hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -788,6 +794,26 @@ fz_debug_store(fz_context *ctx, fz_output *out)
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+void
+fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+	fz_item *item;
+
+	memset(stats, 0, sizeof *stats);
+	if (!store)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->size = store->size;
+	stats->max = store->max;
+	for (item = store->head; item; item = item->next)
+		stats->items++;
+	stats->hits = store->hits;
+	stats->misses = store->misses;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 /*
 	Consider if we have blocks of the following sizes in the store, from oldest
 	to newest:
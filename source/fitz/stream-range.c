@@ -0,0 +1,304 @@
+// Copyright (C) 2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <string.h>
+
+#define DEFAULT_BLOCK_SIZE (64 << 10)
+#define DEFAULT_MAX_BLOCKS 256
+
+typedef struct
+{
+	int64_t index; /* -1 when the slot is empty */
+	int64_t last_use;
+	size_t len;
+	unsigned char *data;
+} fz_range_block;
+
+typedef struct
+{
+	int64_t length;
+	size_t block_size;
+	int max_blocks;
+	int64_t clock;
+	int current; /* Slot that stm->rp/wp point into, never evicted. */
+	fz_range_block *block;
+	unsigned char *scratch;
+	fz_range_fetch_fn *fetch;
+	fz_range_drop_fn *drop;
+	void *opaque;
+} fz_range_state;
+
+static fz_range_block *
+find_block(fz_range_state *st, int64_t index)
+{
+	int i;
+	for (i = 0; i < st->max_blocks; i++)
+		if (st->block[i].index == index)
+			return &st->block[i];
+	return NULL;
+}
+
+static fz_range_block *
+evict_block(fz_context *ctx, fz_range_state *st)
+{
+	fz_range_block *victim = NULL;
+	int i;
+
+	for (i = 0; i < st->max_blocks; i++)
+	{
+		if (i == st->current)
+			continue;
+		if (st->block[i].index < 0)
+		{
+			victim = &st->block[i];
+			break;
+		}
+		if (!victim || st->block[i].last_use < victim->last_use)
+			victim = &st->block[i];
+	}
+
+	if (!victim->data)
+		victim->data = Memento_label(fz_malloc(ctx, st->block_size), "range_block");
+	victim->index = -1;
+	victim->len = 0;
+	return victim;
+}
+
+static size_t
+block_len(fz_range_state *st, int64_t index)
+{
+	int64_t start = index * (int64_t)st->block_size;
+	return (size_t)fz_mini64(st->block_size, st->length - start);
+}
+
+/*
+	Fetch the blocks [first, first+count) in a single call to the
+	fetcher, skipping any we already hold at either end. Returns 0
+	if the fetcher could not supply them yet.
+*/
+static int
+fetch_blocks(fz_context *ctx, fz_range_state *st, int64_t first, int count)
+{
+	unsigned char *tmp = NULL;
+	unsigned char *buf;
+	int64_t offset;
+	size_t len, n;
+	size_t got = 0;
+	int i;
+
+	while (count > 0 && find_block(st, first))
+		first++, count--;
+	while (count > 0 && find_block(st, first + count - 1))
+		count--;
+	if (count == 0)
+		return 1;
+
+	offset = first * (int64_t)st->block_size;
+	len = (size_t)fz_mini64((int64_t)count * st->block_size, st->length - offset);
+
+	/* Single blocks go through a reusable scratch buffer; only
+	 * coalesced prefetches need anything bigger. */
+	if (count == 1)
+	{
+		if (!st->scratch)
+			st->scratch = Memento_label(fz_malloc(ctx, st->block_size), "range_scratch");
+		buf = st->scratch;
+	}
+	else
+		buf = tmp = Memento_label(fz_malloc(ctx, len), "range_prefetch");
+
+	fz_try(ctx)
+	{
+		got = st->fetch(ctx, st->opaque, buf, offset, len);
+		if (got != 0 && got != len)
+			fz_throw(ctx, FZ_ERROR_SYSTEM, "range fetch returned %zu of %zu bytes at %ld", got, len, offset);
+		if (got != 0)
+		{
+			for (i = 0; i < count; i++)
+			{
+				fz_range_block *b = find_block(st, first + i);
+				if (!b)
+				{
+					b = evict_block(ctx, st);
+					n = block_len(st, first + i);
+					memcpy(b->data, buf + (size_t)i * st->block_size, n);
+					b->len = n;
+					b->index = first + i;
+				}
+				b->last_use = ++st->clock;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, tmp);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return got != 0;
+}
+
+static int
+next_range(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	fz_range_state *st = stm->state;
+	fz_range_block *b;
+	int64_t index;
+	size_t off;
+
+	if (stm->pos >= st->length)
+		return EOF;
+
+	index = stm->pos / (int64_t)st->block_size;
+	b = find_block(st, index);
+	if (!b)
+	{
+		if (!fetch_blocks(ctx, st, index, 1))
+			fz_throw(ctx, FZ_ERROR_TRYLATER, "waiting for bytes at %ld", stm->pos);
+		b = find_block(st, index);
+	}
+	b->last_use = ++st->clock;
+	st->current = (int)(b - st->block);
+
+	off = (size_t)(stm->pos - index * (int64_t)st->block_size);
+	stm->rp = b->data + off;
+	stm->wp = b->data + b->len;
+	stm->pos += (int64_t)(b->len - off);
+
+	return *stm->rp++;
+}
+
+static void
+seek_range(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	fz_range_state *st = stm->state;
+
+	if (whence == SEEK_END)
+		offset += st->length;
+	else if (whence == SEEK_CUR)
+		offset += stm->pos;
+
+	if (offset < 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot seek to negative offset");
+	if (offset > st->length)
+		offset = st->length;
+
+	stm->pos = offset;
+	stm->rp = stm->wp;
+}
+
+static void
+drop_range(fz_context *ctx, void *state)
+{
+	fz_range_state *st = state;
+	int i;
+
+	if (st->drop)
+		st->drop(ctx, st->opaque);
+	for (i = 0; i < st->max_blocks; i++)
+		fz_free(ctx, st->block[i].data);
+	fz_free(ctx, st->block);
+	fz_free(ctx, st->scratch);
+	fz_free(ctx, st);
+}
+
+fz_stream *
+fz_open_range_stream(fz_context *ctx, int64_t length, size_t block_size, int max_blocks, int progressive, fz_range_fetch_fn *fetch, fz_range_drop_fn *drop, void *opaque)
+{
+	fz_range_state *st = NULL;
+	fz_stream *stm;
+	int i;
+
+	fz_var(st);
+
+	if (length < 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "range stream needs a length");
+	if (block_size == 0)
+		block_size = DEFAULT_BLOCK_SIZE;
+	if (max_blocks <= 0)
+		max_blocks = DEFAULT_MAX_BLOCKS;
+	/* One block is pinned by the reader, so we need a spare to fetch into. */
+	if (max_blocks < 2)
+		max_blocks = 2;
+
+	fz_try(ctx)
+	{
+		st = fz_malloc_struct(ctx, fz_range_state);
+		st->block = fz_malloc_struct_array(ctx, max_blocks, fz_range_block);
+		for (i = 0; i < max_blocks; i++)
+			st->block[i].index = -1;
+		st->length = length;
+		st->block_size = block_size;
+		st->max_blocks = max_blocks;
+		st->current = -1;
+		st->fetch = fetch;
+		st->drop = drop;
+		st->opaque = opaque;
+	}
+	fz_catch(ctx)
+	{
+		if (st)
+			fz_free(ctx, st->block);
+		fz_free(ctx, st);
+		if (drop)
+			drop(ctx, opaque);
+		fz_rethrow(ctx);
+	}
+
+	stm = fz_new_stream(ctx, st, next_range, drop_range);
+	stm->seek = seek_range;
+	stm->progressive = !!progressive;
+
+	return stm;
+}
+
+int
+fz_prefetch_range_stream(fz_context *ctx, fz_stream *stm, int64_t offset, int64_t len)
+{
+	fz_range_state *st;
+	int64_t first, last;
+	int count;
+
+	if (!stm || stm->next != next_range)
+		return 1;
+	st = stm->state;
+
+	if (offset < 0)
+	{
+		len += offset;
+		offset = 0;
+	}
+	if (len > st->length - offset)
+		len = st->length - offset;
+	if (len <= 0)
+		return 1;
+
+	first = offset / (int64_t)st->block_size;
+	last = (offset + len - 1) / (int64_t)st->block_size;
+
+	/* Never prefetch so much that it evicts itself (or the block the
+	 * reader is sitting in). */
+	count = (int)fz_mini64(last - first + 1, st->max_blocks - 1);
+
+	return fetch_blocks(ctx, st, first, count);
+}
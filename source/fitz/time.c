@@ -24,6 +24,10 @@
 
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 #ifdef _WIN32
 
 #include <stdio.h>
@@ -275,3 +279,15 @@ fz_mkdir(char *path)
 }
 
 #endif /* _WIN32 */
+
+double
+fz_ms_clock(void)
+{
+#ifdef _WINRT
+	return (double)GetTickCount64();
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
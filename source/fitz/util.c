@@ -453,6 +453,37 @@ fz_search_page_number_cb(fz_context *ctx, fz_document *doc, int number, const ch
 	return count;
 }
 
+fz_search_index *
+fz_new_search_index_from_document(fz_context *ctx, fz_document *doc, const fz_stext_options *options)
+{
+	fz_search_index *index;
+	fz_stext_page *text = NULL;
+	int i, n;
+
+	fz_var(text);
+
+	index = fz_new_search_index(ctx);
+	fz_try(ctx)
+	{
+		n = fz_count_pages(ctx, doc);
+		for (i = 0; i < n; ++i)
+		{
+			text = fz_new_stext_page_from_page_number(ctx, doc, i, options);
+			fz_update_search_index(ctx, index, i, text);
+			fz_drop_stext_page(ctx, text);
+			text = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stext_page(ctx, text);
+		fz_drop_search_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
 int
 fz_search_chapter_page_number(fz_context *ctx, fz_document *doc, int chapter, int number, const char *needle, int *hit_mark, fz_quad *hit_bbox, int hit_max)
 {
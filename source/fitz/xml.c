@@ -638,21 +638,61 @@ static int close_tag(fz_context *ctx, struct parser *parser, const char *mark, c
 	return 1;
 }
 
-static char *xml_parse_document_imp(fz_context *ctx, struct parser *parser, const char *p) /* lgtm [cpp/use-of-goto] */
+/*
+	The parser proper is event based. It scans a zero terminated block
+	of UTF-8 text, and passes each tag name, attribute, run of text and
+	CDATA section on to a set of event functions as a pair of pointers
+	into the block. Entities are left for the event functions to resolve.
+
+	Building a tree (fz_parse_xml) is one set of events. Calling the
+	handler of fz_parse_xml_sax is another, for which the data is read
+	from a stream a block at a time. When more data may follow the block,
+	running out of data (or finding what may only be a cut off piece of
+	markup) is not an error: the parser stops, and says where to pick up
+	again once more data has been added. That is always the start of a
+	run of text or of a piece of markup, so no event is ever repeated
+	other than open_tag and the attribute events of an element whose
+	end_of_tag has not yet been reached.
+
+	The events that can stop the parse return NULL to carry on, or a
+	message to stop with.
+*/
+
+typedef struct
+{
+	void (*open_tag)(fz_context *ctx, void *arg, const char *a, const char *b);
+	void (*att_name)(fz_context *ctx, void *arg, const char *a, const char *b);
+	void (*att_value)(fz_context *ctx, void *arg, const char *a, const char *b);
+	const char *(*end_of_tag)(fz_context *ctx, void *arg, int empty);
+	const char *(*close_tag)(fz_context *ctx, void *arg, const char *a, const char *b);
+	const char *(*text)(fz_context *ctx, void *arg, const char *a, const char *b);
+	const char *(*cdata)(fz_context *ctx, void *arg, const char *a, const char *b);
+} xml_events;
+
+static const char xml_more_data[] = "more data needed";
+
+static const char *xml_parse_document_imp(fz_context *ctx, const xml_events *ev, void *arg, const char *p, int more, const char **resume) /* lgtm [cpp/use-of-goto] */
 {
-	const char *mark;
+	const char *mark, *end, *safe;
+	const char *error;
 	int quote;
 
 parse_text:
-	mark = p;
+	safe = mark = p;
 	while (*p && *p != '<') ++p;
 	if (*p == '<') {
-		if (mark < p)
-			xml_emit_text(ctx, parser, mark, p);
+		if (mark < p && (error = ev->text(ctx, arg, mark, p)) != NULL)
+			return error;
+		safe = p;
 		++p;
 		goto parse_element;
-	} else if (mark < p)
-		xml_emit_text(ctx, parser, mark, p);
+	}
+	if (more) {
+		*resume = mark;
+		return xml_more_data;
+	}
+	if (mark < p)
+		return ev->text(ctx, arg, mark, p);
 	return NULL;
 
 parse_element:
@@ -662,7 +702,8 @@ parse_element:
 	while (iswhite(*p)) ++p;
 	if (isname(*p))
 		goto parse_element_name;
-	return "syntax error in element";
+	error = "syntax error in element";
+	goto fail;
 
 parse_comment:
 	if (p[0]=='D' && p[1]=='O' && p[2]=='C' && p[3]=='T' && p[4]=='Y' && p[5]=='P' && p[6]=='E')
@@ -670,8 +711,8 @@ parse_comment:
 	if (p[0]=='E' && p[1]=='N' && p[2]=='T' && p[3]=='I' && p[4]=='T' && p[5]=='Y')
 		goto parse_declaration;
 	if (*p == '[') goto parse_cdata;
-	if (*p++ != '-') return "syntax error in comment (<! not followed by --)";
-	if (*p++ != '-') return "syntax error in comment (<!- not followed by -)";
+	if (*p++ != '-') { error = "syntax error in comment (<! not followed by --)"; goto fail; }
+	if (*p++ != '-') { error = "syntax error in comment (<!- not followed by -)"; goto fail; }
 	while (*p) {
 		if (p[0] == '-' && p[1] == '-' && p[2] == '>') {
 			p += 3;
@@ -679,26 +720,32 @@ parse_comment:
 		}
 		++p;
 	}
-	return "end of data in comment";
+	error = "end of data in comment";
+	goto fail;
 
 parse_declaration:
 	while (*p) if (*p++ == '>') goto parse_text;
-	return "end of data in declaration";
+	error = "end of data in declaration";
+	goto fail;
 
 parse_cdata:
-	if (p[1] != 'C' || p[2] != 'D' || p[3] != 'A' || p[4] != 'T' || p[5] != 'A' || p[6] != '[')
-		return "syntax error in CDATA section";
+	if (p[1] != 'C' || p[2] != 'D' || p[3] != 'A' || p[4] != 'T' || p[5] != 'A' || p[6] != '[') {
+		error = "syntax error in CDATA section";
+		goto fail;
+	}
 	p += 7;
 	mark = p;
 	while (*p) {
 		if (p[0] == ']' && p[1] == ']' && p[2] == '>') {
-			xml_emit_cdata(ctx, parser, mark, p);
+			if ((error = ev->cdata(ctx, arg, mark, p)) != NULL)
+				return error;
 			p += 3;
 			goto parse_text;
 		}
 		++p;
 	}
-	return "end of data in CDATA section";
+	error = "end of data in CDATA section";
+	goto fail;
 
 parse_processing_instruction:
 	while (*p) {
@@ -708,38 +755,44 @@ parse_processing_instruction:
 		}
 		++p;
 	}
-	return "end of data in processing instruction";
+	error = "end of data in processing instruction";
+	goto fail;
 
 parse_closing_element:
 	while (iswhite(*p)) ++p;
 	mark = p;
 	while (isname(*p)) ++p;
-	if (!isname(*mark))
-		return "syntax error in closing element";
-	if (close_tag(ctx, parser, mark, p))
-		return "opening and closing tag mismatch";
+	end = p;
+	if (!isname(*mark)) {
+		error = "syntax error in closing element";
+		goto fail;
+	}
 	while (iswhite(*p)) ++p;
-	if (*p != '>')
-		return "syntax error in closing element";
+	if (*p != '>') {
+		error = "syntax error in closing element";
+		goto fail;
+	}
+	if ((error = ev->close_tag(ctx, arg, mark, end)) != NULL)
+		return error;
 	++p;
 	goto parse_text;
 
 parse_element_name:
 	mark = p;
 	while (isname(*p)) ++p;
-	xml_emit_open_tag(ctx, parser, mark, p, 0);
+	ev->open_tag(ctx, arg, mark, p);
 	if (*p == '>') {
 		++p;
-		goto parse_text;
+		goto end_of_tag;
 	}
 	if (p[0] == '/' && p[1] == '>') {
-		xml_emit_close_tag(ctx, parser);
 		p += 2;
-		goto parse_text;
+		goto end_of_empty_tag;
 	}
 	if (iswhite(*p))
 		goto parse_attributes;
-	return "syntax error after element name";
+	error = "syntax error after element name";
+	goto fail;
 
 parse_attributes:
 	while (iswhite(*p)) ++p;
@@ -747,22 +800,23 @@ parse_attributes:
 		goto parse_attribute_name;
 	if (*p == '>') {
 		++p;
-		goto parse_text;
+		goto end_of_tag;
 	}
 	if (p[0] == '/' && p[1] == '>') {
-		xml_emit_close_tag(ctx, parser);
 		p += 2;
-		goto parse_text;
+		goto end_of_empty_tag;
 	}
-	return "syntax error in attributes";
+	error = "syntax error in attributes";
+	goto fail;
 
 parse_attribute_name:
 	mark = p;
 	while (isname(*p)) ++p;
-	xml_emit_att_name(ctx, parser, mark, p);
+	ev->att_name(ctx, arg, mark, p);
 	while (iswhite(*p)) ++p;
 	if (*p == '=') { ++p; goto parse_attribute_value; }
-	return "syntax error after attribute name";
+	error = "syntax error after attribute name";
+	goto fail;
 
 parse_attribute_value:
 	while (iswhite(*p)) ++p;
@@ -772,20 +826,331 @@ parse_attribute_value:
 	/* special case for handling MOBI filepos=00000 syntax */
 	if (quote >= '0' && quote <= '9') {
 		while (*p >= '0' && *p <= '9') ++p;
-		xml_emit_att_value(ctx, parser, mark, p);
+		ev->att_value(ctx, arg, mark, p);
 		goto parse_attributes;
 	}
 
-	if (quote != '"' && quote != '\'')
-		return "missing quote character";
+	if (quote != '"' && quote != '\'') {
+		error = "missing quote character";
+		goto fail;
+	}
 	while (*p && *p != quote) ++p;
 	if (*p == quote) {
-		xml_emit_att_value(ctx, parser, mark, p++);
+		ev->att_value(ctx, arg, mark, p++);
 		goto parse_attributes;
 	}
-	return "end of data in attribute value";
+	error = "end of data in attribute value";
+	goto fail;
+
+end_of_tag:
+	if ((error = ev->end_of_tag(ctx, arg, 0)) != NULL)
+		return error;
+	goto parse_text;
+
+end_of_empty_tag:
+	if ((error = ev->end_of_tag(ctx, arg, 1)) != NULL)
+		return error;
+	goto parse_text;
+
+fail:
+	/* The markup may just be cut off at the end of the block. */
+	if (more) {
+		*resume = safe;
+		return xml_more_data;
+	}
+	return error;
+}
+
+/* Building a tree. */
+
+static void dom_open_tag(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	xml_emit_open_tag(ctx, arg, a, b, 0);
+}
+
+static void dom_att_name(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	xml_emit_att_name(ctx, arg, a, b);
+}
+
+static void dom_att_value(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	xml_emit_att_value(ctx, arg, a, b);
+}
+
+static const char *dom_end_of_tag(fz_context *ctx, void *arg, int empty)
+{
+	if (empty)
+		xml_emit_close_tag(ctx, arg);
+	return NULL;
+}
+
+static const char *dom_close_tag(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	if (close_tag(ctx, arg, a, b))
+		return "opening and closing tag mismatch";
+	return NULL;
+}
+
+static const char *dom_text(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	xml_emit_text(ctx, arg, a, b);
+	return NULL;
+}
+
+static const char *dom_cdata(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	xml_emit_cdata(ctx, arg, a, b);
+	return NULL;
+}
+
+static const xml_events dom_events =
+{
+	dom_open_tag,
+	dom_att_name,
+	dom_att_value,
+	dom_end_of_tag,
+	dom_close_tag,
+	dom_text,
+	dom_cdata,
+};
+
+/*
+	Calling a fz_xml_sax_handler.
+
+	The element being opened, with its attributes, is collected in a
+	scratch buffer (with entities resolved) and only passed on to the
+	handler once the end of its tag is reached. The names of the open
+	elements are kept on a stack to match closing tags against.
+*/
+
+static const char xml_stopped[] = "stopped";
+
+struct sax_parser
+{
+	int preserve_white;
+	const fz_xml_sax_handler *handler;
+	void *arg;
+
+	/* The element or text being passed on. */
+	char *buf;
+	size_t len, cap;
+
+	/* Offsets of the attribute names and values in buf, and the
+	 * array of pointers to them that is passed to the handler. */
+	size_t *att;
+	char **atts;
+	int natt, maxatt;
+
+	/* Names of the open elements, and where each one starts. */
+	char *stack;
+	size_t stack_len, stack_cap;
+	size_t *tag;
+	int depth, maxdepth;
+};
+
+static void sax_reserve(fz_context *ctx, struct sax_parser *p, size_t n)
+{
+	size_t cap = p->cap ? p->cap : 256;
+	while (p->len + n + 1 > cap)
+		cap *= 2;
+	if (cap != p->cap)
+	{
+		p->buf = fz_realloc(ctx, p->buf, cap);
+		p->cap = cap;
+	}
+}
+
+/* Append a string to the scratch buffer, zero terminated, resolving
+ * entities if asked to. Returns the length of the decoded string. */
+static size_t sax_append(fz_context *ctx, struct sax_parser *p, const char *a, const char *b, int decode)
+{
+	char *s, *d;
+	int c;
+
+	/* entities are all longer than UTFmax so runetochar is safe */
+	sax_reserve(ctx, p, b - a);
+	s = d = p->buf + p->len;
+	while (a < b) {
+		if (decode && *a == '&') {
+			a += xml_parse_entity(&c, a);
+			d += fz_runetochar(d, c);
+		}
+		else {
+			*d++ = *a++;
+		}
+	}
+	*d = 0;
+	p->len += d - s + 1;
+	return d - s;
+}
+
+static void sax_add_att(fz_context *ctx, struct sax_parser *p, size_t ofs)
+{
+	if (p->natt == p->maxatt)
+	{
+		int n = p->maxatt ? p->maxatt * 2 : 16;
+		p->att = fz_realloc_array(ctx, p->att, n, size_t);
+		p->atts = fz_realloc_array(ctx, p->atts, n + 1, char *);
+		p->maxatt = n;
+	}
+	p->att[p->natt++] = ofs;
+}
+
+static const char *sax_close(fz_context *ctx, struct sax_parser *p)
+{
+	p->stack_len = p->tag[--p->depth];
+	if (p->handler->close_tag && p->handler->close_tag(ctx, p->arg, p->stack + p->stack_len))
+		return xml_stopped;
+	return NULL;
+}
+
+static void sax_open_tag(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	const char *ns;
+
+	/* skip namespace prefix */
+	for (ns = a; ns < b - 1; ++ns)
+		if (*ns == ':')
+			a = ns + 1;
+
+	p->len = 0;
+	p->natt = 0;
+	sax_append(ctx, p, a, b, 0);
+}
+
+static void sax_att_name(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	sax_add_att(ctx, p, p->len);
+	sax_append(ctx, p, a, b, 0);
+}
+
+static void sax_att_value(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	sax_add_att(ctx, p, p->len);
+	sax_append(ctx, p, a, b, 1);
+}
+
+static const char *sax_end_of_tag(fz_context *ctx, void *arg, int empty)
+{
+	struct sax_parser *p = arg;
+	size_t n = strlen(p->buf) + 1;
+	int i;
+
+	if (p->depth + 1 >= FZ_XML_MAX_DEPTH)
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "too deep xml element nesting");
+	if (p->depth == p->maxdepth)
+	{
+		int m = p->maxdepth ? p->maxdepth * 2 : 32;
+		p->tag = fz_realloc_array(ctx, p->tag, m, size_t);
+		p->maxdepth = m;
+	}
+	while (p->stack_len + n > p->stack_cap)
+	{
+		size_t m = p->stack_cap ? p->stack_cap * 2 : 256;
+		p->stack = fz_realloc(ctx, p->stack, m);
+		p->stack_cap = m;
+	}
+	memcpy(p->stack + p->stack_len, p->buf, n);
+	p->tag[p->depth++] = p->stack_len;
+	p->stack_len += n;
+
+	if (p->handler->open_tag)
+	{
+		if (p->maxatt == 0)
+		{
+			sax_add_att(ctx, p, 0);
+			p->natt = 0;
+		}
+		for (i = 0; i < p->natt; ++i)
+			p->atts[i] = p->buf + p->att[i];
+		p->atts[p->natt] = NULL;
+		if (p->handler->open_tag(ctx, p->arg, p->stack + p->tag[p->depth - 1], p->atts))
+			return xml_stopped;
+	}
+
+	if (empty)
+		return sax_close(ctx, p);
+	return NULL;
+}
+
+static const char *sax_close_tag(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	const char *ns, *tag;
+
+	/* skip namespace prefix */
+	for (ns = a; ns < b - 1; ++ns)
+		if (*ns == ':')
+			a = ns + 1;
+
+	if (p->depth == 0)
+		return "opening and closing tag mismatch";
+	tag = p->stack + p->tag[p->depth - 1];
+	if (strncmp(tag, a, b - a) != 0 || tag[b - a] != 0)
+		return "opening and closing tag mismatch";
+	return sax_close(ctx, p);
+}
+
+static const char *sax_text(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	const char *s;
+	size_t n;
+
+	/* Skip text outside the root tag */
+	if (p->depth == 0)
+		return NULL;
+
+	/* Skip all-whitespace text */
+	if (!p->preserve_white)
+	{
+		for (s = a; s < b; s++)
+			if (!iswhite(*s))
+				break;
+		if (s == b)
+			return NULL;
+	}
+
+	if (p->handler->text)
+	{
+		p->len = 0;
+		n = sax_append(ctx, p, a, b, 1);
+		if (p->handler->text(ctx, p->arg, p->buf, n))
+			return xml_stopped;
+	}
+	return NULL;
+}
+
+static const char *sax_cdata(fz_context *ctx, void *arg, const char *a, const char *b)
+{
+	struct sax_parser *p = arg;
+	size_t n;
+
+	if (p->depth > 0 && p->handler->text)
+	{
+		p->len = 0;
+		n = sax_append(ctx, p, a, b, 0);
+		if (p->handler->text(ctx, p->arg, p->buf, n))
+			return xml_stopped;
+	}
+	return NULL;
 }
 
+static const xml_events sax_events =
+{
+	sax_open_tag,
+	sax_att_name,
+	sax_att_value,
+	sax_end_of_tag,
+	sax_close_tag,
+	sax_text,
+	sax_cdata,
+};
+
 static int fast_tolower(int c)
 {
 	if ((unsigned)c - 'A' < 26)
@@ -1006,6 +1371,121 @@ static char *convert_to_utf8(fz_context *ctx, unsigned char *s, size_t n, int *d
 	return (char*)s;
 }
 
+void
+fz_parse_xml_sax(fz_context *ctx, fz_stream *stm, int preserve_white, const fz_xml_sax_handler *handler, void *arg)
+{
+	struct sax_parser parser;
+	fz_buffer *buf = NULL;
+	char *data = NULL;
+	char *p = NULL;
+	int dofree = 0;
+	const char *error, *resume;
+	unsigned char *s;
+	size_t cap = 8192;
+	size_t len, n;
+	char *z;
+	int eof = 0;
+
+	memset(&parser, 0, sizeof parser);
+	parser.preserve_white = preserve_white;
+	parser.handler = handler;
+	parser.arg = arg;
+
+	fz_var(buf);
+	fz_var(data);
+	fz_var(p);
+	fz_var(dofree);
+
+	fz_try(ctx)
+	{
+		/* Look at the start of the data to see whether it needs converting. */
+		data = fz_malloc(ctx, cap);
+		len = fz_read(ctx, stm, (unsigned char *)data, 4096);
+		data[len] = 0;
+		s = (unsigned char *)data;
+
+		if ((s[0] == 0xFE && s[1] == 0xFF) || (s[0] == 0xFF && s[1] == 0xFE) || find_xml_encoding(data))
+		{
+			/* Not UTF-8: read it all, and convert it before parsing. */
+			buf = fz_new_buffer(ctx, len + 1024);
+			fz_append_data(ctx, buf, data, len);
+			while ((n = fz_read(ctx, stm, (unsigned char *)data, cap)) > 0)
+				fz_append_data(ctx, buf, data, n);
+			fz_terminate_buffer(ctx, buf);
+			n = fz_buffer_storage(ctx, buf, &s);
+			p = convert_to_utf8(ctx, s, n, &dofree);
+			error = xml_parse_document_imp(ctx, &sax_events, &parser, p, 0, &resume);
+		}
+		else
+		{
+			if (s[0] == 0xEF && s[1] == 0xBB && s[2] == 0xBF)
+			{
+				len -= 3;
+				memmove(data, data + 3, len + 1);
+			}
+
+			/* Like a zero terminated string, stop at the first zero byte. */
+			z = memchr(data, 0, len);
+			if (z)
+			{
+				len = z - data;
+				eof = 1;
+			}
+
+			/* Parse what we have, keep whatever was left over when the
+			 * parser ran out of data, and read some more after it. Grow
+			 * the buffer whenever the leftovers fill half of it, so that
+			 * long runs of text are not scanned over and over again. */
+			for (;;)
+			{
+				error = xml_parse_document_imp(ctx, &sax_events, &parser, data, !eof, &resume);
+				if (error != xml_more_data)
+					break;
+
+				len -= resume - data;
+				memmove(data, resume, len + 1);
+				if (len >= cap / 2)
+				{
+					cap *= 2;
+					data = fz_realloc(ctx, data, cap);
+				}
+
+				n = fz_read(ctx, stm, (unsigned char *)data + len, cap - len - 1);
+				z = memchr(data + len, 0, n);
+				if (z)
+					n = z - (data + len);
+				if (n == 0 || z)
+					eof = 1;
+				len += n;
+				data[len] = 0;
+			}
+		}
+
+		if (error == NULL)
+		{
+			/* Close any elements left open at the end of the data. */
+			while (parser.depth > 0 && sax_close(ctx, &parser) == NULL)
+				;
+		}
+		else if (error != xml_stopped)
+			fz_throw(ctx, FZ_ERROR_SYNTAX, "%s", error);
+	}
+	fz_always(ctx)
+	{
+		if (dofree)
+			fz_free(ctx, p);
+		fz_drop_buffer(ctx, buf);
+		fz_free(ctx, data);
+		fz_free(ctx, parser.buf);
+		fz_free(ctx, parser.att);
+		fz_free(ctx, parser.atts);
+		fz_free(ctx, parser.stack);
+		fz_free(ctx, parser.tag);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 fz_xml *
 fz_parse_xml_stream(fz_context *ctx, fz_stream *stm, int preserve_white)
 {
@@ -1067,7 +1547,7 @@ fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
 	fz_xml *xml = NULL;
 	fz_xml root, *node;
 	char *p = NULL;
-	char *error;
+	const char *error;
 	int dofree = 0;
 	unsigned char *s;
 	size_t n;
@@ -1101,7 +1581,7 @@ fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
 	{
 		p = convert_to_utf8(ctx, s, n, &dofree);
 
-		error = xml_parse_document_imp(ctx, &parser, p);
+		error = xml_parse_document_imp(ctx, &dom_events, &parser, p, 0, NULL);
 		if (error)
 			fz_throw(ctx, FZ_ERROR_SYNTAX, "%s", error);
 
@@ -396,6 +396,238 @@ match_selector(fz_css_selector *sel, fz_xml *node)
 	return 1;
 }
 
+/*
+ * Rule index.
+ *
+ * Every selector is filed under the most selective test in its rightmost
+ * compound: its id, one of its classes, its tag name or, failing those,
+ * as universal. An element then only needs to try the selectors filed
+ * under its own id, classes and tag name, plus the universal ones.
+ */
+
+enum { INDEX_ID, INDEX_CLASS, INDEX_TAG, INDEX_UNIVERSAL };
+
+typedef struct
+{
+	int type;
+	const char *key;
+	int order;
+	fz_css_rule *rule;
+	fz_css_selector *sel;
+} fz_css_rule_entry;
+
+/*
+ * Style sharing cache.
+ *
+ * Siblings with the same tag and classes (and no id or inline style)
+ * match the same rules, unless the stylesheet uses attribute selectors
+ * or adjacent sibling combinators. The same holds for their children,
+ * and so on down, so each match is given a 'share' id that is inherited
+ * by the elements that reuse it.
+ */
+
+#define SHARE_CACHE_SIZE 64
+
+typedef struct
+{
+	int up_share;
+	int share;
+	const char *tag;
+	const char *class_att;
+	fz_css_match match;
+	fz_css_style style;
+} fz_css_share_entry;
+
+struct fz_css_rule_index_s
+{
+	int len;
+	fz_css_rule_entry *entry;
+	fz_css_rule_entry **candidate;
+	int can_share;
+	int next_share;
+	fz_css_share_entry share[SHARE_CACHE_SIZE];
+};
+
+static int
+cmp_rule_key(const fz_css_rule_entry *e, int type, const char *key, size_t len)
+{
+	int c;
+	if (e->type != type)
+		return e->type - type;
+	if (!key)
+		return 0;
+	c = strncmp(e->key, key, len);
+	if (c)
+		return c;
+	return e->key[len] != 0;
+}
+
+static int
+cmp_rule_entry(const void *a_, const void *b_)
+{
+	const fz_css_rule_entry *a = a_;
+	const fz_css_rule_entry *b = b_;
+	int c = cmp_rule_key(a, b->type, b->key, b->key ? strlen(b->key) : 0);
+	if (c)
+		return c;
+	return a->order - b->order;
+}
+
+static int
+cmp_rule_order(const void *a_, const void *b_)
+{
+	const fz_css_rule_entry *a = *(const fz_css_rule_entry **)a_;
+	const fz_css_rule_entry *b = *(const fz_css_rule_entry **)b_;
+	return a->order - b->order;
+}
+
+static void
+file_selector(fz_css_rule_entry *entry, fz_css_selector *sel)
+{
+	fz_css_condition *cond;
+
+	if (sel->combine)
+		sel = sel->right;
+
+	entry->type = INDEX_UNIVERSAL;
+	entry->key = NULL;
+	if (sel->name)
+	{
+		entry->type = INDEX_TAG;
+		entry->key = sel->name;
+	}
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		if (cond->type == '#')
+		{
+			entry->type = INDEX_ID;
+			entry->key = cond->val;
+			break;
+		}
+		if (cond->type == '.' && entry->type > INDEX_CLASS)
+		{
+			entry->type = INDEX_CLASS;
+			entry->key = cond->val;
+		}
+	}
+}
+
+static int
+selector_allows_sharing(fz_css_selector *sel)
+{
+	fz_css_condition *cond;
+
+	if (sel->combine == '+')
+		return 0;
+	for (cond = sel->cond; cond; cond = cond->next)
+		if (cond->type != '#' && cond->type != '.' && cond->type != ':')
+			return 0;
+	if (sel->left && !selector_allows_sharing(sel->left))
+		return 0;
+	if (sel->right && !selector_allows_sharing(sel->right))
+		return 0;
+	return 1;
+}
+
+static fz_css_rule_index *
+build_rule_index(fz_context *ctx, fz_css *css)
+{
+	fz_css_rule_index *index;
+	fz_css_rule_entry *entry;
+	fz_css_rule *rule;
+	fz_css_selector *sel;
+	int n = 0;
+
+	for (rule = css->rule; rule; rule = rule->next)
+		for (sel = rule->selector; sel; sel = sel->next)
+			n++;
+
+	index = fz_pool_alloc(ctx, css->pool, sizeof *index);
+	index->entry = fz_pool_alloc(ctx, css->pool, fz_maxi(n, 1) * sizeof *index->entry);
+	index->candidate = fz_pool_alloc(ctx, css->pool, fz_maxi(n, 1) * sizeof *index->candidate);
+	index->can_share = 1;
+
+	n = 0;
+	for (rule = css->rule; rule; rule = rule->next)
+	{
+		for (sel = rule->selector; sel; sel = sel->next)
+		{
+			entry = &index->entry[n];
+			file_selector(entry, sel);
+			entry->order = n++;
+			entry->rule = rule;
+			entry->sel = sel;
+			if (!selector_allows_sharing(sel))
+				index->can_share = 0;
+		}
+	}
+	index->len = n;
+
+	qsort(index->entry, n, sizeof *index->entry, cmp_rule_entry);
+
+	return index;
+}
+
+static int
+add_rule_candidates(fz_css_rule_index *index, int n, int type, const char *key, size_t len)
+{
+	int l = 0;
+	int r = index->len;
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (cmp_rule_key(&index->entry[m], type, key, len) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+	while (l < index->len && cmp_rule_key(&index->entry[l], type, key, len) == 0)
+		index->candidate[n++] = &index->entry[l++];
+	return n;
+}
+
+/* Find the selectors that may match node, in stylesheet order. */
+static int
+find_rule_candidates(fz_css_rule_index *index, fz_xml *node)
+{
+	const char *s, *e, *t;
+	int n = 0;
+
+	s = fz_xml_att(node, "id");
+	if (s)
+		n = add_rule_candidates(index, n, INDEX_ID, s, strlen(s));
+
+	s = fz_xml_att(node, "class");
+	while (s && *s)
+	{
+		while (*s == ' ')
+			++s;
+		e = s;
+		while (*e && *e != ' ')
+			++e;
+		if (e > s)
+		{
+			/* Skip classes that are listed more than once. */
+			t = fz_xml_att(node, "class");
+			while (t < s && !(!strncmp(t, s, e - s) && (t[e - s] == ' ') && (t == fz_xml_att(node, "class") || t[-1] == ' ')))
+				++t;
+			if (t == s)
+				n = add_rule_candidates(index, n, INDEX_CLASS, s, e - s);
+		}
+		s = e;
+	}
+
+	s = fz_xml_tag(node);
+	if (s)
+		n = add_rule_candidates(index, n, INDEX_TAG, s, strlen(s));
+
+	n = add_rule_candidates(index, n, INDEX_UNIVERSAL, NULL, 0);
+
+	qsort(index->candidate, n, sizeof *index->candidate, cmp_rule_order);
+
+	return n;
+}
+
 /*
  * Annotating nodes with properties and expanding shorthand forms.
  */
@@ -703,31 +935,38 @@ add_property(fz_css_match *match, int name, fz_css_value *value, int spec)
 void
 fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_match *up, fz_css *css, fz_xml *node)
 {
+	fz_css_rule_index *index;
+	fz_css_rule_entry *entry;
 	fz_css_rule *rule;
-	fz_css_selector *sel;
 	fz_css_property *prop;
 	const char *s;
-	int i;
+	int i, n;
+
+	if (!css->index)
+		css->index = build_rule_index(ctx, css);
+	index = css->index;
 
 	match->up = up;
+	match->share = ++index->next_share;
 	for (i = 0; i < NUM_PROPERTIES; ++i)
 	{
 		match->spec[i] = -1;
 		match->value[i] = NULL;
 	}
 
-	for (rule = css->rule; rule; rule = rule->next)
+	/* Apply each rule for the first of its selectors that matches. */
+	rule = NULL;
+	n = find_rule_candidates(index, node);
+	for (i = 0; i < n; ++i)
 	{
-		sel = rule->selector;
-		while (sel)
+		entry = index->candidate[i];
+		if (entry->rule == rule)
+			continue;
+		if (match_selector(entry->sel, node))
 		{
-			if (match_selector(sel, node))
-			{
-				for (prop = rule->declaration; prop; prop = prop->next)
-					add_property(match, prop->name, prop->value, selector_specificity(sel, prop->important));
-				break;
-			}
-			sel = sel->next;
+			rule = entry->rule;
+			for (prop = rule->declaration; prop; prop = prop->next)
+				add_property(match, prop->name, prop->value, selector_specificity(entry->sel, prop->important));
 		}
 	}
 
@@ -756,6 +995,55 @@ fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_match *up, fz_css *css
 	}
 }
 
+static unsigned int
+share_hash(int up_share, const char *tag, const char *class_att)
+{
+	unsigned int h = up_share;
+	while (*tag)
+		h = h * 31 + (unsigned char)*tag++;
+	if (class_att)
+		while (*class_att)
+			h = h * 31 + (unsigned char)*class_att++;
+	return h % SHARE_CACHE_SIZE;
+}
+
+void
+fz_match_css_style(fz_context *ctx, fz_html_font_set *set, fz_css *css, fz_css_match *match, fz_css_match *up, fz_xml *node, fz_css_style *style)
+{
+	fz_css_share_entry *entry = NULL;
+	const char *tag = fz_xml_tag(node);
+	const char *class_att = fz_xml_att(node, "class");
+
+	if (!css->index)
+		css->index = build_rule_index(ctx, css);
+
+	if (css->index->can_share && up && tag && !fz_xml_att(node, "id") && !fz_xml_att(node, "style"))
+	{
+		entry = &css->index->share[share_hash(up->share, tag, class_att)];
+		if (entry->share && entry->up_share == up->share && !strcmp(entry->tag, tag) &&
+			(entry->class_att ? class_att && !strcmp(entry->class_att, class_att) : !class_att))
+		{
+			*match = entry->match;
+			match->up = up;
+			*style = entry->style;
+			return;
+		}
+	}
+
+	fz_match_css(ctx, match, up, css, node);
+	fz_apply_css_style(ctx, set, style, match);
+
+	if (entry)
+	{
+		entry->up_share = up->share;
+		entry->share = match->share;
+		entry->tag = tag;
+		entry->class_att = class_att;
+		entry->match = *match;
+		entry->style = *style;
+	}
+}
+
 void
 fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css *css)
 {
@@ -765,6 +1053,7 @@ fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css *css)
 	int i;
 
 	match->up = NULL;
+	match->share = 0;
 	for (i = 0; i < NUM_PROPERTIES; ++i)
 	{
 		match->spec[i] = -1;
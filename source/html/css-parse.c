@@ -139,6 +139,7 @@ fz_css *fz_new_css(fz_context *ctx)
 		css = fz_pool_alloc(ctx, pool, sizeof *css);
 		css->pool = pool;
 		css->rule = NULL;
+		css->index = NULL;
 	}
 	fz_catch(ctx)
 	{
@@ -1107,4 +1108,5 @@ void fz_parse_css(fz_context *ctx, fz_css *css, const char *source, const char *
 	css_lex_init(ctx, &buf, css->pool, source, file);
 	next(&buf);
 	css->rule = parse_stylesheet(&buf, css->rule);
+	css->index = NULL;
 }
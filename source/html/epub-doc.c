@@ -191,7 +191,8 @@ invalidate_accelerator(fz_context *ctx, epub_accelerator *acc)
 		acc->pages_in_chapter[i] = -1;
 }
 
-static int count_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter *ch)
+/* Return the page count recorded for a chapter, or -1 if unknown. */
+static int known_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 {
 	epub_accelerator *acc = doc->accel;
 	int use_doc_css = fz_use_document_css(ctx);
@@ -203,11 +204,19 @@ static int count_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter
 		invalidate_accelerator(ctx, acc);
 	}
 
-	if (ch->number < acc->num_chapters && acc->pages_in_chapter[ch->number] != -1)
+	if (ch->number < acc->num_chapters)
 		return acc->pages_in_chapter[ch->number];
+	return -1;
+}
+
+static int count_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter *ch)
+{
+	int n = known_chapter_pages(ctx, doc, ch);
+	if (n != -1)
+		return n;
 
 	fz_drop_html(ctx, epub_get_laid_out_html(ctx, doc, ch));
-	return acc->pages_in_chapter[ch->number];
+	return doc->accel->pages_in_chapter[ch->number];
 }
 
 static fz_link_dest
@@ -513,6 +522,123 @@ epub_get_laid_out_html(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 	return html;
 }
 
+/*
+	Chapter layout jobs.
+
+	The chapter is parsed into a private html tree when the job is
+	begun, since parsing needs the archive and the font set. Laying it
+	out only touches the tree itself and the fonts, so jobs can be run
+	concurrently. The fonts' glyph encoding caches and the shared
+	fallback font tables are filled in under locks (see font.c). Once
+	ended, the tree is put in the store, where epub_get_laid_out_html
+	will find it already laid out.
+*/
+
+typedef struct
+{
+	fz_chapter_layout super;
+	fz_html *html;
+	float layout_w, layout_h, layout_em;
+	uint32_t css_sum;
+	int pages;
+} epub_chapter_layout;
+
+static void
+epub_run_chapter_layout(fz_context *ctx, fz_chapter_layout *job_)
+{
+	epub_chapter_layout *job = (epub_chapter_layout *)job_;
+
+	fz_layout_html(ctx, job->html, job->layout_w, job->layout_h, job->layout_em);
+	job->pages = count_laid_out_pages(job->html);
+}
+
+static int
+epub_end_chapter_layout(fz_context *ctx, fz_chapter_layout *job_)
+{
+	epub_chapter_layout *job = (epub_chapter_layout *)job_;
+	epub_document *doc = (epub_document *)job->super.doc;
+	fz_html *html = job->html;
+	epub_chapter *ch;
+
+	job->html = NULL;
+
+	/* Discard the result if the document has been laid out anew. */
+	if (job->pages < 0 ||
+		doc->layout_w != job->layout_w ||
+		doc->layout_h != job->layout_h ||
+		doc->layout_em != job->layout_em ||
+		doc->css_sum != job->css_sum)
+	{
+		fz_drop_html(ctx, html);
+		return -1;
+	}
+
+	for (ch = doc->spine; ch; ch = ch->next)
+		if (ch->number == job->super.chapter)
+			break;
+
+	html = fz_store_html(ctx, html, doc, ch->number);
+	fz_try(ctx)
+	{
+		/* Another copy may have been stored while we were working. */
+		fz_layout_html(ctx, html, doc->layout_w, doc->layout_h, doc->layout_em);
+		accelerate_chapter(ctx, doc, ch, html);
+	}
+	fz_always(ctx)
+		fz_drop_html(ctx, html);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return known_chapter_pages(ctx, doc, ch);
+}
+
+static fz_chapter_layout *
+epub_begin_chapter_layout(fz_context *ctx, fz_document *doc_, int chapter)
+{
+	epub_document *doc = (epub_document*)doc_;
+	epub_chapter_layout *job;
+	epub_chapter *ch;
+	fz_buffer *buf;
+	char base_uri[2048];
+
+	for (ch = doc->spine; ch; ch = ch->next)
+		if (ch->number == chapter)
+			break;
+	if (!ch || known_chapter_pages(ctx, doc, ch) != -1)
+		return NULL;
+
+	job = fz_malloc_struct(ctx, epub_chapter_layout);
+	job->super.chapter = chapter;
+	job->super.run = epub_run_chapter_layout;
+	job->super.end = epub_end_chapter_layout;
+	job->layout_w = doc->layout_w;
+	job->layout_h = doc->layout_h;
+	job->layout_em = doc->layout_em;
+	job->css_sum = doc->css_sum;
+	job->pages = -1;
+
+	fz_dirname(base_uri, ch->path, sizeof base_uri);
+
+	buf = NULL;
+	fz_var(buf);
+	fz_try(ctx)
+	{
+		buf = fz_read_archive_entry(ctx, doc->zip, ch->path);
+		job->html = fz_parse_html(ctx, doc->set, doc->zip, base_uri, buf, fz_user_css(ctx), 1, 1, 0);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, job);
+		fz_rethrow(ctx);
+	}
+
+	job->super.doc = fz_keep_document(ctx, doc_);
+
+	return &job->super;
+}
+
 static fz_rect
 epub_bound_page(fz_context *ctx, fz_page *page_, fz_box_type box)
 {
@@ -1014,6 +1140,7 @@ epub_init(fz_context *ctx, fz_archive *zip, fz_stream *accel)
 		doc->super.lookup_bookmark = epub_lookup_bookmark;
 		doc->super.count_chapters = epub_count_chapters;
 		doc->super.count_pages = epub_count_pages;
+		doc->super.begin_chapter_layout = epub_begin_chapter_layout;
 		doc->super.load_page = epub_load_page;
 		doc->super.page_label = epub_page_label;
 		doc->super.lookup_metadata = epub_lookup_metadata;
@@ -35,6 +35,7 @@ typedef struct fz_css_style_splay_s fz_css_style_splay;
 
 typedef struct fz_css_s fz_css;
 typedef struct fz_css_rule_s fz_css_rule;
+typedef struct fz_css_rule_index_s fz_css_rule_index;
 typedef struct fz_css_match_s fz_css_match;
 typedef struct fz_css_style_s fz_css_style;
 
@@ -79,6 +80,7 @@ struct fz_css_s
 {
 	fz_pool *pool;
 	fz_css_rule *rule;
+	fz_css_rule_index *index; /* built on first match; discarded when rules are added */
 };
 
 struct fz_css_rule_s
@@ -204,6 +206,7 @@ enum
 struct fz_css_match_s
 {
 	fz_css_match *up;
+	int share; /* elements with the same share id match the same rules */
 	short spec[NUM_PROPERTIES];
 	fz_css_value *value[NUM_PROPERTIES];
 };
@@ -312,11 +315,14 @@ enum
 	BOX_TABLE_CELL,		/* table-cell: contains block */
 };
 
+typedef struct fz_html_word_cache_s fz_html_word_cache;
+
 typedef struct
 {
 	fz_storable storable;
 	fz_pool *pool; /* pool allocator for this html tree */
 	fz_html_box *root;
+	fz_html_word_cache *word_cache; /* shaped word widths, kept across layouts */
 } fz_html_tree;
 
 struct fz_html_s
@@ -526,6 +532,13 @@ const char *fz_css_property_name(int name);
 void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_match *up, fz_css *css, fz_xml *node);
 void fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css *css);
 
+/*
+	Match the rules for node and compute its style, reusing the
+	result for an earlier sibling or cousin that is bound to match
+	the same rules where possible.
+*/
+void fz_match_css_style(fz_context *ctx, fz_html_font_set *set, fz_css *css, fz_css_match *match, fz_css_match *up, fz_xml *node, fz_css_style *style);
+
 int fz_get_css_match_display(fz_css_match *node);
 void fz_default_css_style(fz_context *ctx, fz_css_style *style);
 void fz_apply_css_style(fz_context *ctx, fz_html_font_set *set, fz_css_style *style, fz_css_match *match);
@@ -299,6 +299,7 @@ static int walk_string(string_walker *walker)
 	if (quickshape)
 	{
 		unsigned int i;
+		fz_preload_font_metrics(ctx, walker->font);
 		for (i = 0; i < walker->glyph_count; ++i)
 		{
 			int glyph, unicode;
@@ -330,22 +331,165 @@ static const char *get_node_text(fz_context *ctx, fz_html_flow *node)
 		return "";
 }
 
-static void measure_string_w(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_buf)
+/*
+	Word cache.
+
+	The width of a word only depends on its text, font and shaping
+	parameters; the font size merely scales it. We remember the advance
+	(in font units) of each run of glyphs that the string walker produced
+	for a word, so that repeated words, and every relayout at a new font
+	or page size, can skip the shaping altogether.
+
+	The cache lives in the pool of the html tree, so entries are never
+	freed individually.
+*/
+
+#define WORD_CACHE_MAX_RUNS 4
+
+typedef struct word_cache_entry_s word_cache_entry;
+
+struct word_cache_entry_s
+{
+	word_cache_entry *next;
+	unsigned int hash;
+	fz_font *font;
+	char *text;
+	unsigned short language;
+	unsigned char script;
+	unsigned char small_caps;
+	unsigned char rtl;
+	unsigned char runs;
+	struct {
+		int x;
+		int scale;
+	} run[WORD_CACHE_MAX_RUNS];
+};
+
+struct fz_html_word_cache_s
+{
+	fz_pool *pool;
+	int len, cap;
+	word_cache_entry **table;
+};
+
+static fz_html_word_cache *new_word_cache(fz_context *ctx, fz_pool *pool)
+{
+	fz_html_word_cache *cache = fz_pool_alloc(ctx, pool, sizeof *cache);
+	cache->pool = pool;
+	cache->cap = 1024;
+	cache->table = fz_pool_alloc(ctx, pool, cache->cap * sizeof *cache->table);
+	return cache;
+}
+
+static unsigned int word_cache_hash(fz_font *font, const char *text, int script, int language, int small_caps, int rtl)
+{
+	unsigned int h = (unsigned int)(((uintptr_t)font) >> 4);
+	h = h * 31 + script;
+	h = h * 31 + language;
+	h = h * 31 + (small_caps << 1) + rtl;
+	while (*text)
+		h = h * 31 + (unsigned char)*text++;
+	return h;
+}
+
+static word_cache_entry *lookup_word_cache(fz_html_word_cache *cache, unsigned int hash, fz_font *font, const char *text, int script, int language, int small_caps, int rtl)
+{
+	word_cache_entry *e;
+	for (e = cache->table[hash & (cache->cap - 1)]; e; e = e->next)
+	{
+		if (e->hash == hash && e->font == font && e->script == script &&
+			e->language == language &&
+			e->small_caps == small_caps && e->rtl == rtl &&
+			!strcmp(e->text, text))
+			return e;
+	}
+	return NULL;
+}
+
+static void insert_word_cache(fz_context *ctx, fz_html_word_cache *cache, word_cache_entry *e)
+{
+	word_cache_entry **table, *next;
+	int i, cap;
+
+	/* The old table is left behind in the pool when growing; the sizes
+	 * double, so at most half the memory used for tables is wasted. */
+	if (cache->len >= cache->cap)
+	{
+		cap = cache->cap * 2;
+		table = fz_pool_alloc(ctx, cache->pool, cap * sizeof *table);
+		for (i = 0; i < cache->cap; ++i)
+		{
+			for (; cache->table[i]; cache->table[i] = next)
+			{
+				next = cache->table[i]->next;
+				cache->table[i]->next = table[cache->table[i]->hash & (cap - 1)];
+				table[cache->table[i]->hash & (cap - 1)] = cache->table[i];
+			}
+		}
+		cache->table = table;
+		cache->cap = cap;
+	}
+
+	e->next = cache->table[e->hash & (cache->cap - 1)];
+	cache->table[e->hash & (cache->cap - 1)] = e;
+	cache->len++;
+}
+
+static void measure_string_w(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_buf, fz_html_word_cache *cache)
 {
 	float em = node->box->s.layout.em;
+	fz_font *font = node->box->style->font;
+	int rtl = node->bidi_level & 1;
+	int small_caps = node->box->style->small_caps;
 	string_walker walker;
-	unsigned int i;
+	word_cache_entry *e;
+	word_cache_entry tmp;
+	unsigned int i, hash;
 	const char *s;
+	int k;
+
 	node->w = 0;
 	s = get_node_text(ctx, node);
-	init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, node->box->style->font, node->script, node->markup_lang, node->box->style->small_caps, s);
+
+	hash = word_cache_hash(font, s, node->script, node->markup_lang, small_caps, rtl);
+	e = lookup_word_cache(cache, hash, font, s, node->script, node->markup_lang, small_caps, rtl);
+	if (e)
+	{
+		for (k = 0; k < e->runs; ++k)
+			node->w += e->run[k].x * em / e->run[k].scale;
+		return;
+	}
+
+	tmp.runs = 0;
+	init_string_walker(ctx, &walker, hb_buf, rtl, font, node->script, node->markup_lang, small_caps, s);
 	while (walk_string(&walker))
 	{
 		int x = 0;
 		for (i = 0; i < walker.glyph_count; i++)
 			x += walker.glyph_pos[i].x_advance;
 		node->w += x * em / walker.scale;
+		if (tmp.runs < WORD_CACHE_MAX_RUNS)
+		{
+			tmp.run[tmp.runs].x = x;
+			tmp.run[tmp.runs].scale = walker.scale;
+		}
+		tmp.runs++;
 	}
+
+	/* Words that switch between many fallback fonts are rare; don't bother. */
+	if (tmp.runs > WORD_CACHE_MAX_RUNS)
+		return;
+
+	e = fz_pool_alloc(ctx, cache->pool, sizeof *e);
+	*e = tmp;
+	e->hash = hash;
+	e->font = font;
+	e->text = fz_pool_strdup(ctx, cache->pool, s);
+	e->script = node->script;
+	e->language = node->markup_lang;
+	e->small_caps = small_caps;
+	e->rtl = rtl;
+	insert_word_cache(ctx, cache, e);
 }
 
 static void measure_string_h(fz_context *ctx, fz_html_flow *node)
@@ -523,6 +667,7 @@ typedef struct
 	float page_top;
 	float page_h;
 	hb_buffer_t *hb_buf;
+	fz_html_word_cache *word_cache;
 	fz_html_restarter *restart;
 } layout_data;
 
@@ -604,8 +749,8 @@ static void break_word_for_overflow_wrap(fz_context *ctx, fz_html_flow *node, la
 				fz_html_split_flow(ctx, ld->pool, node, fz_runeidx(text, text + b));
 				node->atomic = 1;
 				node->next->overflow_wrap = 1;
-				measure_string_w(ctx, node, ld->hb_buf);
-				measure_string_w(ctx, node->next, ld->hb_buf);
+				measure_string_w(ctx, node, ld->hb_buf, ld->word_cache);
+				measure_string_w(ctx, node->next, ld->hb_buf, ld->word_cache);
 				return;
 			}
 		}
@@ -1552,7 +1697,7 @@ static void layout_update_styles(fz_context *ctx, fz_html_box *box, fz_html_box
 	}
 }
 
-static void layout_update_widths(fz_context *ctx, fz_html_box *box, fz_html_box *top, hb_buffer_t *hb_buf)
+static void layout_update_widths(fz_context *ctx, fz_html_box *box, fz_html_box *top, hb_buffer_t *hb_buf, fz_html_word_cache *cache)
 {
 	while (box)
 	{
@@ -1566,12 +1711,12 @@ static void layout_update_widths(fz_context *ctx, fz_html_box *box, fz_html_box
 					/* start with "native" size (only used for table width calculations) */
 					node->w = node->content.image->w * 72.0f / 96.0f;
 				else if (node->type == FLOW_WORD || node->type == FLOW_SPACE || node->type == FLOW_SHYPHEN)
-					measure_string_w(ctx, node, hb_buf);
+					measure_string_w(ctx, node, hb_buf, cache);
 			}
 		}
 
 		if (box->down)
-			layout_update_widths(ctx, box->down, box, hb_buf);
+			layout_update_widths(ctx, box->down, box, hb_buf, cache);
 
 		box = box->next;
 	}
@@ -1727,6 +1872,9 @@ fz_restartable_layout_html(fz_context *ctx, fz_html_tree *tree, float start_x, f
 		ld.page_h = page_h;
 		ld.page_top = start_y;
 		ld.pool = tree->pool;
+		if (!tree->word_cache)
+			tree->word_cache = new_word_cache(ctx, tree->pool);
+		ld.word_cache = tree->word_cache;
 		if (restart)
 			restart->potential = NULL;
 
@@ -1738,7 +1886,7 @@ fz_restartable_layout_html(fz_context *ctx, fz_html_tree *tree, float start_x, f
 			box->s.layout.x = start_x;
 			box->s.layout.w = page_w;
 			layout_update_styles(ctx, box->down, box);
-			layout_update_widths(ctx, box->down, box, ld.hb_buf);
+			layout_update_widths(ctx, box->down, box, ld.hb_buf, ld.word_cache);
 			layout_collapse_margins(ctx, box->down, box);
 		}
 
@@ -1155,8 +1155,7 @@ static void gen2_children(fz_context *ctx, struct genstate *g, fz_html_box *root
 		tag = fz_xml_tag(node);
 		if (tag)
 		{
-			fz_match_css(ctx, &match, root_match, g->css, node);
-			fz_apply_css_style(ctx, g->set, &style, &match);
+			fz_match_css_style(ctx, g->set, g->css, &match, root_match, node, &style);
 			display = fz_get_css_match_display(&match);
 			if (tag[0]=='b' && tag[1]=='r' && tag[2]==0)
 			{
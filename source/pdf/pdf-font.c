@@ -265,9 +265,9 @@ pdf_font_cid_to_gid(fz_context *ctx, pdf_font_desc *fontdesc, int cid)
 	if (fontdesc->font->ft_face)
 	{
 		int gid;
-		fz_ft_lock(ctx);
+		fz_ft_lock_face(ctx, fontdesc->font);
 		gid = ft_cid_to_gid(fontdesc, cid);
-		fz_ft_unlock(ctx);
+		fz_ft_unlock_face(ctx, fontdesc->font);
 		return gid;
 	}
 	return cid;
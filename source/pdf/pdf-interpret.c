@@ -22,6 +22,7 @@
 
 #include "mupdf/fitz.h"
 #include "pdf-annot-imp.h"
+#include "pdf-profile-imp.h"
 
 #include <string.h>
 #include <math.h>
@@ -29,6 +30,154 @@
 /* Maximum number of errors before aborting */
 #define MAX_SYNTAX_ERRORS 100
 
+/* Read the clock only when the document is being profiled. */
+static double
+pdf_profile_now(pdf_csi *csi)
+{
+	return csi->doc->profile ? fz_ms_clock() : 0;
+}
+
+/*
+	Resolved resource cache.
+
+	Operators that name a resource look it up in the current resource
+	dictionary and then load it, which is usually a store hit. We
+	remember the result per (resource dictionary, kind, name) until the
+	processor is closed, so repeated uses within a page, including from
+	nested forms that share the same resource dictionary, skip both
+	steps.
+*/
+
+enum
+{
+	PDF_RES_FONT,
+	PDF_RES_COLORSPACE,
+	PDF_RES_PATTERN,
+	PDF_RES_SHADING,
+	PDF_RES_XOBJECT,
+	PDF_RES_EXTGSTATE
+};
+
+typedef struct
+{
+	pdf_obj *rdb;
+	int kind;
+	char name[32];
+} pdf_resource_key;
+
+typedef struct
+{
+	int kind; /* type of loaded; may differ from the key kind for shading patterns */
+	pdf_obj *rdb;
+	pdf_obj *obj;
+	void *loaded;
+} pdf_resource_entry;
+
+static void
+pdf_drop_resource_entry(fz_context *ctx, void *entry_)
+{
+	pdf_resource_entry *entry = entry_;
+
+	switch (entry->kind)
+	{
+	case PDF_RES_FONT: pdf_drop_font(ctx, entry->loaded); break;
+	case PDF_RES_COLORSPACE: fz_drop_colorspace(ctx, entry->loaded); break;
+	case PDF_RES_PATTERN: pdf_drop_pattern(ctx, entry->loaded); break;
+	case PDF_RES_SHADING: fz_drop_shade(ctx, entry->loaded); break;
+	case PDF_RES_XOBJECT: fz_drop_image(ctx, entry->loaded); break;
+	}
+	pdf_drop_obj(ctx, entry->obj);
+	pdf_drop_obj(ctx, entry->rdb);
+	fz_free(ctx, entry);
+}
+
+static void
+pdf_drop_resource_cache(fz_context *ctx, pdf_processor *proc)
+{
+	fz_drop_hash_table(ctx, proc->resource_cache);
+	proc->resource_cache = NULL;
+}
+
+static int
+pdf_make_resource_key(pdf_resource_key *key, pdf_csi *csi, int kind)
+{
+	size_t n = strlen(csi->name);
+
+	/* Overlong names are rare; just don't cache them. */
+	if (n >= sizeof key->name)
+		return 0;
+
+	memset(key, 0, sizeof *key);
+	key->rdb = csi->rdb;
+	key->kind = kind;
+	memcpy(key->name, csi->name, n);
+	return 1;
+}
+
+static pdf_resource_entry *
+pdf_find_cached_resource(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int kind)
+{
+	pdf_resource_key key;
+
+	if (!proc->resource_cache || !pdf_make_resource_key(&key, csi, kind))
+		return NULL;
+	return fz_hash_find(ctx, proc->resource_cache, &key);
+}
+
+/*
+	Remember obj (and what was loaded from it) under csi->name. The
+	cache takes its own references. Failing to cache is not an error,
+	so this never throws; it returns NULL instead.
+*/
+static pdf_resource_entry *
+pdf_cache_resource(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int key_kind, int kind, pdf_obj *obj, void *loaded)
+{
+	pdf_resource_key key;
+	pdf_resource_entry *entry = NULL;
+	pdf_resource_entry *existing = NULL;
+
+	if (!pdf_make_resource_key(&key, csi, key_kind))
+		return NULL;
+
+	fz_var(entry);
+
+	fz_try(ctx)
+	{
+		if (!proc->resource_cache)
+			proc->resource_cache = fz_new_hash_table(ctx, 64, sizeof key, -1, pdf_drop_resource_entry);
+
+		entry = fz_malloc_struct(ctx, pdf_resource_entry);
+		entry->kind = kind;
+		entry->rdb = pdf_keep_obj(ctx, csi->rdb);
+		entry->obj = pdf_keep_obj(ctx, obj);
+		switch (kind)
+		{
+		case PDF_RES_FONT: entry->loaded = pdf_keep_font(ctx, loaded); break;
+		case PDF_RES_COLORSPACE: entry->loaded = fz_keep_colorspace(ctx, loaded); break;
+		case PDF_RES_PATTERN: entry->loaded = pdf_keep_pattern(ctx, loaded); break;
+		case PDF_RES_SHADING: entry->loaded = fz_keep_shade(ctx, loaded); break;
+		case PDF_RES_XOBJECT: entry->loaded = fz_keep_image(ctx, loaded); break;
+		}
+
+		/* A nested form may have beaten us to it. */
+		existing = fz_hash_insert(ctx, proc->resource_cache, &key, entry);
+	}
+	fz_catch(ctx)
+	{
+		if (entry)
+			pdf_drop_resource_entry(ctx, entry);
+		fz_ignore_error(ctx);
+		return NULL;
+	}
+
+	if (existing)
+	{
+		pdf_drop_resource_entry(ctx, entry);
+		return existing;
+	}
+	return entry;
+}
+
 void *
 pdf_new_processor(fz_context *ctx, int size)
 {
@@ -52,6 +201,7 @@ pdf_close_processor(fz_context *ctx, pdf_processor *proc)
 		return;
 
 	proc->closed = 1;
+	pdf_drop_resource_cache(ctx, proc);
 	close_processor = proc->close_processor;
 	if (!close_processor)
 		return;
@@ -66,6 +216,7 @@ pdf_drop_processor(fz_context *ctx, pdf_processor *proc)
 	{
 		if (!proc->closed)
 			fz_warn(ctx, "dropping unclosed PDF processor");
+		pdf_drop_resource_cache(ctx, proc);
 		if (proc->drop_processor)
 			proc->drop_processor(ctx, proc);
 		fz_free(ctx, proc);
@@ -78,6 +229,7 @@ void pdf_reset_processor(fz_context *ctx, pdf_processor *proc)
 		return;
 
 	proc->closed = 0;
+	pdf_drop_resource_cache(ctx, proc);
 
 	if (proc->reset_processor == NULL)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "Cannot reset PDF processor");
@@ -112,7 +264,7 @@ pdf_clear_stack(fz_context *ctx, pdf_csi *csi)
 }
 
 static pdf_font_desc *
-pdf_try_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *font, fz_cookie *cookie)
+pdf_try_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *font, fz_cookie *cookie, int *incomplete)
 {
 	pdf_font_desc *desc = NULL;
 	fz_try(ctx)
@@ -124,6 +276,8 @@ pdf_try_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *fon
 			fz_ignore_error(ctx);
 			if (cookie)
 				cookie->incomplete++;
+			if (incomplete)
+				*incomplete = 1;
 		}
 		else
 		{
@@ -251,7 +405,7 @@ pdf_process_extgstate(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_ob
 		pdf_obj *font_size = pdf_array_get(ctx, obj, 1);
 		pdf_font_desc *font;
 		if (pdf_is_dict(ctx, font_ref))
-			font = pdf_try_load_font(ctx, csi->doc, csi->rdb, font_ref, csi->cookie);
+			font = pdf_try_load_font(ctx, csi->doc, csi->rdb, font_ref, csi->cookie, NULL);
 		else
 			font = pdf_load_hail_mary_font(ctx, csi->doc);
 		fz_try(ctx)
@@ -381,12 +535,20 @@ pdf_process_extgstate(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_ob
 static void
 pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 {
+	pdf_resource_entry *entry;
 	pdf_obj *xres, *xobj, *subtype;
 
-	xres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(XObject));
-	xobj = pdf_dict_gets(ctx, xres, csi->name);
-	if (!xobj)
-		fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find XObject resource '%s'", csi->name);
+	entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_XOBJECT);
+	if (entry)
+		xobj = entry->obj;
+	else
+	{
+		xres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(XObject));
+		xobj = pdf_dict_gets(ctx, xres, csi->name);
+		if (!xobj)
+			fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find XObject resource '%s'", csi->name);
+		entry = pdf_cache_resource(ctx, proc, csi, PDF_RES_XOBJECT, PDF_RES_XOBJECT, xobj, NULL);
+	}
 	subtype = pdf_dict_get(ctx, xobj, PDF_NAME(Subtype));
 	if (pdf_name_eq(ctx, subtype, PDF_NAME(Form)))
 	{
@@ -403,7 +565,12 @@ pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 	if (pdf_name_eq(ctx, subtype, PDF_NAME(Form)))
 	{
 		if (proc->op_Do_form)
+		{
+			double t = pdf_profile_now(csi);
 			proc->op_Do_form(ctx, proc, csi->name, xobj);
+			if (csi->doc->profile)
+				pdf_profile_resource(ctx, csi->doc->profile, PDF_PROFILE_FORM, xobj, csi->name, 0, pdf_profile_now(csi) - t);
+		}
 	}
 
 	else if (pdf_name_eq(ctx, subtype, PDF_NAME(Image)))
@@ -411,15 +578,33 @@ pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 		if (proc->op_Do_image)
 		{
 			fz_image *image = NULL;
+			double load = 0, draw;
+
+			if (proc->cull_image && proc->cull_image(ctx, proc))
+				return;
 
 			if (proc->requirements && PDF_PROCESSOR_REQUIRES_DECODED_IMAGES)
-				image = pdf_load_image(ctx, csi->doc, xobj);
+			{
+				if (entry && entry->loaded)
+					image = fz_keep_image(ctx, entry->loaded);
+				else
+				{
+					load = pdf_profile_now(csi);
+					image = pdf_load_image(ctx, csi->doc, xobj);
+					load = pdf_profile_now(csi) - load;
+					if (entry)
+						entry->loaded = fz_keep_image(ctx, image);
+				}
+			}
+			draw = pdf_profile_now(csi);
 			fz_try(ctx)
 				proc->op_Do_image(ctx, proc, csi->name, image);
 			fz_always(ctx)
 				fz_drop_image(ctx, image);
 			fz_catch(ctx)
 				fz_rethrow(ctx);
+			if (csi->doc->profile)
+				pdf_profile_resource(ctx, csi->doc->profile, PDF_PROFILE_IMAGE, xobj, csi->name, load, pdf_profile_now(csi) - draw);
 		}
 	}
 
@@ -454,12 +639,25 @@ pdf_process_CS(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 		cs = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
 	else
 	{
-		pdf_obj *csres, *csobj;
-		csres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ColorSpace));
-		csobj = pdf_dict_gets(ctx, csres, csi->name);
-		if (!csobj)
-			fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find ColorSpace resource '%s'", csi->name);
-		if (pdf_is_array(ctx, csobj) && pdf_array_len(ctx, csobj) == 1 && pdf_name_eq(ctx, pdf_array_get(ctx, csobj, 0), PDF_NAME(Pattern)))
+		pdf_resource_entry *entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_COLORSPACE);
+		if (entry)
+			cs = fz_keep_colorspace(ctx, entry->loaded);
+		else
+		{
+			pdf_obj *csres, *csobj;
+			csres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ColorSpace));
+			csobj = pdf_dict_gets(ctx, csres, csi->name);
+			if (!csobj)
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find ColorSpace resource '%s'", csi->name);
+			if (pdf_is_array(ctx, csobj) && pdf_array_len(ctx, csobj) == 1 && pdf_name_eq(ctx, pdf_array_get(ctx, csobj, 0), PDF_NAME(Pattern)))
+				cs = NULL;
+			else
+				cs = pdf_load_colorspace(ctx, csobj);
+			pdf_cache_resource(ctx, proc, csi, PDF_RES_COLORSPACE, PDF_RES_COLORSPACE, csobj, cs);
+		}
+
+		/* An uncoloured pattern space is cached as a NULL colorspace. */
+		if (!cs)
 		{
 			if (stroke)
 				proc->op_CS(ctx, proc, "Pattern", NULL);
@@ -467,7 +665,6 @@ pdf_process_CS(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 				proc->op_cs(ctx, proc, "Pattern", NULL);
 			return;
 		}
-		cs = pdf_load_colorspace(ctx, csobj);
 	}
 
 	fz_try(ctx)
@@ -488,13 +685,20 @@ pdf_process_SC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 {
 	if (csi->name[0])
 	{
+		pdf_resource_entry *entry;
 		pdf_obj *patres, *patobj;
 		int type;
 
-		patres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Pattern));
-		patobj = pdf_dict_gets(ctx, patres, csi->name);
-		if (!patobj)
-			fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find Pattern resource '%s'", csi->name);
+		entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_PATTERN);
+		if (entry)
+			patobj = entry->obj;
+		else
+		{
+			patres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Pattern));
+			patobj = pdf_dict_gets(ctx, patres, csi->name);
+			if (!patobj)
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find Pattern resource '%s'", csi->name);
+		}
 
 		type = pdf_dict_get_int(ctx, patobj, PDF_NAME(PatternType));
 
@@ -502,7 +706,14 @@ pdf_process_SC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 		{
 			if (proc->op_SC_pattern && proc->op_sc_pattern)
 			{
-				pdf_pattern *pat = pdf_load_pattern(ctx, csi->doc, patobj);
+				pdf_pattern *pat;
+				if (entry && entry->kind == PDF_RES_PATTERN)
+					pat = pdf_keep_pattern(ctx, entry->loaded);
+				else
+				{
+					pat = pdf_load_pattern(ctx, csi->doc, patobj);
+					pdf_cache_resource(ctx, proc, csi, PDF_RES_PATTERN, PDF_RES_PATTERN, patobj, pat);
+				}
 				fz_try(ctx)
 				{
 					if (stroke)
@@ -521,7 +732,14 @@ pdf_process_SC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 		{
 			if (proc->op_SC_shade && proc->op_sc_shade)
 			{
-				fz_shade *shade = pdf_load_shading(ctx, csi->doc, patobj);
+				fz_shade *shade;
+				if (entry && entry->kind == PDF_RES_SHADING)
+					shade = fz_keep_shade(ctx, entry->loaded);
+				else
+				{
+					shade = pdf_load_shading(ctx, csi->doc, patobj);
+					pdf_cache_resource(ctx, proc, csi, PDF_RES_PATTERN, PDF_RES_SHADING, patobj, shade);
+				}
 				fz_try(ctx)
 				{
 					if (stroke)
@@ -644,7 +862,7 @@ static int is_known_bad_word(const char *word)
 #define C(a,b,c) (a | b << 8 | c << 16)
 
 static void
-pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
+pdf_process_keyword_imp(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
 {
 	float *s = csi->stack;
 	char csname[40];
@@ -685,11 +903,18 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 
 	case B('g','s'):
 		{
+			pdf_resource_entry *entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_EXTGSTATE);
 			pdf_obj *gsres, *gsobj;
-			gsres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ExtGState));
-			gsobj = pdf_dict_gets(ctx, gsres, csi->name);
-			if (!gsobj)
-				fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find ExtGState resource '%s'", csi->name);
+			if (entry)
+				gsobj = entry->obj;
+			else
+			{
+				gsres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ExtGState));
+				gsobj = pdf_dict_gets(ctx, gsres, csi->name);
+				if (!gsobj)
+					fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find ExtGState resource '%s'", csi->name);
+				pdf_cache_resource(ctx, proc, csi, PDF_RES_EXTGSTATE, PDF_RES_EXTGSTATE, gsobj, NULL);
+			}
 			if (proc->op_gs_begin)
 				proc->op_gs_begin(ctx, proc, csi->name, gsobj);
 			pdf_process_extgstate(ctx, proc, csi, gsobj);
@@ -743,14 +968,33 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	case B('T','f'):
 		if (proc->op_Tf)
 		{
+			pdf_resource_entry *entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_FONT);
 			pdf_obj *fontres, *fontobj;
 			pdf_font_desc *font;
-			fontres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Font));
-			fontobj = pdf_dict_gets(ctx, fontres, csi->name);
-			if (pdf_is_dict(ctx, fontobj))
-				font = pdf_try_load_font(ctx, csi->doc, csi->rdb, fontobj, csi->cookie);
+			double load = 0;
+			if (entry)
+			{
+				fontobj = entry->obj;
+				font = pdf_keep_font(ctx, entry->loaded);
+			}
 			else
-				font = pdf_load_hail_mary_font(ctx, csi->doc);
+			{
+				int incomplete = 0;
+				fontres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Font));
+				fontobj = pdf_dict_gets(ctx, fontres, csi->name);
+				load = pdf_profile_now(csi);
+				if (pdf_is_dict(ctx, fontobj))
+					font = pdf_try_load_font(ctx, csi->doc, csi->rdb, fontobj, csi->cookie, &incomplete);
+				else
+					font = pdf_load_hail_mary_font(ctx, csi->doc);
+				load = pdf_profile_now(csi) - load;
+				/* Try again next time if the font data has not arrived yet. */
+				if (!incomplete)
+					pdf_cache_resource(ctx, proc, csi, PDF_RES_FONT, PDF_RES_FONT, fontobj, font);
+			}
+			if (csi->doc->profile)
+				pdf_profile_resource(ctx, csi->doc->profile, PDF_PROFILE_FONT, fontobj,
+					font && font->font ? font->font->name : csi->name, load, 0);
 			fz_try(ctx)
 				proc->op_Tf(ctx, proc, csi->name, font, s[0]);
 			fz_always(ctx)
@@ -834,19 +1078,35 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	case B('s','h'):
 		if (proc->op_sh)
 		{
+			pdf_resource_entry *entry = pdf_find_cached_resource(ctx, proc, csi, PDF_RES_SHADING);
 			pdf_obj *shaderes, *shadeobj;
 			fz_shade *shade;
-			shaderes = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Shading));
-			shadeobj = pdf_dict_gets(ctx, shaderes, csi->name);
-			if (!shadeobj)
-				fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find Shading resource '%s'", csi->name);
-			shade = pdf_load_shading(ctx, csi->doc, shadeobj);
+			double load = 0, draw;
+			if (entry)
+			{
+				shadeobj = entry->obj;
+				shade = fz_keep_shade(ctx, entry->loaded);
+			}
+			else
+			{
+				shaderes = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Shading));
+				shadeobj = pdf_dict_gets(ctx, shaderes, csi->name);
+				if (!shadeobj)
+					fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot find Shading resource '%s'", csi->name);
+				load = pdf_profile_now(csi);
+				shade = pdf_load_shading(ctx, csi->doc, shadeobj);
+				load = pdf_profile_now(csi) - load;
+				pdf_cache_resource(ctx, proc, csi, PDF_RES_SHADING, PDF_RES_SHADING, shadeobj, shade);
+			}
+			draw = pdf_profile_now(csi);
 			fz_try(ctx)
 				proc->op_sh(ctx, proc, csi->name, shade);
 			fz_always(ctx)
 				fz_drop_shade(ctx, shade);
 			fz_catch(ctx)
 				fz_rethrow(ctx);
+			if (csi->doc->profile)
+				pdf_profile_resource(ctx, csi->doc->profile, PDF_PROFILE_SHADING, shadeobj, csi->name, load, pdf_profile_now(csi) - draw);
 		}
 		break;
 
@@ -866,7 +1126,251 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 }
 
 static void
-pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm)
+pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
+{
+	pdf_profile *prof = csi->doc->profile;
+	pdf_profile_frame frame;
+
+	if (!prof)
+	{
+		pdf_process_keyword_imp(ctx, proc, csi, stm, word);
+		return;
+	}
+
+	pdf_profile_begin_op(ctx, prof, &frame);
+	fz_try(ctx)
+		pdf_process_keyword_imp(ctx, proc, csi, stm, word);
+	fz_always(ctx)
+		pdf_profile_end_op(ctx, prof, &frame, word);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/*
+	Called from within an fz_catch while processing a content stream.
+	Returns 1 if processing should stop, 0 to carry on with the next
+	operator. Errors other than syntax errors are rethrown.
+*/
+static int
+pdf_recover_from_error(fz_context *ctx, fz_cookie *cookie, int *syntax_errors)
+{
+	int caught = fz_caught(ctx);
+
+	if (caught == FZ_ERROR_TRYLATER)
+	{
+		fz_ignore_error(ctx);
+		if (cookie)
+			cookie->incomplete++;
+		return 1;
+	}
+
+	if (caught != FZ_ERROR_SYNTAX)
+		fz_rethrow(ctx);
+
+	fz_report_error(ctx);
+	if (cookie)
+		cookie->errors++;
+	if (++*syntax_errors >= MAX_SYNTAX_ERRORS)
+	{
+		fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+	Compiled content streams.
+
+	Form XObjects (and tiling patterns) that are drawn many times are
+	lexed and parsed afresh on every use. The second time we process a
+	given content stream object we record the sequence of operators,
+	with their operands, as they are executed; subsequent runs replay
+	that recording straight into pdf_process_keyword without touching
+	the stream at all.
+
+	The recordings live in the store, keyed on the stream object, so
+	they are evicted under memory pressure and purged when the object
+	is edited. Streams that hit lexer errors, contain inline images,
+	or are cut short (abort, TRYLATER, too many errors) are not
+	compiled, since a replay could not be guaranteed to match.
+*/
+
+typedef struct
+{
+	int word; /* offset of keyword in text */
+	int name; /* offset of name in text, or -1 */
+	int string; /* offset of string in text, or -1 */
+	int string_len;
+	int nums; /* offset of operands in nums */
+	int top;
+	pdf_obj *obj;
+} pdf_program_op;
+
+typedef struct
+{
+	fz_storable storable;
+	int compiled; /* 0 while the stream has only been seen once */
+	int broken;
+	size_t size;
+	int len, cap;
+	pdf_program_op *ops;
+	int nums_len, nums_cap;
+	float *nums;
+	int text_len, text_cap;
+	char *text;
+} pdf_content_program;
+
+static void
+pdf_drop_content_program_imp(fz_context *ctx, fz_storable *prog_)
+{
+	pdf_content_program *prog = (pdf_content_program *)prog_;
+	int i;
+
+	for (i = 0; i < prog->len; i++)
+		pdf_drop_obj(ctx, prog->ops[i].obj);
+	fz_free(ctx, prog->ops);
+	fz_free(ctx, prog->nums);
+	fz_free(ctx, prog->text);
+	fz_free(ctx, prog);
+}
+
+static pdf_content_program *
+pdf_new_content_program(fz_context *ctx, int compiled)
+{
+	pdf_content_program *prog = fz_malloc_struct(ctx, pdf_content_program);
+	FZ_INIT_STORABLE(prog, 1, pdf_drop_content_program_imp);
+	prog->compiled = compiled;
+	prog->size = sizeof(*prog);
+	return prog;
+}
+
+static int
+pdf_program_add_text(fz_context *ctx, pdf_content_program *prog, const char *text, int len)
+{
+	int ofs = prog->text_len;
+	if (prog->text_len + len > prog->text_cap)
+	{
+		int cap = prog->text_cap ? prog->text_cap : 256;
+		while (prog->text_len + len > cap)
+			cap *= 2;
+		prog->text = fz_realloc(ctx, prog->text, cap);
+		prog->size += cap - prog->text_cap;
+		prog->text_cap = cap;
+	}
+	memcpy(prog->text + prog->text_len, text, len);
+	prog->text_len += len;
+	return ofs;
+}
+
+static void
+pdf_program_record(fz_context *ctx, pdf_content_program *prog, pdf_csi *csi, char *word)
+{
+	pdf_program_op *op;
+
+	/* Inline images read their data directly from the stream. */
+	if (prog->broken || !strcmp(word, "BI"))
+	{
+		prog->broken = 1;
+		return;
+	}
+
+	if (prog->len == prog->cap)
+	{
+		int cap = prog->cap ? prog->cap * 2 : 64;
+		prog->ops = fz_realloc_array(ctx, prog->ops, cap, pdf_program_op);
+		prog->size += (cap - prog->cap) * sizeof(pdf_program_op);
+		prog->cap = cap;
+	}
+	if (prog->nums_len + csi->top > prog->nums_cap)
+	{
+		int cap = prog->nums_cap ? prog->nums_cap : 256;
+		while (prog->nums_len + csi->top > cap)
+			cap *= 2;
+		prog->nums = fz_realloc_array(ctx, prog->nums, cap, float);
+		prog->size += (cap - prog->nums_cap) * sizeof(float);
+		prog->nums_cap = cap;
+	}
+
+	op = &prog->ops[prog->len];
+	op->word = pdf_program_add_text(ctx, prog, word, (int)strlen(word) + 1);
+	op->name = csi->name[0] ? pdf_program_add_text(ctx, prog, csi->name, (int)strlen(csi->name) + 1) : -1;
+	op->string = csi->string_len > 0 ? pdf_program_add_text(ctx, prog, csi->string, csi->string_len) : -1;
+	op->string_len = csi->string_len;
+	op->nums = prog->nums_len;
+	op->top = csi->top;
+	memcpy(prog->nums + prog->nums_len, csi->stack, csi->top * sizeof(float));
+	prog->nums_len += csi->top;
+	op->obj = pdf_keep_obj(ctx, csi->obj);
+	if (op->obj)
+		prog->size += 64;
+	prog->len++;
+}
+
+static void
+pdf_process_program(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_content_program *prog)
+{
+	fz_cookie *cookie = csi->cookie;
+	int syntax_errors = 0;
+	int i = 0;
+
+	pdf_clear_stack(ctx, csi);
+
+	fz_var(i);
+
+	if (cookie)
+	{
+		cookie->progress_max = -1;
+		cookie->progress = 0;
+	}
+
+	while (i < prog->len)
+	{
+		fz_try(ctx)
+		{
+			while (i < prog->len)
+			{
+				pdf_program_op *op = &prog->ops[i++];
+
+				if (cookie)
+				{
+					if (cookie->abort)
+					{
+						i = prog->len;
+						break;
+					}
+					cookie->progress++;
+				}
+
+				memcpy(csi->stack, prog->nums + op->nums, op->top * sizeof(float));
+				csi->top = op->top;
+				if (op->name >= 0)
+					fz_strlcpy(csi->name, prog->text + op->name, sizeof(csi->name));
+				if (op->string >= 0)
+					memcpy(csi->string, prog->text + op->string, op->string_len);
+				csi->string_len = op->string_len;
+				csi->obj = pdf_keep_obj(ctx, op->obj);
+
+				pdf_process_keyword(ctx, proc, csi, NULL, prog->text + op->word);
+				pdf_clear_stack(ctx, csi);
+			}
+		}
+		fz_always(ctx)
+		{
+			pdf_clear_stack(ctx, csi);
+		}
+		fz_catch(ctx)
+		{
+			if (pdf_recover_from_error(ctx, cookie, &syntax_errors))
+				i = prog->len;
+		}
+	}
+
+	if (syntax_errors > 0)
+		fz_warn(ctx, "encountered syntax errors; page may not be correct");
+}
+
+static void
+pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, pdf_content_program *rec)
 {
 	pdf_document *doc = csi->doc;
 	pdf_lexbuf *buf = csi->buf;
@@ -874,12 +1378,14 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 
 	pdf_token tok = PDF_TOK_ERROR;
 	int in_text_array = 0;
+	int in_op = 0;
 	int syntax_errors = 0;
 
 	/* make sure we have a clean slate if we come here from flush_text */
 	pdf_clear_stack(ctx, csi);
 
 	fz_var(in_text_array);
+	fz_var(in_op);
 	fz_var(tok);
 
 	if (cookie)
@@ -900,6 +1406,8 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					if (cookie->abort)
 					{
 						tok = PDF_TOK_EOF;
+						if (rec)
+							rec->broken = 1;
 						break;
 					}
 					cookie->progress++;
@@ -1025,7 +1533,11 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					break;
 
 				case PDF_TOK_KEYWORD:
+					if (rec)
+						pdf_program_record(ctx, rec, csi, buf->scratch);
+					in_op = 1;
 					pdf_process_keyword(ctx, proc, csi, stm, buf->scratch);
+					in_op = 0;
 					pdf_clear_stack(ctx, csi);
 					break;
 
@@ -1041,58 +1553,18 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 		}
 		fz_catch(ctx)
 		{
-			int caught = fz_caught(ctx);
-			if (cookie)
+			/* An error raised by the lexer rather than by an operator
+			 * means replaying the recorded operators would not
+			 * reproduce this run. */
+			if (rec && !in_op)
+				rec->broken = 1;
+			in_op = 0;
+
+			if (pdf_recover_from_error(ctx, cookie, &syntax_errors))
 			{
-				if (caught == FZ_ERROR_TRYLATER)
-				{
-					fz_ignore_error(ctx);
-					cookie->incomplete++;
-					tok = PDF_TOK_EOF;
-				}
-				else if (caught == FZ_ERROR_ABORT)
-				{
-					fz_rethrow(ctx);
-				}
-				else if (caught == FZ_ERROR_SYNTAX)
-				{
-					fz_report_error(ctx);
-					cookie->errors++;
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
-					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
-					}
-				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
-			}
-			else
-			{
-				if (caught == FZ_ERROR_TRYLATER)
-				{
-					fz_ignore_error(ctx);
-					tok = PDF_TOK_EOF;
-				}
-				else if (caught == FZ_ERROR_ABORT)
-				{
-					fz_rethrow(ctx);
-				}
-				else if (caught == FZ_ERROR_SYNTAX)
-				{
-					fz_report_error(ctx);
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
-					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
-					}
-				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
+				tok = PDF_TOK_EOF;
+				if (rec)
+					rec->broken = 1;
 			}
 
 			/* If we do catch an error, then reset ourselves to a base lexing state */
@@ -1115,17 +1587,30 @@ pdf_obj *pdf_processor_pop_resources(fz_context *ctx, pdf_processor *proc)
 	return proc->pop_resources(ctx, proc);
 }
 
+static int
+pdf_can_compile_contents(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	/* Local objects share numbers with the real ones; keep them out of the store. */
+	if (doc->local_xref && doc->local_xref_nesting > 0)
+		return 0;
+	return pdf_is_indirect(ctx, stmobj) && pdf_is_stream(ctx, stmobj);
+}
+
 void
 pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj, fz_cookie *cookie)
 {
 	pdf_csi csi;
 	pdf_lexbuf buf;
 	fz_stream *stm = NULL;
+	pdf_content_program *prog = NULL;
+	pdf_content_program *rec = NULL;
 
 	if (!stmobj)
 		return;
 
 	fz_var(stm);
+	fz_var(prog);
+	fz_var(rec);
 
 	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
 	pdf_init_csi(ctx, &csi, doc, rdb, &buf, cookie);
@@ -1133,13 +1618,45 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 	fz_try(ctx)
 	{
 		fz_defer_reap_start(ctx);
-		stm = pdf_open_contents_stream(ctx, doc, stmobj);
-		pdf_process_stream(ctx, proc, &csi, stm);
+
+		if (pdf_can_compile_contents(ctx, doc, stmobj))
+		{
+			prog = pdf_find_item(ctx, pdf_drop_content_program_imp, stmobj);
+			if (!prog)
+			{
+				/* First sighting; only compile streams that get reused. */
+				prog = pdf_new_content_program(ctx, 0);
+				pdf_store_item(ctx, stmobj, prog, prog->size);
+				fz_drop_storable(ctx, &prog->storable);
+				prog = NULL;
+			}
+			else if (!prog->compiled)
+			{
+				rec = pdf_new_content_program(ctx, 1);
+			}
+		}
+
+		if (prog && prog->compiled)
+		{
+			pdf_process_program(ctx, proc, &csi, prog);
+		}
+		else
+		{
+			stm = pdf_open_contents_stream(ctx, doc, stmobj);
+			pdf_process_stream(ctx, proc, &csi, stm, rec);
+			if (rec && !rec->broken)
+			{
+				pdf_remove_item(ctx, pdf_drop_content_program_imp, stmobj);
+				pdf_store_item(ctx, stmobj, rec, rec->size);
+			}
+		}
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
 	{
 		fz_defer_reap_end(ctx);
+		fz_drop_storable(ctx, prog ? &prog->storable : NULL);
+		fz_drop_storable(ctx, rec ? &rec->storable : NULL);
 		fz_drop_stream(ctx, stm);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
@@ -1252,7 +1769,7 @@ pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_o
 	{
 		pdf_processor_push_resources(ctx, proc, rdb);
 		stm = fz_open_buffer(ctx, contents);
-		pdf_process_stream(ctx, proc, &csi, stm);
+		pdf_process_stream(ctx, proc, &csi, stm, NULL);
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
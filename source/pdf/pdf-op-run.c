@@ -125,6 +125,10 @@ struct pdf_run_processor
 
 	fz_default_colorspaces *default_cs;
 
+	/* device space region of interest; anything drawn entirely
+	 * outside it is skipped */
+	fz_rect scissor;
+
 	resources_stack *rstack;
 
 	/* path object state */
@@ -372,6 +376,19 @@ pdf_end_group(fz_context *ctx, pdf_run_processor *pr, softmask_save *softmask)
 	end_softmask(ctx, pr, softmask);
 }
 
+/*
+	Return non-zero if bbox (in device space) cannot touch the region
+	the processor has been restricted to. Zero area bounds, such as
+	those of hairlines and spaces, are kept if they lie on the region.
+*/
+static int
+pdf_is_culled(pdf_run_processor *pr, fz_rect bbox)
+{
+	if (fz_is_infinite_rect(pr->scissor))
+		return 0;
+	return !fz_is_valid_rect(fz_intersect_rect(bbox, pr->scissor));
+}
+
 static void
 pdf_show_shade(fz_context *ctx, pdf_run_processor *pr, fz_shade *shd)
 {
@@ -383,6 +400,8 @@ pdf_show_shade(fz_context *ctx, pdf_run_processor *pr, fz_shade *shd)
 		return;
 
 	bbox = fz_bound_shade(ctx, shd, gstate->ctm);
+	if (pdf_is_culled(pr, bbox))
+		return;
 
 	fz_try(ctx)
 	{
@@ -770,6 +789,8 @@ pdf_show_image(fz_context *ctx, pdf_run_processor *pr, fz_image *image)
 	image_ctm = fz_pre_scale(fz_pre_translate(gstate->ctm, 0, 1), 1, -1);
 
 	bbox = fz_transform_rect(fz_unit_rect, image_ctm);
+	if (pdf_is_culled(pr, bbox))
+		return;
 
 	if (image->mask && gstate->blendmode)
 	{
@@ -840,7 +861,7 @@ pdf_show_path(fz_context *ctx, pdf_run_processor *pr, int doclose, int dofill, i
 
 		bbox = fz_bound_path(ctx, path, (dostroke ? gstate->stroke_state : NULL), gstate->ctm);
 
-		if (pr->super.hidden)
+		if (pr->super.hidden || pdf_is_culled(pr, bbox))
 			dostroke = dofill = 0;
 
 		if (dofill || dostroke)
@@ -1000,6 +1021,9 @@ pdf_flush_text(fz_context *ctx, pdf_run_processor *pr)
 		if (!text->head)
 			break;
 
+		if (pdf_is_culled(pr, tb))
+			dofill = dostroke = doinvisible = 0;
+
 		if (dofill || dostroke)
 			gstate = pdf_begin_group(ctx, pr, tb, &softmask);
 
@@ -2089,6 +2113,234 @@ clear_marked_content(fz_context *ctx, pdf_run_processor *pr)
 		fz_rethrow(ctx);
 }
 
+/*
+	Form XObject display lists (see pdf_set_form_caching).
+
+	A form that is not a transparency group depends only on the
+	graphics state it inherits and on the current transform. We record
+	its contents in form space into a display list, store that against
+	the form object together with a snapshot of the inherited state, and
+	replay it with the current transform whenever the form is drawn
+	again under an equivalent state.
+
+	A recording also bakes in the images, forms and fonts the form
+	uses, which are not part of its key, so recordings are only used
+	if nothing in the document has been edited since they were made.
+*/
+
+typedef struct
+{
+	fz_storable storable;
+	fz_display_list *list;
+	pdf_gstate gstate;
+	fz_default_colorspaces *default_cs;
+	int generation;
+} pdf_form_list;
+
+static void
+pdf_drop_form_list_imp(fz_context *ctx, fz_storable *fl_)
+{
+	pdf_form_list *fl = (pdf_form_list *)fl_;
+
+	fz_drop_display_list(ctx, fl->list);
+	pdf_drop_gstate(ctx, &fl->gstate);
+	fz_drop_default_colorspaces(ctx, fl->default_cs);
+	fz_free(ctx, fl);
+}
+
+static int
+pdf_form_list_is_droppable(fz_context *ctx, fz_storable *fl)
+{
+	/* The recorded text holds fonts; as for pdf_font_desc, only
+	 * drop them when we aren't holding the FT lock. */
+	return !fz_ft_lock_held(ctx);
+}
+
+static int
+pdf_default_cs_eq(fz_context *ctx, const fz_default_colorspaces *a, const fz_default_colorspaces *b)
+{
+	if (a == b)
+		return 1;
+	if (!a || !b)
+		return 0;
+	return fz_default_gray(ctx, a) == fz_default_gray(ctx, b) &&
+		fz_default_rgb(ctx, a) == fz_default_rgb(ctx, b) &&
+		fz_default_cmyk(ctx, a) == fz_default_cmyk(ctx, b) &&
+		fz_default_output_intent(ctx, a) == fz_default_output_intent(ctx, b);
+}
+
+static int
+pdf_material_eq(const pdf_material *a, const pdf_material *b)
+{
+	return a->kind == b->kind &&
+		a->colorspace == b->colorspace &&
+		a->alpha == b->alpha &&
+		!memcmp(&a->color_params, &b->color_params, sizeof a->color_params) &&
+		!memcmp(a->v, b->v, sizeof a->v);
+}
+
+static int
+pdf_form_gstate_eq(const pdf_gstate *a, const pdf_gstate *b)
+{
+	const fz_stroke_state *sa = a->stroke_state;
+	const fz_stroke_state *sb = b->stroke_state;
+
+	if (sa != sb && memcmp(&sa->start_cap, &sb->start_cap, sizeof(*sa) - offsetof(fz_stroke_state, start_cap)))
+		return 0;
+
+	return pdf_material_eq(&a->fill, &b->fill) &&
+		pdf_material_eq(&a->stroke, &b->stroke) &&
+		a->ismask == b->ismask &&
+		a->blendmode == b->blendmode &&
+		a->text.font == b->text.font &&
+		a->text.char_space == b->text.char_space &&
+		a->text.word_space == b->text.word_space &&
+		a->text.scale == b->text.scale &&
+		a->text.leading == b->text.leading &&
+		a->text.size == b->text.size &&
+		a->text.render == b->text.render &&
+		a->text.rise == b->text.rise;
+}
+
+static int
+pdf_form_is_cacheable(fz_context *ctx, pdf_run_processor *pr, pdf_document *doc, pdf_obj *xobj)
+{
+	pdf_gstate *gstate = pr->gstate + pr->gtop;
+
+	if (!doc->cache_forms || !pdf_is_indirect(ctx, xobj))
+		return 0;
+	if (pr->dev->hints & FZ_NO_CACHE)
+		return 0;
+
+	/* Type 3 glyphs track undefined state on the device as they run. */
+	if (pr->dev->flags)
+		return 0;
+
+	/* A recording made under a scissor would be missing content. */
+	if (!fz_is_infinite_rect(pr->scissor))
+		return 0;
+
+	/* Inherited soft masks and patterns are tied to the parent's space. */
+	if (gstate->softmask)
+		return 0;
+	if (gstate->fill.kind == PDF_MAT_PATTERN || gstate->fill.kind == PDF_MAT_SHADE)
+		return 0;
+	if (gstate->stroke.kind == PDF_MAT_PATTERN || gstate->stroke.kind == PDF_MAT_SHADE)
+		return 0;
+
+	if (pr->tos.text)
+		return 0;
+
+	/* Structure and layer visibility can change between runs. */
+	if (pdf_dict_get(ctx, xobj, PDF_NAME(StructParent)) || pdf_dict_get(ctx, xobj, PDF_NAME(StructParents)))
+		return 0;
+	if (pdf_count_layers(ctx, doc) > 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+	Run the contents of a form, via the display list cache. Leaves the
+	processor with gtop == gbot, just like the uncached path does once
+	its gstate mismatches have been undone.
+*/
+static void
+pdf_run_cached_form(fz_context *ctx, pdf_run_processor *pr, pdf_document *doc, pdf_obj *resources, pdf_obj *xobj)
+{
+	int gtop = pr->gtop;
+	int gparent = pr->gparent;
+	fz_matrix ctm = pr->gstate[gtop].ctm;
+	fz_device *dev = pr->dev;
+	fz_device *list_dev = NULL;
+	fz_display_list *list = NULL;
+	pdf_form_list *fl;
+	int incomplete = pr->cookie ? pr->cookie->incomplete : 0;
+	int nest_depth = pr->nest_depth;
+	int mc_depth = pr->mc_depth;
+
+	fl = pdf_find_item(ctx, pdf_drop_form_list_imp, xobj);
+	if (fl && fl->generation == doc->form_cache_generation &&
+		pdf_form_gstate_eq(&fl->gstate, &pr->gstate[gtop]) && pdf_default_cs_eq(ctx, fl->default_cs, pr->default_cs))
+	{
+		/* No cookie, as replaying would reset the page's progress. */
+		fz_try(ctx)
+			fz_run_display_list(ctx, fl->list, dev, ctm, fz_infinite_rect, NULL);
+		fz_always(ctx)
+			fz_drop_storable(ctx, &fl->storable);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return;
+	}
+	if (fl)
+	{
+		/* Make way for the new recording. */
+		fz_drop_storable(ctx, &fl->storable);
+		pdf_remove_item(ctx, pdf_drop_form_list_imp, xobj);
+	}
+
+	/* Snapshot the inherited state before the contents can change it. */
+	fl = fz_malloc_struct(ctx, pdf_form_list);
+	FZ_INIT_AWKWARD_STORABLE(fl, 1, pdf_drop_form_list_imp, pdf_form_list_is_droppable);
+	fl->gstate = pr->gstate[gtop];
+	fl->gstate.text.fontname = NULL;
+	pdf_keep_gstate(ctx, &fl->gstate);
+	fl->default_cs = fz_keep_default_colorspaces(ctx, pr->default_cs);
+	fl->generation = doc->form_cache_generation;
+
+	fz_var(list);
+	fz_var(list_dev);
+
+	fz_try(ctx)
+	{
+		list = fz_new_display_list(ctx, fz_infinite_rect);
+		list_dev = fz_new_list_device(ctx, list);
+
+		/* Record in form space; the transform is applied on replay. */
+		pr->dev = list_dev;
+		pr->gstate[gtop].ctm = fz_identity;
+		pr->gstate[gparent].ctm = fz_identity;
+		pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj, pr->cookie, NULL);
+		while (pr->gtop > pr->gbot)
+			pdf_grestore(ctx, pr);
+		fz_close_device(ctx, list_dev);
+	}
+	fz_always(ctx)
+	{
+		pr->dev = dev;
+		pr->gstate[gtop].ctm = ctm;
+		pr->gstate[gparent].ctm = ctm;
+		fz_drop_device(ctx, list_dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_drop_storable(ctx, &fl->storable);
+		fz_rethrow(ctx);
+	}
+
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, ctm, fz_infinite_rect, NULL);
+
+		/* Only keep complete recordings that left no state behind. */
+		if ((!pr->cookie || (!pr->cookie->abort && pr->cookie->incomplete == incomplete)) &&
+			pr->nest_depth == nest_depth && pr->mc_depth == mc_depth &&
+			!pr->marked_content && !pr->pending_mcid_pop && !pr->begin_layer && !pr->tos.text)
+		{
+			fl->list = fz_keep_display_list(ctx, list);
+			pdf_store_item(ctx, xobj, fl, sizeof(*fl) + fz_display_list_size(ctx, list));
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_drop_storable(ctx, &fl->storable);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 static void
 pdf_run_xobject(fz_context *ctx, pdf_run_processor *pr, pdf_obj *xobj, pdf_obj *page_resources, fz_matrix transform, int is_smask)
 {
@@ -2115,6 +2367,17 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *pr, pdf_obj *xobj, pdf_obj *
 	pdf_cycle_list *cycle_up = pr->cycle;
 	if (xobj == NULL || pdf_cycle(ctx, &cycle_here, cycle_up, xobj))
 		return;
+
+	/* Nothing in the form can be drawn outside its BBox, so a form
+	 * that lands outside the scissor need not be opened at all. Soft
+	 * masks are exempt, as their backdrop covers the whole group. */
+	if (!is_smask && !fz_is_infinite_rect(pr->scissor))
+	{
+		fz_matrix ctm = fz_concat(fz_concat(pdf_xobject_matrix(ctx, xobj), transform), pr->gstate[pr->gtop].ctm);
+		if (pdf_is_culled(pr, fz_transform_rect(pdf_xobject_bbox(ctx, xobj), ctm)))
+			return;
+	}
+
 	pr->cycle = &cycle_here;
 
 	pop_any_pending_mcid_changes(ctx, pr);
@@ -2215,7 +2478,10 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *pr, pdf_obj *xobj, pdf_obj *
 		oldbot = pr->gbot;
 		pr->gbot = pr->gtop;
 
-		pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj, pr->cookie, NULL);
+		if (!transparency && !is_smask && !oc && pdf_form_is_cacheable(ctx, pr, doc, xobj))
+			pdf_run_cached_form(ctx, pr, doc, resources, xobj);
+		else
+			pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj, pr->cookie, NULL);
 
 		/* Undo any gstate mismatches due to the pdf_process_contents call */
 		if (oldbot != -1)
@@ -2916,6 +3182,13 @@ static void pdf_run_Do_image(fz_context *ctx, pdf_processor *proc, const char *n
 	pdf_show_image(ctx, pr, image);
 }
 
+static int pdf_run_cull_image(fz_context *ctx, pdf_processor *proc)
+{
+	pdf_run_processor *pr = (pdf_run_processor *)proc;
+	pdf_gstate *gstate = pr->gstate + pr->gtop;
+	return pdf_is_culled(pr, fz_transform_rect(fz_unit_rect, gstate->ctm));
+}
+
 static void pdf_run_Do_form(fz_context *ctx, pdf_processor *proc, const char *name, pdf_obj *xobj)
 {
 	pdf_run_processor *pr = (pdf_run_processor *)proc;
@@ -3190,6 +3463,7 @@ pdf_new_run_processor(fz_context *ctx, pdf_document *doc, fz_device *dev, fz_mat
 		{
 			proc->super.op_BI = pdf_run_BI;
 			proc->super.op_Do_image = pdf_run_Do_image;
+			proc->super.cull_image = pdf_run_cull_image;
 		}
 		proc->super.op_Do_form = pdf_run_Do_form;
 
@@ -3222,6 +3496,7 @@ pdf_new_run_processor(fz_context *ctx, pdf_document *doc, fz_device *dev, fz_mat
 	proc->cookie = cookie;
 
 	proc->default_cs = fz_keep_default_colorspaces(ctx, default_cs);
+	proc->scissor = fz_infinite_rect;
 
 	proc->path = NULL;
 	proc->clip = 0;
@@ -3301,3 +3576,14 @@ pdf_new_run_processor(fz_context *ctx, pdf_document *doc, fz_device *dev, fz_mat
 
 	return (pdf_processor*)proc;
 }
+
+void
+pdf_run_processor_set_scissor(fz_context *ctx, pdf_processor *proc, fz_rect scissor)
+{
+	pdf_run_processor *pr = (pdf_run_processor *)proc;
+
+	if (proc->close_processor != pdf_close_run_processor)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "not a run processor");
+
+	pr->scissor = scissor;
+}
@@ -0,0 +1,56 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+#ifndef MUPDF_PDF_PROFILE_IMP_H
+#define MUPDF_PDF_PROFILE_IMP_H
+
+#include "mupdf/pdf.h"
+
+/* Hooks used by the interpreter to feed a pdf_profile. */
+
+enum
+{
+	PDF_PROFILE_FORM,
+	PDF_PROFILE_IMAGE,
+	PDF_PROFILE_FONT,
+	PDF_PROFILE_SHADING,
+};
+
+/* One per operator in flight; operators nest when forms are run. */
+typedef struct pdf_profile_frame
+{
+	double start;
+	double children;
+	struct pdf_profile_frame *up;
+} pdf_profile_frame;
+
+void pdf_profile_begin_op(fz_context *ctx, pdf_profile *prof, pdf_profile_frame *frame);
+void pdf_profile_end_op(fz_context *ctx, pdf_profile *prof, pdf_profile_frame *frame, const char *word);
+
+/*
+	Account one use of a resource. load and draw are in milliseconds.
+	None of these functions throw; a failure to record is ignored.
+*/
+void pdf_profile_resource(fz_context *ctx, pdf_profile *prof, int kind, pdf_obj *obj, const char *name, double load, double draw);
+
+#endif
@@ -0,0 +1,307 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "pdf-profile-imp.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* The longest operators (such as BDC) have three characters. The
+ * interpreter ignores longer keywords, so they are counted together. */
+#define PDF_PROFILE_OP_SIZE 4
+#define PDF_PROFILE_NAME_SIZE 32
+
+typedef struct
+{
+	char op[PDF_PROFILE_OP_SIZE];
+	int count;
+	double ms;
+	double self;
+} pdf_profile_op;
+
+/* Indirect objects are told apart by number, and direct objects by
+ * the name they are used by. */
+typedef struct
+{
+	int kind;
+	int num;
+	char name[PDF_PROFILE_NAME_SIZE];
+} pdf_profile_key;
+
+typedef struct
+{
+	pdf_profile_key key;
+	char name[PDF_PROFILE_NAME_SIZE];
+	int count;
+	double load;
+	double draw;
+} pdf_profile_res;
+
+struct pdf_profile
+{
+	fz_hash_table *ops;
+	fz_hash_table *resources;
+	int nops, nresources;
+	pdf_profile_frame *top;
+	double total;
+};
+
+static void
+pdf_profile_drop_entry(fz_context *ctx, void *val)
+{
+	fz_free(ctx, val);
+}
+
+pdf_profile *
+pdf_new_profile(fz_context *ctx)
+{
+	pdf_profile *prof = fz_malloc_struct(ctx, pdf_profile);
+	fz_try(ctx)
+	{
+		prof->ops = fz_new_hash_table(ctx, 128, sizeof(((pdf_profile_op *)0)->op), -1, pdf_profile_drop_entry);
+		prof->resources = fz_new_hash_table(ctx, 256, sizeof(pdf_profile_key), -1, pdf_profile_drop_entry);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_profile(ctx, prof);
+		fz_rethrow(ctx);
+	}
+	return prof;
+}
+
+void
+pdf_drop_profile(fz_context *ctx, pdf_profile *prof)
+{
+	if (!prof)
+		return;
+	fz_drop_hash_table(ctx, prof->ops);
+	fz_drop_hash_table(ctx, prof->resources);
+	fz_free(ctx, prof);
+}
+
+void
+pdf_set_profile(fz_context *ctx, pdf_document *doc, pdf_profile *prof)
+{
+	doc->profile = prof;
+}
+
+void
+pdf_profile_begin_op(fz_context *ctx, pdf_profile *prof, pdf_profile_frame *frame)
+{
+	frame->children = 0;
+	frame->up = prof->top;
+	prof->top = frame;
+	frame->start = fz_ms_clock();
+}
+
+void
+pdf_profile_end_op(fz_context *ctx, pdf_profile *prof, pdf_profile_frame *frame, const char *word)
+{
+	double elapsed = fz_ms_clock() - frame->start;
+	pdf_profile_op *op;
+	char key[sizeof op->op] = { 0 };
+
+	prof->top = frame->up;
+	if (prof->top)
+		prof->top->children += elapsed;
+	else
+		prof->total += elapsed;
+
+	if (strlen(word) < sizeof key)
+		memcpy(key, word, strlen(word));
+	else
+		key[0] = '?';
+	op = fz_hash_find(ctx, prof->ops, key);
+	if (!op)
+	{
+		fz_try(ctx)
+		{
+			op = fz_malloc_struct(ctx, pdf_profile_op);
+			memcpy(op->op, key, sizeof key);
+			fz_hash_insert(ctx, prof->ops, key, op);
+			prof->nops++;
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, op);
+			fz_ignore_error(ctx);
+			return;
+		}
+	}
+
+	op->count++;
+	op->ms += elapsed;
+	op->self += elapsed - frame->children;
+}
+
+static void
+pdf_profile_copy_name(char dst[PDF_PROFILE_NAME_SIZE], const char *name)
+{
+	char *s;
+
+	fz_strlcpy(dst, name ? name : "", PDF_PROFILE_NAME_SIZE);
+	/* Keep the JSON output well formed. */
+	for (s = dst; *s; s++)
+		if (*s < 32 && *s >= 0)
+			*s = '?';
+}
+
+void
+pdf_profile_resource(fz_context *ctx, pdf_profile *prof, int kind, pdf_obj *obj, const char *name, double load, double draw)
+{
+	pdf_profile_key key = { 0 };
+	pdf_profile_res *res;
+
+	key.kind = kind;
+	key.num = pdf_to_num(ctx, obj);
+	if (key.num == 0)
+		pdf_profile_copy_name(key.name, name);
+
+	res = fz_hash_find(ctx, prof->resources, &key);
+	if (!res)
+	{
+		fz_try(ctx)
+		{
+			res = fz_malloc_struct(ctx, pdf_profile_res);
+			res->key = key;
+			pdf_profile_copy_name(res->name, name);
+			fz_hash_insert(ctx, prof->resources, &key, res);
+			prof->nresources++;
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, res);
+			fz_ignore_error(ctx);
+			return;
+		}
+	}
+
+	res->count++;
+	res->load += load;
+	res->draw += draw;
+}
+
+/* JSON output */
+
+typedef struct
+{
+	int len, max;
+	void **list;
+} pdf_profile_list;
+
+static void
+pdf_profile_collect(fz_context *ctx, void *state, void *key, int keylen, void *val)
+{
+	pdf_profile_list *list = state;
+	if (list->len < list->max)
+		list->list[list->len++] = val;
+}
+
+static int
+pdf_profile_cmp_op(const void *a_, const void *b_)
+{
+	const pdf_profile_op *a = *(const pdf_profile_op **)a_;
+	const pdf_profile_op *b = *(const pdf_profile_op **)b_;
+	if (a->ms != b->ms)
+		return a->ms < b->ms ? 1 : -1;
+	return strcmp(a->op, b->op);
+}
+
+static int
+pdf_profile_cmp_res(const void *a_, const void *b_)
+{
+	const pdf_profile_res *a = *(const pdf_profile_res **)a_;
+	const pdf_profile_res *b = *(const pdf_profile_res **)b_;
+	double ta = a->load + a->draw;
+	double tb = b->load + b->draw;
+	if (ta != tb)
+		return ta < tb ? 1 : -1;
+	if (a->key.num != b->key.num)
+		return a->key.num - b->key.num;
+	return strcmp(a->name, b->name);
+}
+
+static void
+pdf_write_profile_resources(fz_context *ctx, fz_output *out, pdf_profile_list *list, int kind, const char *label)
+{
+	int i, n = 0;
+
+	fz_write_printf(ctx, out, ",%q:[", label);
+	for (i = 0; i < list->len; i++)
+	{
+		pdf_profile_res *res = list->list[i];
+		if (res->key.kind != kind)
+			continue;
+		fz_write_printf(ctx, out, "%s{%q:%d,%q:%q,%q:%d", n++ ? "," : "",
+			"object", res->key.num, "name", res->name, "count", res->count);
+		if (kind != PDF_PROFILE_FORM)
+			fz_write_printf(ctx, out, ",%q:%.3f", "load_ms", res->load);
+		if (kind != PDF_PROFILE_FONT)
+			fz_write_printf(ctx, out, ",%q:%.3f", "ms", res->draw);
+		fz_write_byte(ctx, out, '}');
+	}
+	fz_write_byte(ctx, out, ']');
+}
+
+void
+pdf_write_profile_json(fz_context *ctx, fz_output *out, pdf_profile *prof)
+{
+	pdf_profile_list list = { 0 };
+	int i, n;
+
+	n = fz_maxi(prof->nops, prof->nresources);
+	list.list = fz_malloc_array(ctx, n + 1, void *);
+
+	fz_try(ctx)
+	{
+		fz_write_printf(ctx, out, "{%q:%.3f,%q:[", "total_ms", prof->total, "operators");
+
+		list.max = n;
+		fz_hash_for_each(ctx, prof->ops, &list, pdf_profile_collect);
+		qsort(list.list, list.len, sizeof *list.list, pdf_profile_cmp_op);
+		for (i = 0; i < list.len; i++)
+		{
+			pdf_profile_op *op = list.list[i];
+			fz_write_printf(ctx, out, "%s{%q:%q,%q:%d,%q:%.3f,%q:%.3f}", i ? "," : "",
+				"op", op->op, "count", op->count, "ms", op->ms, "self_ms", op->self);
+		}
+		fz_write_byte(ctx, out, ']');
+
+		list.len = 0;
+		fz_hash_for_each(ctx, prof->resources, &list, pdf_profile_collect);
+		qsort(list.list, list.len, sizeof *list.list, pdf_profile_cmp_res);
+		pdf_write_profile_resources(ctx, out, &list, PDF_PROFILE_FORM, "forms");
+		pdf_write_profile_resources(ctx, out, &list, PDF_PROFILE_IMAGE, "images");
+		pdf_write_profile_resources(ctx, out, &list, PDF_PROFILE_FONT, "fonts");
+		pdf_write_profile_resources(ctx, out, &list, PDF_PROFILE_SHADING, "shadings");
+
+		fz_write_byte(ctx, out, '}');
+	}
+	fz_always(ctx)
+		fz_free(ctx, list.list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
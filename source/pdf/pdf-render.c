@@ -0,0 +1,411 @@
+// Copyright (C) 2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+#include "pdf-annot-imp.h"
+
+#include <string.h>
+
+/* Damage rectangles that overlap are merged; beyond this many the
+ * closest pair is merged instead so the list stays short. */
+#define MAX_DAMAGE 16
+
+typedef struct
+{
+	pdf_annot *annot;
+	fz_display_list *list;
+	fz_irect bbox;
+	int hidden;
+	int seen;
+} pdf_render_entry;
+
+struct pdf_page_renderer
+{
+	pdf_page *page;
+	fz_matrix ctm;
+	fz_irect area;
+	fz_pixmap *contents;
+	fz_pixmap *pix;
+
+	int len;
+	pdf_render_entry *entry;
+
+	int ndamage;
+	fz_irect damage[MAX_DAMAGE + 1]; /* Room for one more while merging. */
+};
+
+static fz_irect
+union_irect(fz_irect a, fz_irect b)
+{
+	if (fz_is_empty_irect(a))
+		return b;
+	if (fz_is_empty_irect(b))
+		return a;
+	if (b.x0 < a.x0) a.x0 = b.x0;
+	if (b.y0 < a.y0) a.y0 = b.y0;
+	if (b.x1 > a.x1) a.x1 = b.x1;
+	if (b.y1 > a.y1) a.y1 = b.y1;
+	return a;
+}
+
+static int64_t
+irect_area(fz_irect r)
+{
+	if (fz_is_empty_irect(r))
+		return 0;
+	return (int64_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+static void
+add_damage(fz_context *ctx, pdf_page_renderer *ren, fz_irect r)
+{
+	int i, j, best_i, best_j;
+	int64_t cost, best;
+
+	r = fz_intersect_irect(r, ren->area);
+	if (fz_is_empty_irect(r))
+		return;
+
+	/* Swallow any rectangles this one touches, repeating since the
+	 * union may grow to touch others. */
+	i = 0;
+	while (i < ren->ndamage)
+	{
+		if (!fz_is_empty_irect(fz_intersect_irect(r, ren->damage[i])))
+		{
+			r = union_irect(r, ren->damage[i]);
+			ren->damage[i] = ren->damage[--ren->ndamage];
+			i = 0;
+		}
+		else
+			i++;
+	}
+
+	if (ren->ndamage == MAX_DAMAGE)
+	{
+		/* Merge the pair whose union wastes the least area. */
+		ren->damage[ren->ndamage++] = r;
+		best = -1;
+		best_i = 0;
+		best_j = 1;
+		for (i = 0; i < ren->ndamage; i++)
+			for (j = i + 1; j < ren->ndamage; j++)
+			{
+				cost = irect_area(union_irect(ren->damage[i], ren->damage[j]))
+					- irect_area(ren->damage[i]) - irect_area(ren->damage[j]);
+				if (best < 0 || cost < best)
+				{
+					best = cost;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		r = union_irect(ren->damage[best_i], ren->damage[best_j]);
+		ren->damage[best_j] = ren->damage[--ren->ndamage];
+		ren->damage[best_i] = ren->damage[--ren->ndamage];
+		add_damage(ctx, ren, r);
+		return;
+	}
+
+	ren->damage[ren->ndamage++] = r;
+}
+
+static void
+drop_entries(fz_context *ctx, pdf_render_entry *entry, int len)
+{
+	int i;
+	for (i = 0; i < len; i++)
+	{
+		fz_drop_display_list(ctx, entry[i].list);
+		pdf_drop_annot(ctx, entry[i].annot);
+	}
+	fz_free(ctx, entry);
+}
+
+static fz_display_list *
+record_annot(fz_context *ctx, pdf_page_renderer *ren, pdf_annot *annot, fz_irect *bboxp)
+{
+	fz_display_list *list;
+	fz_device *dev = NULL;
+	fz_rect bounds = fz_empty_rect;
+
+	fz_var(dev);
+
+	list = fz_new_display_list(ctx, pdf_bound_page(ctx, ren->page, FZ_CROP_BOX));
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+		pdf_run_annot(ctx, annot, dev, fz_identity, NULL);
+		fz_close_device(ctx, dev);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+
+		/* The list's own bounds are just the page; measure what the
+		 * appearance actually touches at the target resolution. */
+		dev = fz_new_bbox_device(ctx, &bounds);
+		fz_run_display_list(ctx, list, dev, ren->ctm, fz_infinite_rect, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	/* Leave a pixel for anti-aliasing spill. */
+	if (fz_is_empty_rect(bounds))
+		*bboxp = fz_empty_irect;
+	else
+		*bboxp = fz_intersect_irect(fz_expand_irect(fz_round_rect(bounds), 1), ren->area);
+	return list;
+}
+
+static pdf_render_entry *
+find_entry(pdf_page_renderer *ren, pdf_annot *annot, int hint)
+{
+	int i;
+	if (hint < ren->len && ren->entry[hint].annot == annot)
+		return &ren->entry[hint];
+	for (i = 0; i < ren->len; i++)
+		if (ren->entry[i].annot == annot)
+			return &ren->entry[i];
+	return NULL;
+}
+
+static void
+sync_entry(fz_context *ctx, pdf_page_renderer *ren, pdf_render_entry *entry, pdf_annot *annot, int hint)
+{
+	pdf_render_entry *old;
+	int changed;
+
+	changed = pdf_update_annot(ctx, annot);
+	old = find_entry(ren, annot, hint);
+	if (old)
+		old->seen = 1;
+
+	if (old && !changed && old->hidden == annot->hidden_editing)
+	{
+		entry->list = fz_keep_display_list(ctx, old->list);
+		entry->bbox = old->bbox;
+	}
+	else
+	{
+		entry->list = record_annot(ctx, ren, annot, &entry->bbox);
+		if (old)
+			add_damage(ctx, ren, old->bbox);
+		add_damage(ctx, ren, entry->bbox);
+	}
+	entry->annot = pdf_keep_annot(ctx, annot);
+	entry->hidden = annot->hidden_editing;
+}
+
+/*
+	Bring the per-annotation lists up to date with the page, recording
+	the device space area of anything that appeared, vanished or
+	changed appearance.
+*/
+static void
+sync_entries(fz_context *ctx, pdf_page_renderer *ren)
+{
+	pdf_page *page = ren->page;
+	pdf_render_entry *entry = NULL;
+	pdf_annot *annot;
+	int i, n, len = 0;
+
+	fz_var(entry);
+	fz_var(len);
+
+	for (i = 0; i < ren->len; i++)
+		ren->entry[i].seen = 0;
+
+	fz_try(ctx)
+	{
+		pdf_begin_implicit_operation(ctx, page->doc);
+		if (page->doc->recalculate)
+			pdf_calculate_form(ctx, page->doc);
+
+		n = 0;
+		for (annot = page->annots; annot; annot = annot->next)
+			n++;
+		for (annot = page->widgets; annot; annot = annot->next)
+			n++;
+		entry = fz_malloc_array(ctx, n, pdf_render_entry);
+		if (n)
+			memset(entry, 0, n * sizeof *entry);
+
+		/* Keep the run order of pdf_run_page: annotations, then widgets. */
+		for (annot = page->annots; annot; annot = annot->next, len++)
+			sync_entry(ctx, ren, &entry[len], annot, len);
+		for (annot = page->widgets; annot; annot = annot->next, len++)
+			sync_entry(ctx, ren, &entry[len], annot, len);
+
+		pdf_end_operation(ctx, page->doc);
+	}
+	fz_catch(ctx)
+	{
+		pdf_abandon_operation(ctx, page->doc);
+		drop_entries(ctx, entry, len);
+		/* pdf_update_annot may already have reported changes that we
+		 * never got to act on, so re-record everything next time. */
+		for (i = 0; i < ren->len; i++)
+			ren->entry[i].hidden = -1;
+		fz_rethrow(ctx);
+	}
+
+	for (i = 0; i < ren->len; i++)
+		if (!ren->entry[i].seen)
+			add_damage(ctx, ren, ren->entry[i].bbox);
+
+	drop_entries(ctx, ren->entry, ren->len);
+	ren->entry = entry;
+	ren->len = len;
+}
+
+static void
+repaint(fz_context *ctx, pdf_page_renderer *ren, fz_irect r)
+{
+	fz_pixmap *tmp = NULL;
+	fz_device *dev = NULL;
+	fz_irect wide;
+	fz_rect scissor;
+	int i;
+
+	fz_var(tmp);
+	fz_var(dev);
+
+	/* Coverage along a clip edge isn't quite what an unclipped render
+	 * gives, so draw a little beyond the damage and copy back only
+	 * the part we know to be exact. */
+	wide = fz_intersect_irect(fz_expand_irect(r, 2), ren->area);
+	scissor = fz_rect_from_irect(wide);
+
+	fz_try(ctx)
+	{
+		tmp = fz_new_pixmap_with_bbox(ctx, ren->pix->colorspace, wide, NULL, ren->pix->alpha);
+		fz_copy_pixmap_rect(ctx, tmp, ren->contents, wide, NULL);
+
+		dev = fz_new_draw_device(ctx, fz_identity, tmp);
+		for (i = 0; i < ren->len; i++)
+			if (!fz_is_empty_irect(fz_intersect_irect(ren->entry[i].bbox, wide)))
+				fz_run_display_list(ctx, ren->entry[i].list, dev, ren->ctm, scissor, NULL);
+		fz_close_device(ctx, dev);
+
+		fz_copy_pixmap_rect(ctx, ren->pix, tmp, r, NULL);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, tmp);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+pdf_page_renderer *
+pdf_new_page_renderer(fz_context *ctx, pdf_page *page, fz_matrix ctm, fz_colorspace *cs, int alpha)
+{
+	pdf_page_renderer *ren;
+	fz_device *dev = NULL;
+	int i;
+
+	fz_var(dev);
+
+	ren = fz_malloc_struct(ctx, pdf_page_renderer);
+	fz_try(ctx)
+	{
+		ren->page = (pdf_page *)fz_keep_page(ctx, &page->super);
+		ren->ctm = ctm;
+		ren->area = fz_round_rect(fz_transform_rect(pdf_bound_page(ctx, page, FZ_CROP_BOX), ctm));
+
+		ren->contents = fz_new_pixmap_with_bbox(ctx, cs, ren->area, NULL, alpha);
+		if (alpha)
+			fz_clear_pixmap(ctx, ren->contents);
+		else
+			fz_clear_pixmap_with_value(ctx, ren->contents, 0xFF);
+
+		dev = fz_new_draw_device(ctx, fz_identity, ren->contents);
+		pdf_run_page_contents(ctx, page, dev, ctm, NULL);
+		fz_close_device(ctx, dev);
+
+		ren->pix = fz_clone_pixmap(ctx, ren->contents);
+
+		/* Every annotation is new, so this damages exactly the areas
+		 * that need painting over the contents. */
+		sync_entries(ctx, ren);
+		for (i = 0; i < ren->ndamage; i++)
+			repaint(ctx, ren, ren->damage[i]);
+		ren->ndamage = 0;
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		pdf_drop_page_renderer(ctx, ren);
+		fz_rethrow(ctx);
+	}
+
+	return ren;
+}
+
+void
+pdf_drop_page_renderer(fz_context *ctx, pdf_page_renderer *ren)
+{
+	if (!ren)
+		return;
+	drop_entries(ctx, ren->entry, ren->len);
+	fz_drop_pixmap(ctx, ren->pix);
+	fz_drop_pixmap(ctx, ren->contents);
+	fz_drop_page(ctx, &ren->page->super);
+	fz_free(ctx, ren);
+}
+
+fz_pixmap *
+pdf_page_renderer_pixmap(fz_context *ctx, pdf_page_renderer *ren)
+{
+	return ren->pix;
+}
+
+int
+pdf_update_page_renderer(fz_context *ctx, pdf_page_renderer *ren, fz_irect *damage, int max_damage)
+{
+	int i, n;
+
+	ren->ndamage = 0;
+	sync_entries(ctx, ren);
+
+	for (i = 0; i < ren->ndamage; i++)
+		repaint(ctx, ren, ren->damage[i]);
+
+	/* Fold whatever doesn't fit into the caller's last slot. */
+	n = 0;
+	for (i = 0; i < ren->ndamage && max_damage > 0; i++)
+	{
+		if (n < max_damage)
+			damage[n++] = ren->damage[i];
+		else
+			damage[n - 1] = union_irect(damage[n - 1], ren->damage[i]);
+	}
+
+	return n;
+}
@@ -114,7 +114,7 @@ static fz_rect pdf_page_mediabox(fz_context *ctx, pdf_page *page)
 }
 
 static void
-pdf_run_page_contents_with_usage_imp(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_cookie *cookie)
+pdf_run_page_contents_with_usage_imp(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_rect scissor, fz_cookie *cookie)
 {
 	fz_matrix page_ctm;
 	pdf_obj *resources;
@@ -196,6 +196,7 @@ pdf_run_page_contents_with_usage_imp(fz_context *ctx, pdf_document *doc, pdf_pag
 		}
 
 		proc = pdf_new_run_processor(ctx, page->doc, dev, ctm, struct_parent_num, usage, NULL, default_cs, cookie, NULL, NULL);
+		pdf_run_processor_set_scissor(ctx, proc, scissor);
 		pdf_process_contents(ctx, proc, doc, resources, contents, cookie, NULL);
 		pdf_close_processor(ctx, proc);
 
@@ -222,7 +223,8 @@ pdf_run_page_contents_with_usage_imp(fz_context *ctx, pdf_document *doc, pdf_pag
 	}
 }
 
-void pdf_run_page_contents_with_usage(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_cookie *cookie)
+static void
+pdf_run_page_contents_with_scissor_imp(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_rect scissor, fz_cookie *cookie)
 {
 	pdf_document *doc = page->doc;
 	int nocache;
@@ -233,7 +235,7 @@ void pdf_run_page_contents_with_usage(fz_context *ctx, pdf_page *page, fz_device
 
 	fz_try(ctx)
 	{
-		pdf_run_page_contents_with_usage_imp(ctx, doc, page, dev, ctm, usage, cookie);
+		pdf_run_page_contents_with_usage_imp(ctx, doc, page, dev, ctm, usage, scissor, cookie);
 	}
 	fz_always(ctx)
 	{
@@ -246,6 +248,16 @@ void pdf_run_page_contents_with_usage(fz_context *ctx, pdf_page *page, fz_device
 	}
 }
 
+void pdf_run_page_contents_with_usage(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, const char *usage, fz_cookie *cookie)
+{
+	pdf_run_page_contents_with_scissor_imp(ctx, page, dev, ctm, usage, fz_infinite_rect, cookie);
+}
+
+void pdf_run_page_contents_with_scissor(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie)
+{
+	pdf_run_page_contents_with_scissor_imp(ctx, page, dev, ctm, "View", scissor, cookie);
+}
+
 void pdf_run_page_contents(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, fz_cookie *cookie)
 {
 	pdf_run_page_contents_with_usage(ctx, page, dev, ctm, "View", cookie);
@@ -387,6 +399,16 @@ void pdf_run_page_widgets_with_usage(fz_context *ctx, pdf_page *page, fz_device
 	}
 }
 
+void pdf_set_form_caching(fz_context *ctx, pdf_document *doc, int enable)
+{
+	doc->cache_forms = !!enable;
+}
+
+int pdf_form_caching(fz_context *ctx, pdf_document *doc)
+{
+	return doc->cache_forms;
+}
+
 void pdf_run_page_widgets(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matrix ctm, fz_cookie *cookie)
 {
 	pdf_run_page_widgets_with_usage(ctx, page, dev, ctm, "View", cookie);
@@ -402,7 +424,7 @@ pdf_run_page_with_usage(fz_context *ctx, pdf_page *page, fz_device *dev, fz_matr
 		pdf_mark_xref(ctx, doc);
 	fz_try(ctx)
 	{
-		pdf_run_page_contents_with_usage_imp(ctx, doc, page, dev, ctm, usage, cookie);
+		pdf_run_page_contents_with_usage_imp(ctx, doc, page, dev, ctm, usage, fz_infinite_rect, cookie);
 		pdf_run_page_annots_with_usage_imp(ctx, doc, page, dev, ctm, usage, cookie);
 		pdf_run_page_widgets_with_usage_imp(ctx, doc, page, dev, ctm, usage, cookie);
 	}
@@ -154,5 +154,8 @@ pdf_filter_object_number(fz_context *ctx, void *ref_, void *key_)
 void pdf_purge_object_from_store(fz_context *ctx, pdf_document *doc, int num)
 {
 	struct doc_num_info ref = { doc, num };
+	/* Form recordings bake in whatever resources they used, so any
+	 * change may make them stale. */
+	doc->form_cache_generation++;
 	fz_filter_store(ctx, pdf_filter_object_number, &ref, &pdf_obj_store_type);
 }
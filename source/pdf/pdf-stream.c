@@ -449,15 +449,106 @@ pdf_open_raw_stream_number(fz_context *ctx, pdf_document *doc, int num)
 	return pdf_open_raw_filter(ctx, doc->file, doc, x->obj, num, &orig_num, &orig_gen, x->stm_ofs);
 }
 
+static size_t
+pdf_guess_filter_length(size_t len, const char *filter)
+{
+	size_t nlen = len;
+
+	/* First ones get smaller, no overflow check required. */
+	if (!strcmp(filter, "ASCIIHexDecode"))
+		return len / 2;
+	else if (!strcmp(filter, "ASCII85Decode"))
+		return len * 4 / 5;
+
+	if (!strcmp(filter, "FlateDecode"))
+		nlen = len * 3;
+	else if (!strcmp(filter, "RunLengthDecode"))
+		nlen = len * 3;
+	else if (!strcmp(filter, "LZWDecode"))
+		nlen = len * 2;
+
+	/* Live with a bad estimate - we'll malloc up as we go, but
+	 * it's probably destined to fail anyway. */
+	if (nlen < len)
+		return len;
+
+	return nlen;
+}
+
+/* Upper limit on the compressed size of a stream that we will inflate
+ * up front when asked to open it. Anything larger is streamed. */
+#define MAX_ONE_SHOT_FLATE (8 << 20)
+
+/*
+ * Check for a stream of known length with a single FlateDecode filter
+ * and no predictor. These can be inflated from memory in a single pass,
+ * which is considerably quicker than streaming them through the filter.
+ */
+static int
+is_one_shot_flate(fz_context *ctx, pdf_obj *dict, int64_t *len)
+{
+	pdf_obj *f = pdf_dict_geta(ctx, dict, PDF_NAME(Filter), PDF_NAME(F));
+	pdf_obj *p = pdf_dict_geta(ctx, dict, PDF_NAME(DecodeParms), PDF_NAME(DP));
+
+	if (pdf_is_array(ctx, f))
+	{
+		if (pdf_array_len(ctx, f) != 1)
+			return 0;
+		f = pdf_array_get(ctx, f, 0);
+		p = pdf_array_get(ctx, p, 0);
+	}
+	if (!pdf_name_eq(ctx, f, PDF_NAME(FlateDecode)) && !pdf_name_eq(ctx, f, PDF_NAME(Fl)))
+		return 0;
+	if (pdf_dict_get_int_default(ctx, p, PDF_NAME(Predictor), 1) > 1)
+		return 0;
+
+	*len = pdf_dict_get_int64(ctx, dict, PDF_NAME(Length));
+	return *len > 0;
+}
+
+static fz_buffer *
+pdf_load_one_shot_flate(fz_context *ctx, pdf_document *doc, int num, size_t initial, int *truncated, size_t worst_case)
+{
+	fz_buffer *raw, *buf;
+
+	raw = pdf_load_raw_stream_number(ctx, doc, num);
+	fz_try(ctx)
+		buf = fz_new_inflated_buffer(ctx, raw->data, raw->len, 15, initial, truncated, worst_case);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, raw);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return buf;
+}
+
 static fz_stream *
 pdf_open_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compression_params *params, int might_be_image)
 {
 	pdf_xref_entry *x;
+	int64_t len;
 
 	x = pdf_cache_object(ctx, doc, num);
 	if (x->stm_ofs == 0 && x->stm_buf == NULL)
 		fz_throw(ctx, FZ_ERROR_FORMAT, "object is not a stream");
 
+	/* Content streams and object streams are always read in their
+	 * entirety, so decode the common small ones up front. */
+	if (!params && is_one_shot_flate(ctx, x->obj, &len) && len <= MAX_ONE_SHOT_FLATE)
+	{
+		/* Damaged data is returned truncated, as the streaming filter would. */
+		int truncated;
+		fz_buffer *buf = pdf_load_one_shot_flate(ctx, doc, num, pdf_guess_filter_length(len, "FlateDecode"), &truncated, 0);
+		fz_stream *stm;
+		fz_try(ctx)
+			stm = fz_open_buffer(ctx, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return stm;
+	}
+
 	return pdf_open_filter(ctx, doc, doc->file, x->obj, num, x->stm_ofs, params, might_be_image);
 }
 
@@ -515,32 +606,6 @@ pdf_load_raw_stream_number(fz_context *ctx, pdf_document *doc, int num)
 	return buf;
 }
 
-static size_t
-pdf_guess_filter_length(size_t len, const char *filter)
-{
-	size_t nlen = len;
-
-	/* First ones get smaller, no overflow check required. */
-	if (!strcmp(filter, "ASCIIHexDecode"))
-		return len / 2;
-	else if (!strcmp(filter, "ASCII85Decode"))
-		return len * 4 / 5;
-
-	if (!strcmp(filter, "FlateDecode"))
-		nlen = len * 3;
-	else if (!strcmp(filter, "RunLengthDecode"))
-		nlen = len * 3;
-	else if (!strcmp(filter, "LZWDecode"))
-		nlen = len * 2;
-
-	/* Live with a bad estimate - we'll malloc up as we go, but
-	 * it's probably destined to fail anyway. */
-	if (nlen < len)
-		return len;
-
-	return nlen;
-}
-
 /* Check if an entry has a cached stream and return whether it is directly
  * reusable. A buffer is directly reusable only if the stream is
  * uncompressed, or if it is compressed purely a compression method we can
@@ -601,8 +666,10 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 	int i, n;
 	size_t len;
 	fz_buffer *buf;
+	int one_shot = 0;
 
 	fz_var(buf);
+	fz_var(one_shot);
 
 	if (num > 0 && num < pdf_xref_len(ctx, doc))
 	{
@@ -617,6 +684,8 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 	fz_try(ctx)
 	{
 		int64_t ilen = pdf_dict_get_int64(ctx, dict, PDF_NAME(Length));
+		if (!params)
+			one_shot = is_one_shot_flate(ctx, dict, &ilen);
 		if (ilen < 0)
 			ilen = 0;
 		len = (size_t)ilen;
@@ -639,6 +708,9 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 		fz_rethrow(ctx);
 	}
 
+	if (one_shot)
+		return pdf_load_one_shot_flate(ctx, doc, num, len, truncated, worst_case);
+
 	stm = pdf_open_image_stream(ctx, doc, num, params, 1);
 
 	fz_try(ctx)
@@ -2417,6 +2417,36 @@ pdf_obj_read(fz_context *ctx, pdf_document *doc, int64_t *offset, int *nump, pdf
 	return 0;
 }
 
+/*
+	Ask for the byte ranges that the hint tables place the page's own
+	objects and its shared object groups in, so that a range stream can
+	fetch them in a few large requests rather than block by block as the
+	parser wanders through them. Does nothing for other streams.
+*/
+static void
+prefetch_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
+{
+	int64_t start, end, i;
+	int r;
+
+	if (pagenum < 0 || pagenum >= doc->linear_page_count)
+		return;
+
+	start = doc->hint_page[pagenum].offset;
+	end = doc->hint_page[pagenum+1].offset;
+	if (end > start)
+		fz_prefetch_range_stream(ctx, doc->file, doc->bias + start, end - start);
+
+	for (i = doc->hint_page[pagenum].index; i < doc->hint_page[pagenum+1].index; i++)
+	{
+		r = doc->hint_shared_ref[i];
+		start = doc->hint_shared[r].offset;
+		end = doc->hint_shared[r+1].offset;
+		if (end > start)
+			fz_prefetch_range_stream(ctx, doc->file, doc->bias + start, end - start);
+	}
+}
+
 static void
 pdf_load_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
 {
@@ -2433,6 +2463,7 @@ pdf_load_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
 	fz_try(ctx)
 	{
 		int num = doc->hint_page[pagenum].number;
+		prefetch_hinted_page(ctx, doc, pagenum);
 		page = pdf_load_object(ctx, doc, num);
 		if (pdf_name_eq(ctx, PDF_NAME(Page), pdf_dict_get(ctx, page, PDF_NAME(Type))))
 		{
@@ -2864,6 +2895,7 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 
 	fz_drop_buffer(ctx, x->stm_buf);
 	pdf_drop_obj(ctx, x->obj);
+	doc->form_cache_generation++;
 
 	x->type = 'f';
 	x->ofs = 0;
@@ -2969,6 +3001,7 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
 
 	pdf_drop_obj(ctx, x->obj);
+	doc->form_cache_generation++;
 
 	x->type = 'n';
 	x->ofs = 0;
@@ -0,0 +1,626 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+/*
+ * mubench -- Time the rendering pipeline over a corpus of documents.
+ *
+ * Each file is put through a fixed sequence of phases:
+ *
+ *	open		open (and authenticate) the document
+ *	pagetree	count the pages, and for PDF load the page tree
+ *	load		load each page
+ *	list		build a display list for each page
+ *	raster		draw each display list into a pixmap
+ *	stext		extract structured text from each display list
+ *	save		write the whole document to memory (PDF only)
+ *
+ * The sequence is run once from a cold store (both the resource store
+ * and the glyph cache emptied first), and then again on the same open
+ * document with the store left warm. The raster and stext phases are
+ * spread over the requested number of threads; the other phases
+ * touch the document and so always run on the main thread.
+ *
+ * Results are written as one JSON object per line, one line per run,
+ * for easy collection into dashboards.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mupdf/helpers/mu-threads.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define MAX_THREADS 64
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"Usage: mubench [options] file [file ...]\n"
+		"\t-p -\tpassword\n"
+		"\t-r -\tresolution in dpi for the raster phase (default: 72)\n"
+		"\t-T -\tcomma separated list of thread counts to run (default: 1)\n"
+		"\t-s -\tstore size in bytes (default: 256M, 0 for unlimited)\n"
+		"\t-o -\toutput file (default: stdout)\n"
+		);
+	return EXIT_FAILURE;
+}
+
+static char *password = "";
+static float resolution = 72;
+static size_t store_size = FZ_STORE_DEFAULT;
+
+/* Peak resident set size of the whole process, in kilobytes. */
+static long peak_rss_kb(void)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru))
+		return -1;
+#ifdef __APPLE__
+	return (long)(ru.ru_maxrss / 1024);
+#else
+	return (long)ru.ru_maxrss;
+#endif
+#endif
+}
+
+#ifndef DISABLE_MUTHREADS
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void mubench_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void mubench_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context mubench_locks =
+{
+	NULL, mubench_lock, mubench_unlock
+};
+
+static void fin_mubench_locks(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+}
+
+static fz_locks_context *init_mubench_locks(void)
+{
+	int i;
+	int failed = 0;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		failed |= mu_create_mutex(&mutexes[i]);
+
+	if (failed)
+	{
+		fin_mubench_locks();
+		return NULL;
+	}
+
+	return &mubench_locks;
+}
+
+#endif
+
+/* Per page timings for one phase. */
+typedef struct
+{
+	int count;
+	double wall;
+	double *ms;
+} phase_t;
+
+enum { PHASE_RASTER, PHASE_STEXT };
+
+typedef struct
+{
+	fz_context *ctx;
+	mu_thread thread;
+} worker_t;
+
+/* The work shared by the threads of a parallel phase. */
+static struct
+{
+	int phase;
+	int count;
+	int next;
+	fz_display_list **lists;
+	phase_t *timings;
+	int failures;
+#ifndef DISABLE_MUTHREADS
+	mu_mutex mutex;
+#endif
+} job;
+
+static void raster_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_matrix ctm = fz_scale(resolution / 72, resolution / 72);
+	fz_irect bbox = fz_round_rect(fz_transform_rect(fz_bound_display_list(ctx, list), ctm));
+	fz_pixmap *pix = NULL;
+	fz_device *dev = NULL;
+
+	fz_var(pix);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, NULL, 0);
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_run_display_list(ctx, list, dev, ctm, fz_infinite_rect, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int take_job(void)
+{
+	int i;
+#ifndef DISABLE_MUTHREADS
+	mu_lock_mutex(&job.mutex);
+#endif
+	i = job.next++;
+#ifndef DISABLE_MUTHREADS
+	mu_unlock_mutex(&job.mutex);
+#endif
+	return i < job.count ? i : -1;
+}
+
+static void fail_job(fz_context *ctx)
+{
+	fz_report_error(ctx);
+#ifndef DISABLE_MUTHREADS
+	mu_lock_mutex(&job.mutex);
+#endif
+	job.failures++;
+#ifndef DISABLE_MUTHREADS
+	mu_unlock_mutex(&job.mutex);
+#endif
+}
+
+static void worker_run(void *arg)
+{
+	worker_t *me = arg;
+	fz_context *ctx = me->ctx;
+	int i;
+
+	while ((i = take_job()) >= 0)
+	{
+		double t = fz_ms_clock();
+		fz_try(ctx)
+		{
+			if (job.phase == PHASE_RASTER)
+				raster_list(ctx, job.lists[i]);
+			else
+				fz_drop_stext_page(ctx, fz_new_stext_page_from_display_list(ctx, job.lists[i], NULL));
+		}
+		fz_catch(ctx)
+			fail_job(ctx);
+		job.timings->ms[i] = fz_ms_clock() - t;
+	}
+}
+
+static void run_parallel(worker_t *workers, int nthreads, int phase, phase_t *timings)
+{
+	double t = fz_ms_clock();
+
+	job.phase = phase;
+	job.next = 0;
+	job.timings = timings;
+
+	if (nthreads == 1)
+		worker_run(&workers[0]);
+#ifndef DISABLE_MUTHREADS
+	else
+	{
+		int i, started = 0;
+		for (i = 0; i < nthreads; i++)
+		{
+			if (mu_create_thread(&workers[i].thread, worker_run, &workers[i]))
+				break;
+			started++;
+		}
+		/* If we could not start them all, carry on with what we have. */
+		if (started == 0)
+			worker_run(&workers[0]);
+		for (i = 0; i < started; i++)
+			mu_destroy_thread(&workers[i].thread);
+	}
+#endif
+
+	timings->count = job.count;
+	timings->wall = fz_ms_clock() - t;
+}
+
+static int cmp_double(const void *a_, const void *b_)
+{
+	double a = *(const double *)a_;
+	double b = *(const double *)b_;
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* Nearest rank percentile of a sorted list. */
+static double percentile(const double *v, int n, int p)
+{
+	int i = (n * p + 99) / 100 - 1;
+	return v[fz_clampi(i, 0, n - 1)];
+}
+
+static void write_single(fz_context *ctx, fz_output *out, const char *name, double ms)
+{
+	fz_write_printf(ctx, out, "%q:{%q:%.3f},", name, "ms", ms);
+}
+
+static void write_phase(fz_context *ctx, fz_output *out, const char *name, phase_t *ph, int last)
+{
+	double *v, total = 0;
+	int i, n = ph->count;
+
+	fz_write_printf(ctx, out, "%q:{%q:%d", name, "count", n);
+	if (n > 0)
+	{
+		v = fz_malloc_array(ctx, n, double);
+		memcpy(v, ph->ms, n * sizeof *v);
+		qsort(v, n, sizeof *v, cmp_double);
+		for (i = 0; i < n; i++)
+			total += v[i];
+		fz_write_printf(ctx, out, ",%q:%.3f,%q:%.3f,%q:%.3f", "ms", total, "wall_ms", ph->wall,
+			"pages_per_s", ph->wall > 0 ? n * 1000 / ph->wall : 0);
+		fz_write_printf(ctx, out, ",%q:%.3f,%q:%.3f,%q:%.3f,%q:%.3f",
+			"p50_ms", percentile(v, n, 50), "p90_ms", percentile(v, n, 90),
+			"p99_ms", percentile(v, n, 99), "max_ms", v[n - 1]);
+		fz_free(ctx, v);
+	}
+	fz_write_printf(ctx, out, "}%s", last ? "" : ",");
+}
+
+static void
+bench_document(fz_context *ctx, fz_output *out, const char *filename, int nthreads)
+{
+	fz_document *doc = NULL;
+	fz_page *page = NULL;
+	fz_display_list **lists = NULL;
+	phase_t load = { 0 }, list = { 0 }, raster = { 0 }, stext = { 0 };
+	worker_t workers[MAX_THREADS] = { { 0 } };
+	double open_ms = 0, pagetree_ms = 0, save_ms, t;
+	int i, n = 0, pass;
+
+	fz_var(doc);
+	fz_var(page);
+	fz_var(lists);
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		/* A single worker runs on this thread, so it can share our
+		 * context; without locks there is nothing to clone anyway. */
+		if (nthreads == 1)
+			workers[0].ctx = ctx;
+		else
+		{
+			for (i = 0; i < nthreads; i++)
+			{
+				workers[i].ctx = fz_clone_context(ctx);
+				if (!workers[i].ctx)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context for worker thread");
+			}
+		}
+
+		for (pass = 0; pass < 2; pass++)
+		{
+			fz_store_stats store0, store1;
+			fz_glyph_cache_stats glyph0, glyph1;
+			pdf_document *pdf;
+
+			if (pass == 0)
+			{
+				fz_empty_store(ctx);
+				fz_purge_glyph_cache(ctx);
+			}
+			fz_get_store_stats(ctx, &store0);
+			fz_get_glyph_cache_stats(ctx, &glyph0);
+			job.failures = 0;
+
+			if (pass == 0)
+			{
+				t = fz_ms_clock();
+				doc = fz_open_document(ctx, filename);
+				if (fz_needs_password(ctx, doc))
+					if (!fz_authenticate_password(ctx, doc, password))
+						fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", filename);
+				open_ms = fz_ms_clock() - t;
+
+				t = fz_ms_clock();
+				n = fz_count_pages(ctx, doc);
+				pdf = pdf_specifics(ctx, doc);
+				if (pdf)
+					pdf_load_page_tree(ctx, pdf);
+				pagetree_ms = fz_ms_clock() - t;
+
+				load.ms = fz_malloc_array(ctx, n + 1, double);
+				list.ms = fz_malloc_array(ctx, n + 1, double);
+				raster.ms = fz_malloc_array(ctx, n + 1, double);
+				stext.ms = fz_malloc_array(ctx, n + 1, double);
+				lists = fz_malloc_array(ctx, n + 1, fz_display_list *);
+				memset(lists, 0, (n + 1) * sizeof *lists);
+			}
+			pdf = pdf_specifics(ctx, doc);
+
+			/* Pages and display lists can only be made on this thread. */
+			load.wall = list.wall = 0;
+			for (i = 0; i < n; i++)
+			{
+				t = fz_ms_clock();
+				fz_try(ctx)
+					page = fz_load_page(ctx, doc, i);
+				fz_catch(ctx)
+				{
+					fz_report_error(ctx);
+					job.failures++;
+				}
+				load.ms[i] = fz_ms_clock() - t;
+				load.wall += load.ms[i];
+
+				t = fz_ms_clock();
+				fz_try(ctx)
+				{
+					if (page)
+						lists[i] = fz_new_display_list_from_page(ctx, page);
+				}
+				fz_always(ctx)
+				{
+					fz_drop_page(ctx, page);
+					page = NULL;
+				}
+				fz_catch(ctx)
+				{
+					fz_report_error(ctx);
+					job.failures++;
+				}
+				list.ms[i] = fz_ms_clock() - t;
+				list.wall += list.ms[i];
+			}
+			load.count = list.count = n;
+
+			/* Pages whose list could not be made are skipped. */
+			job.count = 0;
+			for (i = 0; i < n; i++)
+			{
+				fz_display_list *l = lists[i];
+				lists[i] = NULL;
+				if (l)
+					lists[job.count++] = l;
+			}
+			job.lists = lists;
+
+			run_parallel(workers, nthreads, PHASE_RASTER, &raster);
+			run_parallel(workers, nthreads, PHASE_STEXT, &stext);
+
+			for (i = 0; i < job.count; i++)
+			{
+				fz_drop_display_list(ctx, lists[i]);
+				lists[i] = NULL;
+			}
+
+			save_ms = -1;
+			if (pdf)
+			{
+				fz_buffer *buf = fz_new_buffer(ctx, 1 << 16);
+				fz_output *mem = NULL;
+				fz_var(mem);
+				t = fz_ms_clock();
+				fz_try(ctx)
+				{
+					mem = fz_new_output_with_buffer(ctx, buf);
+					pdf_write_document(ctx, pdf, mem, NULL);
+					fz_close_output(ctx, mem);
+				}
+				fz_always(ctx)
+				{
+					fz_drop_output(ctx, mem);
+					fz_drop_buffer(ctx, buf);
+				}
+				fz_catch(ctx)
+				{
+					fz_report_error(ctx);
+					job.failures++;
+				}
+				save_ms = fz_ms_clock() - t;
+			}
+
+			fz_get_store_stats(ctx, &store1);
+			fz_get_glyph_cache_stats(ctx, &glyph1);
+
+			fz_write_printf(ctx, out, "{%q:%q,%q:%q,%q:%d,%q:%g,%q:%d,%q:%d,%q:{",
+				"filename", filename,
+				"store", pass == 0 ? "cold" : "warm",
+				"threads", nthreads,
+				"dpi", resolution,
+				"pages", n,
+				"failures", job.failures,
+				"phases");
+			if (pass == 0)
+			{
+				write_single(ctx, out, "open", open_ms);
+				write_single(ctx, out, "pagetree", pagetree_ms);
+			}
+			write_phase(ctx, out, "load", &load, 0);
+			write_phase(ctx, out, "list", &list, 0);
+			write_phase(ctx, out, "raster", &raster, 0);
+			write_phase(ctx, out, "stext", &stext, save_ms < 0);
+			if (save_ms >= 0)
+				fz_write_printf(ctx, out, "%q:{%q:%.3f}", "save", "ms", save_ms);
+			fz_write_printf(ctx, out, "},%q:%ld", "peak_rss_kb", peak_rss_kb());
+			fz_write_printf(ctx, out, ",%q:{%q:%zu,%q:%zu,%q:%d,%q:%zu,%q:%zu}",
+				"store_stats",
+				"size", store1.size, "max", store1.max, "items", store1.items,
+				"hits", store1.hits - store0.hits, "misses", store1.misses - store0.misses);
+			fz_write_printf(ctx, out, ",%q:{%q:%zu,%q:%d,%q:%zu,%q:%zu}}\n",
+				"glyph_cache",
+				"size", glyph1.size, "glyphs", glyph1.glyphs,
+				"hits", glyph1.hits - glyph0.hits, "misses", glyph1.misses - glyph0.misses);
+		}
+	}
+	fz_always(ctx)
+	{
+		if (lists)
+			for (i = 0; i < n; i++)
+				fz_drop_display_list(ctx, lists[i]);
+		fz_free(ctx, lists);
+		fz_free(ctx, load.ms);
+		fz_free(ctx, list.ms);
+		fz_free(ctx, raster.ms);
+		fz_free(ctx, stext.ms);
+		fz_drop_page(ctx, page);
+		fz_drop_document(ctx, doc);
+		if (nthreads > 1)
+			for (i = 0; i < nthreads; i++)
+				fz_drop_context(workers[i].ctx);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx = NULL;
+	fz_locks_context *locks = NULL;
+	fz_output *out = NULL;
+	const char *output = NULL;
+	const char *thread_list = "1";
+	int threads[MAX_THREADS];
+	int nthreadlists = 0;
+	int i, k, c, errors = 0;
+
+	while ((c = fz_getopt(argc, argv, "p:r:T:s:o:")) != -1)
+	{
+		switch (c)
+		{
+		default: return usage();
+		case 'p': password = fz_optarg; break;
+		case 'r': resolution = fz_atof(fz_optarg); break;
+		case 'T': thread_list = fz_optarg; break;
+		case 's': store_size = (size_t)fz_atoi64(fz_optarg); break;
+		case 'o': output = fz_optarg; break;
+		}
+	}
+
+	if (fz_optind == argc || resolution <= 0)
+		return usage();
+
+	while (*thread_list && nthreadlists < MAX_THREADS)
+	{
+		int t = fz_clampi(fz_atoi(thread_list), 1, MAX_THREADS);
+#ifdef DISABLE_MUTHREADS
+		if (t > 1)
+		{
+			fprintf(stderr, "threading disabled, running with 1 thread\n");
+			t = 1;
+		}
+#endif
+		threads[nthreadlists++] = t;
+		thread_list = strchr(thread_list, ',');
+		if (!thread_list)
+			break;
+		thread_list++;
+	}
+
+#ifndef DISABLE_MUTHREADS
+	locks = init_mubench_locks();
+	if (locks == NULL || mu_create_mutex(&job.mutex))
+	{
+		fprintf(stderr, "cannot initialise mutexes\n");
+		return EXIT_FAILURE;
+	}
+#endif
+
+	ctx = fz_new_context(NULL, locks, store_size);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_var(out);
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		if (output)
+			out = fz_new_output_with_path(ctx, output, 0);
+		else
+			out = fz_stdout(ctx);
+
+		for (i = fz_optind; i < argc; i++)
+		{
+			for (k = 0; k < nthreadlists; k++)
+			{
+				fz_try(ctx)
+					bench_document(ctx, out, argv[i], threads[k]);
+				fz_catch(ctx)
+				{
+					fz_report_error(ctx);
+					fprintf(stderr, "cannot benchmark %s\n", argv[i]);
+					errors++;
+				}
+			}
+		}
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_report_error(ctx);
+		errors++;
+	}
+
+	fz_drop_context(ctx);
+#ifndef DISABLE_MUTHREADS
+	mu_destroy_mutex(&job.mutex);
+	fin_mubench_locks();
+#endif
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,6 +26,11 @@
 
 #include "mupdf/fitz.h"
 
+#ifndef DISABLE_MUTHREADS
+#include "mupdf/helpers/mu-threads.h"
+#endif
+
+#include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -62,6 +67,11 @@ static int usage(void)
 		"\t-S -\tfont size for EPUB layout\n"
 		"\t-U -\tfile name of user stylesheet for EPUB layout\n"
 		"\t-X\tdisable document styles for EPUB layout\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-T -\tnumber of threads to use for interpreting pages\n"
+#else
+		"\t-T -\tnumber of threads to use for interpreting pages (disabled in this non-threading build)\n"
+#endif
 		"\n"
 		"\t-o -\toutput file name (%%d for page number)\n"
 		"\t-F -\toutput format (default inferred from output file name)\n"
@@ -86,6 +96,26 @@ static int usage(void)
 	return 1;
 }
 
+static fz_document *open_input(const char *filename)
+{
+	fz_document *input = fz_open_document(ctx, filename);
+
+	fz_try(ctx)
+	{
+		if (fz_needs_password(ctx, input))
+			if (!fz_authenticate_password(ctx, input, password))
+				fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", filename);
+		fz_layout_document(ctx, input, layout_w, layout_h, layout_em);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_document(ctx, input);
+		fz_rethrow(ctx);
+	}
+
+	return input;
+}
+
 static void runpage(int number)
 {
 	fz_rect box;
@@ -132,12 +162,305 @@ static void runrange(const char *range)
 	}
 }
 
+#ifndef DISABLE_MUTHREADS
+
+static int num_workers = 0;
+
+/*
+	In threaded mode each worker has its own copy of the input
+	document, and interprets the pages handed to it into either a
+	structured text page (for text writers that build one, which then
+	only need to print it) or a display list (for everything else,
+	including streamed plain text, which is then replayed into the
+	writer so that it picks the same device as when not threaded).
+	Page N of the range goes to worker N % num_workers, and the
+	results are written in range order, so at most num_workers
+	pages are held in memory at any time.
+*/
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void muconvert_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void muconvert_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context muconvert_locks =
+{
+	NULL, muconvert_lock, muconvert_unlock
+};
+
+static void fin_muconvert_locks(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+}
+
+static fz_locks_context *init_muconvert_locks(void)
+{
+	int i;
+	int failed = 0;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		failed |= mu_create_mutex(&mutexes[i]);
+
+	if (failed)
+	{
+		fin_muconvert_locks();
+		return NULL;
+	}
+
+	return &muconvert_locks;
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_document *doc;
+	int number; /* 0 to shutdown, or page to interpret */
+	int error;
+	int running; /* set by the main thread while the worker has a page */
+	const fz_stext_options *text_opts;
+	fz_rect box;
+	fz_stext_page *text;
+	fz_display_list *list;
+	mu_semaphore start;
+	mu_semaphore stop;
+	mu_thread thread;
+} worker_t;
+
+static worker_t *workers;
+
+static void extract_page(worker_t *me)
+{
+	fz_context *wctx = me->ctx;
+	fz_page *page;
+	fz_device *dev = NULL;
+	fz_matrix ctm;
+	fz_rect box;
+
+	page = fz_load_page(wctx, me->doc, me->number - 1);
+
+	fz_var(dev);
+
+	fz_try(wctx)
+	{
+		box = fz_bound_page_box(wctx, page, page_box);
+
+		// Realign page box on 0,0
+		ctm = fz_translate(-box.x0, -box.y0);
+		me->box = fz_transform_rect(box, ctm);
+
+		if (me->text_opts)
+		{
+			me->text = fz_new_stext_page(wctx, me->box);
+			dev = fz_new_stext_device(wctx, me->text, me->text_opts);
+		}
+		else
+		{
+			me->list = fz_new_display_list(wctx, me->box);
+			dev = fz_new_list_device(wctx, me->list);
+		}
+		fz_run_page(wctx, page, dev, ctm, NULL);
+		fz_close_device(wctx, dev);
+	}
+	fz_always(wctx)
+	{
+		fz_drop_device(wctx, dev);
+		fz_drop_page(wctx, page);
+	}
+	fz_catch(wctx)
+		fz_rethrow(wctx);
+}
+
+static void worker_thread(void *arg)
+{
+	worker_t *me = (worker_t *)arg;
+	int number;
+
+	do
+	{
+		mu_wait_semaphore(&me->start);
+		number = me->number;
+		if (number > 0)
+		{
+			fz_try(me->ctx)
+				extract_page(me);
+			fz_catch(me->ctx)
+			{
+				fz_report_error(me->ctx);
+				me->error = 1;
+			}
+		}
+		mu_trigger_semaphore(&me->stop);
+	}
+	while (number > 0);
+}
+
+static void drop_worker_page(worker_t *w)
+{
+	fz_drop_stext_page(ctx, w->text);
+	w->text = NULL;
+	fz_drop_display_list(ctx, w->list);
+	w->list = NULL;
+}
+
+static void write_worker_page(worker_t *w)
+{
+	fz_device *dev;
+
+	if (w->text)
+	{
+		fz_write_stext_page(ctx, out, w->text);
+		return;
+	}
+
+	dev = fz_begin_page(ctx, out, w->box);
+	fz_run_display_list(ctx, w->list, dev, fz_identity, fz_infinite_rect, NULL);
+	fz_end_page(ctx, out);
+}
+
+static void start_worker(worker_t *w, int number)
+{
+	w->number = number;
+	w->error = 0;
+	w->running = 1;
+	mu_trigger_semaphore(&w->start);
+}
+
+static void wait_worker(worker_t *w)
+{
+	mu_wait_semaphore(&w->stop);
+	w->running = 0;
+}
+
+static void runrange_threaded(const char *filename, const char *range)
+{
+	const fz_stext_options *text_opts = fz_text_writer_options(ctx, out);
+	const char *r;
+	int *pages = NULL;
+	int start, end, i, n;
+
+	/* Expand the range into the list of pages to write. */
+	n = 0;
+	r = range;
+	while ((r = fz_parse_page_range(ctx, r, &start, &end, count)))
+		n += fz_absi(end - start) + 1;
+	if (n == 0)
+		return;
+
+	pages = fz_malloc_array(ctx, n, int);
+
+	fz_try(ctx)
+	{
+		n = 0;
+		r = range;
+		while ((r = fz_parse_page_range(ctx, r, &start, &end, count)))
+		{
+			if (start < end)
+				for (i = start; i <= end; ++i)
+					pages[n++] = i;
+			else
+				for (i = start; i >= end; --i)
+					pages[n++] = i;
+		}
+
+		for (i = 0; i < num_workers; ++i)
+		{
+			workers[i].doc = open_input(filename);
+			workers[i].text_opts = text_opts;
+		}
+
+		for (i = 0; i < num_workers && i < n; ++i)
+			start_worker(&workers[i], pages[i]);
+
+		for (i = 0; i < n; ++i)
+		{
+			worker_t *w = &workers[i % num_workers];
+
+			wait_worker(w);
+			if (w->error)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot interpret page %d", pages[i]);
+			fz_try(ctx)
+				write_worker_page(w);
+			fz_always(ctx)
+				drop_worker_page(w);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+			if (i + num_workers < n)
+				start_worker(w, pages[i + num_workers]);
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < num_workers; ++i)
+		{
+			if (workers[i].running)
+				wait_worker(&workers[i]);
+			drop_worker_page(&workers[i]);
+			fz_drop_document(ctx, workers[i].doc);
+			workers[i].doc = NULL;
+		}
+		fz_free(ctx, pages);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int start_workers(void)
+{
+	int i;
+	int fail = 0;
+
+	/* Let the workers use FreeType on different fonts at once. */
+	fz_set_font_face_locking(ctx, 1);
+
+	workers = fz_calloc(ctx, num_workers, sizeof(*workers));
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].ctx = fz_clone_context(ctx);
+		fail |= !workers[i].ctx;
+		fail |= mu_create_semaphore(&workers[i].start);
+		fail |= mu_create_semaphore(&workers[i].stop);
+		fail |= mu_create_thread(&workers[i].thread, worker_thread, &workers[i]);
+	}
+	return fail;
+}
+
+static void stop_workers(void)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].number = 0;
+		mu_trigger_semaphore(&workers[i].start);
+		mu_wait_semaphore(&workers[i].stop);
+		mu_destroy_semaphore(&workers[i].start);
+		mu_destroy_semaphore(&workers[i].stop);
+		mu_destroy_thread(&workers[i].thread);
+		fz_drop_context(workers[i].ctx);
+	}
+	fz_free(ctx, workers);
+	workers = NULL;
+}
+
+#endif /* DISABLE_MUTHREADS */
+
 int muconvert_main(int argc, char **argv)
 {
 	int i, c;
 	int retval = EXIT_SUCCESS;
+	fz_locks_context *locks = NULL;
 
-	while ((c = fz_getopt(argc, argv, "p:A:W:H:S:U:Xo:F:O:b:")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:A:W:H:S:U:XT:o:F:O:b:")) != -1)
 	{
 		switch (c)
 		{
@@ -151,6 +474,14 @@ int muconvert_main(int argc, char **argv)
 		case 'U': layout_css = fz_optarg; break;
 		case 'X': layout_use_doc_css = 0; break;
 
+		case 'T':
+#ifndef DISABLE_MUTHREADS
+			num_workers = atoi(fz_optarg); break;
+#else
+			fprintf(stderr, "Threads not enabled in this build\n");
+			break;
+#endif
+
 		case 'o': output = fz_optarg; break;
 		case 'F': format = fz_optarg; break;
 		case 'O': options = fz_optarg; break;
@@ -169,8 +500,20 @@ int muconvert_main(int argc, char **argv)
 	if (fz_optind == argc || (!format && !output))
 		return usage();
 
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0)
+	{
+		locks = init_muconvert_locks();
+		if (locks == NULL)
+		{
+			fprintf(stderr, "mutex initialisation failed\n");
+			return EXIT_FAILURE;
+		}
+	}
+#endif
+
 	/* Create a context to hold the exception stack and various caches. */
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	ctx = fz_new_context(NULL, locks, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot create mupdf context\n");
@@ -199,6 +542,14 @@ int muconvert_main(int argc, char **argv)
 
 	fz_set_use_document_css(ctx, layout_use_doc_css);
 
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0 && start_workers())
+	{
+		fprintf(stderr, "worker startup failed\n");
+		exit(1);
+	}
+#endif
+
 	/* Open the output document. */
 	fz_try(ctx)
 		out = fz_new_document_writer(ctx, output, format, options);
@@ -215,17 +566,21 @@ int muconvert_main(int argc, char **argv)
 	{
 		for (i = fz_optind; i < argc; ++i)
 		{
-			doc = fz_open_document(ctx, argv[i]);
-			if (fz_needs_password(ctx, doc))
-				if (!fz_authenticate_password(ctx, doc, password))
-					fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", argv[i]);
-			fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+			const char *filename = argv[i];
+			const char *range = "1-N";
+
+			doc = open_input(filename);
 			count = fz_count_pages(ctx, doc);
 
 			if (i+1 < argc && fz_is_page_range(ctx, argv[i+1]))
-				runrange(argv[++i]);
+				range = argv[++i];
+
+#ifndef DISABLE_MUTHREADS
+			if (num_workers > 0)
+				runrange_threaded(filename, range);
 			else
-				runrange("1-N");
+#endif
+				runrange(range);
 
 			fz_drop_document(ctx, doc);
 			doc = NULL;
@@ -243,6 +598,17 @@ int muconvert_main(int argc, char **argv)
 		retval = EXIT_FAILURE;
 	}
 
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0)
+		stop_workers();
+#endif
+
 	fz_drop_context(ctx);
+
+#ifndef DISABLE_MUTHREADS
+	if (locks)
+		fin_muconvert_locks();
+#endif
+
 	return retval;
 }
@@ -85,6 +85,7 @@ enum {
 	OUT_PGM,
 	OUT_PKM,
 	OUT_PNG,
+	OUT_JPEG,
 	OUT_J2K,
 	OUT_PNM,
 	OUT_PPM,
@@ -134,6 +135,8 @@ static const suffix_t suffix_table[] =
 	{ ".j2k", OUT_J2K, 0 },
 #endif
 	{ ".png", OUT_PNG, 0 },
+	{ ".jpg", OUT_JPEG, 0 },
+	{ ".jpeg", OUT_JPEG, 0 },
 	{ ".pgm", OUT_PGM, 0 },
 	{ ".ppm", OUT_PPM, 0 },
 	{ ".pnm", OUT_PNM, 0 },
@@ -195,6 +198,7 @@ typedef struct
 static const format_cs_table_t format_cs_table[] =
 {
 	{ OUT_PNG, CS_RGB, { CS_GRAY, CS_GRAY_ALPHA, CS_RGB, CS_RGB_ALPHA, CS_ICC } },
+	{ OUT_JPEG, CS_RGB, { CS_GRAY, CS_RGB, CS_CMYK } },
 	{ OUT_J2K, CS_RGB, { CS_GRAY, CS_RGB } },
 	{ OUT_PPM, CS_RGB, { CS_GRAY, CS_RGB } },
 	{ OUT_PNM, CS_GRAY, { CS_GRAY, CS_RGB } },
@@ -419,7 +423,7 @@ static int usage(void)
 		"\n"
 		"\t-o -\toutput file name (%%d for page number)\n"
 		"\t-F -\toutput format (default inferred from output file name)\n"
-		"\t\traster: png, pnm, pam, pbm, pkm, pwg, pcl, ps, pdf, j2k\n"
+		"\t\traster: png, jpeg, pnm, pam, pbm, pkm, pwg, pcl, ps, pdf, j2k\n"
 		"\t\tvector: svg, pdf, trace, ocr.trace\n"
 		"\t\ttext: txt, html, xhtml, stext, stext.json\n"
 #ifndef OCR_DISABLED
@@ -442,9 +446,9 @@ static int usage(void)
 		"\t-h -\theight (in pixels) (maximum height if -r is specified)\n"
 		"\t-f\tfit width and/or height exactly; ignore original aspect ratio\n"
 		"\t-b -\tuse named page box (MediaBox, CropBox, BleedBox, TrimBox, or ArtBox)\n"
-		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd and png output only)\n"
+		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd, png and jpeg output only)\n"
 #ifndef DISABLE_MUTHREADS
-		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t-T -\tnumber of threads to use for rendering (banded mode only) and EPUB layout\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -1117,6 +1121,8 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					bander = fz_new_pam_band_writer(ctx, out);
 				else if (output_format == OUT_PNG)
 					bander = fz_new_png_band_writer(ctx, out);
+				else if (output_format == OUT_JPEG)
+					bander = fz_new_jpeg_band_writer(ctx, out, 90, 1);
 				else if (output_format == OUT_PBM)
 					bander = fz_new_pbm_band_writer(ctx, out);
 				else if (output_format == OUT_PKM)
@@ -1763,6 +1769,96 @@ static void bgprint_worker(void *arg)
 	while (pagenum >= 0);
 	DEBUG_THREADS(("BGPrint shutting down\n"));
 }
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_chapter_layout *job;
+	mu_thread thread;
+} layout_worker_t;
+
+static void layout_worker(void *arg)
+{
+	layout_worker_t *me = (layout_worker_t *)arg;
+
+	fz_try(me->ctx)
+		fz_run_chapter_layout(me->ctx, me->job);
+	fz_catch(me->ctx)
+		fz_report_error(me->ctx);
+}
+
+/*
+	Count the pages of a reflowable document by laying out its
+	chapters in parallel. The chapters are parsed num_workers at a
+	time on this thread, and then laid out on that many threads.
+*/
+static void count_pages_in_parallel(fz_context *ctx, fz_document *doc)
+{
+	layout_worker_t *lw;
+	int nc = fz_count_chapters(ctx, doc);
+	int c = 0;
+	int n = 0;
+	int i;
+
+	lw = fz_calloc(ctx, num_workers, sizeof(*lw));
+
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		while (c < nc)
+		{
+			for (n = 0; n < num_workers && c < nc; ++c)
+			{
+				lw[n].job = fz_begin_chapter_layout(ctx, doc, c);
+				if (lw[n].job)
+				{
+					memset(&lw[n].thread, 0, sizeof(lw[n].thread));
+					lw[n].ctx = fz_clone_context(ctx);
+					if (!lw[n++].ctx)
+						fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context");
+				}
+			}
+
+			for (i = 0; i < n; ++i)
+				if (mu_create_thread(&lw[i].thread, layout_worker, &lw[i]))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start layout thread");
+			for (i = 0; i < n; ++i)
+			{
+				mu_destroy_thread(&lw[i].thread);
+				fz_drop_context(lw[i].ctx);
+				lw[i].ctx = NULL;
+			}
+
+			for (i = 0; i < n; ++i)
+			{
+				fz_chapter_layout *job = lw[i].job;
+				lw[i].job = NULL;
+				(void) fz_end_chapter_layout(ctx, job);
+			}
+			n = 0;
+
+			if (!quiet)
+				fprintf(stderr, "laid out %d of %d chapters\n", c, nc);
+		}
+	}
+	fz_always(ctx)
+	{
+		/* Only reached with jobs outstanding if something went wrong. */
+		for (i = 0; i < n; ++i)
+		{
+			mu_destroy_thread(&lw[i].thread);
+			fz_drop_context(lw[i].ctx);
+			fz_try(ctx)
+				(void) fz_end_chapter_layout(ctx, lw[i].job);
+			fz_catch(ctx)
+				fz_report_error(ctx);
+		}
+		fz_free(ctx, lw);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
 #endif
 
 static inline int iswhite(int ch)
@@ -2248,6 +2344,8 @@ int mudraw_main(int argc, char **argv)
 		{
 			int i;
 			int fail = 0;
+			/* Let the workers use FreeType on different fonts at once. */
+			fz_set_font_face_locking(ctx, 1);
 			workers = fz_calloc(ctx, num_workers, sizeof(*workers));
 			for (i = 0; i < num_workers; i++)
 			{
@@ -2335,6 +2433,7 @@ int mudraw_main(int argc, char **argv)
 				output_format != OUT_PPM &&
 				output_format != OUT_PNM &&
 				output_format != OUT_PNG &&
+				output_format != OUT_JPEG &&
 				output_format != OUT_PBM &&
 				output_format != OUT_PKM &&
 				output_format != OUT_PCL &&
@@ -2343,7 +2442,7 @@ int mudraw_main(int argc, char **argv)
 				output_format != OUT_PSD &&
 				output_format != OUT_OCR_PDF)
 			{
-				fprintf(stderr, "Banded operation only possible with PxM, PCL, PCLM, PDFOCR, PS, PSD, and PNG outputs\n");
+				fprintf(stderr, "Banded operation only possible with PxM, PCL, PCLM, PDFOCR, PS, PSD, PNG, and JPEG outputs\n");
 				exit(1);
 			}
 			if (showmd5)
@@ -2631,6 +2730,10 @@ int mudraw_main(int argc, char **argv)
 
 					layouttime = gettime();
 					fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+#ifndef DISABLE_MUTHREADS
+					if (num_workers > 0 && fz_is_document_reflowable(ctx, doc))
+						count_pages_in_parallel(ctx, doc);
+#endif
 					(void) fz_count_pages(ctx, doc);
 					layouttime = gettime() - layouttime;
 
@@ -21,6 +21,7 @@
 // CA 94129, USA, for further information.
 
 #include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -39,6 +40,8 @@ static int usage(void)
 		"\t-X\tdisable document styles for EPUB layout\n"
 		"\n"
 		"\t-d\tuse display list\n"
+		"\t-P\trender instead of tracing, and print a JSON timing profile\n"
+		"\t\tof each PDF document's operators and resources\n"
 		"\n"
 		"\tpages\tcomma separated list of page numbers and ranges\n"
 		);
@@ -52,24 +55,36 @@ static char *layout_css = NULL;
 static int layout_use_doc_css = 1;
 
 static int use_display_list = 0;
+static int use_profile = 0;
 
 static void runpage(fz_context *ctx, fz_document *doc, int number)
 {
 	fz_page *page = NULL;
 	fz_display_list *list = NULL;
 	fz_device *dev = NULL;
+	fz_pixmap *pix = NULL;
 	fz_rect mediabox;
 
 	fz_var(page);
 	fz_var(list);
 	fz_var(dev);
+	fz_var(pix);
 	fz_try(ctx)
 	{
 		page = fz_load_page(ctx, doc, number - 1);
 		mediabox = fz_bound_page(ctx, page);
-		printf("<page number=\"%d\" mediabox=\"%g %g %g %g\">\n",
-				number, mediabox.x0, mediabox.y0, mediabox.x1, mediabox.y1);
-		dev = fz_new_trace_device(ctx, fz_stdout(ctx));
+		if (use_profile)
+		{
+			pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), fz_round_rect(mediabox), NULL, 0);
+			fz_clear_pixmap_with_value(ctx, pix, 255);
+			dev = fz_new_draw_device(ctx, fz_identity, pix);
+		}
+		else
+		{
+			printf("<page number=\"%d\" mediabox=\"%g %g %g %g\">\n",
+					number, mediabox.x0, mediabox.y0, mediabox.x1, mediabox.y1);
+			dev = fz_new_trace_device(ctx, fz_stdout(ctx));
+		}
 		if (use_display_list)
 		{
 			list = fz_new_display_list_from_page(ctx, page);
@@ -79,13 +94,16 @@ static void runpage(fz_context *ctx, fz_document *doc, int number)
 		{
 			fz_run_page(ctx, page, dev, fz_identity, NULL);
 		}
-		printf("</page>\n");
+		fz_close_device(ctx, dev);
+		if (!use_profile)
+			printf("</page>\n");
 	}
 	fz_always(ctx)
 	{
 		fz_drop_display_list(ctx, list);
 		fz_drop_page(ctx, page);
 		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
 	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
@@ -110,10 +128,11 @@ int mutrace_main(int argc, char **argv)
 {
 	fz_context *ctx;
 	fz_document *doc = NULL;
+	pdf_profile *prof = NULL;
 	char *password = "";
 	int i, c, count;
 
-	while ((c = fz_getopt(argc, argv, "p:W:H:S:U:Xd")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:W:H:S:U:XdP")) != -1)
 	{
 		switch (c)
 		{
@@ -127,6 +146,7 @@ int mutrace_main(int argc, char **argv)
 		case 'X': layout_use_doc_css = 0; break;
 
 		case 'd': use_display_list = 1; break;
+		case 'P': use_profile = 1; break;
 		}
 	}
 
@@ -160,22 +180,48 @@ int mutrace_main(int argc, char **argv)
 	}
 
 	fz_var(doc);
+	fz_var(prof);
 	fz_try(ctx)
 	{
 		for (i = fz_optind; i < argc; ++i)
 		{
-			doc = fz_open_document(ctx, argv[i]);
+			const char *filename = argv[i];
+			pdf_document *pdf;
+
+			doc = fz_open_document(ctx, filename);
 			if (fz_needs_password(ctx, doc))
 				if (!fz_authenticate_password(ctx, doc, password))
-					fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", argv[i]);
+					fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", filename);
 			fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
-			printf("<document filename=\"%s\">\n", argv[i]);
+
+			pdf = pdf_specifics(ctx, doc);
+			if (use_profile && !pdf)
+				fz_warn(ctx, "not a PDF file, cannot profile: %s", filename);
+			else if (use_profile)
+			{
+				prof = pdf_new_profile(ctx);
+				pdf_set_profile(ctx, pdf, prof);
+			}
+			else
+				printf("<document filename=\"%s\">\n", filename);
+
 			count = fz_count_pages(ctx, doc);
 			if (i+1 < argc && fz_is_page_range(ctx, argv[i+1]))
 				runrange(ctx, doc, count, argv[++i]);
 			else
 				runrange(ctx, doc, count, "1-N");
-			printf("</document>\n");
+
+			if (prof)
+			{
+				pdf_set_profile(ctx, pdf, NULL);
+				fz_write_printf(ctx, fz_stdout(ctx), "{%q:%q,%q:", "filename", filename, "profile");
+				pdf_write_profile_json(ctx, fz_stdout(ctx), prof);
+				fz_write_string(ctx, fz_stdout(ctx), "}\n");
+				pdf_drop_profile(ctx, prof);
+				prof = NULL;
+			}
+			else if (!use_profile)
+				printf("</document>\n");
 			fz_drop_document(ctx, doc);
 			doc = NULL;
 		}
@@ -185,6 +231,7 @@ int mutrace_main(int argc, char **argv)
 		fz_report_error(ctx);
 		fprintf(stderr, "cannot run document\n");
 		fz_drop_document(ctx, doc);
+		pdf_drop_profile(ctx, prof);
 		fz_drop_context(ctx);
 		return EXIT_FAILURE;
 	}
@@ -61,9 +61,9 @@ void
 xps_select_font_encoding(fz_context *ctx, fz_font *font, int idx)
 {
 	FT_Face face = fz_font_ft_face(ctx, font);
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	FT_Set_Charmap(face, face->charmaps[idx]);
-	fz_ft_unlock(ctx);
+	fz_ft_unlock_face(ctx, font);
 }
 
 int
@@ -71,11 +71,11 @@ xps_encode_font_char(fz_context *ctx, fz_font *font, int code)
 {
 	FT_Face face = fz_font_ft_face(ctx, font);
 	int gid;
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	gid = FT_Get_Char_Index(face, code);
 	if (gid == 0 && face->charmap && face->charmap->platform_id == 3 && face->charmap->encoding_id == 0)
 		gid = FT_Get_Char_Index(face, 0xF000 | code);
-	fz_ft_unlock(ctx);
+	fz_ft_unlock_face(ctx, font);
 	return gid;
 }
 
@@ -86,10 +86,10 @@ xps_measure_font_glyph(fz_context *ctx, xps_document *doc, fz_font *font, int gi
 	FT_Face face = fz_font_ft_face(ctx, font);
 	FT_Fixed hadv = 0, vadv = 0;
 
-	fz_ft_lock(ctx);
+	fz_ft_lock_face(ctx, font);
 	FT_Get_Advance(face, gid, mask, &hadv);
 	FT_Get_Advance(face, gid, mask | FT_LOAD_VERTICAL_LAYOUT, &vadv);
-	fz_ft_unlock(ctx);
+	fz_ft_unlock_face(ctx, font);
 
 	mtx->hadv = (float) hadv / face->units_per_EM;
 	mtx->vadv = (float) vadv / face->units_per_EM;